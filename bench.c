@@ -0,0 +1,515 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Compares fastimage with stb_image on the same corpus: speed, bytes consumed and results
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_STDIO
+#define STBI_NO_LINEAR
+#define STBI_NO_HDR
+#include "third_party/stb_image.h"
+
+#include "fastimage.h"
+#include "fastimage_preview.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+typedef struct {
+	char *path;
+	unsigned char *data;
+	size_t size;
+} bench_file_t;
+
+typedef struct {
+	bench_file_t *files;
+	size_t files_num;
+	size_t files_max;
+	uint64_t total_size;
+} bench_corpus_t;
+
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+	size_t offset;
+	uint64_t bytes_read;
+} bench_stb_context_t;
+
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+	size_t offset;
+	uint64_t bytes_read;
+} bench_reader_context_t;
+
+// Mean absolute difference of preview and stb decode averaged over the same source pixels,
+// DC of subsampled jpeg chroma covers 16x16 pixels, so small previews of such files differ more
+#define BENCH_PREVIEW_MAX_DIFF 20.0
+
+static double benchTime(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER counter, frequency;
+
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+
+	return (double)counter.QuadPart/(double)frequency.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec+(double)ts.tv_nsec/1e9;
+#endif
+}
+
+static bool benchAddFile(bench_corpus_t *corpus, const char *path)
+{
+	bench_file_t file;
+	FILE *f;
+	long size;
+
+	f = fopen(path, "rb");
+	if(!f) return false;
+
+	if(fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)) {
+		fclose(f);
+
+		return false;
+	}
+
+	file.size = (size_t)size;
+	file.data = malloc(file.size?file.size:1);
+	file.path = malloc(strlen(path)+1);
+	if(!file.data || !file.path || fread(file.data, 1, file.size, f) != file.size) {
+		free(file.data);
+		free(file.path);
+		fclose(f);
+
+		return false;
+	}
+
+	fclose(f);
+	strcpy(file.path, path);
+
+	if(corpus->files_num == corpus->files_max) {
+		bench_file_t *_files;
+		size_t files_max = corpus->files_max?corpus->files_max*2:64;
+
+		_files = realloc(corpus->files, files_max*sizeof(bench_file_t));
+		if(!_files) {
+			free(file.data);
+			free(file.path);
+
+			return false;
+		}
+
+		corpus->files = _files;
+		corpus->files_max = files_max;
+	}
+
+	corpus->files[corpus->files_num++] = file;
+	corpus->total_size += file.size;
+
+	return true;
+}
+
+static void benchAddPath(bench_corpus_t *corpus, const char *path)
+{
+#if defined(_WIN32)
+	WIN32_FIND_DATAA find_data;
+	HANDLE find;
+	DWORD attributes;
+	char *pattern;
+
+	attributes = GetFileAttributesA(path);
+	if(attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		if(!benchAddFile(corpus, path))
+			fprintf(stderr, "can't read %s\n", path);
+
+		return;
+	}
+
+	pattern = malloc(strlen(path)+3);
+	if(!pattern) return;
+	sprintf(pattern, "%s\\*", path);
+
+	find = FindFirstFileA(pattern, &find_data);
+	free(pattern);
+	if(find == INVALID_HANDLE_VALUE) return;
+
+	do {
+		char *child;
+
+		if(!strcmp(find_data.cFileName, ".") || !strcmp(find_data.cFileName, "..")) continue;
+
+		child = malloc(strlen(path)+strlen(find_data.cFileName)+2);
+		if(!child) break;
+		sprintf(child, "%s\\%s", path, find_data.cFileName);
+		benchAddPath(corpus, child);
+		free(child);
+	} while(FindNextFileA(find, &find_data));
+
+	FindClose(find);
+#else
+	struct stat st;
+	struct dirent *entry;
+	DIR *dir;
+
+	if(stat(path, &st) || !S_ISDIR(st.st_mode)) {
+		if(!benchAddFile(corpus, path))
+			fprintf(stderr, "can't read %s\n", path);
+
+		return;
+	}
+
+	dir = opendir(path);
+	if(!dir) return;
+
+	while((entry = readdir(dir)) != 0) {
+		char *child;
+
+		if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+
+		child = malloc(strlen(path)+strlen(entry->d_name)+2);
+		if(!child) break;
+		sprintf(child, "%s/%s", path, entry->d_name);
+		benchAddPath(corpus, child);
+		free(child);
+	}
+
+	closedir(dir);
+#endif
+}
+
+static int benchStbRead(void *user, char *data, int size)
+{
+	bench_stb_context_t *context = (bench_stb_context_t *)user;
+
+	if((size_t)size > context->size-context->offset)
+		size = (int)(context->size-context->offset);
+
+	memcpy(data, context->data+context->offset, size);
+	context->offset += size;
+	context->bytes_read += size;
+
+	return size;
+}
+
+static void benchStbSkip(void *user, int n)
+{
+	bench_stb_context_t *context = (bench_stb_context_t *)user;
+
+	if(n < 0 && (size_t)(-n) > context->offset)
+		context->offset = 0;
+	else if(n > 0 && (size_t)n > context->size-context->offset)
+		context->offset = context->size;
+	else
+		context->offset += n;
+}
+
+static int benchStbEof(void *user)
+{
+	bench_stb_context_t *context = (bench_stb_context_t *)user;
+
+	return context->offset >= context->size;
+}
+
+static size_t FASTIMAGE_APIENTRY benchRead(void *context, size_t size, void *buf)
+{
+	bench_reader_context_t *reader = (bench_reader_context_t *)context;
+
+	if(size > reader->size-reader->offset)
+		size = reader->size-reader->offset;
+
+	memcpy(buf, reader->data+reader->offset, size);
+	reader->offset += size;
+	reader->bytes_read += size;
+
+	return size;
+}
+
+static bool FASTIMAGE_APIENTRY benchSeek(void *context, int64_t pos, bool seek_cur)
+{
+	bench_reader_context_t *reader = (bench_reader_context_t *)context;
+
+	if(seek_cur) pos += (int64_t)reader->offset;
+	if(pos < 0 || (uint64_t)pos > reader->size) return false;
+
+	reader->offset = (size_t)pos;
+
+	return true;
+}
+
+// Previews at max_side against full stb decodes scaled down to the same size, returns number of mismatches
+static size_t benchPreview(bench_corpus_t *corpus, size_t max_side)
+{
+	uint64_t preview_bytes = 0;
+	size_t previews = 0, scaled = 0, mismatches = 0, i;
+	double preview_time = 0, stb_time = 0;
+
+	for(i = 0; i < corpus->files_num; i++) {
+		bench_file_t *file = corpus->files+i;
+		bench_reader_context_t context;
+		fastimage_reader_t reader;
+		fastimage_options_t options;
+		fastimage_hints_t hints;
+		fastimage_image_t image;
+		fastimage_preview_t preview;
+		unsigned char *pixels;
+		uint64_t diff = 0;
+		size_t scaled_width, scaled_height, step, x, y;
+		int width, height, channels;
+		double start, mean;
+
+		memset(&context, 0, sizeof(bench_reader_context_t));
+		context.data = file->data;
+		context.size = file->size;
+
+		reader.context = &context;
+		reader.read = benchRead;
+		reader.seek = benchSeek;
+
+		memset(&options, 0, sizeof(fastimage_options_t));
+		memset(&hints, 0, sizeof(fastimage_hints_t));
+		options.hints = &hints;
+
+		start = benchTime();
+		image = fastimageOpenEx(&reader, &options);
+		context.bytes_read = 0;
+		preview = fastimageDecodePreview(&reader, &image, &hints, max_side);
+		preview_time += benchTime()-start;
+
+		if(!preview.pixels) continue;
+
+		start = benchTime();
+		pixels = stbi_load_from_memory(file->data, (int)file->size, &width, &height, &channels, (int)preview.channels);
+		stb_time += benchTime()-start;
+
+		if(!pixels) {
+			fastimageFreePreview(&preview);
+			continue;
+		}
+
+		previews++;
+		if(preview.scale > 1) scaled++;
+		preview_bytes += context.bytes_read;
+
+		// Size before box downscale, each of its pixels is scale x scale source pixels:
+		// their mean for jpeg DC, the top left one for png pass 1
+		scaled_width = ((size_t)width+preview.scale-1)/preview.scale;
+		scaled_height = ((size_t)height+preview.scale-1)/preview.scale;
+		step = (image.format == fastimage_png)?preview.scale:1;
+
+		for(y = 0; y < preview.height; y++)
+			for(x = 0; x < preview.width; x++) {
+				size_t x0, x1, y0, y1, sx, sy;
+				unsigned int c;
+
+				x0 = (size_t)((uint64_t)x*scaled_width/preview.width);
+				x1 = (size_t)((uint64_t)(x+1)*scaled_width/preview.width);
+				y0 = (size_t)((uint64_t)y*scaled_height/preview.height);
+				y1 = (size_t)((uint64_t)(y+1)*scaled_height/preview.height);
+				if(x1 <= x0) x1 = x0+1;
+				if(y1 <= y0) y1 = y0+1;
+
+				x0 *= preview.scale;
+				y0 *= preview.scale;
+				x1 = (x1*preview.scale < (size_t)width)?x1*preview.scale:(size_t)width;
+				y1 = (y1*preview.scale < (size_t)height)?y1*preview.scale:(size_t)height;
+
+				for(c = 0; c < preview.channels; c++) {
+					uint64_t sum = 0, area = 0;
+					int value;
+
+					for(sy = y0; sy < y1; sy += step)
+						for(sx = x0; sx < x1; sx += step) {
+							sum += pixels[(sy*width+sx)*preview.channels+c];
+							area++;
+						}
+
+					value = (int)((sum+area/2)/area)-preview.pixels[(y*preview.width+x)*preview.channels+c];
+					diff += (uint64_t)(value < 0?-value:value);
+				}
+			}
+
+		mean = (double)diff/((double)preview.width*preview.height*preview.channels);
+		if(mean > BENCH_PREVIEW_MAX_DIFF) {
+			printf("preview mismatch: %s %ux%u scale 1/%u, mean difference %.1f\n", file->path, (unsigned int)preview.width, (unsigned int)preview.height, preview.scale, mean);
+			mismatches++;
+		}
+
+		stbi_image_free(pixels);
+		fastimageFreePreview(&preview);
+	}
+
+	printf("\nfiles: %u, previews: %u (%u from 1/8 decoders), max side: %u\n", (unsigned int)corpus->files_num, (unsigned int)previews, (unsigned int)scaled, (unsigned int)max_side);
+	printf("preview %.3f s, %llu bytes read; stb full decode %.3f s\n", preview_time, (unsigned long long)preview_bytes, stb_time);
+	printf("preview mismatches: %u\n", (unsigned int)mismatches);
+
+	return mismatches;
+}
+
+int main(int argc, char **argv)
+{
+	bench_corpus_t corpus;
+	stbi_io_callbacks stb_callbacks;
+	uint64_t fi_bytes = 0, stb_bytes = 0;
+	size_t fi_found = 0, stb_found = 0, mismatches = 0, channel_mismatches = 0, i;
+	double fi_time, stb_time, start;
+	size_t preview_side = 0;
+	int iterations = 100, arg, iter;
+
+	if(argc < 2) {
+		printf("bench [-n iterations] [-p max_side] file_or_dir...\n"
+		       "\t-p - check previews against stb_image instead of probes\n");
+
+		return 0;
+	}
+
+	memset(&corpus, 0, sizeof(bench_corpus_t));
+
+	for(arg = 1; arg < argc; arg++) {
+		if(!strcmp(argv[arg], "-n") && arg+1 < argc) {
+			iterations = atoi(argv[++arg]);
+			if(iterations < 1) iterations = 1;
+		} else if(!strcmp(argv[arg], "-p") && arg+1 < argc) {
+			preview_side = (size_t)atoi(argv[++arg]);
+			if(preview_side < 1) preview_side = 1;
+		} else
+			benchAddPath(&corpus, argv[arg]);
+	}
+
+	if(!corpus.files_num) {
+		printf("no files\n");
+
+		return 1;
+	}
+
+	if(preview_side) {
+		mismatches = benchPreview(&corpus, preview_side);
+
+		for(i = 0; i < corpus.files_num; i++) {
+			free(corpus.files[i].data);
+			free(corpus.files[i].path);
+		}
+		free(corpus.files);
+
+		return mismatches?1:0;
+	}
+
+	stb_callbacks.read = benchStbRead;
+	stb_callbacks.skip = benchStbSkip;
+	stb_callbacks.eof = benchStbEof;
+
+	// Differential check and bytes consumed
+	for(i = 0; i < corpus.files_num; i++) {
+		bench_file_t *file = corpus.files+i;
+		bench_stb_context_t stb_context;
+		fastimage_options_t options;
+		fastimage_stats_t stats;
+		fastimage_image_t image;
+		int stb_width, stb_height, stb_channels, stb_result;
+		bool fi_result;
+
+		memset(&options, 0, sizeof(fastimage_options_t));
+		options.stats = &stats;
+
+		image = fastimageOpenMemoryEx(file->data, file->size, &options);
+		fi_result = image.format != fastimage_error && image.format != fastimage_unknown;
+
+		memset(&stb_context, 0, sizeof(bench_stb_context_t));
+		stb_context.data = file->data;
+		stb_context.size = file->size;
+
+		stb_result = stbi_info_from_callbacks(&stb_callbacks, &stb_context, &stb_width, &stb_height, &stb_channels);
+
+		fi_bytes += stats.bytes_read;
+		stb_bytes += stb_context.bytes_read;
+		if(fi_result) fi_found++;
+		if(stb_result) stb_found++;
+
+		if(fi_result && stb_result) {
+			if(image.width != (size_t)stb_width || image.height != (size_t)stb_height) {
+				printf("size mismatch: %s fastimage %ux%u stb %dx%d\n", file->path, (unsigned int)image.width, (unsigned int)image.height, stb_width, stb_height);
+				mismatches++;
+			}
+
+			if(image.channels != (unsigned int)stb_channels) {
+				// For palette images stb reports channels after expanding, so it's only a note
+				printf("channels mismatch%s: %s fastimage %u stb %d\n", image.palette?" (palette)":"", file->path, image.channels, stb_channels);
+				channel_mismatches++;
+			}
+		} else if(fi_result != (stb_result != 0)) {
+			printf("only %s recognized: %s\n", fi_result?"fastimage":"stb", file->path);
+			if(stb_result) mismatches++;
+		}
+	}
+
+	// Throughput, both over memory
+	start = benchTime();
+	for(iter = 0; iter < iterations; iter++)
+		for(i = 0; i < corpus.files_num; i++)
+			fastimageOpenMemory(corpus.files[i].data, corpus.files[i].size);
+	fi_time = benchTime()-start;
+
+	start = benchTime();
+	for(iter = 0; iter < iterations; iter++)
+		for(i = 0; i < corpus.files_num; i++) {
+			int stb_width, stb_height, stb_channels;
+
+			stbi_info_from_memory(corpus.files[i].data, (int)corpus.files[i].size, &stb_width, &stb_height, &stb_channels);
+		}
+	stb_time = benchTime()-start;
+
+	printf("\nfiles: %u (%.1f MB), iterations: %d\n", (unsigned int)corpus.files_num, (double)corpus.total_size/1048576.0, iterations);
+	printf("%-10s %10s %14s %16s %14s\n", "", "recognized", "probes/s", "bytes consumed", "bytes/probe");
+	printf("%-10s %10u %14.0f %16llu %14.1f\n", "fastimage", (unsigned int)fi_found,
+		(double)corpus.files_num*iterations/(fi_time > 0?fi_time:1e-9), (unsigned long long)fi_bytes, (double)fi_bytes/corpus.files_num);
+	printf("%-10s %10u %14.0f %16llu %14.1f\n", "stb_image", (unsigned int)stb_found,
+		(double)corpus.files_num*iterations/(stb_time > 0?stb_time:1e-9), (unsigned long long)stb_bytes, (double)stb_bytes/corpus.files_num);
+	printf("size mismatches: %u, channels mismatches: %u\n", (unsigned int)mismatches, (unsigned int)channel_mismatches);
+
+	for(i = 0; i < corpus.files_num; i++) {
+		free(corpus.files[i].data);
+		free(corpus.files[i].path);
+	}
+	free(corpus.files);
+
+	return mismatches?1:0;
+}
@@ -44,11 +44,43 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <curl/curl.h>
 #endif
 
+#if defined(FASTIMAGE_USE_ZLIB)
+#include <zlib.h>
+#endif
+
 #include "fastimage.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if !defined(FASTIMAGE_NO_SIMD) && defined(__PCLMUL__) && defined(__SSE4_1__)
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#define FASTIMAGE_PCLMUL
+#elif !defined(FASTIMAGE_NO_SIMD) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define FASTIMAGE_ARM_CRC32
+#endif
+
+#if !defined(FASTIMAGE_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define FASTIMAGE_AVX2
+#elif !defined(FASTIMAGE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define FASTIMAGE_SSE2
+#endif
 
 typedef struct {
 	short Xmin;
@@ -82,6 +114,38 @@ typedef struct {
 } qoi_header_t;
 #pragma pack(pop)
 
+#define ICO_DIRENTRY_SIZE 16
+#define ICO_PEEK_SIZE 26 // Enough for PNG IHDR or BITMAPINFOHEADER
+#define ANI_HEADER_SIZE 36
+
+// First 4 bytes as little endian number (also FourCC of DDS)
+#define FASTIMAGE_SIGN(a, b, c, d) ((uint32_t)(a)|((uint32_t)(b)<<8)|((uint32_t)(c)<<16)|((uint32_t)(d)<<24))
+
+static uint32_t fastimageLe16(const unsigned char *p)
+{
+	return (uint32_t)(p[0])+(uint32_t)(p[1])*256;
+}
+
+static uint32_t fastimageLe32(const unsigned char *p)
+{
+	return (uint32_t)(p[0])+(uint32_t)(p[1])*256+(uint32_t)(p[2])*65536+(uint32_t)(p[3])*16777216;
+}
+
+static uint64_t fastimageLe64(const unsigned char *p)
+{
+	return (uint64_t)fastimageLe32(p)+((uint64_t)fastimageLe32(p+4)<<32);
+}
+
+static uint32_t fastimageBe16(const unsigned char *p)
+{
+	return (uint32_t)(p[0])*256+(uint32_t)(p[1]);
+}
+
+static uint32_t fastimageBe32(const unsigned char *p)
+{
+	return (uint32_t)(p[0])*16777216+(uint32_t)(p[1])*65536+(uint32_t)(p[2])*256+(uint32_t)(p[3]);
+}
+
 static void fastimageReadBmp(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
 {
 	bmp_infoheader_min_t bmp_infoheader;
@@ -124,14 +188,15 @@ static void fastimageReadBmp(const fastimage_reader_t *reader, unsigned char *si
 		image->channels = image->bitsperpixel / 8;
 }
 
-static void fastimageReadTga(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+// header_size bytes of header are already read
+static void fastimageReadTgaHeader(const fastimage_reader_t *reader, unsigned char *header, size_t header_size, fastimage_image_t *image)
 {
 	unsigned char tga_header[18];
 	
 	memset(tga_header, 0, 18);
-	memcpy(tga_header, sign, 4);
+	memcpy(tga_header, header, header_size);
 
-	if(reader->read(reader->context, 14, tga_header+4) != 14) goto TGA_ERROR;
+	if(reader->read(reader->context, 18-header_size, tga_header+header_size) != 18-header_size) goto TGA_ERROR;
 
 	image->width = tga_header[12]+256*tga_header[13];
 	image->height = tga_header[14]+256*tga_header[15];
@@ -160,6 +225,11 @@ TGA_ERROR:
 	image->format = fastimage_error;
 }
 
+static void fastimageReadTga(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+{
+	fastimageReadTgaHeader(reader, sign, 4, image);
+}
+
 static void fastimageReadPcx(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
 {
 	pcx_header_min_t pcx_header_min;
@@ -183,11 +253,14 @@ static void fastimageReadPcx(const fastimage_reader_t *reader, unsigned char *si
 		image->format = fastimage_error;
 }
 
-static void fastimageReadPng(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+#define PNG_CHUNKS_BEFORE_IHDR 8 // IHDR goes first, Apple's CgBI chunk is the known exception
+
+static void fastimageReadPng(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, fastimage_hints_t *hints)
 {
-	unsigned char png_bytes[10];
+	unsigned char png_bytes[13];
 	int64_t png_curr_offt = 4;
 	uint32_t png_chunk_size;
+	int png_chunks = 0;
 	
 	(void)sign; // Unused
 	
@@ -204,6 +277,9 @@ static void fastimageReadPng(const fastimage_reader_t *reader, unsigned char *si
 	while(1) {
 		unsigned char png_chunk_head[8];
 		
+		if(png_chunks++ == PNG_CHUNKS_BEFORE_IHDR)
+			goto PNG_ERROR;
+		
 		if(reader->read(reader->context, 8, png_chunk_head) != 8)
 			goto PNG_ERROR;
 		
@@ -223,7 +299,7 @@ static void fastimageReadPng(const fastimage_reader_t *reader, unsigned char *si
 	if(png_chunk_size != 0xD)
 		goto PNG_ERROR;
 
-	if(reader->read(reader->context, 10, png_bytes) != 10)
+	if(reader->read(reader->context, 13, png_bytes) != 13)
 		goto PNG_ERROR;
 
 	image->width = (uint32_t)(png_bytes[0])*16777216+(uint32_t)(png_bytes[1])*65536+(uint32_t)(png_bytes[2])*256+png_bytes[3];
@@ -255,6 +331,13 @@ static void fastimageReadPng(const fastimage_reader_t *reader, unsigned char *si
 	else
 		image->bitsperpixel = (unsigned int)(png_bytes[8]) * image->channels;
 
+	if(!hints) return;
+
+	hints->bitspersample = image->palette?8:png_bytes[8];
+	if(png_bytes[8] > 8) hints->flags |= fastimage_hint_high_depth;
+	if(png_bytes[12] == 1) hints->flags |= fastimage_hint_interlaced;
+	if(png_bytes[9] == 4 || png_bytes[9] == 6) hints->flags |= fastimage_hint_alpha;
+
 	return;
 	
 PNG_ERROR:
@@ -289,15 +372,15 @@ static void fastimageReadGif(const fastimage_reader_t *reader, unsigned char *si
 	image->palette = 8;
 }
 
-static void fastimageReadWebp(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+static void fastimageReadWebp(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, int level, fastimage_hints_t *hints)
 {
-	size_t riff_size;
+	unsigned char riff_size[4], vp8_header[9];
 	char fourcc[4], vp8fourcc[4];
 	
 	(void)sign; // Unused
 	
-	if(reader->read(reader->context, 4, &riff_size) != 4) goto WEBP_ERROR;
-	if(riff_size < 8) goto WEBP_ERROR;
+	if(reader->read(reader->context, 4, riff_size) != 4) goto WEBP_ERROR;
+	if(fastimageLe32(riff_size) < 8) goto WEBP_ERROR;
 	
 	if(reader->read(reader->context, 4, fourcc) != 4) goto WEBP_ERROR;
 	
@@ -309,6 +392,9 @@ static void fastimageReadWebp(const fastimage_reader_t *reader, unsigned char *s
 		
 		return;
 	}
+
+	// Chunk type gives only depth
+	if(level != fastimage_level_full) return;
 	
 	if(reader->read(reader->context, 4, vp8fourcc) != 4) goto WEBP_ERROR;
 	
@@ -322,6 +408,21 @@ static void fastimageReadWebp(const fastimage_reader_t *reader, unsigned char *s
 		image->bitsperpixel = 32;
 		image->channels = 4;
 	} else return;
+
+	if(!hints || !memcmp(vp8fourcc, "VP8 ", 4)) return;
+
+	hints->bitspersample = 8;
+
+	// Chunk size, then VP8X flags or VP8L signature and 32 bits of size, alpha and version
+	if(reader->read(reader->context, 9, vp8_header) != 9) return;
+
+	if(!memcmp(vp8fourcc, "VP8L", 4)) {
+		hints->flags |= fastimage_hint_lossless;
+		if(vp8_header[4] == 0x2F && (vp8_header[8]&0x10)) hints->flags |= fastimage_hint_alpha;
+	} else {
+		if(vp8_header[4]&0x10) hints->flags |= fastimage_hint_alpha;
+		if(vp8_header[4]&0x02) hints->flags |= fastimage_hint_animated;
+	}
 	
 	return;
 	
@@ -330,219 +431,673 @@ WEBP_ERROR:
 	image->format = fastimage_error;
 }
 
-static void fastimageReadJpeg(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+// SOFn markers, but not DHT (C4), JPG (C8) and DAC (CC). Marker byte is high byte of jpg_frame
+static bool fastimageJpegSof(unsigned short jpg_frame)
 {
-	int64_t jpg_curr_offt = 4;
-	unsigned short jpg_frame;
-	int64_t jpg_segment_size;
-		
-	jpg_frame = sign[2]+(unsigned short)(sign[3])*256;
-		
-	// First of all, skipping segments we don't needed
-	// TODO: there are segments without length (with empty or 2-byte data). Need to check them
-	while(1) {
-		unsigned char jpg_bytes[2];
-			
-		//printf("jpeg segment %hx\n", jpg_frame);
-			
-		// Read segment size
-		if(reader->read(reader->context, 2, jpg_bytes) != 2) {
-			image->format = fastimage_error;
-				
-			return;
-		}
-			
-		jpg_curr_offt += 2;
-			
-		jpg_segment_size = (int64_t)(jpg_bytes[0])*256+jpg_bytes[1];
-			
-		if(jpg_segment_size < 2) {
-			image->format = fastimage_error;
-				
-			return;
+	unsigned int marker = jpg_frame>>8;
+
+	return (jpg_frame&0xFF) == 0xFF && marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+#define ISOBMFF_FTYP_CHUNK 64
+#define ISOBMFF_FTYP_MAX 1024 // Brands of real files take a few dozen bytes
+
+// Brands of mp4 and mov, checked after brands of images
+static int fastimageVideoBrand(const unsigned char *brand)
+{
+	static const char brands[][4] = {"isom", "mp41", "mp42", "avc1", "dash", "M4V ", "f4v ", "mmp4", "XAVC", "MSNV", "cmfc"};
+	size_t i;
+
+	if(!memcmp(brand, "qt  ", 4)) return fastimage_mov;
+
+	// iso2-iso9, 3gp4-3gp9 and 3g2a-3g2c
+	if((!memcmp(brand, "iso", 3) && brand[3] >= '2' && brand[3] <= '9') || !memcmp(brand, "3gp", 3) || !memcmp(brand, "3g2", 3))
+		return fastimage_mp4;
+
+	for(i = 0; i < sizeof(brands)/sizeof(brands[0]); i++)
+		if(!memcmp(brand, brands[i], 4)) return fastimage_mp4;
+
+	return fastimage_unknown;
+}
+
+// QuickTime files without ftyp start with one of these
+static bool fastimageQuickTimeAtom(const unsigned char *type)
+{
+	return !memcmp(type, "moov", 4) || !memcmp(type, "mdat", 4) || !memcmp(type, "wide", 4) || !memcmp(type, "free", 4) ||
+		!memcmp(type, "skip", 4) || !memcmp(type, "pnot", 4);
+}
+
+static void fastimageDetectISOBMFF(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, int level)
+{
+	size_t ftyp_size, i;
+	unsigned char ftyp_body[ISOBMFF_FTYP_CHUNK];
+	int format = fastimage_unknown, video = fastimage_unknown;
+
+	ftyp_size = fastimageBe32(sign);
+
+	if(ftyp_size < 8 && ftyp_size != 1) return;
+
+	// Check box type before reading brands
+	if(reader->read(reader->context, 4, ftyp_body) != 4) return;
+
+	// Stream is left at the start of the first atom
+	if(memcmp(ftyp_body, "ftyp", 4)) {
+		if(fastimageQuickTimeAtom(ftyp_body) && reader->seek(reader->context, -8, true))
+			image->format = fastimage_mov;
+
+		return;
+	}
+
+	if(ftyp_size < 8 || ftyp_size > ISOBMFF_FTYP_MAX || ftyp_size%4) return;
+
+	ftyp_size -= 8;
+
+	// Brands are read by chunks, until the whole box is read
+	while(ftyp_size) {
+		size_t chunk_size = ISOBMFF_FTYP_CHUNK;
+
+		if(chunk_size > ftyp_size) chunk_size = ftyp_size;
+
+		if(reader->read(reader->context, chunk_size, ftyp_body) != chunk_size) return;
+
+		ftyp_size -= chunk_size;
+
+		for(i = 0; i < chunk_size && (format == fastimage_unknown || format == fastimage_miaf); i += 4) {
+			if(!memcmp(ftyp_body+i, "mif1", 4) || !memcmp(ftyp_body + i, "miaf", 4))
+				format = fastimage_miaf;
+			else if(!memcmp(ftyp_body+i, "heic", 4) || !memcmp(ftyp_body+i, "hevc", 4))
+				format = fastimage_heic;
+			else if(!memcmp(ftyp_body + i, "avif", 4) || !memcmp(ftyp_body+i, "avis", 4))
+				format = fastimage_avif;
+			else if(video == fastimage_unknown)
+				video = fastimageVideoBrand(ftyp_body+i);
 		}
-			
-		jpg_segment_size -= 2;
-			
-		if(jpg_frame == 0xC0FF || jpg_frame == 0xC1FF || jpg_frame == 0xC2FF) {
+
+		// Rest of box is not needed if we don't read meta
+		if(level == fastimage_level_format && format != fastimage_unknown && format != fastimage_miaf)
 			break;
-		}
-			
-		// Skip segment
-		jpg_curr_offt += jpg_segment_size;
-			
-		if(!reader->seek(reader->context, jpg_curr_offt, false)) {
-			image->format = fastimage_error;
-				
-			return;
-		}
-			
-		// Read next segment signature
-		if(reader->read(reader->context, 2, &jpg_frame) != 2) {
-			image->format = fastimage_error;
-				
-			return;
-		}
-		
-		jpg_curr_offt += 2;
 	}
-		
-	if(jpg_frame == 0xC0FF || jpg_frame == 0xC1FF || jpg_frame == 0xC2FF) {
-		// Found segment with header
-		unsigned char jpg_bytes[6];
-		
-		if(jpg_segment_size < 6) {
-			image->format = fastimage_error;
-					
-			return;
-		}
-				
-		if(reader->read(reader->context, 6, jpg_bytes) != 6) {
-			image->format = fastimage_error;
-				
-			return;
-		}
-			
-		image->width = (size_t)(jpg_bytes[3])*256+jpg_bytes[4];
-		image->height = (size_t)(jpg_bytes[1])*256+jpg_bytes[2];
-		image->channels = jpg_bytes[5];
-		image->bitsperpixel = image->channels * (unsigned int)(jpg_bytes[0]);
-	} else
-		image->format = fastimage_error;
+
+	image->format = (format != fastimage_unknown)?format:video;
 }
 
-static void fastimageDetectISOBMFF(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+// HEIF meta box. Items are looked up by ID in iinf, ipma and iloc, only a few of them are resolved
+
+#define HEIF_ALPHA_URN "urn:mpeg:mpegB:cicp:systems:auxiliary:alpha"
+#define HEIF_HEVC_ALPHA_URN "urn:mpeg:hevc:2015:auxid:1"
+
+typedef struct {
+	const unsigned char *meta; // Body of meta box, from version and flags
+	size_t size;
+	uint64_t offset; // Of body in stream
+	const unsigned char *iinf, *iref, *ipco, *ipma, *iloc, *idat;
+	size_t iinf_size, iref_size, ipco_size, ipma_size, iloc_size, idat_size;
+} fastimage_heif_meta_t;
+
+static uint64_t fastimageBeN(const unsigned char *p, size_t size)
 {
-	size_t ftyp_size, i;
-	unsigned char *ftyp_body;
+	uint64_t value = 0;
 
-	ftyp_size = (size_t)(sign[0])*16777216+(size_t)(sign[1])*65536+(size_t)(sign[2])*256+(size_t)(sign[3]);
+	while(size--)
+		value = (value<<8)|*p++;
 
-	if(ftyp_size < 8) return;
+	return value;
+}
+
+// Child box in [*p, end), false at the end or when box is broken
+static bool fastimageBoxNext(const unsigned char **p, const unsigned char *end, const unsigned char **type, const unsigned char **body, size_t *body_size)
+{
+	size_t left = (size_t)(end-*p), header = 8;
+	uint64_t size;
 
-	ftyp_size -= 4;
-	if(ftyp_size%4) return;
+	if(left < 8) return false;
 
-	ftyp_body = malloc(ftyp_size);
-	if(!ftyp_body) return;
+	size = fastimageBe32(*p);
+	if(size == 1) {
+		if(left < 16) return false;
 
-	if(reader->read(reader->context, ftyp_size, ftyp_body) != ftyp_size) {
-		free(ftyp_body);
-		return;
+		size = fastimageBeN(*p+8, 8);
+		header = 16;
+	} else if(!size)
+		size = left;
+
+	if(size < header || size > left) return false;
+
+	*type = *p+4;
+	*body = *p+header;
+	*body_size = (size_t)size-header;
+	*p += size;
+
+	return true;
+}
+
+static bool fastimageHeifAlphaUrn(const unsigned char *urn, size_t size)
+{
+	return (size >= sizeof(HEIF_ALPHA_URN)-1 && !memcmp(urn, HEIF_ALPHA_URN, sizeof(HEIF_ALPHA_URN)-1)) ||
+		(size >= sizeof(HEIF_HEVC_ALPHA_URN)-1 && !memcmp(urn, HEIF_HEVC_ALPHA_URN, sizeof(HEIF_HEVC_ALPHA_URN)-1));
+}
+
+// Item type from infe (version 2 or 3)
+static bool fastimageHeifType(const fastimage_heif_meta_t *meta, uint32_t id, char *type)
+{
+	const unsigned char *p, *end, *box_type, *body;
+	size_t body_size, id_size;
+
+	// Version, flags and entry count
+	if(!meta->iinf || meta->iinf_size < (size_t)(meta->iinf[0]?8:6)) return false;
+
+	p = meta->iinf+(meta->iinf[0]?8:6);
+	end = meta->iinf+meta->iinf_size;
+
+	while(fastimageBoxNext(&p, end, &box_type, &body, &body_size)) {
+		if(memcmp(box_type, "infe", 4) || body_size < 4 || body[0] < 2) continue;
+
+		id_size = (body[0] == 2)?2:4;
+		if(body_size < 4+id_size+2+4 || fastimageBeN(body+4, id_size) != id) continue;
+
+		memcpy(type, body+4+id_size+2, 4);
+		type[4] = 0;
+
+		return true;
 	}
 
-	if(memcmp(ftyp_body, "ftyp", 4)) {
-		free(ftyp_body);
+	return false;
+}
 
-		return;
+// Property of ipco by 1-based index, if it has this type
+static const unsigned char *fastimageHeifPropertyAt(const fastimage_heif_meta_t *meta, unsigned int index, const char *want, size_t *size)
+{
+	const unsigned char *p = meta->ipco, *end = meta->ipco+meta->ipco_size, *type, *body;
+	size_t body_size;
+
+	if(!p || !index) return 0;
+
+	while(fastimageBoxNext(&p, end, &type, &body, &body_size))
+		if(!--index) {
+			if(memcmp(type, want, 4)) return 0;
+
+			*size = body_size;
+
+			return body;
+		}
+
+	return 0;
+}
+
+// The first property of item with this type, from associations of ipma
+static const unsigned char *fastimageHeifProperty(const fastimage_heif_meta_t *meta, uint32_t id, const char *want, size_t *size)
+{
+	const unsigned char *p, *end, *body;
+	size_t id_size, index_size;
+	uint32_t count, i;
+	unsigned int n, j;
+
+	if(!meta->ipma || meta->ipma_size < 8) return 0;
+
+	id_size = meta->ipma[0]?4:2;
+	index_size = (meta->ipma[3]&1)?2:1;
+	count = fastimageBe32(meta->ipma+4);
+	p = meta->ipma+8;
+	end = meta->ipma+meta->ipma_size;
+
+	for(i = 0; i < count; i++) {
+		if((size_t)(end-p) < id_size+1) return 0;
+
+		n = p[id_size];
+		if((size_t)(end-p-id_size-1) < n*index_size) return 0;
+
+		if(fastimageBeN(p, id_size) == id) {
+			p += id_size+1;
+
+			// Highest bit is essential flag
+			for(j = 0; j < n; j++)
+				if((body = fastimageHeifPropertyAt(meta, (unsigned int)fastimageBeN(p+j*index_size, index_size)&((index_size == 2)?0x7FFF:0x7F), want, size)) != 0)
+					return body;
+
+			return 0;
+		}
+
+		p += id_size+1+n*index_size;
 	}
 
-	for(i = 4; i < ftyp_size; i += 4) {
-		if(!memcmp(ftyp_body+i, "mif1", 4) || !memcmp(ftyp_body + i, "miaf", 4)) {
-			image->format = fastimage_miaf;
+	return 0;
+}
+
+// Data of item in stream, false if it's not one contiguous range of this file (or of idat)
+static bool fastimageHeifLocate(const fastimage_heif_meta_t *meta, uint32_t id, uint64_t *offset, uint64_t *length)
+{
+	const unsigned char *p, *end;
+	unsigned int version, offset_size, length_size, base_size, index_size, method, data_reference;
+	size_t id_size, entry_size;
+	uint32_t count, i, extents, j;
+	uint64_t base, extent_offset, extent_length;
+
+	if(!meta->iloc || meta->iloc_size < 6) return false;
+
+	p = meta->iloc;
+	end = p+meta->iloc_size;
+	version = p[0];
+	offset_size = p[4]>>4;
+	length_size = p[4]&15;
+	base_size = p[5]>>4;
+	index_size = (version >= 1)?(p[5]&15):0;
+
+	if(version > 2) return false;
+	if((offset_size != 0 && offset_size != 4 && offset_size != 8) || (length_size != 0 && length_size != 4 && length_size != 8)) return false;
+	if((base_size != 0 && base_size != 4 && base_size != 8) || (index_size != 0 && index_size != 4 && index_size != 8)) return false;
+
+	id_size = (version < 2)?2:4;
+	entry_size = index_size+offset_size+length_size;
+	p += 6;
+
+	if((size_t)(end-p) < id_size) return false;
+	count = (uint32_t)fastimageBeN(p, id_size);
+	p += id_size;
+
+	// Item, construction method (version 1 and 2), data reference, base offset and extents
+	for(i = 0; i < count; i++) {
+		if((size_t)(end-p) < id_size+(version?2:0)+2+base_size+2) return false;
+
+		if(fastimageBeN(p, id_size) != id) {
+			p += id_size+(version?2:0)+2+base_size;
+			extents = fastimageBe16(p);
+			p += 2;
+			if((size_t)(end-p) < extents*entry_size) return false;
+			p += extents*entry_size;
+
+			continue;
+		}
+
+		p += id_size;
+		method = 0;
+		if(version) {
+			method = fastimageBe16(p)&15;
+			p += 2;
 		}
-		if(!memcmp(ftyp_body+i, "heic", 4) || !memcmp(ftyp_body+i, "hevc", 4)) {
-			image->format = fastimage_heic;
-			break;
+		data_reference = fastimageBe16(p);
+		base = fastimageBeN(p+2, base_size);
+		extents = fastimageBe16(p+2+base_size);
+		p += 2+base_size+2;
+
+		if(data_reference || method > 1 || !extents || (size_t)(end-p) < extents*entry_size) return false;
+
+		*offset = base+fastimageBeN(p+index_size, offset_size);
+		*length = 0;
+
+		// Length 0 is up to the end of file
+		for(j = 0; j < extents; j++, p += entry_size) {
+			extent_offset = base+fastimageBeN(p+index_size, offset_size);
+			extent_length = fastimageBeN(p+index_size+offset_size, length_size);
+
+			if(!extent_length || extent_offset != *offset+*length) return false;
+
+			*length += extent_length;
 		}
-		if(!memcmp(ftyp_body + i, "avif", 4) || !memcmp(ftyp_body+i, "avis", 4)) {
-			image->format = fastimage_avif;
-			break;
+
+		if(method == 1) {
+			if(!meta->idat || *offset > meta->idat_size || *length > meta->idat_size-*offset) return false;
+
+			*offset += meta->offset+(uint64_t)(meta->idat-meta->meta);
 		}
+
+		return true;
 	}
-	free(ftyp_body);
+
+	return false;
 }
 
-static void fastimageReadISOBMFF(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+// Next reference of this type in iref, to are IDs of id_size bytes
+static bool fastimageHeifReference(const fastimage_heif_meta_t *meta, const unsigned char **cursor, const char *want, uint32_t *from, const unsigned char **to, uint32_t *count, size_t *id_size)
 {
-	unsigned char atom_head[8];
+	const unsigned char *end, *type, *body;
+	size_t body_size;
 
-	(void)sign;
+	if(!meta->iref || meta->iref_size < 4) return false;
 
-	while(1) {
-		size_t ftyp_size;
+	*id_size = meta->iref[0]?4:2;
+	end = meta->iref+meta->iref_size;
+	if(!*cursor) *cursor = meta->iref+4;
 
-		if(reader->read(reader->context, 8, atom_head) != 8) goto ISOBMFF_ERROR;
-	
-		ftyp_size = (size_t)(atom_head[0])*16777216+(size_t)(atom_head[1])*65536+(size_t)(atom_head[2])*256+(size_t)(atom_head[3]);
-		ftyp_size -= 8;
+	while(fastimageBoxNext(cursor, end, &type, &body, &body_size)) {
+		if(memcmp(type, want, 4) || body_size < *id_size+2) continue;
 
-		if(ftyp_size < 8) goto ISOBMFF_ERROR;
+		*from = (uint32_t)fastimageBeN(body, *id_size);
+		*count = fastimageBe16(body+*id_size);
+		if(body_size < *id_size+2+*count**id_size) continue;
 
-		//printf("Container is %hc%hc%hc%hc\n", atom_head[4], atom_head[5], atom_head[6], atom_head[7]);
+		*to = body+*id_size+2;
 
-		if(!memcmp(atom_head+4, "meta", 4)) {
-			unsigned char *atom_data;
-			size_t i;
+		return true;
+	}
 
-			atom_data = malloc(ftyp_size);
-			if(!atom_data) goto ISOBMFF_ERROR;
+	return false;
+}
 
-			if(reader->read(reader->context, ftyp_size, atom_data) != ftyp_size) {
-				free(atom_data);
-				goto ISOBMFF_ERROR;
-			}
+static bool fastimageHeifRefers(const unsigned char *to, uint32_t count, size_t id_size, uint32_t id)
+{
+	uint32_t i;
 
-			// Very dirty implementation (I don't know what should be correct)
-			for(i = 0; i < ftyp_size-20; i++) {
-				// ispe 20 (12 - wid(be), 16 - hei(be))
-				if(!memcmp(atom_data+i, "\x00\x00\x00\x14ispe", 8)) {
-					image->width = (size_t)(atom_data[i+12])*16777216+(size_t)(atom_data[i+13])*65536+(size_t)(atom_data[i+14])*256+(size_t)(atom_data[i+15]);
-					image->height = (size_t)(atom_data[i+16])*16777216+(size_t)(atom_data[i+17])*65536+(size_t)(atom_data[i+18])*256+(size_t)(atom_data[i+19]);
-				} else if(!memcmp(atom_data+i, "\x00\x00\x00\x10pixi", 8) || !memcmp(atom_data+i, "\x00\x00\x00\x0epixi", 8)) {
-					size_t j;
+	for(i = 0; i < count; i++)
+		if(fastimageBeN(to+i*id_size, id_size) == id) return true;
 
-					image->channels += atom_data[i+12];
+	return false;
+}
 
-					if(atom_data[i+12] > atom_data[i+3]-13) goto ISOBMFF_ERROR;
+static void fastimageHeifItem(const fastimage_heif_meta_t *meta, uint32_t id, fastimage_heif_item_t *item)
+{
+	const unsigned char *body;
+	size_t size;
+	unsigned int i;
 
-					for(j = 0; j < atom_data[i+12]; j++)
-						image->bitsperpixel += atom_data[i+13];
-				}
-			}
-			
-			free(atom_data);
-			break;
-		} else if(!reader->seek(reader->context, ftyp_size, true)) goto ISOBMFF_ERROR;
+	memset(item, 0, sizeof(fastimage_heif_item_t));
+	item->id = id;
+
+	fastimageHeifType(meta, id, item->type);
+
+	// Version and flags, then width and height
+	if((body = fastimageHeifProperty(meta, id, "ispe", &size)) != 0 && size >= 12) {
+		item->width = fastimageBe32(body+4);
+		item->height = fastimageBe32(body+8);
 	}
 
-	return;
+	// Version and flags, number of channels, bits of each
+	if((body = fastimageHeifProperty(meta, id, "pixi", &size)) != 0 && size >= 5 && size >= (size_t)5+body[4]) {
+		item->channels = body[4];
+		for(i = 0; i < body[4]; i++)
+			item->bitsperpixel += body[5+i];
+	}
 
-ISOBMFF_ERROR:
-	memset(image, 0, sizeof(fastimage_image_t));
-	image->format = fastimage_error;
+	if((body = fastimageHeifProperty(meta, id, "hvcC", &size)) != 0 || (body = fastimageHeifProperty(meta, id, "av1C", &size)) != 0) {
+		item->config_offset = meta->offset+(uint64_t)(body-meta->meta);
+		item->config_length = size;
+	}
+
+	if(!fastimageHeifLocate(meta, id, &item->offset, &item->length)) {
+		item->offset = 0;
+		item->length = 0;
+	}
 }
 
-static void fastimageReadQoi(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+// Bytes of stream, from meta when they are in it. Stream is left after meta
+static bool fastimageHeifRead(const fastimage_reader_t *reader, const fastimage_heif_meta_t *meta, uint64_t offset, size_t size, unsigned char *buf)
 {
-	qoi_header_t head;
-	
-	(void)sign; // unused
-	
-	if(reader->read(reader->context, sizeof(qoi_header_t), &head) != sizeof(qoi_header_t)) goto QOI_ERROR;
+	bool result;
 
-	if(head.channels < 3 || head.channels > 4) goto QOI_ERROR;
-	if(head.colorspace > 1) goto QOI_ERROR;
-	
-	image->width = ((head.width&0xff000000)>>24)+((head.width&0xff0000)>>16)+((head.width&0xff00)<<16)+((head.width&0xff)<<24);
-	image->height = ((head.height&0xff000000)>>24)+((head.height&0xff0000)>>16)+((head.height&0xff00)<<16)+((head.height&0xff)<<24);
-	image->channels = head.channels;
-	image->bitsperpixel = head.channels*8;
-	
-	return;
-QOI_ERROR:
-	memset(image, 0, sizeof(fastimage_image_t));
-	image->format = fastimage_error;
+	if(offset >= meta->offset && offset-meta->offset <= meta->size && size <= meta->size-(offset-meta->offset)) {
+		memcpy(buf, meta->meta+(offset-meta->offset), size);
+
+		return true;
+	}
+
+	result = reader->seek(reader->context, (int64_t)offset, false) && reader->read(reader->context, size, buf) == size;
+
+	return reader->seek(reader->context, (int64_t)(meta->offset+meta->size), false) && result;
 }
 
-static void fastimageReadIco(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+// Body of meta box at offset of stream, false if there is no primary item
+static bool fastimageHeifParse(const fastimage_reader_t *reader, const unsigned char *data, size_t size, uint64_t offset, fastimage_heif_t *heif)
 {
-	char header[14];
-	bmp_infoheader_min_t binfoh;
-	
-	memcpy(header, sign, 4);
-	
-	if(reader->read(reader->context, 10, header+4) != 10) goto ICO_ERROR;
+	fastimage_heif_meta_t meta;
+	fastimage_heif_item_t thumbnail;
+	const unsigned char *p, *end, *type, *body, *child, *child_type, *child_body, *cursor, *to;
+	size_t body_size, child_size, id_size;
+	uint32_t primary = 0, from, count;
+	unsigned char grid[12];
+
+	memset(&meta, 0, sizeof(fastimage_heif_meta_t));
+	memset(heif, 0, sizeof(fastimage_heif_t));
+
+	if(size < 4) return false;
+
+	meta.meta = data;
+	meta.size = size;
+	meta.offset = offset;
+
+	// After version and flags of meta
+	p = data+4;
+	end = data+size;
+
+	while(fastimageBoxNext(&p, end, &type, &body, &body_size)) {
+		if(!memcmp(type, "pitm", 4) && body_size >= 6)
+			primary = body[0]?((body_size >= 8)?fastimageBe32(body+4):0):fastimageBe16(body+4);
+		else if(!memcmp(type, "iinf", 4)) {
+			meta.iinf = body;
+			meta.iinf_size = body_size;
+		} else if(!memcmp(type, "iref", 4)) {
+			meta.iref = body;
+			meta.iref_size = body_size;
+		} else if(!memcmp(type, "iloc", 4)) {
+			meta.iloc = body;
+			meta.iloc_size = body_size;
+		} else if(!memcmp(type, "idat", 4)) {
+			meta.idat = body;
+			meta.idat_size = body_size;
+		} else if(!memcmp(type, "iprp", 4)) {
+			child = body;
+
+			while(fastimageBoxNext(&child, body+body_size, &child_type, &child_body, &child_size))
+				if(!memcmp(child_type, "ipco", 4) && !meta.ipco) {
+					meta.ipco = child_body;
+					meta.ipco_size = child_size;
+				} else if(!memcmp(child_type, "ipma", 4) && !meta.ipma) {
+					meta.ipma = child_body;
+					meta.ipma_size = child_size;
+				}
+		}
+	}
+
+	if(!primary) return false;
+
+	fastimageHeifItem(&meta, primary, &heif->primary);
+
+	// Tiles are dimg references of grid in order. Grid data: version, flags, rows-1, columns-1 and output size
+	if(!memcmp(heif->primary.type, "grid", 4)) {
+		cursor = 0;
+
+		while(fastimageHeifReference(&meta, &cursor, "dimg", &from, &to, &count, &id_size))
+			if(from == primary && count) {
+				fastimageHeifItem(&meta, (uint32_t)fastimageBeN(to, id_size), &heif->tile);
+				break;
+			}
+
+		if(heif->primary.length >= 8 && fastimageHeifRead(reader, &meta, heif->primary.offset, heif->primary.length >= 12?12:8, grid)) {
+			heif->grid_rows = (unsigned int)grid[2]+1;
+			heif->grid_columns = (unsigned int)grid[3]+1;
+
+			// ispe is mandatory, but output size is here too
+			if(!heif->primary.width) {
+				if(!(grid[1]&1)) {
+					heif->primary.width = fastimageBe16(grid+4);
+					heif->primary.height = fastimageBe16(grid+6);
+				} else if(heif->primary.length >= 12) {
+					heif->primary.width = fastimageBe32(grid+4);
+					heif->primary.height = fastimageBe32(grid+8);
+				}
+			}
+		}
+	}
+
+	cursor = 0;
+
+	while(fastimageHeifReference(&meta, &cursor, "thmb", &from, &to, &count, &id_size))
+		if(fastimageHeifRefers(to, count, id_size, primary)) {
+			fastimageHeifItem(&meta, from, &thumbnail);
+			heif->thumbnails++;
+
+			if(!heif->thumbnail.id || (uint64_t)thumbnail.width*thumbnail.height > (uint64_t)heif->thumbnail.width*heif->thumbnail.height)
+				heif->thumbnail = thumbnail;
+		}
+
+	// Alpha is auxiliary image with URN of alpha in auxC
+	cursor = 0;
+
+	while(fastimageHeifReference(&meta, &cursor, "auxl", &from, &to, &count, &id_size))
+		if(fastimageHeifRefers(to, count, id_size, primary) && (body = fastimageHeifProperty(&meta, from, "auxC", &body_size)) != 0 && body_size > 4 && fastimageHeifAlphaUrn(body+4, body_size-4))
+			heif->alpha = true;
+
+	return true;
+}
+
+#define ISOBMFF_BOXES_LIMIT 64 // Before meta, it's usually right after ftyp
+#define ISOBMFF_META_CHUNK 65536
+
+static void fastimageReadISOBMFF(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, int level, fastimage_hints_t *hints, fastimage_heif_t *heif)
+{
+	unsigned char atom_head[16];
+	uint64_t offset = fastimageBe32(sign); // ftyp is read by fastimageDetectISOBMFF
+	int boxes;
+
+	for(boxes = 0; ; boxes++) {
+		size_t ftyp_size, header = 8;
+		uint64_t box_size;
+
+		if(boxes == ISOBMFF_BOXES_LIMIT) goto ISOBMFF_ERROR;
+
+		if(reader->read(reader->context, 8, atom_head) != 8) goto ISOBMFF_ERROR;
+
+		box_size = fastimageBe32(atom_head);
+
+		// 64-bit size
+		if(box_size == 1) {
+			if(reader->read(reader->context, 8, atom_head+8) != 8) goto ISOBMFF_ERROR;
+
+			box_size = fastimageBeN(atom_head+8, 8);
+			header = 16;
+		}
+
+		if(box_size < header+8) goto ISOBMFF_ERROR;
+
+		offset += header;
+
+		//printf("Container is %hc%hc%hc%hc\n", atom_head[4], atom_head[5], atom_head[6], atom_head[7]);
+
+		if(!memcmp(atom_head+4, "meta", 4)) {
+			unsigned char *atom_data = 0, *grown;
+			size_t i, got, part;
+
+			if(box_size-header > SIZE_MAX) goto ISOBMFF_ERROR;
+			ftyp_size = (size_t)(box_size-header);
+
+			// Buffer grows with data that is really there, broken size can't allocate more than twice the stream
+			for(got = 0; got < ftyp_size; got += part) {
+				part = (got > ISOBMFF_META_CHUNK)?got:ISOBMFF_META_CHUNK;
+				if(part > ftyp_size-got) part = ftyp_size-got;
+
+				grown = realloc(atom_data, got+part);
+				if(!grown || reader->read(reader->context, part, grown+got) != part) {
+					free(grown?grown:atom_data);
+					goto ISOBMFF_ERROR;
+				}
+
+				atom_data = grown;
+			}
+
+			// Items of primary image, or the first ispe and pixi found if there is no pitm
+			if(fastimageHeifParse(reader, atom_data, ftyp_size, offset, heif) && heif->primary.width) {
+				const fastimage_heif_item_t *item = heif->primary.channels?(&heif->primary):(&heif->tile);
+
+				image->width = heif->primary.width;
+				image->height = heif->primary.height;
+
+				if(level == fastimage_level_full) {
+					image->channels = item->channels;
+					image->bitsperpixel = item->bitsperpixel;
+				}
+
+				if(hints) {
+					if(item->channels) {
+						hints->bitspersample = item->bitsperpixel/item->channels;
+						if(hints->bitspersample > 8) hints->flags |= fastimage_hint_high_depth;
+					}
+					if(heif->alpha) hints->flags |= fastimage_hint_alpha;
+				}
+
+				free(atom_data);
+				break;
+			}
+
+			// Very dirty implementation (I don't know what should be correct)
+			for(i = 0; i+20 < ftyp_size; i++) {
+				// ispe 20 (12 - wid(be), 16 - hei(be))
+				if(!memcmp(atom_data+i, "\x00\x00\x00\x14ispe", 8)) {
+					image->width = (size_t)(atom_data[i+12])*16777216+(size_t)(atom_data[i+13])*65536+(size_t)(atom_data[i+14])*256+(size_t)(atom_data[i+15]);
+					image->height = (size_t)(atom_data[i+16])*16777216+(size_t)(atom_data[i+17])*65536+(size_t)(atom_data[i+18])*256+(size_t)(atom_data[i+19]);
+				} else if(level == fastimage_level_full && (!memcmp(atom_data+i, "\x00\x00\x00\x10pixi", 8) || !memcmp(atom_data+i, "\x00\x00\x00\x0epixi", 8))) {
+					size_t j;
+
+					image->channels += atom_data[i+12];
+
+					if(atom_data[i+12] > atom_data[i+3]-13) {
+						free(atom_data);
+						goto ISOBMFF_ERROR;
+					}
+
+					for(j = 0; j < atom_data[i+12]; j++)
+						image->bitsperpixel += atom_data[i+13];
+
+					if(hints && atom_data[i+12] && atom_data[i+13] > hints->bitspersample) {
+						hints->bitspersample = atom_data[i+13];
+						if(atom_data[i+13] > 8) hints->flags |= fastimage_hint_high_depth;
+					}
+				} else if(hints && !memcmp(atom_data+i+4, "auxC", 4)) {
+					// Alpha auxiliary image of AVIF or HEIC
+					if(fastimageHeifAlphaUrn(atom_data+i+12, ftyp_size-i-12))
+						hints->flags |= fastimage_hint_alpha;
+				}
+			}
+			
+			free(atom_data);
+			break;
+		} else if(!reader->seek(reader->context, (int64_t)(box_size-header), true)) goto ISOBMFF_ERROR;
+
+		offset += box_size-header;
+	}
+
+	return;
+
+ISOBMFF_ERROR:
+	memset(image, 0, sizeof(fastimage_image_t));
+	image->format = fastimage_error;
+}
+
+static void fastimageReadQoi(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+{
+	qoi_header_t head;
+	
+	(void)sign; // unused
+	
+	if(reader->read(reader->context, sizeof(qoi_header_t), &head) != sizeof(qoi_header_t)) goto QOI_ERROR;
+
+	if(head.channels < 3 || head.channels > 4) goto QOI_ERROR;
+	if(head.colorspace > 1) goto QOI_ERROR;
+	
+	image->width = ((head.width&0xff000000)>>24)+((head.width&0xff0000)>>16)+((head.width&0xff00)<<16)+((head.width&0xff)<<24);
+	image->height = ((head.height&0xff000000)>>24)+((head.height&0xff0000)>>16)+((head.height&0xff00)<<16)+((head.height&0xff)<<24);
+	image->channels = head.channels;
+	image->bitsperpixel = head.channels*8;
+	
+	return;
+QOI_ERROR:
+	memset(image, 0, sizeof(fastimage_image_t));
+	image->format = fastimage_error;
+}
+
+static void fastimageReadIco(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image)
+{
+	unsigned char header[14];
+	bmp_infoheader_min_t binfoh;
+	
+	memcpy(header, sign, 4);
+	
+	if(reader->read(reader->context, 10, header+4) != 10) goto ICO_ERROR;
+
+	// Cur signature is also truecolor TGA without color map, which has zeroes here
+	if(image->format == fastimage_cur && !header[4] && !header[5]) {
+		image->format = fastimage_tga;
+		fastimageReadTgaHeader(reader, header, 14, image);
+
+		return;
+	}
 	
 	if((!header[4] && !header[5]) || header[9]) goto ICO_ERROR; // Number of images should be greater than 0, Reserved should be 0
 	
@@ -573,204 +1128,5309 @@ static void fastimageReadIco(const fastimage_reader_t *reader, unsigned char *si
 		if(binfoh.biBitCount <= 8) image->palette = binfoh.biBitCount;
 		else image->palette = 0;
 	}
-	
-	return;
-	
-ICO_ERROR:
-	memset(image, 0, sizeof(fastimage_image_t));
-	image->format = fastimage_error;
+	
+	return;
+	
+ICO_ERROR:
+	memset(image, 0, sizeof(fastimage_image_t));
+	image->format = fastimage_error;
+}
+
+// GPU textures, everything is in fixed size header
+
+#define DDS_HEADER_SIZE 124
+#define DDS_DX10_HEADER_SIZE 20
+#define KTX_IDENTIFIER_SIZE 12
+#define KTX_HEADER_SIZE 64
+#define KTX2_HEADER_SIZE 80 // Without level index
+#define KTX2_DFD_PEEK_SIZE 44 // Total size, basic descriptor block and its first sample
+#define PVR_HEADER_SIZE 52
+#define ASTC_HEADER_SIZE 16
+
+#define DDSD_DEPTH 0x800000
+#define DDPF_FOURCC 0x4
+#define DDSCAPS2_CUBEMAP 0x200
+#define DDSCAPS2_CUBEMAP_FACES 0xFC00
+#define DDSCAPS2_VOLUME 0x200000
+#define DDS_RESOURCE_MISC_TEXTURECUBE 0x4
+#define DDS_DIMENSION_TEXTURE3D 4
+
+#define KHR_DF_MODEL_ETC1S 163
+#define KHR_DF_MODEL_UASTC 166
+
+// Width, height, bits and channels of block of each fastimage_texture_encoding
+static const unsigned char fastimage_texture_blocks[][4] = {
+	{0, 0, 0, 0}, {1, 1, 0, 0}, // Unknown, uncompressed
+	{4, 4, 64, 4}, {4, 4, 128, 4}, {4, 4, 128, 4}, {4, 4, 64, 1}, {4, 4, 128, 2}, {4, 4, 128, 3}, {4, 4, 128, 4}, // BC1-BC7
+	{4, 4, 64, 3}, {4, 4, 64, 3}, {4, 4, 64, 4}, {4, 4, 128, 4}, {4, 4, 64, 1}, {4, 4, 128, 2}, // ETC1, ETC2, EAC
+	{4, 4, 128, 4}, {8, 4, 64, 4}, {4, 4, 64, 4}, // ASTC (size of block varies), PVRTC
+	{4, 4, 64, 3}, {4, 4, 128, 4} // ETC1S, UASTC
+};
+
+// 2D blocks of ASTC in order of GL, Vulkan and PVR formats, 3D blocks follow
+static const unsigned char fastimage_astc_blocks[][3] = {
+	{4, 4, 1}, {5, 4, 1}, {5, 5, 1}, {6, 5, 1}, {6, 6, 1}, {8, 5, 1}, {8, 6, 1},
+	{8, 8, 1}, {10, 5, 1}, {10, 6, 1}, {10, 8, 1}, {10, 10, 1}, {12, 10, 1}, {12, 12, 1},
+	{3, 3, 3}, {4, 3, 3}, {4, 4, 3}, {4, 4, 4}, {5, 4, 4}, {5, 5, 4}, {5, 5, 5}, {6, 5, 5}, {6, 6, 5}, {6, 6, 6}
+};
+
+#define ASTC_BLOCKS_2D 14
+
+typedef struct {
+	uint16_t bits; // 0 for compressed, bits of block are in fastimage_texture_blocks
+	uint8_t channels; // 0 - default of encoding
+	uint8_t encoding;
+} fastimage_texture_format_t;
+
+#define TEXTURE_U(bits, channels) {bits, channels, fastimage_texture_uncompressed}
+#define TEXTURE_C(encoding, channels) {0, channels, encoding}
+#define TEXTURE_NONE {0, 0, fastimage_texture_unknown}
+
+// Indexed by DXGI_FORMAT
+static const fastimage_texture_format_t fastimage_dxgi_formats[] = {
+	TEXTURE_NONE,
+	TEXTURE_U(128, 4), TEXTURE_U(128, 4), TEXTURE_U(128, 4), TEXTURE_U(128, 4), // 1, R32G32B32A32
+	TEXTURE_U(96, 3), TEXTURE_U(96, 3), TEXTURE_U(96, 3), TEXTURE_U(96, 3), // 5, R32G32B32
+	TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), // 9, R16G16B16A16
+	TEXTURE_U(64, 2), TEXTURE_U(64, 2), TEXTURE_U(64, 2), TEXTURE_U(64, 2), // 15, R32G32
+	TEXTURE_U(64, 2), TEXTURE_U(64, 2), TEXTURE_U(64, 1), TEXTURE_U(64, 1), // 19, R32G8X24, D32_FLOAT_S8X24
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 3), // 23, R10G10B10A2, R11G11B10_FLOAT
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), // 27, R8G8B8A8
+	TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), // 33, R16G16
+	TEXTURE_U(32, 1), TEXTURE_U(32, 1), TEXTURE_U(32, 1), TEXTURE_U(32, 1), TEXTURE_U(32, 1), // 39, R32, D32_FLOAT
+	TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 1), TEXTURE_U(32, 1), // 44, R24G8, D24_UNORM_S8_UINT
+	TEXTURE_U(16, 2), TEXTURE_U(16, 2), TEXTURE_U(16, 2), TEXTURE_U(16, 2), TEXTURE_U(16, 2), // 48, R8G8
+	TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), // 53, R16, D16_UNORM
+	TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), // 60, R8, A8_UNORM
+	TEXTURE_U(1, 1), TEXTURE_U(32, 3), TEXTURE_U(16, 3), TEXTURE_U(16, 3), // 66, R1_UNORM, R9G9B9E5_SHAREDEXP, R8G8_B8G8, G8R8_G8B8
+	TEXTURE_C(fastimage_texture_bc1, 0), TEXTURE_C(fastimage_texture_bc1, 0), TEXTURE_C(fastimage_texture_bc1, 0), // 70
+	TEXTURE_C(fastimage_texture_bc2, 0), TEXTURE_C(fastimage_texture_bc2, 0), TEXTURE_C(fastimage_texture_bc2, 0),
+	TEXTURE_C(fastimage_texture_bc3, 0), TEXTURE_C(fastimage_texture_bc3, 0), TEXTURE_C(fastimage_texture_bc3, 0),
+	TEXTURE_C(fastimage_texture_bc4, 0), TEXTURE_C(fastimage_texture_bc4, 0), TEXTURE_C(fastimage_texture_bc4, 0),
+	TEXTURE_C(fastimage_texture_bc5, 0), TEXTURE_C(fastimage_texture_bc5, 0), TEXTURE_C(fastimage_texture_bc5, 0),
+	TEXTURE_U(16, 3), TEXTURE_U(16, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 3), TEXTURE_U(32, 4), // 85, B5G6R5, B5G5R5A1, B8G8R8A8, B8G8R8X8, R10G10B10_XR_BIAS_A2
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 3), TEXTURE_U(32, 3), // 90, B8G8R8A8, B8G8R8X8
+	TEXTURE_C(fastimage_texture_bc6h, 0), TEXTURE_C(fastimage_texture_bc6h, 0), TEXTURE_C(fastimage_texture_bc6h, 0), // 94
+	TEXTURE_C(fastimage_texture_bc7, 0), TEXTURE_C(fastimage_texture_bc7, 0), TEXTURE_C(fastimage_texture_bc7, 0),
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(64, 4), TEXTURE_U(12, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), // 100, AYUV, Y410, Y416, NV12, P010, P016
+	TEXTURE_U(12, 3), TEXTURE_U(16, 3), TEXTURE_U(32, 3), TEXTURE_U(32, 3), TEXTURE_U(12, 3), // 106, 420_OPAQUE, YUY2, Y210, Y216, NV11
+	TEXTURE_U(8, 2), TEXTURE_U(8, 2), TEXTURE_U(8, 1), TEXTURE_U(16, 2), TEXTURE_U(16, 4) // 111, AI44, IA44, P8, A8P8, B4G4R4A4
+};
+
+// Indexed by VkFormat, ASTC (157-184) is handled separately
+static const fastimage_texture_format_t fastimage_vk_formats[] = {
+	TEXTURE_NONE,
+	TEXTURE_U(8, 2), TEXTURE_U(16, 4), TEXTURE_U(16, 4), TEXTURE_U(16, 3), TEXTURE_U(16, 3), // 1, R4G4, R4G4B4A4, B4G4R4A4, R5G6B5, B5G6R5
+	TEXTURE_U(16, 4), TEXTURE_U(16, 4), TEXTURE_U(16, 4), // 6, R5G5B5A1, B5G5R5A1, A1R5G5B5
+	TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), TEXTURE_U(8, 1), // 9, R8
+	TEXTURE_U(16, 2), TEXTURE_U(16, 2), TEXTURE_U(16, 2), TEXTURE_U(16, 2), TEXTURE_U(16, 2), TEXTURE_U(16, 2), TEXTURE_U(16, 2), // 16, R8G8
+	TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), // 23, R8G8B8
+	TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), TEXTURE_U(24, 3), // 30, B8G8R8
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), // 37, R8G8B8A8
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), // 44, B8G8R8A8
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), // 51, A8B8G8R8
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), // 58, A2R10G10B10
+	TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), TEXTURE_U(32, 4), // 64, A2B10G10R10
+	TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), TEXTURE_U(16, 1), // 70, R16
+	TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), TEXTURE_U(32, 2), // 77, R16G16
+	TEXTURE_U(48, 3), TEXTURE_U(48, 3), TEXTURE_U(48, 3), TEXTURE_U(48, 3), TEXTURE_U(48, 3), TEXTURE_U(48, 3), TEXTURE_U(48, 3), // 84, R16G16B16
+	TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), TEXTURE_U(64, 4), // 91, R16G16B16A16
+	TEXTURE_U(32, 1), TEXTURE_U(32, 1), TEXTURE_U(32, 1), TEXTURE_U(64, 2), TEXTURE_U(64, 2), TEXTURE_U(64, 2), // 98, R32, R32G32
+	TEXTURE_U(96, 3), TEXTURE_U(96, 3), TEXTURE_U(96, 3), TEXTURE_U(128, 4), TEXTURE_U(128, 4), TEXTURE_U(128, 4), // 104, R32G32B32, R32G32B32A32
+	TEXTURE_U(64, 1), TEXTURE_U(64, 1), TEXTURE_U(64, 1), TEXTURE_U(128, 2), TEXTURE_U(128, 2), TEXTURE_U(128, 2), // 110, R64, R64G64
+	TEXTURE_U(192, 3), TEXTURE_U(192, 3), TEXTURE_U(192, 3), TEXTURE_U(256, 4), TEXTURE_U(256, 4), TEXTURE_U(256, 4), // 116, R64G64B64, R64G64B64A64
+	TEXTURE_U(32, 3), TEXTURE_U(32, 3), TEXTURE_U(16, 1), TEXTURE_U(32, 1), TEXTURE_U(32, 1), TEXTURE_U(8, 1), // 122, B10G11R11, E5B9G9R9, D16, X8_D24, D32, S8
+	TEXTURE_U(24, 2), TEXTURE_U(32, 2), TEXTURE_U(40, 2), // 128, D16_S8, D24_S8, D32_S8
+	TEXTURE_C(fastimage_texture_bc1, 3), TEXTURE_C(fastimage_texture_bc1, 3), TEXTURE_C(fastimage_texture_bc1, 4), TEXTURE_C(fastimage_texture_bc1, 4), // 131
+	TEXTURE_C(fastimage_texture_bc2, 0), TEXTURE_C(fastimage_texture_bc2, 0), TEXTURE_C(fastimage_texture_bc3, 0), TEXTURE_C(fastimage_texture_bc3, 0), // 135
+	TEXTURE_C(fastimage_texture_bc4, 0), TEXTURE_C(fastimage_texture_bc4, 0), TEXTURE_C(fastimage_texture_bc5, 0), TEXTURE_C(fastimage_texture_bc5, 0), // 139
+	TEXTURE_C(fastimage_texture_bc6h, 0), TEXTURE_C(fastimage_texture_bc6h, 0), TEXTURE_C(fastimage_texture_bc7, 0), TEXTURE_C(fastimage_texture_bc7, 0), // 143
+	TEXTURE_C(fastimage_texture_etc2_rgb, 0), TEXTURE_C(fastimage_texture_etc2_rgb, 0), // 147
+	TEXTURE_C(fastimage_texture_etc2_rgba1, 0), TEXTURE_C(fastimage_texture_etc2_rgba1, 0),
+	TEXTURE_C(fastimage_texture_etc2_rgba, 0), TEXTURE_C(fastimage_texture_etc2_rgba, 0),
+	TEXTURE_C(fastimage_texture_eac_r11, 0), TEXTURE_C(fastimage_texture_eac_r11, 0),
+	TEXTURE_C(fastimage_texture_eac_rg11, 0), TEXTURE_C(fastimage_texture_eac_rg11, 0)
+};
+
+#define VK_FORMAT_ASTC_4x4_UNORM_BLOCK 157
+#define VK_FORMAT_ASTC_12x12_SRGB_BLOCK 184
+#define VK_FORMAT_PVRTC1_2BPP_UNORM_BLOCK_IMG 1000054000
+#define VK_FORMAT_PVRTC2_4BPP_SRGB_BLOCK_IMG 1000054007
+#define VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK 1000066000
+#define VK_FORMAT_ASTC_12x12_SFLOAT_BLOCK 1000066013
+#define VK_FORMAT_A4R4G4B4_UNORM_PACK16 1000340000
+#define VK_FORMAT_A4B4G4R4_UNORM_PACK16 1000340001
+
+// Indexed by PVR v3 pixel format with zero high 32 bits, ASTC (27-50) is handled separately
+static const fastimage_texture_format_t fastimage_pvr_formats[] = {
+	TEXTURE_C(fastimage_texture_pvrtc_2bpp, 3), TEXTURE_C(fastimage_texture_pvrtc_2bpp, 4), // PVRTC RGB and RGBA
+	TEXTURE_C(fastimage_texture_pvrtc_4bpp, 3), TEXTURE_C(fastimage_texture_pvrtc_4bpp, 4),
+	TEXTURE_C(fastimage_texture_pvrtc_2bpp, 4), TEXTURE_C(fastimage_texture_pvrtc_4bpp, 4), // PVRTC-II
+	TEXTURE_C(fastimage_texture_etc1, 0), TEXTURE_C(fastimage_texture_bc1, 0), // 6, ETC1, DXT1
+	TEXTURE_C(fastimage_texture_bc2, 0), TEXTURE_C(fastimage_texture_bc2, 0), TEXTURE_C(fastimage_texture_bc3, 0), TEXTURE_C(fastimage_texture_bc3, 0), // 8, DXT2-DXT5
+	TEXTURE_C(fastimage_texture_bc4, 0), TEXTURE_C(fastimage_texture_bc5, 0), TEXTURE_C(fastimage_texture_bc6h, 0), TEXTURE_C(fastimage_texture_bc7, 0), // 12
+	TEXTURE_U(16, 3), TEXTURE_U(16, 3), TEXTURE_U(1, 1), TEXTURE_U(32, 3), TEXTURE_U(16, 3), TEXTURE_U(16, 3), // 16, UYVY, YUY2, BW1bpp, SharedExponent, RGBG, GRGB
+	TEXTURE_C(fastimage_texture_etc2_rgb, 0), TEXTURE_C(fastimage_texture_etc2_rgba, 0), TEXTURE_C(fastimage_texture_etc2_rgba1, 0), // 22
+	TEXTURE_C(fastimage_texture_eac_r11, 0), TEXTURE_C(fastimage_texture_eac_rg11, 0)
+};
+
+#define PVR_FORMAT_ASTC_4x4 27
+#define PVR_FORMAT_ASTC_6x6x6 50
+
+static uint32_t fastimageTextureU32(const unsigned char *p, bool swap)
+{
+	return swap?fastimageBe32(p):fastimageLe32(p);
+}
+
+static void fastimageTextureSetEncoding(fastimage_texture_t *texture, int encoding, unsigned int channels)
+{
+	texture->encoding = encoding;
+	texture->block_width = fastimage_texture_blocks[encoding][0];
+	texture->block_height = fastimage_texture_blocks[encoding][1];
+	texture->block_depth = texture->block_width?1:0;
+	texture->block_bits = fastimage_texture_blocks[encoding][2];
+	texture->channels = channels?channels:fastimage_texture_blocks[encoding][3];
+}
+
+static void fastimageTextureSetFormat(fastimage_texture_t *texture, const fastimage_texture_format_t *format)
+{
+	fastimageTextureSetEncoding(texture, format->encoding, format->channels);
+
+	if(format->encoding == fastimage_texture_uncompressed)
+		texture->block_bits = format->bits;
+}
+
+static void fastimageTextureSetAstc(fastimage_texture_t *texture, unsigned int block)
+{
+	fastimageTextureSetEncoding(texture, fastimage_texture_astc, 0);
+
+	texture->block_width = fastimage_astc_blocks[block][0];
+	texture->block_height = fastimage_astc_blocks[block][1];
+	texture->block_depth = fastimage_astc_blocks[block][2];
+}
+
+static int fastimageKtxVersion(const unsigned char *identifier)
+{
+	if(!memcmp(identifier, "\xABKTX 11\xBB\r\n\x1A\n", KTX_IDENTIFIER_SIZE)) return fastimage_ktx;
+	if(!memcmp(identifier, "\xABKTX 20\xBB\r\n\x1A\n", KTX_IDENTIFIER_SIZE)) return fastimage_ktx2;
+
+	return fastimage_unknown;
+}
+
+static bool fastimageReadDds(const fastimage_reader_t *reader, fastimage_texture_t *texture)
+{
+	unsigned char header[DDS_HEADER_SIZE], dx10[DDS_DX10_HEADER_SIZE];
+	uint32_t flags, pixel_flags, fourcc, caps2, masks, depth;
+	int i;
+
+	if(reader->read(reader->context, DDS_HEADER_SIZE, header) != DDS_HEADER_SIZE) return false;
+	if(fastimageLe32(header) != DDS_HEADER_SIZE) return false;
+
+	flags = fastimageLe32(header+4);
+	texture->height = fastimageLe32(header+8);
+	texture->width = fastimageLe32(header+12);
+	depth = fastimageLe32(header+20);
+	if(fastimageLe32(header+24)) texture->levels = fastimageLe32(header+24); // Some writers don't set DDSD_MIPMAPCOUNT
+	pixel_flags = fastimageLe32(header+76);
+	fourcc = fastimageLe32(header+80);
+	caps2 = fastimageLe32(header+108);
+
+	if(((flags&DDSD_DEPTH) || (caps2&DDSCAPS2_VOLUME)) && depth) texture->depth = depth;
+
+	if(caps2&DDSCAPS2_CUBEMAP) { // Faces may be missing in D3D9 files
+		texture->faces = 0;
+		for(i = 0; i < 6; i++)
+			if(caps2&(0x400u<<i)) texture->faces++;
+		if(!texture->faces) texture->faces = 6;
+	}
+
+	if(!(pixel_flags&DDPF_FOURCC)) {
+		// Channels are the masks that are set (RGB, luminance, alpha, bump map)
+		texture->channels = 0;
+		for(i = 0; i < 4; i++) {
+			masks = fastimageLe32(header+88+i*4);
+			if(masks) texture->channels++;
+		}
+
+		fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, texture->channels?texture->channels:1);
+		texture->block_bits = fastimageLe32(header+84);
+	} else if(fourcc == FASTIMAGE_SIGN('D', 'X', '1', '0')) {
+		if(reader->read(reader->context, DDS_DX10_HEADER_SIZE, dx10) != DDS_DX10_HEADER_SIZE) return false;
+
+		texture->native_format = fastimageLe32(dx10);
+		texture->depth = (fastimageLe32(dx10+4) == DDS_DIMENSION_TEXTURE3D && depth)?depth:1;
+		texture->faces = (fastimageLe32(dx10+8)&DDS_RESOURCE_MISC_TEXTURECUBE)?6:1;
+		if(fastimageLe32(dx10+12)) texture->layers = fastimageLe32(dx10+12);
+
+		if(texture->native_format < sizeof(fastimage_dxgi_formats)/sizeof(fastimage_texture_format_t))
+			fastimageTextureSetFormat(texture, &fastimage_dxgi_formats[texture->native_format]);
+	} else {
+		texture->native_format = fourcc;
+
+		switch(fourcc) {
+			case FASTIMAGE_SIGN('D', 'X', 'T', '1'):
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc1, 0);
+				break;
+			case FASTIMAGE_SIGN('D', 'X', 'T', '2'):
+			case FASTIMAGE_SIGN('D', 'X', 'T', '3'):
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc2, 0);
+				break;
+			case FASTIMAGE_SIGN('D', 'X', 'T', '4'):
+			case FASTIMAGE_SIGN('D', 'X', 'T', '5'):
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc3, 0);
+				break;
+			case FASTIMAGE_SIGN('A', 'T', 'I', '1'):
+			case FASTIMAGE_SIGN('B', 'C', '4', 'U'):
+			case FASTIMAGE_SIGN('B', 'C', '4', 'S'):
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc4, 0);
+				break;
+			case FASTIMAGE_SIGN('A', 'T', 'I', '2'):
+			case FASTIMAGE_SIGN('B', 'C', '5', 'U'):
+			case FASTIMAGE_SIGN('B', 'C', '5', 'S'):
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc5, 0);
+				break;
+			case FASTIMAGE_SIGN('R', 'G', 'B', 'G'):
+			case FASTIMAGE_SIGN('G', 'R', 'G', 'B'):
+			case FASTIMAGE_SIGN('U', 'Y', 'V', 'Y'):
+			case FASTIMAGE_SIGN('Y', 'U', 'Y', '2'):
+				fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 3);
+				texture->block_bits = 16;
+				break;
+			// D3DFORMAT numbers of float and 16 bit formats
+			case 36: case 110: case 113: // A16B16G16R16, Q16W16V16U16, A16B16G16R16F
+				fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 4);
+				texture->block_bits = 64;
+				break;
+			case 111: // R16F
+				fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 1);
+				texture->block_bits = 16;
+				break;
+			case 112: // G16R16F
+				fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 2);
+				texture->block_bits = 32;
+				break;
+			case 114: // R32F
+				fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 1);
+				texture->block_bits = 32;
+				break;
+			case 115: // G32R32F
+				fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 2);
+				texture->block_bits = 64;
+				break;
+			case 116: // A32B32G32R32F
+				fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 4);
+				texture->block_bits = 128;
+				break;
+		}
+	}
+
+	return texture->width && texture->height;
+}
+
+static void fastimageTextureSetGl(fastimage_texture_t *texture, uint32_t type, uint32_t format, uint32_t internal_format)
+{
+	unsigned int channels = 0, bits = 0;
+
+	// Compressed formats have zero type
+	if(!type) {
+		switch(internal_format) {
+			case 0x83F0: case 0x8C4C: // COMPRESSED_RGB_S3TC_DXT1, COMPRESSED_SRGB_S3TC_DXT1
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc1, 3);
+				break;
+			case 0x83F1: case 0x8C4D: // COMPRESSED_RGBA_S3TC_DXT1, COMPRESSED_SRGB_ALPHA_S3TC_DXT1
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc1, 4);
+				break;
+			case 0x83F2: case 0x8C4E: // DXT3
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc2, 0);
+				break;
+			case 0x83F3: case 0x8C4F: // DXT5
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc3, 0);
+				break;
+			case 0x8DBB: case 0x8DBC: // RGTC1
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc4, 0);
+				break;
+			case 0x8DBD: case 0x8DBE: // RGTC2
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc5, 0);
+				break;
+			case 0x8E8C: case 0x8E8D: // BPTC_UNORM
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc7, 0);
+				break;
+			case 0x8E8E: case 0x8E8F: // BPTC_FLOAT
+				fastimageTextureSetEncoding(texture, fastimage_texture_bc6h, 0);
+				break;
+			case 0x8D64: // ETC1_RGB8_OES
+				fastimageTextureSetEncoding(texture, fastimage_texture_etc1, 0);
+				break;
+			case 0x9270: case 0x9271:
+				fastimageTextureSetEncoding(texture, fastimage_texture_eac_r11, 0);
+				break;
+			case 0x9272: case 0x9273:
+				fastimageTextureSetEncoding(texture, fastimage_texture_eac_rg11, 0);
+				break;
+			case 0x9274: case 0x9275:
+				fastimageTextureSetEncoding(texture, fastimage_texture_etc2_rgb, 0);
+				break;
+			case 0x9276: case 0x9277:
+				fastimageTextureSetEncoding(texture, fastimage_texture_etc2_rgba1, 0);
+				break;
+			case 0x9278: case 0x9279:
+				fastimageTextureSetEncoding(texture, fastimage_texture_etc2_rgba, 0);
+				break;
+			case 0x8C00: // COMPRESSED_RGB_PVRTC_4BPPV1
+				fastimageTextureSetEncoding(texture, fastimage_texture_pvrtc_4bpp, 3);
+				break;
+			case 0x8C01:
+				fastimageTextureSetEncoding(texture, fastimage_texture_pvrtc_2bpp, 3);
+				break;
+			case 0x8C02:
+				fastimageTextureSetEncoding(texture, fastimage_texture_pvrtc_4bpp, 4);
+				break;
+			case 0x8C03:
+				fastimageTextureSetEncoding(texture, fastimage_texture_pvrtc_2bpp, 4);
+				break;
+			default:
+				// RGBA and SRGB8_ALPHA8 ASTC, 3D blocks of OES_texture_compression_astc
+				if(internal_format >= 0x93B0 && internal_format <= 0x93BD)
+					fastimageTextureSetAstc(texture, internal_format-0x93B0);
+				else if(internal_format >= 0x93D0 && internal_format <= 0x93DD)
+					fastimageTextureSetAstc(texture, internal_format-0x93D0);
+				else if(internal_format >= 0x93C0 && internal_format <= 0x93C9)
+					fastimageTextureSetAstc(texture, ASTC_BLOCKS_2D+internal_format-0x93C0);
+				else if(internal_format >= 0x93E0 && internal_format <= 0x93E9)
+					fastimageTextureSetAstc(texture, ASTC_BLOCKS_2D+internal_format-0x93E0);
+		}
+
+		return;
+	}
+
+	switch(format) {
+		case 0x1902: case 0x1903: case 0x1906: case 0x1909: case 0x8D94: // DEPTH_COMPONENT, RED, ALPHA, LUMINANCE, RED_INTEGER
+			channels = 1;
+			break;
+		case 0x190A: case 0x8227: case 0x8228: case 0x84F9: // LUMINANCE_ALPHA, RG, RG_INTEGER, DEPTH_STENCIL
+			channels = 2;
+			break;
+		case 0x1907: case 0x80E0: case 0x8D98: case 0x8D9A: // RGB, BGR, RGB_INTEGER, BGR_INTEGER
+			channels = 3;
+			break;
+		case 0x1908: case 0x80E1: case 0x8D99: case 0x8D9B: // RGBA, BGRA, RGBA_INTEGER, BGRA_INTEGER
+			channels = 4;
+			break;
+	}
+
+	switch(type) {
+		case 0x1400: case 0x1401: // BYTE, UNSIGNED_BYTE
+			bits = 8*channels;
+			break;
+		case 0x1402: case 0x1403: case 0x140B: // SHORT, UNSIGNED_SHORT, HALF_FLOAT
+			bits = 16*channels;
+			break;
+		case 0x1404: case 0x1405: case 0x1406: // INT, UNSIGNED_INT, FLOAT
+			bits = 32*channels;
+			break;
+		// Packed types hold the whole pixel
+		case 0x8032: case 0x8362: // UNSIGNED_BYTE_3_3_2, UNSIGNED_BYTE_2_3_3_REV
+			bits = 8;
+			break;
+		case 0x8033: case 0x8034: case 0x8363: case 0x8364: case 0x8365: case 0x8366: // 4_4_4_4, 5_5_5_1, 5_6_5 and their REV
+			bits = 16;
+			break;
+		case 0x8035: case 0x8036: case 0x8367: case 0x8368: case 0x8C3B: case 0x8C3E: case 0x84FA: // 8_8_8_8, 10_10_10_2, 10F_11F_11F, 5_9_9_9, 24_8
+			bits = 32;
+			break;
+		case 0x8DAD: // FLOAT_32_UNSIGNED_INT_24_8_REV
+			bits = 64;
+			break;
+	}
+
+	if(channels && bits) {
+		fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, channels);
+		texture->block_bits = bits;
+	}
+}
+
+static bool fastimageReadKtx(const fastimage_reader_t *reader, fastimage_texture_t *texture)
+{
+	unsigned char header[KTX_HEADER_SIZE];
+	uint32_t value;
+	bool swap;
+
+	if(reader->read(reader->context, KTX_HEADER_SIZE-KTX_IDENTIFIER_SIZE, header+KTX_IDENTIFIER_SIZE) != KTX_HEADER_SIZE-KTX_IDENTIFIER_SIZE) return false;
+
+	// Endianness field is written in native order of writer
+	value = fastimageLe32(header+12);
+	if(value != 0x04030201 && value != 0x01020304) return false;
+	swap = (value == 0x01020304);
+
+	texture->native_format = fastimageTextureU32(header+28, swap);
+	texture->width = fastimageTextureU32(header+36, swap);
+	texture->height = fastimageTextureU32(header+40, swap);
+	if(!texture->height) texture->height = 1; // 1D
+	if((value = fastimageTextureU32(header+44, swap)) != 0) texture->depth = value;
+	if((value = fastimageTextureU32(header+48, swap)) != 0) texture->layers = value;
+	if((value = fastimageTextureU32(header+52, swap)) != 0) texture->faces = value;
+	if((value = fastimageTextureU32(header+56, swap)) != 0) texture->levels = value; // 0 asks loader to generate mipmaps
+
+	fastimageTextureSetGl(texture, fastimageTextureU32(header+16, swap), fastimageTextureU32(header+24, swap), (uint32_t)texture->native_format);
+
+	return texture->width != 0;
+}
+
+static bool fastimageReadKtx2(const fastimage_reader_t *reader, fastimage_texture_t *texture)
+{
+	unsigned char header[KTX2_HEADER_SIZE], dfd[KTX2_DFD_PEEK_SIZE];
+	uint32_t format, value, dfd_offset;
+	unsigned int samples;
+
+	if(reader->read(reader->context, KTX2_HEADER_SIZE-KTX_IDENTIFIER_SIZE, header+KTX_IDENTIFIER_SIZE) != KTX2_HEADER_SIZE-KTX_IDENTIFIER_SIZE) return false;
+
+	format = fastimageLe32(header+12);
+	texture->native_format = format;
+	texture->width = fastimageLe32(header+20);
+	texture->height = fastimageLe32(header+24);
+	if(!texture->height) texture->height = 1;
+	if((value = fastimageLe32(header+28)) != 0) texture->depth = value;
+	if((value = fastimageLe32(header+32)) != 0) texture->layers = value;
+	if((value = fastimageLe32(header+36)) != 0) texture->faces = value;
+	if((value = fastimageLe32(header+40)) != 0) texture->levels = value;
+	texture->supercompression = fastimageLe32(header+44);
+
+	if(!texture->width) return false;
+
+	if(format < sizeof(fastimage_vk_formats)/sizeof(fastimage_texture_format_t))
+		fastimageTextureSetFormat(texture, &fastimage_vk_formats[format]);
+	else if(format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK)
+		fastimageTextureSetAstc(texture, (format-VK_FORMAT_ASTC_4x4_UNORM_BLOCK)/2);
+	else if(format >= VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK && format <= VK_FORMAT_ASTC_12x12_SFLOAT_BLOCK)
+		fastimageTextureSetAstc(texture, format-VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK);
+	else if(format >= VK_FORMAT_PVRTC1_2BPP_UNORM_BLOCK_IMG && format <= VK_FORMAT_PVRTC2_4BPP_SRGB_BLOCK_IMG)
+		fastimageTextureSetEncoding(texture, (format%2)?fastimage_texture_pvrtc_4bpp:fastimage_texture_pvrtc_2bpp, 0);
+	else if(format == VK_FORMAT_A4R4G4B4_UNORM_PACK16 || format == VK_FORMAT_A4B4G4R4_UNORM_PACK16) {
+		fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 4);
+		texture->block_bits = 16;
+	}
+
+	// Basis Universal has undefined format, its model is in data format descriptor
+	dfd_offset = fastimageLe32(header+48);
+	if(format || fastimageLe32(header+52) < KTX2_DFD_PEEK_SIZE) return true;
+
+	if(!reader->seek(reader->context, dfd_offset, false)) return true;
+	if(reader->read(reader->context, KTX2_DFD_PEEK_SIZE, dfd) != KTX2_DFD_PEEK_SIZE) return true;
+
+	samples = (fastimageLe16(dfd+10) >= 24)?(fastimageLe16(dfd+10)-24)/16:0;
+
+	if(dfd[12] == KHR_DF_MODEL_ETC1S)
+		fastimageTextureSetEncoding(texture, fastimage_texture_etc1s, (samples > 1)?4:3); // Second slice is alpha
+	else if(dfd[12] == KHR_DF_MODEL_UASTC) {
+		static const unsigned char uastc_channels[16] = {3, 0, 0, 4, 1, 2, 2}; // RGB, -, -, RGBA, RRR, RRRG, RG
+
+		fastimageTextureSetEncoding(texture, fastimage_texture_uastc, uastc_channels[dfd[31]&0xF]);
+	}
+
+	return true;
+}
+
+static bool fastimageReadPvr(const fastimage_reader_t *reader, unsigned char *sign, fastimage_texture_t *texture)
+{
+	unsigned char header[PVR_HEADER_SIZE];
+	uint32_t low, high, value;
+	unsigned int i;
+	bool swap;
+
+	if(reader->read(reader->context, PVR_HEADER_SIZE-4, header+4) != PVR_HEADER_SIZE-4) return false;
+
+	// Version is 0x03525650 in byte order of writer
+	swap = (sign[0] == 3);
+
+	low = fastimageTextureU32(header+(swap?12:8), swap);
+	high = fastimageTextureU32(header+(swap?8:12), swap);
+	texture->native_format = ((uint64_t)high<<32)|low;
+	texture->height = fastimageTextureU32(header+24, swap);
+	texture->width = fastimageTextureU32(header+28, swap);
+	if((value = fastimageTextureU32(header+32, swap)) != 0) texture->depth = value;
+	if((value = fastimageTextureU32(header+36, swap)) != 0) texture->layers = value;
+	if((value = fastimageTextureU32(header+40, swap)) != 0) texture->faces = value;
+	if((value = fastimageTextureU32(header+44, swap)) != 0) texture->levels = value;
+
+	if(high) {
+		// Names of channels ('r', 'g', 'b', 'a'...) in low bytes, their bits in high bytes
+		fastimageTextureSetEncoding(texture, fastimage_texture_uncompressed, 0);
+
+		for(i = 0; i < 4; i++) {
+			if((low>>(i*8))&0xFF) texture->channels++;
+			texture->block_bits += (high>>(i*8))&0xFF;
+		}
+	} else if(low < sizeof(fastimage_pvr_formats)/sizeof(fastimage_texture_format_t))
+		fastimageTextureSetFormat(texture, &fastimage_pvr_formats[low]);
+	else if(low >= PVR_FORMAT_ASTC_4x4 && low <= PVR_FORMAT_ASTC_6x6x6)
+		fastimageTextureSetAstc(texture, low-PVR_FORMAT_ASTC_4x4);
+
+	return texture->width && texture->height;
+}
+
+static bool fastimageReadAstc(const fastimage_reader_t *reader, fastimage_texture_t *texture)
+{
+	unsigned char header[ASTC_HEADER_SIZE];
+
+	if(reader->read(reader->context, ASTC_HEADER_SIZE-4, header+4) != ASTC_HEADER_SIZE-4) return false;
+
+	// 2D blocks are 4x4 to 12x12, 3D ones are 3x3x3 to 6x6x6
+	if(header[4] < 3 || header[4] > 12 || header[5] < 3 || header[5] > 12 || !header[6] || header[6] > 6) return false;
+
+	fastimageTextureSetEncoding(texture, fastimage_texture_astc, 0);
+	texture->block_width = header[4];
+	texture->block_height = header[5];
+	texture->block_depth = header[6];
+
+	// Sizes are 24 bit little endian
+	texture->width = header[7]|((size_t)header[8]<<8)|((size_t)header[9]<<16);
+	texture->height = header[10]|((size_t)header[11]<<8)|((size_t)header[12]<<16);
+	texture->depth = header[13]|((size_t)header[14]<<8)|((size_t)header[15]<<16);
+
+	return texture->width && texture->height && texture->depth;
+}
+
+// Format is the one matched by signature, for ktx the rest of identifier tells its version
+static int fastimageReadTexture(const fastimage_reader_t *reader, unsigned char *sign, int format, fastimage_texture_t *texture)
+{
+	unsigned char identifier[KTX_IDENTIFIER_SIZE];
+	bool result = false;
+	unsigned int texels;
+
+	memset(texture, 0, sizeof(fastimage_texture_t));
+	texture->depth = 1;
+	texture->layers = 1;
+	texture->faces = 1;
+	texture->levels = 1;
+
+	if(format == fastimage_dds)
+		result = fastimageReadDds(reader, texture);
+	else if(format == fastimage_ktx) {
+		memcpy(identifier, sign, 4);
+
+		if(reader->read(reader->context, KTX_IDENTIFIER_SIZE-4, identifier+4) != KTX_IDENTIFIER_SIZE-4) goto TEXTURE_ERROR;
+
+		format = fastimageKtxVersion(identifier);
+		if(format == fastimage_unknown) {
+			memset(texture, 0, sizeof(fastimage_texture_t));
+
+			return format;
+		}
+
+		result = (format == fastimage_ktx)?fastimageReadKtx(reader, texture):fastimageReadKtx2(reader, texture);
+	} else if(format == fastimage_pvr)
+		result = fastimageReadPvr(reader, sign, texture);
+	else if(format == fastimage_astc)
+		result = fastimageReadAstc(reader, texture);
+
+	if(!result) goto TEXTURE_ERROR;
+
+	texels = texture->block_width*texture->block_height*texture->block_depth;
+	if(texels) texture->bitsperpixel = (texture->block_bits+texels-1)/texels;
+
+	return format;
+
+TEXTURE_ERROR:
+	memset(texture, 0, sizeof(fastimage_texture_t));
+
+	return fastimage_error;
+}
+
+// Signatures are masked by fastimage_signs_mask before comparison
+#define FASTIMAGE_SIGNS_NUM 32 // Multiple of 8 for SIMD, unused entries never match
+
+// In order of priority, first match wins
+static const uint32_t fastimage_signs_mask[FASTIMAGE_SIGNS_NUM] = {
+	0x0000FFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+	0xFFFFFFFF, 0xFFFFFFFF, 0x0000FFFF, 0xFFFFFFFF,
+	0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+	0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00FFFF00,
+	0x00FFFF00, 0x00FFFF00, 0x00FFFF00, 0x00FFFF00,
+	0x00FFFF00, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+	0x0000FFFF, 0x0000F0FF, 0xFFFFFFFF, 0,
+	0, 0, 0, 0
+};
+
+static const uint32_t fastimage_signs[FASTIMAGE_SIGNS_NUM] = {
+	FASTIMAGE_SIGN('B', 'M', 0, 0),
+	FASTIMAGE_SIGN(0x89, 'P', 'N', 'G'),
+	FASTIMAGE_SIGN('G', 'I', 'F', '8'), // GIF87a or GIF89a
+	FASTIMAGE_SIGN('R', 'I', 'F', 'F'),
+	FASTIMAGE_SIGN('q', 'o', 'i', 'f'),
+	FASTIMAGE_SIGN('q', 'o', 'y', 'f'),
+	FASTIMAGE_SIGN(0xFF, 0xD8, 0, 0),
+	FASTIMAGE_SIGN(10, 5, 1, 8),
+	FASTIMAGE_SIGN(0, 0, 1, 0),
+	FASTIMAGE_SIGN(0, 0, 2, 0),
+	FASTIMAGE_SIGN('D', 'D', 'S', ' '),
+	FASTIMAGE_SIGN(0xAB, 'K', 'T', 'X'), // KTX 1 or 2
+	FASTIMAGE_SIGN('P', 'V', 'R', 3),
+	FASTIMAGE_SIGN(3, 'R', 'V', 'P'), // Big endian PVR
+	FASTIMAGE_SIGN(0x13, 0xAB, 0xA1, 0x5C), // ASTC
+	// TGA, color map availability and data type
+	FASTIMAGE_SIGN(0, 1, 1, 0), // Palette, uncompressed
+	FASTIMAGE_SIGN(0, 1, 9, 0), // Palette, RLE
+	FASTIMAGE_SIGN(0, 0, 2, 0), // True Color, uncompressed
+	FASTIMAGE_SIGN(0, 0, 3, 0), // Grayscale, uncompressed
+	FASTIMAGE_SIGN(0, 0, 10, 0), // True Color, RLE
+	FASTIMAGE_SIGN(0, 0, 11, 0), // Grayscale, RLE
+	FASTIMAGE_SIGN(0x76, 0x2F, 0x31, 0x01), // OpenEXR
+	FASTIMAGE_SIGN('8', 'B', 'P', 'S'), // PSD or PSB
+	FASTIMAGE_SIGN('f', 'a', 'r', 'b'),
+	FASTIMAGE_SIGN('#', '?', 0, 0), // #?RADIANCE or #?RGBE
+	FASTIMAGE_SIGN('P', '0', 0, 0), // P and digit, see fastimagePnmSign
+	FASTIMAGE_SIGN(0x1A, 0x45, 0xDF, 0xA3), // EBML of Matroska or WebM
+	0xFFFFFFFF, 0xFFFFFFFF,
+	0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF
+};
+
+static const int fastimage_signs_format[FASTIMAGE_SIGNS_NUM] = {
+	fastimage_bmp, fastimage_png, fastimage_gif, fastimage_webp,
+	fastimage_qoi, fastimage_qoy, fastimage_jpg, fastimage_pcx,
+	fastimage_ico, fastimage_cur, fastimage_dds, fastimage_ktx,
+	fastimage_pvr, fastimage_pvr, fastimage_astc, fastimage_tga,
+	fastimage_tga, fastimage_tga, fastimage_tga, fastimage_tga,
+	fastimage_tga, fastimage_exr, fastimage_psd, fastimage_farbfeld,
+	fastimage_hdr, fastimage_pnm, fastimage_mkv, fastimage_unknown,
+	fastimage_unknown, fastimage_unknown, fastimage_unknown, fastimage_unknown
+};
+
+// Bit i is set if signature i matches, all signatures are compared at once
+static unsigned int fastimageMatchSigns(uint32_t head)
+{
+	unsigned int matches = 0;
+	int i;
+#if defined(FASTIMAGE_AVX2)
+	__m256i value, eq;
+
+	value = _mm256_set1_epi32((int)head);
+
+	for(i = 0; i < FASTIMAGE_SIGNS_NUM; i += 8) {
+		eq = _mm256_cmpeq_epi32(_mm256_and_si256(value, _mm256_loadu_si256((const __m256i *)(fastimage_signs_mask+i))), _mm256_loadu_si256((const __m256i *)(fastimage_signs+i)));
+
+		matches |= (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(eq))<<i;
+	}
+#elif defined(FASTIMAGE_SSE2)
+	__m128i value, eq0, eq1;
+
+	value = _mm_set1_epi32((int)head);
+
+	for(i = 0; i < FASTIMAGE_SIGNS_NUM; i += 8) {
+		eq0 = _mm_cmpeq_epi32(_mm_and_si128(value, _mm_loadu_si128((const __m128i *)(fastimage_signs_mask+i))), _mm_loadu_si128((const __m128i *)(fastimage_signs+i)));
+		eq1 = _mm_cmpeq_epi32(_mm_and_si128(value, _mm_loadu_si128((const __m128i *)(fastimage_signs_mask+i+4))), _mm_loadu_si128((const __m128i *)(fastimage_signs+i+4)));
+
+		// 32 bit masks to 8 bit, order is kept
+		matches |= ((unsigned int)_mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(eq0, eq1), _mm_setzero_si128()))&0xFF)<<i;
+	}
+#else
+	for(i = 0; i < FASTIMAGE_SIGNS_NUM; i++)
+		if((head&fastimage_signs_mask[i]) == fastimage_signs[i]) matches |= 1u<<i;
+#endif
+
+	return matches;
+}
+
+static int fastimageMatchSign(const unsigned char *sign)
+{
+	unsigned int matches, i;
+
+	matches = fastimageMatchSigns(fastimageLe32(sign));
+	if(!matches) return fastimage_unknown;
+
+	for(i = 0; !(matches&1); i++)
+		matches >>= 1;
+
+	return fastimage_signs_format[i];
+}
+
+// P1-P7 and whitespace
+static bool fastimagePnmSign(const unsigned char *sign)
+{
+	return sign[0] == 'P' && sign[1] >= '1' && sign[1] <= '7' && (sign[2] == ' ' || sign[2] == '\t' || sign[2] == '\n' || sign[2] == '\r');
+}
+
+// Verify level: whole stream is checked in big blocks, pixels are not decoded
+
+#define FASTIMAGE_VERIFY_BLOCK 65536
+
+typedef struct {
+	const fastimage_reader_t *reader;
+	unsigned char buf[FASTIMAGE_VERIFY_BLOCK];
+	size_t size;
+	size_t pos;
+	bool eof;
+#if !defined(FASTIMAGE_PCLMUL) && !defined(FASTIMAGE_ARM_CRC32)
+	uint32_t crc_table[8][256]; // Slicing-by-8
+#endif
+} fastimage_verify_t;
+
+static void fastimageCrc32Init(fastimage_verify_t *verify)
+{
+#if !defined(FASTIMAGE_PCLMUL) && !defined(FASTIMAGE_ARM_CRC32)
+	uint32_t crc;
+	int i, j;
+
+	for(i = 0; i < 256; i++) {
+		crc = (uint32_t)i;
+
+		for(j = 0; j < 8; j++)
+			crc = (crc>>1)^(0xEDB88320&(0-(crc&1)));
+
+		verify->crc_table[0][i] = crc;
+	}
+
+	for(i = 0; i < 256; i++)
+		for(j = 1; j < 8; j++)
+			verify->crc_table[j][i] = (verify->crc_table[j-1][i]>>8)^verify->crc_table[0][verify->crc_table[j-1][i]&0xFF];
+#else
+	(void)verify;
+#endif
+}
+
+// CRC-32 of PNG and zlib, crc is not inverted (start with 0xFFFFFFFF, invert at the end)
+static uint32_t fastimageCrc32(const fastimage_verify_t *verify, uint32_t crc, const unsigned char *p, size_t size)
+{
+#if defined(FASTIMAGE_PCLMUL)
+	// Folding by carry-less multiplication, 4 lanes of 128 bits
+	static const uint64_t k1k2[2] = {0x0154442bd4, 0x01c6e41596};
+	static const uint64_t k3k4[2] = {0x01751997d0, 0x00ccaa009e};
+	static const uint64_t k5k0[2] = {0x0163cd6124, 0x0000000000};
+	static const uint64_t poly[2] = {0x01db710641, 0x01f7011641};
+	int i;
+
+	(void)verify;
+
+	if(size >= 64) {
+		__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, mask;
+		size_t blocks = size&~(size_t)15;
+
+		x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), _mm_cvtsi32_si128((int)crc));
+		x2 = _mm_loadu_si128((const __m128i *)(p+16));
+		x3 = _mm_loadu_si128((const __m128i *)(p+32));
+		x4 = _mm_loadu_si128((const __m128i *)(p+48));
+		x0 = _mm_loadu_si128((const __m128i *)k1k2);
+		p += 64;
+		size -= 64;
+		blocks -= 64;
+
+		while(blocks >= 64) {
+			x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+			x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+			x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+			x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x5), _mm_loadu_si128((const __m128i *)p));
+			x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, x0, 0x11), x6), _mm_loadu_si128((const __m128i *)(p+16)));
+			x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, x0, 0x11), x7), _mm_loadu_si128((const __m128i *)(p+32)));
+			x4 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x4, x0, 0x11), x8), _mm_loadu_si128((const __m128i *)(p+48)));
+
+			p += 64;
+			size -= 64;
+			blocks -= 64;
+		}
+
+		// 4 lanes to 1, then the rest of 16 byte blocks
+		x0 = _mm_loadu_si128((const __m128i *)k3k4);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x2), x5);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x3), x5);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x4), x5);
+
+		while(blocks >= 16) {
+			x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), _mm_loadu_si128((const __m128i *)p)), x5);
+
+			p += 16;
+			size -= 16;
+			blocks -= 16;
+		}
+
+		// 128 bits to 64, then Barrett reduction to 32
+		mask = _mm_setr_epi32(~0, 0, ~0, 0);
+		x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+		x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+		x2 = _mm_srli_si128(x1, 4);
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), x0, 0x00), x2);
+
+		x0 = _mm_loadu_si128((const __m128i *)poly);
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), x0, 0x10);
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), x0, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+
+		crc = (uint32_t)_mm_extract_epi32(x1, 1);
+	}
+
+	while(size--) {
+		crc ^= *p++;
+
+		for(i = 0; i < 8; i++)
+			crc = (crc>>1)^(0xEDB88320&(0-(crc&1)));
+	}
+
+	return crc;
+#elif defined(FASTIMAGE_ARM_CRC32)
+	(void)verify;
+
+	for(; size >= 8; p += 8, size -= 8) {
+		uint64_t value;
+
+		memcpy(&value, p, 8);
+		crc = __crc32d(crc, value);
+	}
+
+	while(size--)
+		crc = __crc32b(crc, *p++);
+
+	return crc;
+#else
+	const uint32_t (*t)[256] = verify->crc_table;
+
+	for(; size >= 8; p += 8, size -= 8) {
+		uint32_t lo = crc^((uint32_t)p[0]|((uint32_t)p[1]<<8)|((uint32_t)p[2]<<16)|((uint32_t)p[3]<<24));
+
+		crc = t[7][lo&0xFF]^t[6][(lo>>8)&0xFF]^t[5][(lo>>16)&0xFF]^t[4][lo>>24]^t[3][p[4]]^t[2][p[5]]^t[1][p[6]]^t[0][p[7]];
+	}
+
+	while(size--)
+		crc = (crc>>8)^t[0][(crc^*p++)&0xFF];
+
+	return crc;
+#endif
+}
+
+// Next block, false at the end of stream
+static bool fastimageVerifyFill(fastimage_verify_t *verify)
+{
+	size_t size = FASTIMAGE_VERIFY_BLOCK, got = 0;
+
+	if(verify->eof) return false;
+
+	// Some readers refuse reads past the end, so smaller reads are tried there
+	while(size && !(got = verify->reader->read(verify->reader->context, size, verify->buf)))
+		size /= 2;
+
+	verify->size = got;
+	verify->pos = 0;
+	verify->eof = !got;
+
+	return got != 0;
+}
+
+static bool fastimageVerifyRead(fastimage_verify_t *verify, unsigned char *out, size_t size)
+{
+	size_t part;
+
+	while(size) {
+		if(verify->pos == verify->size && !fastimageVerifyFill(verify)) return false;
+
+		part = verify->size-verify->pos;
+		if(part > size) part = size;
+
+		memcpy(out, verify->buf+verify->pos, part);
+		verify->pos += part;
+		out += part;
+		size -= part;
+	}
+
+	return true;
+}
+
+static int fastimageVerifyByte(fastimage_verify_t *verify)
+{
+	if(verify->pos == verify->size && !fastimageVerifyFill(verify)) return -1;
+
+	return verify->buf[verify->pos++];
+}
+
+// Skips size bytes, CRC is updated when crc is not null
+static bool fastimageVerifySkip(fastimage_verify_t *verify, uint64_t size, uint32_t *crc)
+{
+	size_t part;
+
+	while(size) {
+		if(verify->pos == verify->size && !fastimageVerifyFill(verify)) return false;
+
+		part = verify->size-verify->pos;
+		if(part > size) part = (size_t)size;
+
+		if(crc) *crc = fastimageCrc32(verify, *crc, verify->buf+verify->pos, part);
+		verify->pos += part;
+		size -= part;
+	}
+
+	return true;
+}
+
+static int fastimageVerifyPng(fastimage_verify_t *verify)
+{
+	unsigned char head[8], stored[4];
+	uint32_t size, crc;
+	bool first = true;
+
+	if(!fastimageVerifyRead(verify, head, 8)) return fastimage_verify_truncated;
+	if(memcmp(head, "\x89PNG\x0d\x0a\x1a\x0a", 8)) return fastimage_verify_corrupt;
+
+	// Length, type and data, CRC of type and data
+	for(;;) {
+		if(!fastimageVerifyRead(verify, head, 8)) return fastimage_verify_truncated;
+
+		size = fastimageBe32(head);
+		if(size > 0x7FFFFFFF) return fastimage_verify_corrupt;
+		if(first && memcmp(head+4, "IHDR", 4)) return fastimage_verify_corrupt;
+		first = false;
+
+		crc = fastimageCrc32(verify, 0xFFFFFFFF, head+4, 4);
+		if(!fastimageVerifySkip(verify, size, &crc) || !fastimageVerifyRead(verify, stored, 4)) return fastimage_verify_truncated;
+
+		if(fastimageBe32(stored) != (crc^0xFFFFFFFF)) return fastimage_verify_corrupt;
+
+		if(!memcmp(head+4, "IEND", 4)) return fastimage_verify_ok;
+	}
+}
+
+static int fastimageVerifyJpeg(fastimage_verify_t *verify)
+{
+	unsigned char length[2];
+	bool frame = false;
+	int c, marker;
+
+	if(fastimageVerifyByte(verify) != 0xFF || fastimageVerifyByte(verify) != 0xD8) return fastimage_verify_corrupt;
+
+	c = fastimageVerifyByte(verify);
+
+	for(;;) {
+		if(c < 0) return fastimage_verify_truncated;
+		if(c != 0xFF) return fastimage_verify_corrupt;
+
+		// Fill bytes
+		while((marker = fastimageVerifyByte(verify)) == 0xFF);
+
+		if(marker < 0) return fastimage_verify_truncated;
+		if(marker == 0xD9) return frame?fastimage_verify_ok:fastimage_verify_corrupt;
+
+		// No segment: TEM, RSTn (allowed out of scan by some encoders). Reserved and SOI are not expected
+		if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+			c = fastimageVerifyByte(verify);
+
+			continue;
+		}
+
+		if(marker < 0xC0 || marker == 0xD8) return fastimage_verify_corrupt;
+
+		if(!fastimageVerifyRead(verify, length, 2)) return fastimage_verify_truncated;
+		if(length[0] == 0 && length[1] < 2) return fastimage_verify_corrupt;
+		if(!fastimageVerifySkip(verify, ((uint64_t)length[0]<<8)+length[1]-2, 0)) return fastimage_verify_truncated;
+
+		// SOFn, but not DHT, JPG and DAC
+		if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+			frame = true;
+
+		if(marker != 0xDA) {
+			c = fastimageVerifyByte(verify);
+
+			continue;
+		}
+
+		if(!frame) return fastimage_verify_corrupt;
+
+		// Entropy coded data ends at marker other than stuffed zero and RSTn
+		for(;;) {
+			c = fastimageVerifyByte(verify);
+			if(c < 0) return fastimage_verify_truncated;
+			if(c != 0xFF) continue;
+
+			while((c = fastimageVerifyByte(verify)) == 0xFF);
+			if(c < 0) return fastimage_verify_truncated;
+			if(c == 0 || (c >= 0xD0 && c <= 0xD7)) continue;
+
+			// Marker is handled by outer loop
+			verify->pos--;
+			c = 0xFF;
+
+			break;
+		}
+	}
+}
+
+static int fastimageVerifyGifBlocks(fastimage_verify_t *verify)
+{
+	int size;
+
+	while((size = fastimageVerifyByte(verify)) > 0)
+		if(!fastimageVerifySkip(verify, (uint64_t)size, 0)) return fastimage_verify_truncated;
+
+	return (size < 0)?fastimage_verify_truncated:fastimage_verify_ok;
+}
+
+static int fastimageVerifyGif(fastimage_verify_t *verify)
+{
+	unsigned char header[13], descriptor[9];
+	int block, result;
+
+	if(!fastimageVerifyRead(verify, header, 13)) return fastimage_verify_truncated;
+	if(memcmp(header, "GIF87a", 6) && memcmp(header, "GIF89a", 6)) return fastimage_verify_corrupt;
+
+	// Global color table
+	if((header[10]&0x80) && !fastimageVerifySkip(verify, (uint64_t)3<<((header[10]&7)+1), 0)) return fastimage_verify_truncated;
+
+	for(;;) {
+		block = fastimageVerifyByte(verify);
+
+		if(block == 0x3B) return fastimage_verify_ok;
+
+		if(block == 0x21) {
+			// Label, then sub-blocks
+			if(fastimageVerifyByte(verify) < 0) return fastimage_verify_truncated;
+		} else if(block == 0x2C) {
+			if(!fastimageVerifyRead(verify, descriptor, 9)) return fastimage_verify_truncated;
+			if((descriptor[8]&0x80) && !fastimageVerifySkip(verify, (uint64_t)3<<((descriptor[8]&7)+1), 0)) return fastimage_verify_truncated;
+
+			// LZW minimum code size
+			block = fastimageVerifyByte(verify);
+			if(block < 0) return fastimage_verify_truncated;
+			if(block < 1 || block > 11) return fastimage_verify_corrupt;
+		} else
+			return (block < 0)?fastimage_verify_truncated:fastimage_verify_corrupt;
+
+		result = fastimageVerifyGifBlocks(verify);
+		if(result != fastimage_verify_ok) return result;
+	}
+}
+
+static int fastimageVerify(const fastimage_reader_t *reader, int format)
+{
+	fastimage_verify_t *verify;
+	int result = fastimage_verify_none;
+
+	if(format != fastimage_png && format != fastimage_jpg && format != fastimage_gif) return result;
+
+	verify = malloc(sizeof(fastimage_verify_t));
+	if(!verify) return result;
+
+	verify->reader = reader;
+	verify->size = 0;
+	verify->pos = 0;
+	verify->eof = false;
+
+	if(!reader->seek(reader->context, 0, false)) {
+		result = fastimage_verify_truncated;
+	} else if(format == fastimage_png) {
+		fastimageCrc32Init(verify);
+		result = fastimageVerifyPng(verify);
+	} else if(format == fastimage_jpg)
+		result = fastimageVerifyJpeg(verify);
+	else
+		result = fastimageVerifyGif(verify);
+
+	free(verify);
+
+	return result;
+}
+
+// Header cursor: small buffer on the stack for parsers that walk headers. It reads exactly what is asked,
+// unless it is sequential (text headers), is inside a window of headers set by parser (like moov box) or has made
+// many reader calls (GIF sub-blocks, or lots of tiny segments and boxes), then it reads ahead up to its buffer,
+// but never more than limit or what is left of max_bytes
+
+#define FASTIMAGE_CURSOR_SIZE 512
+#define FASTIMAGE_CURSOR_CALLS 32 // Reader calls before reading ahead, usual headers take less
+#define FASTIMAGE_HEADER_LIMIT 65536 // Text and attribute headers
+
+typedef struct {
+	const fastimage_reader_t *reader;
+	unsigned char buf[FASTIMAGE_CURSOR_SIZE];
+	size_t size;
+	size_t pos;
+	uint64_t filled; // Bytes read from reader
+	uint64_t limit; // Stream is cut after this number of read bytes, 0 - no limit
+	uint64_t offset; // Position of reader from the start of cursor
+	uint64_t window; // Headers end at this offset
+	unsigned int calls;
+	bool sequential;
+} fastimage_cursor_t;
+
+static uint64_t fastimageBudget(const fastimage_reader_t *reader);
+
+static void fastimageCursorInit(fastimage_cursor_t *cursor, const fastimage_reader_t *reader, uint64_t limit, bool sequential)
+{
+	cursor->reader = reader;
+	cursor->size = 0;
+	cursor->pos = 0;
+	cursor->filled = 0;
+	cursor->limit = limit;
+	cursor->offset = 0;
+	cursor->window = 0;
+	cursor->calls = 0;
+	cursor->sequential = sequential;
+}
+
+// Next size bytes are headers that are walked, they may be read ahead
+static void fastimageCursorWindow(fastimage_cursor_t *cursor, uint64_t size)
+{
+	uint64_t pos = cursor->offset-(cursor->size-cursor->pos);
+
+	cursor->window = (size < UINT64_MAX-pos)?pos+size:UINT64_MAX;
+}
+
+// Bytes that may be read ahead. Text headers are read anyway, but windows and long walks have data that is seeked over,
+// and seeks are not counted against max_bytes, so they are read ahead only without the limit
+static size_t fastimageCursorAhead(const fastimage_cursor_t *cursor)
+{
+	size_t room = FASTIMAGE_CURSOR_SIZE-cursor->size;
+
+	if(cursor->sequential) return room;
+
+	if(fastimageBudget(cursor->reader) != UINT64_MAX) return 0;
+
+	if(cursor->calls >= FASTIMAGE_CURSOR_CALLS) return room;
+
+	if(cursor->window > cursor->offset && cursor->window-cursor->offset < room) return (size_t)(cursor->window-cursor->offset);
+
+	return (cursor->window > cursor->offset)?room:0;
+}
+
+// At least need bytes (up to FASTIMAGE_CURSOR_SIZE) in buffer, false at the end of stream
+static bool fastimageCursorFill(fastimage_cursor_t *cursor, size_t need)
+{
+	size_t want, ahead, got;
+
+	if(cursor->size-cursor->pos >= need) return true;
+
+	memmove(cursor->buf, cursor->buf+cursor->pos, cursor->size-cursor->pos);
+	cursor->size -= cursor->pos;
+	cursor->pos = 0;
+
+	while(cursor->size < need) {
+		want = need-cursor->size;
+		ahead = fastimageCursorAhead(cursor);
+
+		if(ahead > want) {
+			uint64_t budget = fastimageBudget(cursor->reader);
+
+			if(budget < ahead) ahead = (budget > want)?(size_t)budget:want;
+			want = ahead;
+		}
+
+		if(cursor->limit) {
+			if(cursor->filled >= cursor->limit) return false;
+			if(want > cursor->limit-cursor->filled) want = (size_t)(cursor->limit-cursor->filled);
+		}
+
+		got = cursor->reader->read(cursor->reader->context, want, cursor->buf+cursor->size);
+		cursor->calls++;
+
+		// Some readers refuse reads past the end, so read ahead is given up there
+		if(!got && want > need-cursor->size) {
+			want = need-cursor->size;
+			got = cursor->reader->read(cursor->reader->context, want, cursor->buf+cursor->size);
+			cursor->calls++;
+		}
+
+		if(!got) return false;
+
+		cursor->size += got;
+		cursor->filled += got;
+		cursor->offset += got;
+	}
+
+	return true;
+}
+
+static bool fastimageCursorRead(fastimage_cursor_t *cursor, unsigned char *out, size_t size)
+{
+	size_t part;
+
+	if(size <= FASTIMAGE_CURSOR_SIZE) {
+		if(!fastimageCursorFill(cursor, size)) return false;
+
+		memcpy(out, cursor->buf+cursor->pos, size);
+		cursor->pos += size;
+
+		return true;
+	}
+
+	// Big reads go straight to reader
+	part = cursor->size-cursor->pos;
+	memcpy(out, cursor->buf+cursor->pos, part);
+	cursor->size = cursor->pos = 0;
+
+	if(cursor->limit && (cursor->filled >= cursor->limit || size-part > cursor->limit-cursor->filled)) return false;
+	cursor->calls++;
+	if(cursor->reader->read(cursor->reader->context, size-part, out+part) != size-part) return false;
+
+	cursor->filled += size-part;
+	cursor->offset += size-part;
+
+	return true;
+}
+
+static int fastimageCursorByte(fastimage_cursor_t *cursor)
+{
+	if(!fastimageCursorFill(cursor, 1)) return -1;
+
+	return cursor->buf[cursor->pos++];
+}
+
+// Skips size bytes, seeking over what is not buffered
+static bool fastimageCursorSkip(fastimage_cursor_t *cursor, uint64_t size)
+{
+	size_t left = cursor->size-cursor->pos;
+
+	// What may be read ahead anyway is read through instead of seeking
+	if(size > left && size-left <= fastimageCursorAhead(cursor) && !fastimageCursorFill(cursor, (size_t)size)) return false;
+
+	if(size <= cursor->size-cursor->pos) {
+		cursor->pos += (size_t)size;
+
+		return true;
+	}
+
+	cursor->size = 0;
+	cursor->pos = 0;
+
+	cursor->calls++;
+	if(!cursor->reader->seek(cursor->reader->context, (int64_t)(size-left), true)) return false;
+
+	cursor->offset += size-left;
+
+	return true;
+}
+
+// Line of text header without line end, longer lines are cut. False at the end of stream
+static bool fastimageCursorLine(fastimage_cursor_t *cursor, char *line, size_t size)
+{
+	size_t len = 0;
+	int c;
+
+	while((c = fastimageCursorByte(cursor)) != '\n') {
+		if(c < 0) return false;
+
+		if(len+1 < size) line[len++] = (char)c;
+	}
+
+	if(len && line[len-1] == '\r') len--;
+	line[len] = 0;
+
+	return true;
+}
+
+// Chunks after IHDR up to image data. acTL and tRNS are before image data, errors here are left to decoder
+static void fastimagePngHints(const fastimage_reader_t *reader, fastimage_hints_t *hints)
+{
+	fastimage_cursor_t cursor;
+	unsigned char png_chunk_head[12];
+	uint32_t png_chunk_size;
+
+	fastimageCursorInit(&cursor, reader, 0, false);
+
+	// CRC of IHDR
+	if(!fastimageCursorSkip(&cursor, 4)) return;
+
+	while(fastimageCursorRead(&cursor, png_chunk_head, 8)) {
+		if(!memcmp(png_chunk_head+4, "IDAT", 4) || !memcmp(png_chunk_head+4, "IEND", 4))
+			break;
+
+		png_chunk_size = fastimageBe32(png_chunk_head);
+
+		if(!memcmp(png_chunk_head+4, "tRNS", 4))
+			hints->flags |= fastimage_hint_alpha;
+		else if(!memcmp(png_chunk_head+4, "acTL", 4) && png_chunk_size >= 4) {
+			if(!fastimageCursorRead(&cursor, png_chunk_head+8, 4)) break;
+
+			hints->frames = fastimageBe32(png_chunk_head+8);
+			if(hints->frames > 1) hints->flags |= fastimage_hint_animated;
+
+			png_chunk_size -= 4;
+		}
+
+		if(!fastimageCursorSkip(&cursor, (uint64_t)png_chunk_size+4)) break;
+	}
+}
+
+// Blocks after GIF header up to the second frame, many sub-blocks of image data make cursor read ahead
+static void fastimageGifHints(const fastimage_reader_t *reader, fastimage_hints_t *hints)
+{
+	fastimage_cursor_t cursor;
+	unsigned char screen[3], descriptor[9], control[4];
+	int block, frames = 0;
+
+	hints->bitspersample = 8;
+
+	fastimageCursorInit(&cursor, reader, 0, false);
+
+	// Rest of logical screen descriptor and global color table
+	if(!fastimageCursorRead(&cursor, screen, 3)) return;
+	if((screen[0]&0x80) && !fastimageCursorSkip(&cursor, (uint64_t)3<<((screen[0]&7)+1))) return;
+
+	for(;;) {
+		block = fastimageCursorByte(&cursor);
+
+		if(block == 0x21) {
+			block = fastimageCursorByte(&cursor);
+
+			// Graphic control extension, transparent color flag
+			if(block == 0xF9) {
+				if(fastimageCursorByte(&cursor) != 4 || !fastimageCursorRead(&cursor, control, 4)) break;
+				if(control[0]&1) hints->flags |= fastimage_hint_alpha;
+			} else if(block < 0)
+				break;
+		} else if(block == 0x2C) {
+			if(!fastimageCursorRead(&cursor, descriptor, 9)) break;
+			if(++frames == 2) break;
+
+			if(descriptor[8]&0x40) hints->flags |= fastimage_hint_interlaced;
+
+			// Local color table and LZW minimum code size
+			if((descriptor[8]&0x80) && !fastimageCursorSkip(&cursor, (uint64_t)3<<((descriptor[8]&7)+1))) break;
+			if(fastimageCursorByte(&cursor) < 0) break;
+		} else
+			break;
+
+		// Sub-blocks up to terminator
+		while((block = fastimageCursorByte(&cursor)) > 0)
+			if(!fastimageCursorSkip(&cursor, (uint64_t)block)) break;
+
+		if(block != 0) break;
+	}
+
+	if(frames == 2) hints->flags |= fastimage_hint_animated;
+}
+
+// Segments before SOF are walked through header cursor, which reads ahead when there are lots of them
+static void fastimageReadJpeg(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, fastimage_hints_t *hints)
+{
+	fastimage_cursor_t cursor;
+	unsigned char jpg_bytes[6];
+	unsigned short jpg_frame;
+	int64_t jpg_segment_size;
+
+	jpg_frame = sign[2]+(unsigned short)(sign[3])*256;
+
+	fastimageCursorInit(&cursor, reader, 0, false);
+
+	// First of all, skipping segments we don't needed
+	// TODO: there are segments without length (with empty or 2-byte data). Need to check them
+	while(1) {
+		//printf("jpeg segment %hx\n", jpg_frame);
+
+		// Read segment size
+		if(!fastimageCursorRead(&cursor, jpg_bytes, 2)) goto JPEG_ERROR;
+
+		jpg_segment_size = (int64_t)(jpg_bytes[0])*256+jpg_bytes[1];
+
+		if(jpg_segment_size < 2) goto JPEG_ERROR;
+
+		jpg_segment_size -= 2;
+
+		if(fastimageJpegSof(jpg_frame)) break;
+
+		// Skip segment and read next segment signature
+		if(!fastimageCursorSkip(&cursor, (uint64_t)jpg_segment_size)) goto JPEG_ERROR;
+		if(!fastimageCursorRead(&cursor, jpg_bytes, 2)) goto JPEG_ERROR;
+
+		jpg_frame = jpg_bytes[0]+(unsigned short)(jpg_bytes[1])*256;
+	}
+
+	// Found segment with header
+	if(jpg_segment_size < 6) goto JPEG_ERROR;
+
+	if(!fastimageCursorRead(&cursor, jpg_bytes, 6)) goto JPEG_ERROR;
+
+	image->width = (size_t)(jpg_bytes[3])*256+jpg_bytes[4];
+	image->height = (size_t)(jpg_bytes[1])*256+jpg_bytes[2];
+	image->channels = jpg_bytes[5];
+	image->bitsperpixel = image->channels * (unsigned int)(jpg_bytes[0]);
+
+	if(hints) {
+		unsigned int marker = jpg_frame>>8;
+
+		hints->jpeg_marker = marker;
+		hints->bitspersample = jpg_bytes[0];
+		if(jpg_bytes[0] > 8) hints->flags |= fastimage_hint_high_depth;
+		if((marker&3) == 2) hints->flags |= fastimage_hint_progressive;
+		if((marker&3) == 3) hints->flags |= fastimage_hint_lossless;
+		if(marker >= 0xC9) hints->flags |= fastimage_hint_arithmetic;
+		if((marker&7) >= 5) hints->flags |= fastimage_hint_hierarchical;
+	}
+
+	return;
+
+JPEG_ERROR:
+	image->format = fastimage_error;
+}
+
+// Headers of HDR and professional formats, text and attributes are read through header cursor
+
+#define EXR_LONG_NAMES 0x04 // In second byte of version
+#define EXR_CHLIST_MAX 65536
+
+// Zero terminated string of EXR header
+static bool fastimageExrString(fastimage_cursor_t *cursor, char *str, size_t size)
+{
+	size_t len = 0;
+	int c;
+
+	while((c = fastimageCursorByte(cursor)) != 0) {
+		if(c < 0 || len+1 >= size) return false;
+
+		str[len++] = (char)c;
+	}
+
+	str[len] = 0;
+
+	return true;
+}
+
+// Channels and bits of chlist: name, pixel type, pLinear, 3 reserved bytes, x and y sampling
+static bool fastimageExrChannels(const unsigned char *chlist, size_t size, fastimage_image_t *image, fastimage_hints_t *hints)
+{
+	const unsigned char *end;
+	size_t pos = 0, name_size;
+	unsigned int bits;
+
+	while(pos < size && chlist[pos]) {
+		end = memchr(chlist+pos, 0, size-pos);
+		if(!end) return false;
+
+		name_size = (size_t)(end-(chlist+pos));
+		if(pos+name_size+17 > size) return false;
+
+		// UINT, HALF or FLOAT
+		switch(fastimageLe32(chlist+pos+name_size+1)) {
+			case 0:
+			case 2:
+				bits = 32;
+				break;
+			case 1:
+				bits = 16;
+				break;
+			default:
+				return false;
+		}
+
+		image->channels++;
+		image->bitsperpixel += bits;
+
+		if(hints) {
+			if(bits > hints->bitspersample) hints->bitspersample = bits;
+
+			// A of default layer or of named one
+			if((name_size == 1 && chlist[pos] == 'A') || (name_size >= 2 && !memcmp(chlist+pos+name_size-2, ".A", 2)))
+				hints->flags |= fastimage_hint_alpha;
+		}
+
+		pos += name_size+17;
+	}
+
+	if(hints && hints->bitspersample) hints->flags |= fastimage_hint_high_depth;
+
+	return true;
+}
+
+static void fastimageReadExr(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, fastimage_hints_t *hints)
+{
+	fastimage_cursor_t cursor;
+	unsigned char version[4], value[16], *chlist = 0;
+	char name[256], type[256];
+	size_t name_max;
+	uint32_t size, chlist_size = 0;
+	int64_t windows[2][2] = {{0, 0}, {0, 0}}; // Width and height of data and display windows
+	int window;
+
+	(void)sign; // Unused
+
+	fastimageCursorInit(&cursor, reader, FASTIMAGE_HEADER_LIMIT, true);
+
+	if(!fastimageCursorRead(&cursor, version, 4) || version[0] != 2) goto EXR_ERROR;
+
+	name_max = (version[1]&EXR_LONG_NAMES)?256:32;
+
+	// Attributes of the first part up to empty name: name, type, size and value
+	while(1) {
+		if(!fastimageExrString(&cursor, name, name_max)) goto EXR_ERROR;
+		if(!name[0]) break;
+
+		if(!fastimageExrString(&cursor, type, name_max) || !fastimageCursorRead(&cursor, value, 4)) goto EXR_ERROR;
+
+		size = fastimageLe32(value);
+
+		window = !strcmp(name, "dataWindow")?0:(!strcmp(name, "displayWindow")?1:-1);
+
+		if(window >= 0 && !strcmp(type, "box2i") && size == 16) {
+			if(!fastimageCursorRead(&cursor, value, 16)) goto EXR_ERROR;
+
+			// xMin, yMin, xMax, yMax
+			windows[window][0] = (int64_t)(int32_t)fastimageLe32(value+8)-(int32_t)fastimageLe32(value)+1;
+			windows[window][1] = (int64_t)(int32_t)fastimageLe32(value+12)-(int32_t)fastimageLe32(value+4)+1;
+			if(windows[window][0] <= 0 || windows[window][1] <= 0) goto EXR_ERROR;
+		} else if(!strcmp(name, "channels") && !strcmp(type, "chlist") && !chlist && size && size <= EXR_CHLIST_MAX) {
+			chlist = malloc(size);
+			if(!chlist || !fastimageCursorRead(&cursor, chlist, size)) goto EXR_ERROR;
+
+			chlist_size = size;
+		} else if(!fastimageCursorSkip(&cursor, size))
+			goto EXR_ERROR;
+	}
+
+	// Data window is what decoder gives, display window is only a fallback
+	window = windows[0][0]?0:1;
+	if(!windows[window][0] || !chlist) goto EXR_ERROR;
+
+	image->width = (size_t)windows[window][0];
+	image->height = (size_t)windows[window][1];
+	if(!fastimageExrChannels(chlist, chlist_size, image, hints)) goto EXR_ERROR;
+
+	free(chlist);
+
+	return;
+
+EXR_ERROR:
+	free(chlist);
+	memset(image, 0, sizeof(fastimage_image_t));
+	image->format = fastimage_error;
+}
+
+// Unsigned decimal after spaces, up to UINT32_MAX
+static bool fastimageTextNumber(const char **text, uint32_t *value)
+{
+	const char *p = *text;
+	uint64_t v = 0;
+
+	while(*p == ' ' || *p == '\t') p++;
+
+	if(*p < '0' || *p > '9') return false;
+
+	for(; *p >= '0' && *p <= '9'; p++) {
+		v = v*10+(uint64_t)(*p-'0');
+		if(v > UINT32_MAX) return false;
+	}
+
+	*text = p;
+	*value = (uint32_t)v;
+
+	return true;
+}
+
+static void fastimageReadHdr(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, fastimage_hints_t *hints)
+{
+	fastimage_cursor_t cursor;
+	char line[128];
+	const char *p;
+	uint32_t width = 0, height = 0;
+	int i;
+
+	(void)sign; // Unused
+
+	fastimageCursorInit(&cursor, reader, FASTIMAGE_HEADER_LIMIT, true);
+
+	// Rest of program type, then variables (FORMAT=32-bit_rle_rgbe...) and comments up to empty line
+	if(!fastimageCursorLine(&cursor, line, sizeof(line))) goto HDR_ERROR;
+
+	do {
+		if(!fastimageCursorLine(&cursor, line, sizeof(line))) goto HDR_ERROR;
+	} while(line[0]);
+
+	// Resolution like "-Y 512 +X 768", order of axes is scanline direction, not size
+	if(!fastimageCursorLine(&cursor, line, sizeof(line))) goto HDR_ERROR;
+
+	for(i = 0, p = line; i < 2; i++) {
+		while(*p == ' ') p++;
+
+		if((p[0] != '-' && p[0] != '+') || (p[1] != 'X' && p[1] != 'Y')) goto HDR_ERROR;
+
+		if(p[1] == 'X') {
+			p += 2;
+			if(!fastimageTextNumber(&p, &width)) goto HDR_ERROR;
+		} else {
+			p += 2;
+			if(!fastimageTextNumber(&p, &height)) goto HDR_ERROR;
+		}
+	}
+
+	if(!width || !height) goto HDR_ERROR;
+
+	image->width = width;
+	image->height = height;
+	image->channels = 3;
+	image->bitsperpixel = 32; // Shared exponent
+
+	// Decoded to floats
+	if(hints) {
+		hints->bitspersample = 32;
+		hints->flags |= fastimage_hint_high_depth;
+	}
+
+	return;
+
+HDR_ERROR:
+	memset(image, 0, sizeof(fastimage_image_t));
+	image->format = fastimage_error;
+}
+
+static void fastimageReadPsd(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, fastimage_hints_t *hints)
+{
+	unsigned char header[22];
+	unsigned int version, channels, depth, color;
+
+	(void)sign; // Unused
+
+	// Version, 6 reserved bytes, channels, height, width, depth and color mode
+	if(reader->read(reader->context, 22, header) != 22) goto PSD_ERROR;
+
+	version = fastimageBe16(header);
+	channels = fastimageBe16(header+8);
+	depth = fastimageBe16(header+18);
+
+	// 1 - PSD, 2 - PSB
+	if(version != 1 && version != 2) goto PSD_ERROR;
+	if(!channels || channels > 56) goto PSD_ERROR;
+	if(depth != 1 && depth != 8 && depth != 16 && depth != 32) goto PSD_ERROR;
+
+	switch(fastimageBe16(header+20)) {
+		case 0: // Bitmap
+		case 1: // Grayscale
+		case 2: // Indexed
+		case 8: // Duotone
+			color = 1;
+			break;
+		case 3: // RGB
+		case 9: // Lab
+			color = 3;
+			break;
+		case 4: // CMYK
+			color = 4;
+			break;
+		case 7: // Multichannel
+			color = channels;
+			break;
+		default:
+			goto PSD_ERROR;
+	}
+
+	image->height = fastimageBe32(header+10);
+	image->width = fastimageBe32(header+14);
+
+	if(fastimageBe16(header+20) == 2) {
+		image->channels = 3;
+		image->bitsperpixel = 24;
+		image->palette = 8;
+	} else {
+		image->channels = channels;
+		image->bitsperpixel = channels*depth;
+	}
+
+	if(hints) {
+		hints->bitspersample = depth;
+		if(depth > 8) hints->flags |= fastimage_hint_high_depth;
+
+		// Extra channels after color ones, usually alpha
+		if(channels > color) hints->flags |= fastimage_hint_alpha;
+	}
+
+	return;
+
+PSD_ERROR:
+	memset(image, 0, sizeof(fastimage_image_t));
+	image->format = fastimage_error;
+}
+
+// Number of PNM header after whitespace and comments
+static bool fastimagePnmNumber(fastimage_cursor_t *cursor, uint32_t *value)
+{
+	uint64_t v = 0;
+	int c;
+
+	do {
+		c = fastimageCursorByte(cursor);
+
+		if(c == '#')
+			while((c = fastimageCursorByte(cursor)) >= 0 && c != '\n' && c != '\r');
+	} while(c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f');
+
+	if(c < '0' || c > '9') return false;
+
+	for(; c >= '0' && c <= '9'; c = fastimageCursorByte(cursor)) {
+		v = v*10+(uint64_t)(c-'0');
+		if(v > UINT32_MAX) return false;
+	}
+
+	*value = (uint32_t)v;
+
+	return true;
+}
+
+// PAM header lines up to ENDHDR
+static bool fastimagePamHeader(fastimage_cursor_t *cursor, uint32_t *width, uint32_t *height, uint32_t *depth, uint32_t *maxval, bool *alpha)
+{
+	char line[128];
+	const char *p;
+	size_t len;
+
+	while(1) {
+		if(!fastimageCursorLine(cursor, line, sizeof(line))) return false;
+
+		for(p = line; *p == ' ' || *p == '\t'; p++);
+
+		if(!strncmp(p, "ENDHDR", 6)) return true;
+
+		if(!strncmp(p, "WIDTH", 5)) {
+			p += 5;
+			if(!fastimageTextNumber(&p, width)) return false;
+		} else if(!strncmp(p, "HEIGHT", 6)) {
+			p += 6;
+			if(!fastimageTextNumber(&p, height)) return false;
+		} else if(!strncmp(p, "DEPTH", 5)) {
+			p += 5;
+			if(!fastimageTextNumber(&p, depth)) return false;
+		} else if(!strncmp(p, "MAXVAL", 6)) {
+			p += 6;
+			if(!fastimageTextNumber(&p, maxval)) return false;
+		} else if(!strncmp(p, "TUPLTYPE", 8)) {
+			// GRAYSCALE_ALPHA, RGB_ALPHA
+			for(len = strlen(p); len && (p[len-1] == ' ' || p[len-1] == '\t'); len--);
+			if(len >= 14 && !memcmp(p+len-6, "_ALPHA", 6)) *alpha = true;
+		}
+	}
+}
+
+static void fastimageReadPnm(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, fastimage_hints_t *hints)
+{
+	fastimage_cursor_t cursor;
+	uint32_t width = 0, height = 0, depth = 0, maxval = 1;
+	unsigned int type = sign[1]-'0', bits;
+	bool alpha = false;
+
+	// Header starts after magic and whitespace
+	if(!reader->seek(reader->context, 3, false)) goto PNM_ERROR;
+
+	fastimageCursorInit(&cursor, reader, FASTIMAGE_HEADER_LIMIT, true);
+
+	if(type == 7) {
+		maxval = 0;
+		if(!fastimagePamHeader(&cursor, &width, &height, &depth, &maxval, &alpha)) goto PNM_ERROR;
+		if(!depth || depth > 16) goto PNM_ERROR;
+	} else {
+		if(!fastimagePnmNumber(&cursor, &width) || !fastimagePnmNumber(&cursor, &height)) goto PNM_ERROR;
+
+		// Bitmaps have no maxval
+		if(type != 1 && type != 4 && !fastimagePnmNumber(&cursor, &maxval)) goto PNM_ERROR;
+
+		depth = (type == 3 || type == 6)?3:1;
+	}
+
+	if(!width || !height || !maxval || maxval > 65535) goto PNM_ERROR;
+
+	if(type == 1 || type == 4)
+		bits = 1;
+	else
+		bits = (maxval > 255)?16:8;
+
+	image->width = width;
+	image->height = height;
+	image->channels = depth;
+	image->bitsperpixel = depth*bits;
+
+	if(hints) {
+		hints->bitspersample = bits;
+		if(bits > 8) hints->flags |= fastimage_hint_high_depth;
+		if(alpha) hints->flags |= fastimage_hint_alpha;
+	}
+
+	return;
+
+PNM_ERROR:
+	memset(image, 0, sizeof(fastimage_image_t));
+	image->format = fastimage_error;
+}
+
+static void fastimageReadFarbfeld(const fastimage_reader_t *reader, unsigned char *sign, fastimage_image_t *image, fastimage_hints_t *hints)
+{
+	unsigned char header[12];
+
+	(void)sign; // Unused
+
+	// Rest of "farbfeld", width and height, then 16 bit RGBA
+	if(reader->read(reader->context, 12, header) != 12) {
+		image->format = fastimage_error;
+
+		return;
+	}
+
+	if(memcmp(header, "feld", 4)) {
+		image->format = fastimage_unknown;
+
+		return;
+	}
+
+	image->width = fastimageBe32(header+4);
+	image->height = fastimageBe32(header+8);
+	image->channels = 4;
+	image->bitsperpixel = 64;
+
+	if(hints) {
+		hints->bitspersample = 16;
+		hints->flags |= fastimage_hint_high_depth | fastimage_hint_alpha;
+	}
+}
+
+// Video containers: the first video track of mp4/mov (moov, trak, tkhd, stsd) or mkv/webm (Segment, Tracks, TrackEntry).
+// Headers are read through header cursor, which reads ahead only inside moov, EBML header and Tracks; sample tables,
+// mdat and clusters are seeked over
+
+#define FASTIMAGE_VIDEO_LIMIT 262144
+#define VIDEO_BOX_DEPTH 4 // trak, mdia, minf, stbl
+
+static void fastimageVideoFourcc(fastimage_video_t *video, const unsigned char *fourcc)
+{
+	int i;
+
+	for(i = 0; i < 4; i++)
+		video->codec[i] = (fourcc[i] >= 0x20 && fourcc[i] < 0x7F)?(char)fourcc[i]:'?';
+
+	video->codec[4] = 0;
+}
+
+// Header of the next box of parent with *left bytes, which are decreased by the whole box
+static bool fastimageVideoBox(fastimage_cursor_t *cursor, uint64_t *left, unsigned char *type, uint64_t *size)
+{
+	unsigned char head[16];
+	uint64_t box_size, header = 8;
+
+	if(*left < 8 || !fastimageCursorRead(cursor, head, 8)) return false;
+
+	box_size = fastimageBe32(head);
+	if(box_size == 1) {
+		if(*left < 16 || !fastimageCursorRead(cursor, head+8, 8)) return false;
+
+		box_size = fastimageBeN(head+8, 8);
+		header = 16;
+	} else if(!box_size)
+		box_size = *left; // Up to the end
+
+	if(box_size < header || box_size > *left || box_size > (uint64_t)INT64_MAX) return false;
+
+	memcpy(type, head+4, 4);
+	*size = box_size-header;
+	*left -= box_size;
+
+	return true;
+}
+
+// Boxes of one trak, video_handler is set by hdlr of mdia
+static bool fastimageVideoTrak(fastimage_cursor_t *cursor, uint64_t left, int depth, fastimage_video_t *track, bool *video_handler)
+{
+	unsigned char type[4], body[96];
+	uint64_t size;
+
+	while(left) {
+		if(!fastimageVideoBox(cursor, &left, type, &size)) return false;
+
+		// Media information of other tracks is not needed
+		if(depth < VIDEO_BOX_DEPTH && (!memcmp(type, "mdia", 4) || !memcmp(type, "stbl", 4) || (!memcmp(type, "minf", 4) && *video_handler))) {
+			if(!fastimageVideoTrak(cursor, size, depth+1, track, video_handler)) return false;
+
+			continue;
+		}
+
+		// Version and flags, times, track ID, duration, layer..., matrix, then 16.16 width and height
+		if(!memcmp(type, "tkhd", 4) && size >= 84) {
+			size_t head_size = (size >= 96)?96:84;
+			const unsigned char *matrix = body+40;
+
+			if(!fastimageCursorRead(cursor, body, head_size)) return false;
+			size -= head_size;
+
+			// 64-bit times and duration in version 1
+			if(body[0] == 1) matrix += 12;
+
+			if(matrix+44 <= body+head_size) {
+				track->width = fastimageBe32(matrix+36)>>16;
+				track->height = fastimageBe32(matrix+40)>>16;
+
+				// Rotation is the usual matrix of 90 degree steps
+				if(!fastimageBe32(matrix) && fastimageBe32(matrix+4) == 0x10000) track->rotation = 90;
+				else if(fastimageBe32(matrix) == 0xFFFF0000 && !fastimageBe32(matrix+4)) track->rotation = 180;
+				else if(!fastimageBe32(matrix) && fastimageBe32(matrix+4) == 0xFFFF0000) track->rotation = 270;
+			}
+		} else if(!memcmp(type, "hdlr", 4) && depth == 2 && size >= 12) {
+			// Version and flags, pre_defined (component type of QuickTime), handler type
+			if(!fastimageCursorRead(cursor, body, 12)) return false;
+			size -= 12;
+
+			*video_handler = !memcmp(body+8, "vide", 4);
+		} else if(!memcmp(type, "stsd", 4) && size >= 44) {
+			// Version and flags, entry count, the first sample entry: size, format, reserved, data reference,
+			// version, revision, vendor, qualities, then width and height
+			if(!fastimageCursorRead(cursor, body, 44)) return false;
+			size -= 44;
+
+			if(fastimageBe32(body+4) && !track->codec[0]) {
+				fastimageVideoFourcc(track, body+12);
+				track->coded_width = fastimageBe16(body+40);
+				track->coded_height = fastimageBe16(body+42);
+			}
+		}
+
+		if(!fastimageCursorSkip(cursor, size)) return false;
+	}
+
+	return true;
+}
+
+// Top level boxes after ftyp, or from the first box of QuickTime file without it. moov may be after mdat
+static int fastimageReadMp4(const fastimage_reader_t *reader, int format, fastimage_video_t *video)
+{
+	fastimage_cursor_t cursor;
+	unsigned char type[4];
+	uint64_t left = UINT64_MAX, size, moov_left;
+	fastimage_video_t track;
+	bool video_handler;
+
+	fastimageCursorInit(&cursor, reader, FASTIMAGE_VIDEO_LIMIT, false);
+
+	while(1) {
+		if(!fastimageVideoBox(&cursor, &left, type, &size)) return fastimage_error;
+
+		if(memcmp(type, "moov", 4)) {
+			if(!fastimageCursorSkip(&cursor, size)) return fastimage_error;
+
+			continue;
+		}
+
+		moov_left = size;
+		fastimageCursorWindow(&cursor, moov_left);
+
+		while(moov_left) {
+			if(!fastimageVideoBox(&cursor, &moov_left, type, &size)) return fastimage_error;
+
+			if(!memcmp(type, "trak", 4)) {
+				memset(&track, 0, sizeof(fastimage_video_t));
+				video_handler = false;
+
+				if(!fastimageVideoTrak(&cursor, size, 1, &track, &video_handler)) return fastimage_error;
+
+				// The first video track is reported, others are only counted
+				if(video_handler && track.codec[0]) {
+					if(!video->tracks) *video = track;
+					video->tracks++;
+				}
+			} else if(!fastimageCursorSkip(&cursor, size)) return fastimage_error;
+		}
+
+		break;
+	}
+
+	// Coded size when tkhd has none
+	if(!video->width || !video->height) {
+		video->width = video->coded_width;
+		video->height = video->coded_height;
+	}
+
+	return format;
+}
+
+#define EBML_UNKNOWN_SIZE UINT64_MAX
+
+// EBML variable size integer. Element IDs keep their marker bits, sizes don't (all ones is unknown size)
+static bool fastimageEbmlVint(fastimage_cursor_t *cursor, bool id, uint64_t *value, uint64_t *length)
+{
+	unsigned char rest[7];
+	int c, size, i;
+	bool unknown;
+
+	if((c = fastimageCursorByte(cursor)) <= 0) return false;
+
+	for(size = 1; !(c&(0x80>>(size-1))); size++);
+	if(id && size > 4) return false;
+
+	*value = id?(uint64_t)c:(uint64_t)(c&(0xFF>>size));
+	unknown = (*value == (uint64_t)(0xFF>>size));
+
+	if(size > 1 && !fastimageCursorRead(cursor, rest, (size_t)size-1)) return false;
+
+	for(i = 0; i < size-1; i++) {
+		*value = (*value<<8)|rest[i];
+		unknown = unknown && rest[i] == 0xFF;
+	}
+
+	if(!id && unknown) *value = EBML_UNKNOWN_SIZE;
+	*length += (uint64_t)size;
+
+	return true;
+}
+
+// Element of parent with *left bytes (unknown size parent is never decreased)
+static bool fastimageEbmlElement(fastimage_cursor_t *cursor, uint64_t *left, uint32_t *id, uint64_t *size)
+{
+	uint64_t value, length = 0;
+
+	if(*left < 2 || !fastimageEbmlVint(cursor, true, &value, &length) || !fastimageEbmlVint(cursor, false, size, &length)) return false;
+
+	*id = (uint32_t)value;
+
+	if(*left == EBML_UNKNOWN_SIZE) return true;
+
+	// Only master elements have unknown size, it's up to the end of parent then
+	if(*size == EBML_UNKNOWN_SIZE) *size = *left-length;
+	if(length > *left || *size > *left-length) return false;
+
+	*left -= length+*size;
+
+	return true;
+}
+
+static bool fastimageEbmlUint(fastimage_cursor_t *cursor, uint64_t size, uint64_t *value)
+{
+	unsigned char data[8];
+
+	if(size > 8 || !fastimageCursorRead(cursor, data, (size_t)size)) return false;
+
+	*value = fastimageBeN(data, (size_t)size);
+
+	return true;
+}
+
+// String element, cut to buffer
+static bool fastimageEbmlString(fastimage_cursor_t *cursor, uint64_t size, char *string, size_t string_size)
+{
+	size_t part = (size < string_size-1)?(size_t)size:string_size-1;
+
+	if(!fastimageCursorRead(cursor, (unsigned char *)string, part)) return false;
+	string[part] = 0;
+
+	return fastimageCursorSkip(cursor, size-part);
+}
+
+#define MATROSKA_EBML_DOCTYPE 0x4282
+#define MATROSKA_SEGMENT 0x18538067
+#define MATROSKA_CLUSTER 0x1F43B675
+#define MATROSKA_TRACKS 0x1654AE6B
+#define MATROSKA_TRACK_ENTRY 0xAE
+#define MATROSKA_TRACK_TYPE 0x83
+#define MATROSKA_CODEC_ID 0x86
+#define MATROSKA_CODEC_PRIVATE 0x63A2
+#define MATROSKA_VIDEO 0xE0
+#define MATROSKA_PIXEL_WIDTH 0xB0
+#define MATROSKA_PIXEL_HEIGHT 0xBA
+#define MATROSKA_PIXEL_CROP_BOTTOM 0x54AA
+#define MATROSKA_PIXEL_CROP_TOP 0x54BB
+#define MATROSKA_PIXEL_CROP_LEFT 0x54CC
+#define MATROSKA_PIXEL_CROP_RIGHT 0x54DD
+#define MATROSKA_DISPLAY_WIDTH 0x54B0
+#define MATROSKA_DISPLAY_HEIGHT 0x54BA
+#define MATROSKA_DISPLAY_UNIT 0x54B2
+
+// CodecID of Matroska to FourCC of ISOBMFF sample entry
+static const char *const fastimage_matroska_codecs[][2] = {
+	{"V_MPEG4/ISO/AVC", "avc1"},
+	{"V_MPEGH/ISO/HEVC", "hvc1"},
+	{"V_MPEGI/ISO/VVC", "vvc1"},
+	{"V_AV1", "av01"},
+	{"V_VP8", "vp08"},
+	{"V_VP9", "vp09"},
+	{"V_MPEG4/ISO/", "mp4v"}, // SP, ASP and AP
+	{"V_MPEG2", "mp2v"},
+	{"V_MPEG1", "mp1v"},
+	{"V_THEORA", "theo"},
+	{"V_FFV1", "FFV1"}
+};
+
+// One TrackEntry, video is filled only if it's a video track
+static bool fastimageMatroskaTrack(fastimage_cursor_t *cursor, uint64_t left, fastimage_video_t *video, bool *is_video)
+{
+	uint64_t size, value, video_left, crop[4] = {0, 0, 0, 0}, display_width = 0, display_height = 0, display_unit = 0;
+	unsigned char private_data[20];
+	size_t private_size = 0, i;
+	uint32_t id;
+
+	*is_video = false;
+
+	while(left) {
+		if(!fastimageEbmlElement(cursor, &left, &id, &size)) return false;
+
+		if(id == MATROSKA_TRACK_TYPE) {
+			if(!fastimageEbmlUint(cursor, size, &value)) return false;
+
+			*is_video = (value == 1);
+		} else if(id == MATROSKA_CODEC_ID) {
+			if(!fastimageEbmlString(cursor, size, video->codec_id, sizeof(video->codec_id))) return false;
+		} else if(id == MATROSKA_CODEC_PRIVATE) {
+			// Only the start, for FourCC
+			private_size = (size < sizeof(private_data))?(size_t)size:sizeof(private_data);
+
+			if(!fastimageCursorRead(cursor, private_data, private_size) || !fastimageCursorSkip(cursor, size-private_size)) return false;
+		} else if(id == MATROSKA_VIDEO) {
+			video_left = size;
+
+			while(video_left) {
+				if(!fastimageEbmlElement(cursor, &video_left, &id, &size)) return false;
+
+				if(id == MATROSKA_PIXEL_WIDTH || id == MATROSKA_PIXEL_HEIGHT || id == MATROSKA_DISPLAY_WIDTH || id == MATROSKA_DISPLAY_HEIGHT || id == MATROSKA_DISPLAY_UNIT ||
+					id == MATROSKA_PIXEL_CROP_BOTTOM || id == MATROSKA_PIXEL_CROP_TOP || id == MATROSKA_PIXEL_CROP_LEFT || id == MATROSKA_PIXEL_CROP_RIGHT) {
+					if(!fastimageEbmlUint(cursor, size, &value)) return false;
+
+					if(value > UINT32_MAX) value = 0;
+
+					switch(id) {
+						case MATROSKA_PIXEL_WIDTH: video->coded_width = (size_t)value; break;
+						case MATROSKA_PIXEL_HEIGHT: video->coded_height = (size_t)value; break;
+						case MATROSKA_DISPLAY_WIDTH: display_width = value; break;
+						case MATROSKA_DISPLAY_HEIGHT: display_height = value; break;
+						case MATROSKA_DISPLAY_UNIT: display_unit = value; break;
+						case MATROSKA_PIXEL_CROP_BOTTOM: crop[0] = value; break;
+						case MATROSKA_PIXEL_CROP_TOP: crop[1] = value; break;
+						case MATROSKA_PIXEL_CROP_LEFT: crop[2] = value; break;
+						default: crop[3] = value;
+					}
+				} else if(!fastimageCursorSkip(cursor, size)) return false;
+			}
+		} else if(!fastimageCursorSkip(cursor, size)) return false;
+	}
+
+	if(!*is_video) return true;
+
+	for(i = 0; i < sizeof(fastimage_matroska_codecs)/sizeof(fastimage_matroska_codecs[0]); i++)
+		if(!strncmp(video->codec_id, fastimage_matroska_codecs[i][0], strlen(fastimage_matroska_codecs[i][0]))) {
+			memcpy(video->codec, fastimage_matroska_codecs[i][1], 5);
+			break;
+		}
+
+	// FourCC is in CodecPrivate: BITMAPINFOHEADER of VfW, sample description of QuickTime, FourCC alone for ProRes
+	if(!strcmp(video->codec_id, "V_MS/VFW/FOURCC") && private_size >= 20)
+		fastimageVideoFourcc(video, private_data+16);
+	else if(!strcmp(video->codec_id, "V_QUICKTIME") && private_size >= 8)
+		fastimageVideoFourcc(video, private_data+4);
+	else if(!strcmp(video->codec_id, "V_PRORES") && private_size >= 4)
+		fastimageVideoFourcc(video, private_data);
+
+	// Display size defaults to cropped pixel size, it's only aspect ratio for units other than pixels
+	if(crop[0]+crop[1] < video->coded_height && crop[2]+crop[3] < video->coded_width) {
+		video->width = video->coded_width-(size_t)(crop[2]+crop[3]);
+		video->height = video->coded_height-(size_t)(crop[0]+crop[1]);
+	}
+
+	if(display_width && display_height) {
+		if(!display_unit) {
+			video->width = (size_t)display_width;
+			video->height = (size_t)display_height;
+		} else if(display_unit == 3 && video->height)
+			video->width = (size_t)((uint64_t)video->height*display_width/display_height);
+	}
+
+	return true;
+}
+
+// EBML header after its ID, then with video: Segment up to Tracks
+static int fastimageReadMatroska(const fastimage_reader_t *reader, fastimage_video_t *video)
+{
+	fastimage_cursor_t cursor;
+	fastimage_video_t track;
+	uint64_t left, length = 0, size, tracks_left;
+	uint32_t id;
+	char doctype[16] = "";
+	int format;
+	bool is_video;
+
+	fastimageCursorInit(&cursor, reader, FASTIMAGE_VIDEO_LIMIT, false);
+
+	if(!fastimageEbmlVint(&cursor, false, &left, &length) || left == EBML_UNKNOWN_SIZE) return fastimage_error;
+
+	fastimageCursorWindow(&cursor, left);
+
+	// DocType defaults to matroska
+	while(left) {
+		if(!fastimageEbmlElement(&cursor, &left, &id, &size)) return fastimage_error;
+
+		if(id == MATROSKA_EBML_DOCTYPE) {
+			if(!fastimageEbmlString(&cursor, size, doctype, sizeof(doctype))) return fastimage_error;
+		} else if(!fastimageCursorSkip(&cursor, size)) return fastimage_error;
+	}
+
+	if(!strcmp(doctype, "webm")) format = fastimage_webm;
+	else if(!doctype[0] || !strcmp(doctype, "matroska")) format = fastimage_mkv;
+	else format = fastimage_unknown;
+
+	if(!video || format == fastimage_unknown) return format;
+
+	left = EBML_UNKNOWN_SIZE;
+	if(!fastimageEbmlElement(&cursor, &left, &id, &size) || id != MATROSKA_SEGMENT) return fastimage_error;
+
+	// Tracks come before clusters, clusters of unknown size (live streams) can't be skipped
+	left = size;
+
+	while(1) {
+		if(!fastimageEbmlElement(&cursor, &left, &id, &size)) return fastimage_error;
+
+		if(id == MATROSKA_TRACKS) break;
+
+		if(size == EBML_UNKNOWN_SIZE || !fastimageCursorSkip(&cursor, size)) return fastimage_error;
+	}
+
+	tracks_left = size;
+	if(tracks_left == EBML_UNKNOWN_SIZE) return fastimage_error;
+
+	fastimageCursorWindow(&cursor, tracks_left);
+
+	while(tracks_left) {
+		if(!fastimageEbmlElement(&cursor, &tracks_left, &id, &size)) return fastimage_error;
+
+		if(id != MATROSKA_TRACK_ENTRY) {
+			if(!fastimageCursorSkip(&cursor, size)) return fastimage_error;
+
+			continue;
+		}
+
+		memset(&track, 0, sizeof(fastimage_video_t));
+
+		if(!fastimageMatroskaTrack(&cursor, size, &track, &is_video)) return fastimage_error;
+
+		// The first video track is reported, others are only counted
+		if(is_video) {
+			if(!video->tracks) *video = track;
+			video->tracks++;
+		}
+	}
+
+	return format;
+}
+
+static void fastimageReadSvg(const fastimage_reader_t *reader, const unsigned char *sign, fastimage_image_t *image, int level);
+
+static bool fastimageSvgSign(const unsigned char *sign)
+{
+	return sign[0] == '<' || sign[0] == ' ' || sign[0] == '\t' || sign[0] == '\r' || sign[0] == '\n' ||
+		!memcmp(sign, "\xEF\xBB\xBF", 3) || !memcmp(sign, "\x1F\x8B\x08", 3);
+}
+
+static fastimage_image_t fastimageProbe(const fastimage_reader_t *reader, int level, int *verify, fastimage_hints_t *hints)
+{
+	fastimage_image_t image;
+	fastimage_heif_t heif;
+	unsigned char sign[4];
+	bool verify_stream;
+	
+	memset(&image, 0, sizeof(fastimage_image_t));
+	if(hints) memset(hints, 0, sizeof(fastimage_hints_t));
+
+	// Verify is full level with check of the whole stream at the end
+	verify_stream = (level == fastimage_level_verify);
+	if(verify_stream) level = fastimage_level_full;
+	if(verify) *verify = fastimage_verify_none;
+	
+	if(reader->read(reader->context, 4, sign) != 4) {
+		image.format = fastimage_error;
+		
+		return image;
+	}
+	
+	image.format = fastimageMatchSign(sign);
+	if(image.format == fastimage_pnm && !fastimagePnmSign(sign))
+		image.format = fastimage_unknown;
+
+	// XML text (maybe after BOM or spaces) or gzip, both are read up to the root element
+	if(image.format == fastimage_unknown && fastimageSvgSign(sign)) {
+		fastimageReadSvg(reader, sign, &image, level);
+
+		// ISOBMFF detection needs the stream after signature, it is left out if reader can't go back
+		if(image.format == fastimage_unknown && !reader->seek(reader->context, 4, false))
+			return image;
+	}
+
+	// Try to detect HEIF or AVIF
+	if(image.format == fastimage_unknown)
+		fastimageDetectISOBMFF(reader, sign, &image, level); // Should be last, because we read some data here
+
+	// RIFF is a container, only its form type tells webp from ani
+	if(image.format == fastimage_webp && level == fastimage_level_format)
+		fastimageReadWebp(reader, sign, &image, level, hints);
+
+	// EBML header tells mkv from webm
+	if(image.format == fastimage_mkv && level == fastimage_level_format)
+		image.format = fastimageReadMatroska(reader, 0);
+
+	// Cur or TGA, see fastimageReadIco
+	if(image.format == fastimage_cur && level == fastimage_level_format) {
+		unsigned char count[2];
+
+		if(reader->read(reader->context, 2, count) != 2)
+			image.format = fastimage_error;
+		else if(!count[0] && !count[1])
+			image.format = fastimage_tga;
+	}
+
+	// Version of KTX is in the rest of identifier
+	if(image.format == fastimage_ktx && level == fastimage_level_format) {
+		unsigned char identifier[KTX_IDENTIFIER_SIZE];
+
+		memcpy(identifier, sign, 4);
+
+		if(reader->read(reader->context, KTX_IDENTIFIER_SIZE-4, identifier+4) != KTX_IDENTIFIER_SIZE-4)
+			image.format = fastimage_error;
+		else
+			image.format = fastimageKtxVersion(identifier);
+	}
+
+	if(level == fastimage_level_format)
+		return image;
+
+	// Hints are read only at full level
+	if(level != fastimage_level_full)
+		hints = 0;
+	
+	// Read BMP meta
+	if(image.format == fastimage_bmp)
+		fastimageReadBmp(reader, sign, &image);
+	
+	// Read TGA meta
+	if(image.format == fastimage_tga)
+		fastimageReadTga(reader, sign, &image);
+	
+	// Read PCX meta
+	if(image.format == fastimage_pcx)
+		fastimageReadPcx(reader, sign, &image);
+	
+	// Read PNG meta
+	if(image.format == fastimage_png)
+		fastimageReadPng(reader, sign, &image, hints);
+	
+	// Read GIF meta
+	if(image.format == fastimage_gif)
+		fastimageReadGif(reader, sign, &image);
+	
+	// Read WEBP meta
+	if(image.format == fastimage_webp)
+		fastimageReadWebp(reader, sign, &image, level, hints);
+	
+	// Read HEIC or AVIF meta
+	if(image.format == fastimage_heic || image.format == fastimage_avif || image.format == fastimage_miaf)
+		fastimageReadISOBMFF(reader, sign, &image, level, hints, &heif);
+	
+	// Read JPG meta
+	if(image.format == fastimage_jpg)
+		fastimageReadJpeg(reader, sign, &image, hints);
+	
+	if(image.format == fastimage_qoi || image.format == fastimage_qoy)
+		fastimageReadQoi(reader, sign, &image);
+	
+	if(image.format == fastimage_ico || image.format == fastimage_cur)
+		fastimageReadIco(reader, sign, &image);
+
+	// Read DDS, KTX, PVR or ASTC header
+	if(image.format == fastimage_dds || image.format == fastimage_ktx || image.format == fastimage_pvr || image.format == fastimage_astc) {
+		fastimage_texture_t texture;
+
+		image.format = fastimageReadTexture(reader, sign, image.format, &texture);
+		image.width = texture.width;
+		image.height = texture.height;
+		image.channels = texture.channels;
+		image.bitsperpixel = texture.bitsperpixel;
+	}
+
+	if(image.format == fastimage_exr)
+		fastimageReadExr(reader, sign, &image, hints);
+
+	if(image.format == fastimage_hdr)
+		fastimageReadHdr(reader, sign, &image, hints);
+
+	if(image.format == fastimage_psd)
+		fastimageReadPsd(reader, sign, &image, hints);
+
+	if(image.format == fastimage_pnm)
+		fastimageReadPnm(reader, sign, &image, hints);
+
+	if(image.format == fastimage_farbfeld)
+		fastimageReadFarbfeld(reader, sign, &image, hints);
+
+	// Display size of the first video track
+	if(image.format == fastimage_mp4 || image.format == fastimage_mov || image.format == fastimage_mkv) {
+		fastimage_video_t video;
+
+		memset(&video, 0, sizeof(fastimage_video_t));
+
+		if(image.format == fastimage_mkv)
+			image.format = fastimageReadMatroska(reader, &video);
+		else
+			image.format = fastimageReadMp4(reader, image.format, &video);
+
+		if(image.format != fastimage_error) {
+			image.width = video.width;
+			image.height = video.height;
+		}
+	}
+
+	if(hints) {
+		if(image.format == fastimage_png)
+			fastimagePngHints(reader, hints);
+		else if(image.format == fastimage_gif)
+			fastimageGifHints(reader, hints);
+		else if((image.format == fastimage_qoi || image.format == fastimage_qoy || image.format == fastimage_tga || image.format == fastimage_ico || image.format == fastimage_cur) && image.channels == 4)
+			hints->flags |= fastimage_hint_alpha; // Alpha channel is all these headers tell
+	}
+
+	if(verify_stream) {
+		int result = fastimageVerify(reader, image.format);
+
+		if(verify) *verify = result;
+
+		if(result == fastimage_verify_truncated || result == fastimage_verify_corrupt) {
+			memset(&image, 0, sizeof(fastimage_image_t));
+			image.format = fastimage_error;
+		}
+	}
+
+	if(hints && image.format == fastimage_error)
+		memset(hints, 0, sizeof(fastimage_hints_t));
+	
+	return image;
+}
+
+fastimage_image_t fastimageOpen(const fastimage_reader_t *reader)
+{
+	return fastimageProbe(reader, fastimage_level_full, 0, 0);
+}
+
+static const char *fastimage_format_names[FASTIMAGE_FORMATS_NUM] = {
+	"error", "unknown", "bmp", "tga", "pcx", "png", "gif", "webp", "heic", "jpg",
+	"avif", "miaf", "qoi", "qoy", "ani", "ico", "cur", "svg", "dds", "ktx", "ktx2", "pvr", "astc",
+	"exr", "hdr", "psd", "pnm", "farbfeld", "mp4", "mov", "mkv", "webm"
+};
+
+const char *fastimageFormatName(int format)
+{
+	if(format < 0 || format >= FASTIMAGE_FORMATS_NUM) return "other";
+
+	return fastimage_format_names[format];
+}
+
+#define FASTIMAGE_XXH_P1 0x9E3779B185EBCA87ULL
+#define FASTIMAGE_XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define FASTIMAGE_XXH_P3 0x165667B19E3779F9ULL
+#define FASTIMAGE_XXH_P4 0x85EBCA77C2B2AE63ULL
+#define FASTIMAGE_XXH_P5 0x27D4EB2F165667C5ULL
+#define FASTIMAGE_FINGERPRINT_PREFIX 65536
+#define FASTIMAGE_FINGERPRINT_CHUNK 16384
+
+// Streaming XXH64
+typedef struct {
+	uint64_t total;
+	uint64_t v[4];
+	unsigned char mem[32];
+	size_t mem_size;
+} fastimage_xxh64_t;
+
+static uint64_t fastimageRotl64(uint64_t value, int bits)
+{
+	return (value<<bits)|(value>>(64-bits));
+}
+
+static uint64_t fastimageXxh64Round(uint64_t acc, uint64_t input)
+{
+	acc += input*FASTIMAGE_XXH_P2;
+	acc = fastimageRotl64(acc, 31);
+
+	return acc*FASTIMAGE_XXH_P1;
+}
+
+static uint64_t fastimageXxh64Merge(uint64_t acc, uint64_t value)
+{
+	acc ^= fastimageXxh64Round(0, value);
+
+	return acc*FASTIMAGE_XXH_P1+FASTIMAGE_XXH_P4;
+}
+
+static void fastimageXxh64Init(fastimage_xxh64_t *state)
+{
+	memset(state, 0, sizeof(fastimage_xxh64_t));
+
+	state->v[0] = FASTIMAGE_XXH_P1+FASTIMAGE_XXH_P2;
+	state->v[1] = FASTIMAGE_XXH_P2;
+	state->v[2] = 0;
+	state->v[3] = 0-FASTIMAGE_XXH_P1;
+}
+
+static void fastimageXxh64Stripe(fastimage_xxh64_t *state, const unsigned char *p)
+{
+	state->v[0] = fastimageXxh64Round(state->v[0], fastimageLe64(p));
+	state->v[1] = fastimageXxh64Round(state->v[1], fastimageLe64(p+8));
+	state->v[2] = fastimageXxh64Round(state->v[2], fastimageLe64(p+16));
+	state->v[3] = fastimageXxh64Round(state->v[3], fastimageLe64(p+24));
+}
+
+static void fastimageXxh64Update(fastimage_xxh64_t *state, const unsigned char *p, size_t size)
+{
+	state->total += size;
+
+	if(state->mem_size+size < 32) {
+		memcpy(state->mem+state->mem_size, p, size);
+		state->mem_size += size;
+
+		return;
+	}
+
+	if(state->mem_size) {
+		size_t part = 32-state->mem_size;
+
+		memcpy(state->mem+state->mem_size, p, part);
+		fastimageXxh64Stripe(state, state->mem);
+		p += part;
+		size -= part;
+		state->mem_size = 0;
+	}
+
+	while(size >= 32) {
+		fastimageXxh64Stripe(state, p);
+		p += 32;
+		size -= 32;
+	}
+
+	memcpy(state->mem, p, size);
+	state->mem_size = size;
+}
+
+static uint64_t fastimageXxh64Digest(const fastimage_xxh64_t *state)
+{
+	const unsigned char *p = state->mem;
+	size_t size = state->mem_size;
+	uint64_t h;
+
+	if(state->total >= 32) {
+		h = fastimageRotl64(state->v[0], 1)+fastimageRotl64(state->v[1], 7)+fastimageRotl64(state->v[2], 12)+fastimageRotl64(state->v[3], 18);
+		h = fastimageXxh64Merge(h, state->v[0]);
+		h = fastimageXxh64Merge(h, state->v[1]);
+		h = fastimageXxh64Merge(h, state->v[2]);
+		h = fastimageXxh64Merge(h, state->v[3]);
+	} else
+		h = state->v[2]+FASTIMAGE_XXH_P5;
+
+	h += state->total;
+
+	for(; size >= 8; p += 8, size -= 8) {
+		h ^= fastimageXxh64Round(0, fastimageLe64(p));
+		h = fastimageRotl64(h, 27)*FASTIMAGE_XXH_P1+FASTIMAGE_XXH_P4;
+	}
+
+	if(size >= 4) {
+		h ^= (uint64_t)fastimageLe32(p)*FASTIMAGE_XXH_P1;
+		h = fastimageRotl64(h, 23)*FASTIMAGE_XXH_P2+FASTIMAGE_XXH_P3;
+		p += 4;
+		size -= 4;
+	}
+
+	for(; size; p++, size--) {
+		h ^= (*p)*FASTIMAGE_XXH_P5;
+		h = fastimageRotl64(h, 11)*FASTIMAGE_XXH_P1;
+	}
+
+	h ^= h>>33;
+	h *= FASTIMAGE_XXH_P2;
+	h ^= h>>29;
+	h *= FASTIMAGE_XXH_P3;
+	h ^= h>>32;
+
+	return h;
+}
+
+typedef struct {
+	const fastimage_reader_t *reader;
+	const fastimage_options_t *options;
+	uint64_t deadline;
+	fastimage_stats_t stats;
+	// Fingerprint, bytes [0, hashed) are hashed, reader is at pos
+	fastimage_xxh64_t xxh;
+	uint64_t pos;
+	uint64_t hashed;
+	uint64_t hash_limit;
+	bool hash_eof;
+} fastimage_guard_context_t;
+
+static uint64_t fastimageTicks(void)
+{
+#if defined(_WIN32) && defined(__WATCOMC__)
+	return GetTickCount();
+#elif defined(_WIN32)
+	return GetTickCount64();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec*1000+(uint64_t)ts.tv_nsec/1000000;
+#endif
+}
+
+static bool fastimageGuardCheck(fastimage_guard_context_t *guard)
+{
+	if(guard->stats.abort_reason)
+		return false;
+
+	if(guard->options->cancel && *guard->options->cancel)
+		guard->stats.abort_reason = fastimage_abort_cancel;
+	else if(guard->deadline && fastimageTicks() >= guard->deadline)
+		guard->stats.abort_reason = fastimage_abort_timeout;
+
+	return !guard->stats.abort_reason;
+}
+
+// Reads from underlying reader, bytes not hashed yet are hashed
+static size_t fastimageGuardReadHashed(fastimage_guard_context_t *guard, size_t size, void *buf)
+{
+	uint64_t start = guard->pos;
+
+	size = guard->reader->read(guard->reader->context, size, buf);
+	guard->pos += size;
+
+	if(guard->hash_limit && start <= guard->hashed && guard->hashed < guard->pos && guard->hashed < guard->hash_limit) {
+		uint64_t end = (guard->pos < guard->hash_limit)?guard->pos:guard->hash_limit;
+
+		fastimageXxh64Update(&guard->xxh, (const unsigned char *)buf+(guard->hashed-start), (size_t)(end-guard->hashed));
+		guard->hashed = end;
+	}
+
+	return size;
+}
+
+// Reads everything between hashed and target, instead of seeking over it
+static bool fastimageGuardHashTo(fastimage_guard_context_t *guard, uint64_t target)
+{
+	unsigned char chunk[FASTIMAGE_FINGERPRINT_CHUNK];
+
+	if(target > guard->hash_limit) target = guard->hash_limit;
+
+	if(guard->hash_eof || guard->hashed >= target) return true;
+
+	if(guard->pos != guard->hashed) {
+		if(!guard->reader->seek(guard->reader->context, (int64_t)guard->hashed, false)) return false;
+
+		guard->pos = guard->hashed;
+	}
+
+	while(guard->hashed < target) {
+		size_t size = sizeof(chunk);
+
+		if(size > target-guard->hashed) size = (size_t)(target-guard->hashed);
+
+		if(fastimageGuardReadHashed(guard, size, chunk) != size) {
+			guard->hash_eof = true;
+			break;
+		}
+	}
+
+	return true;
+}
+
+static size_t FASTIMAGE_APIENTRY fastimageGuardRead(void *context, size_t size, void *buf)
+{
+	fastimage_guard_context_t *guard;
+
+	guard = (fastimage_guard_context_t *)context;
+
+	if(!fastimageGuardCheck(guard)) return 0;
+
+	if(guard->options->max_bytes && size > guard->options->max_bytes-guard->stats.bytes_read) {
+		guard->stats.abort_reason = fastimage_abort_bytes;
+
+		return 0;
+	}
+
+	size = fastimageGuardReadHashed(guard, size, buf);
+
+	guard->stats.reads++;
+	guard->stats.bytes_read += size;
+
+	return size;
+}
+
+static bool FASTIMAGE_APIENTRY fastimageGuardSeek(void *context, int64_t pos, bool seek_cur)
+{
+	fastimage_guard_context_t *guard;
+
+	guard = (fastimage_guard_context_t *)context;
+
+	if(!fastimageGuardCheck(guard)) return false;
+
+	if(guard->options->max_seeks && guard->stats.seeks >= guard->options->max_seeks) {
+		guard->stats.abort_reason = fastimage_abort_seeks;
+
+		return false;
+	}
+
+	guard->stats.seeks++;
+
+	if(seek_cur) pos += (int64_t)guard->pos;
+	if(pos < 0) return false;
+
+	// Skipped bytes are needed for hash anyway
+	if(guard->hash_limit && !fastimageGuardHashTo(guard, (uint64_t)pos)) return false;
+
+	if(guard->pos == (uint64_t)pos) return true;
+
+	if(!guard->reader->seek(guard->reader->context, pos, false)) return false;
+
+	guard->pos = (uint64_t)pos;
+
+	return true;
+}
+
+// Bytes the reader may still read, read ahead of header cursor stays within it
+static uint64_t fastimageBudget(const fastimage_reader_t *reader)
+{
+	fastimage_guard_context_t *guard;
+
+	if(reader->read != fastimageGuardRead) return UINT64_MAX;
+
+	guard = (fastimage_guard_context_t *)reader->context;
+
+	if(!guard->options->max_bytes) return UINT64_MAX;
+
+	return guard->options->max_bytes-guard->stats.bytes_read;
+}
+
+fastimage_image_t fastimageOpenEx(const fastimage_reader_t *reader, const fastimage_options_t *options)
+{
+	fastimage_guard_context_t guard;
+	fastimage_reader_t guard_reader;
+	fastimage_image_t image;
+	fastimage_fingerprint_t *fingerprint = 0;
+
+	if(!options)
+		return fastimageOpen(reader);
+
+	if(options->fingerprint && options->fingerprint->mode != fastimage_fingerprint_none)
+		fingerprint = options->fingerprint;
+
+	// Nothing to check, so don't wrap reader
+	if(!options->max_bytes && !options->max_seeks && !options->timeout_ms && !options->cancel && !options->stats && !fingerprint)
+		return fastimageProbe(reader, options->level, 0, options->hints);
+
+	memset(&guard, 0, sizeof(fastimage_guard_context_t));
+	guard.reader = reader;
+	guard.options = options;
+	if(options->timeout_ms)
+		guard.deadline = fastimageTicks()+options->timeout_ms;
+
+	if(fingerprint) {
+		fastimageXxh64Init(&guard.xxh);
+
+		if(fingerprint->mode == fastimage_fingerprint_full)
+			guard.hash_limit = UINT64_MAX;
+		else
+			guard.hash_limit = fingerprint->prefix_size?fingerprint->prefix_size:FASTIMAGE_FINGERPRINT_PREFIX;
+	}
+
+	// Every read and seek of parser goes through limits check
+	guard_reader.context = &guard;
+	guard_reader.read = fastimageGuardRead;
+	guard_reader.seek = fastimageGuardSeek;
+
+	image = fastimageProbe(&guard_reader, options->level, &guard.stats.verify, options->hints);
+
+	if(guard.stats.abort_reason) {
+		memset(&image, 0, sizeof(fastimage_image_t));
+		image.format = fastimage_error;
+		if(options->hints) memset(options->hints, 0, sizeof(fastimage_hints_t));
+	}
+
+	if(fingerprint) {
+		// Rest of hashed part, even if format is unknown
+		if(!guard.stats.abort_reason && fastimageGuardHashTo(&guard, guard.hash_limit)) {
+			if(fingerprint->mode == fastimage_fingerprint_full)
+				fingerprint->size = guard.hashed;
+			else if(fingerprint->size) {
+				unsigned char size[8];
+				int i;
+
+				for(i = 0; i < 8; i++)
+					size[i] = (unsigned char)(fingerprint->size>>(i*8));
+
+				fastimageXxh64Update(&guard.xxh, size, 8);
+			}
+
+			fingerprint->hash = fastimageXxh64Digest(&guard.xxh);
+		} else {
+			fingerprint->hash = 0;
+			memset(&image, 0, sizeof(fastimage_image_t));
+			image.format = fastimage_error;
+			if(options->hints) memset(options->hints, 0, sizeof(fastimage_hints_t));
+		}
+	}
+
+	if(options->stats)
+		*options->stats = guard.stats;
+
+	return image;
+}
+
+int fastimageIconsOpen(const fastimage_reader_t *reader, fastimage_icons_t *icons)
+{
+	unsigned char header[12];
+	size_t dir_size;
+
+	memset(icons, 0, sizeof(fastimage_icons_t));
+	icons->reader = reader;
+
+	if(reader->read(reader->context, 4, header) != 4) goto ICONS_ERROR;
+
+	icons->offset = 4;
+
+	if(!memcmp(header, "RIFF", 4)) {
+		if(reader->read(reader->context, 8, header+4) != 8) goto ICONS_ERROR;
+
+		icons->offset = 12;
+
+		if(memcmp(header+8, "ACON", 4))
+			icons->format = fastimage_unknown;
+		else
+			icons->format = fastimage_ani;
+
+		return icons->format;
+	}
+
+	if(header[0] || header[1] || header[3] || (header[2] != 1 && header[2] != 2)) {
+		icons->format = fastimage_unknown;
+
+		return icons->format;
+	}
+
+	if(reader->read(reader->context, 2, header+4) != 2) goto ICONS_ERROR;
+
+	icons->offset = 6;
+	icons->count = fastimageLe16(header+4);
+	if(!icons->count) { // Probably TGA
+		icons->format = fastimage_unknown;
+
+		return icons->format;
+	}
+
+	// Read whole ICONDIR at once
+	dir_size = icons->count*ICO_DIRENTRY_SIZE;
+
+	icons->dir = malloc(dir_size);
+	if(!icons->dir) goto ICONS_ERROR;
+
+	if(reader->read(reader->context, dir_size, icons->dir) != dir_size) goto ICONS_ERROR;
+
+	icons->offset += dir_size;
+	icons->format = (header[2] == 1)?(fastimage_ico):(fastimage_cur);
+
+	return icons->format;
+
+ICONS_ERROR:
+	if(icons->dir) free(icons->dir);
+	memset(icons, 0, sizeof(fastimage_icons_t));
+	icons->format = fastimage_error;
+
+	return icons->format;
+}
+
+static void fastimageIconsPeek(fastimage_icons_t *icons, fastimage_icon_t *icon)
+{
+	const fastimage_reader_t *reader = icons->reader;
+	unsigned char peek[ICO_PEEK_SIZE];
+	size_t peek_size;
+
+	if(icons->offset != icon->offset) {
+		if(!reader->seek(reader->context, (int64_t)icon->offset, false)) {
+			icons->offset = UINT64_MAX;
+
+			return;
+		}
+
+		icons->offset = icon->offset;
+	}
+
+	peek_size = reader->read(reader->context, ICO_PEEK_SIZE, peek);
+	icons->offset += peek_size;
+
+	if(peek_size != ICO_PEEK_SIZE) return;
+
+	if(!memcmp(peek, "\x89PNG\x0d\x0a\x1a\x0a", 8) && !memcmp(peek+12, "IHDR", 4)) {
+		unsigned int png_channels;
+
+		icon->payload = fastimage_icon_png;
+		icon->width = fastimageBe32(peek+16);
+		icon->height = fastimageBe32(peek+20);
+
+		switch(peek[25]) {
+			case 2: png_channels = 3; break;
+			case 4: png_channels = 2; break;
+			case 6: png_channels = 4; break;
+			default: png_channels = 1; // Grayscale or palette
+		}
+
+		icon->bitsperpixel = (unsigned int)(peek[24]) * png_channels;
+	} else if(fastimageLe32(peek) >= 40) { // BITMAPINFOHEADER or newer
+		int32_t bmp_width, bmp_height;
+
+		bmp_width = (int32_t)fastimageLe32(peek+4);
+		bmp_height = (int32_t)fastimageLe32(peek+8);
+
+		icon->payload = fastimage_icon_bmp;
+		icon->width = (bmp_width < 0)?(-(int64_t)bmp_width):(bmp_width);
+		icon->height = ((bmp_height < 0)?(-(int64_t)bmp_height):(bmp_height)) / 2; // XOR and AND masks
+		icon->bitsperpixel = fastimageLe16(peek+14);
+	}
+}
+
+static bool fastimageIconsNextAni(fastimage_icons_t *icons, fastimage_icon_t *icon)
+{
+	const fastimage_reader_t *reader = icons->reader;
+
+	while(1) {
+		unsigned char chunk_head[8];
+		uint64_t chunk_size;
+
+		if(icons->list_end && icons->offset >= icons->list_end)
+			icons->list_end = 0;
+
+		if(reader->read(reader->context, 8, chunk_head) != 8) return false;
+
+		icons->offset += 8;
+		chunk_size = fastimageLe32(chunk_head+4);
+
+		if(!memcmp(chunk_head, "LIST", 4) && chunk_size >= 4) {
+			unsigned char list_type[4];
+
+			if(reader->read(reader->context, 4, list_type) != 4) return false;
+
+			icons->offset += 4;
+			chunk_size -= 4;
+
+			if(!memcmp(list_type, "fram", 4)) { // Frames are subchunks, step into
+				icons->list_end = icons->offset + chunk_size;
+
+				continue;
+			}
+		} else if(!memcmp(chunk_head, "anih", 4) && chunk_size >= ANI_HEADER_SIZE) {
+			unsigned char anih[ANI_HEADER_SIZE];
+
+			if(reader->read(reader->context, ANI_HEADER_SIZE, anih) != ANI_HEADER_SIZE) return false;
+
+			icons->offset += ANI_HEADER_SIZE;
+			chunk_size -= ANI_HEADER_SIZE;
+
+			icons->count = fastimageLe32(anih+4);
+			icons->ani_width = fastimageLe32(anih+12);
+			icons->ani_height = fastimageLe32(anih+16);
+			icons->ani_bitsperpixel = fastimageLe32(anih+20);
+			icons->ani_flags = fastimageLe32(anih+32);
+		} else if(icons->list_end && !memcmp(chunk_head, "icon", 4)) {
+			// Report frame without reading it
+			icon->width = icons->ani_width;
+			icon->height = icons->ani_height;
+			icon->bitsperpixel = icons->ani_bitsperpixel;
+			icon->payload = (icons->ani_flags & 1)?(fastimage_icon_ico):(fastimage_icon_bmp);
+			icon->offset = icons->offset;
+			icon->size = chunk_size;
+
+			icons->index++;
+			icons->offset += chunk_size + (chunk_size & 1);
+
+			if(!reader->seek(reader->context, (int64_t)icons->offset, false))
+				icons->format = fastimage_error;
+
+			return true;
+		}
+
+		// Skip the rest of chunk, chunks are word aligned
+		chunk_size += chunk_size & 1;
+
+		if(chunk_size) {
+			icons->offset += chunk_size;
+
+			if(!reader->seek(reader->context, (int64_t)icons->offset, false)) return false;
+		}
+	}
+}
+
+bool fastimageIconsNext(fastimage_icons_t *icons, fastimage_icon_t *icon)
+{
+	unsigned char *entry;
+
+	memset(icon, 0, sizeof(fastimage_icon_t));
+
+	if(icons->format == fastimage_ani)
+		return fastimageIconsNextAni(icons, icon);
+
+	if(icons->format != fastimage_ico && icons->format != fastimage_cur)
+		return false;
+
+	if(icons->index >= icons->count)
+		return false;
+
+	entry = icons->dir + icons->index*ICO_DIRENTRY_SIZE;
+	icons->index++;
+
+	icon->width = entry[0];
+	if(!icon->width) icon->width = 256;
+	icon->height = entry[1];
+	if(!icon->height) icon->height = 256;
+
+	if(icons->format == fastimage_cur) {
+		icon->hotspot_x = fastimageLe16(entry+4);
+		icon->hotspot_y = fastimageLe16(entry+6);
+	} else
+		icon->bitsperpixel = fastimageLe16(entry+6);
+
+	if(!icon->bitsperpixel && entry[2]) { // Guess from number of colors
+		if(entry[2] <= 2) icon->bitsperpixel = 1;
+		else if(entry[2] <= 16) icon->bitsperpixel = 4;
+		else icon->bitsperpixel = 8;
+	}
+
+	icon->size = fastimageLe32(entry+8);
+	icon->offset = fastimageLe32(entry+12);
+
+	// Only the payload header, to tell PNG from BMP and get real size
+	fastimageIconsPeek(icons, icon);
+
+	return true;
+}
+
+void fastimageIconsClose(fastimage_icons_t *icons)
+{
+	if(icons->dir) free(icons->dir);
+
+	memset(icons, 0, sizeof(fastimage_icons_t));
+}
+
+int fastimageTextureOpen(const fastimage_reader_t *reader, fastimage_texture_t *texture)
+{
+	unsigned char sign[4];
+	int format;
+
+	memset(texture, 0, sizeof(fastimage_texture_t));
+
+	if(reader->read(reader->context, 4, sign) != 4) return fastimage_error;
+
+	format = fastimageMatchSign(sign);
+	if(format != fastimage_dds && format != fastimage_ktx && format != fastimage_pvr && format != fastimage_astc)
+		return fastimage_unknown;
+
+	return fastimageReadTexture(reader, sign, format, texture);
+}
+
+int fastimageVideoOpen(const fastimage_reader_t *reader, fastimage_video_t *video)
+{
+	fastimage_image_t image;
+	unsigned char sign[4];
+
+	memset(video, 0, sizeof(fastimage_video_t));
+	memset(&image, 0, sizeof(fastimage_image_t));
+
+	if(reader->read(reader->context, 4, sign) != 4) return fastimage_error;
+
+	image.format = fastimageMatchSign(sign);
+	if(image.format == fastimage_mkv)
+		image.format = fastimageReadMatroska(reader, video);
+	else if(image.format == fastimage_unknown) {
+		fastimageDetectISOBMFF(reader, sign, &image, fastimage_level_full);
+
+		if(image.format != fastimage_mp4 && image.format != fastimage_mov) return fastimage_unknown;
+
+		image.format = fastimageReadMp4(reader, image.format, video);
+	} else
+		return fastimage_unknown;
+
+	if(image.format == fastimage_error) memset(video, 0, sizeof(fastimage_video_t));
+
+	return image.format;
+}
+
+int fastimageHeifOpen(const fastimage_reader_t *reader, fastimage_heif_t *heif)
+{
+	fastimage_image_t image;
+	unsigned char sign[4];
+
+	memset(heif, 0, sizeof(fastimage_heif_t));
+	memset(&image, 0, sizeof(fastimage_image_t));
+
+	if(reader->read(reader->context, 4, sign) != 4) return fastimage_error;
+
+	if(fastimageMatchSign(sign) != fastimage_unknown) return fastimage_unknown;
+
+	fastimageDetectISOBMFF(reader, sign, &image, fastimage_level_full);
+	if(image.format != fastimage_heic && image.format != fastimage_avif && image.format != fastimage_miaf)
+		return fastimage_unknown;
+
+	fastimageReadISOBMFF(reader, sign, &image, fastimage_level_full, 0, heif);
+	if(image.format == fastimage_error) {
+		memset(heif, 0, sizeof(fastimage_heif_t));
+
+		return fastimage_error;
+	}
+
+	return image.format;
+}
+
+static size_t FASTIMAGE_APIENTRY fastimageFileRead(void *context, size_t size, void *buf)
+{
+	return fread(buf, 1, size, context);
+}
+
+static bool FASTIMAGE_APIENTRY fastimageFileSeek(void *context, int64_t pos, bool seek_cur)
+{
+#if defined(_WIN32)
+	return _fseeki64(context, pos, seek_cur?(SEEK_CUR):(SEEK_SET)) == 0;
+#else
+	return fseeko64(context, pos, seek_cur?(SEEK_CUR):(SEEK_SET)) == 0;
+#endif
+}
+
+fastimage_image_t fastimageOpenFile(FILE *f)
+{
+	return fastimageOpenFileEx(f, 0);
+}
+
+fastimage_image_t fastimageOpenFileEx(FILE *f, const fastimage_options_t *options)
+{
+	fastimage_reader_t reader;
+
+	// Size from current position, for prefix fingerprint
+	if(options && options->fingerprint && options->fingerprint->mode == fastimage_fingerprint_prefix) {
+		int64_t start, end = -1;
+
+#if defined(_WIN32)
+		start = _ftelli64(f);
+		if(start >= 0 && !_fseeki64(f, 0, SEEK_END)) end = _ftelli64(f);
+		if(start >= 0) _fseeki64(f, start, SEEK_SET);
+#else
+		start = ftello64(f);
+		if(start >= 0 && !fseeko64(f, 0, SEEK_END)) end = ftello64(f);
+		if(start >= 0) fseeko64(f, start, SEEK_SET);
+#endif
+
+		options->fingerprint->size = (end >= start && start >= 0)?(uint64_t)(end-start):0;
+	}
+	
+	reader.context = f;
+	reader.read = fastimageFileRead;
+	reader.seek = fastimageFileSeek;
+	
+	return fastimageOpenEx(&reader, options);
+}
+
+fastimage_image_t fastimageOpenFileA(const char *filename)
+{
+	return fastimageOpenFileExA(filename, 0);
+}
+
+fastimage_image_t fastimageOpenFileExA(const char *filename, const fastimage_options_t *options)
+{
+	fastimage_image_t image;
+	FILE *f = 0;
+	
+	f = fopen(filename, "rb");
+	if(!f) {
+		memset(&image, 0, sizeof(fastimage_image_t));
+		image.format = fastimage_error;
+	
+		return image;
+	}
+	
+	image = fastimageOpenFileEx(f, options);
+
+	fclose(f);
+
+	return image;
+}
+
+#if !defined(_WIN32)
+FILE *_wfopen(const wchar_t* filename, const wchar_t* mode)
+{
+	size_t filename_len, mode_len;
+	char* cfilename = 0, * cmode = 0;
+	FILE *f = 0;
+
+	filename_len = wcslen(filename);
+	mode_len = wcslen(mode);
+
+	cfilename = malloc(filename_len * MB_CUR_MAX + 1);
+	cmode = malloc(mode_len * MB_CUR_MAX + 1);
+	if (!cfilename || !cmode) {
+		errno = ENOMEM;
+		goto FINAL;
+	}
+
+	if (wcstombs(cfilename, filename, filename_len * MB_CUR_MAX + 1) == (size_t)(-1)) {
+		errno = EINVAL;
+		goto FINAL;
+	}
+
+	if (wcstombs(cmode, mode, mode_len * MB_CUR_MAX + 1) == (size_t)(-1)) {
+		errno = EINVAL;
+		goto FINAL;
+	}
+
+	f = fopen(cfilename, cmode);
+
+FINAL:
+	if (cfilename) free(cfilename);
+	if (cmode) free(cmode);
+
+	return f;
+}
+#endif
+
+fastimage_image_t fastimageOpenFileW(const wchar_t *filename)
+{
+	return fastimageOpenFileExW(filename, 0);
+}
+
+fastimage_image_t fastimageOpenFileExW(const wchar_t *filename, const fastimage_options_t *options)
+{
+	fastimage_image_t image;
+	FILE *f = 0;
+	
+	f = _wfopen(filename, L"rb");
+	if(!f) {
+		memset(&image, 0, sizeof(fastimage_image_t));
+		image.format = fastimage_error;
+	
+		return image;
+	}
+	
+	image = fastimageOpenFileEx(f, options);
+
+	fclose(f);
+
+	return image;
+}
+
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+	size_t offset;
+} fastimage_memory_context_t;
+
+static size_t FASTIMAGE_APIENTRY fastimageMemoryRead(void *context, size_t size, void *buf)
+{
+	fastimage_memory_context_t *memc;
+
+	memc = (fastimage_memory_context_t *)context;
+
+	if(size > memc->size-memc->offset)
+		size = memc->size-memc->offset;
+
+	memcpy(buf, memc->data+memc->offset, size);
+	memc->offset += size;
+
+	return size;
+}
+
+static bool FASTIMAGE_APIENTRY fastimageMemorySeek(void *context, int64_t pos, bool seek_cur)
+{
+	fastimage_memory_context_t *memc;
+
+	memc = (fastimage_memory_context_t *)context;
+
+	if(seek_cur) pos += memc->offset;
+
+	if(pos < 0 || (uint64_t)pos > memc->size) return false;
+
+	memc->offset = (size_t)pos;
+
+	return true;
+}
+
+fastimage_image_t fastimageOpenMemory(const void *data, size_t size)
+{
+	return fastimageOpenMemoryEx(data, size, 0);
+}
+
+fastimage_image_t fastimageOpenMemoryEx(const void *data, size_t size, const fastimage_options_t *options)
+{
+	fastimage_memory_context_t context;
+	fastimage_reader_t reader;
+
+	context.data = data;
+	context.size = size;
+	context.offset = 0;
+
+	reader.context = &context;
+	reader.read = fastimageMemoryRead;
+	reader.seek = fastimageMemorySeek;
+
+	if(options && options->fingerprint && options->fingerprint->mode == fastimage_fingerprint_prefix)
+		options->fingerprint->size = size;
+
+	return fastimageOpenEx(&reader, options);
+}
+
+// Same result as fastimageOpenMemoryEx with fastimage_level_format, but without reader for the usual formats
+static int fastimageClassifyPrefix(const unsigned char *prefix, size_t size)
+{
+	fastimage_options_t options;
+	int format;
+
+	if(size < 4) return fastimage_error;
+
+	format = fastimageMatchSign(prefix);
+
+	if(format == fastimage_webp) {
+		if(size < 12 || fastimageLe32(prefix+4) < 8) return fastimage_error;
+
+		if(!memcmp(prefix+8, "WEBP", 4)) return fastimage_webp;
+		if(!memcmp(prefix+8, "ACON", 4)) return fastimage_ani;
+
+		return fastimage_unknown;
+	}
+
+	if(format == fastimage_cur) {
+		if(size < 6) return fastimage_error;
+
+		return (prefix[4] || prefix[5])?fastimage_cur:fastimage_tga;
+	}
+
+	if(format == fastimage_ktx) {
+		if(size < KTX_IDENTIFIER_SIZE) return fastimage_error;
+
+		return fastimageKtxVersion(prefix);
+	}
+
+	if(format == fastimage_pnm && !fastimagePnmSign(prefix))
+		return fastimage_unknown;
+
+	// Brands of ftyp box, DocType of EBML and root element of SVG are left to the usual probe
+	if(format == fastimage_mkv || (format == fastimage_unknown && ((size >= 8 && (!memcmp(prefix+4, "ftyp", 4) || fastimageQuickTimeAtom(prefix+4))) || fastimageSvgSign(prefix)))) {
+		memset(&options, 0, sizeof(fastimage_options_t));
+		options.level = fastimage_level_format;
+
+		return fastimageOpenMemoryEx(prefix, size, &options).format;
+	}
+
+	return format;
+}
+
+void fastimageClassifyBatch(const unsigned char *const *prefixes, const size_t *sizes, size_t count, int *formats)
+{
+	size_t i;
+
+	for(i = 0; i < count; i++)
+		formats[i] = fastimageClassifyPrefix(prefixes[i], sizes[i]);
+}
+
+void fastimageClassifyStrided(const void *prefixes, size_t stride, size_t size, size_t count, int *formats)
+{
+	const unsigned char *prefix = prefixes;
+	size_t i;
+
+	for(i = 0; i < count; i++, prefix += stride)
+		formats[i] = fastimageClassifyPrefix(prefix, size);
+}
+
+typedef struct {
+	int fd;
+	uint64_t base;
+	uint64_t size; // UINT64_MAX if up to the end of file
+	uint64_t pos;
+} fastimage_fd_context_t;
+
+// Positional reads, file position of descriptor is not used
+static size_t FASTIMAGE_APIENTRY fastimageFdRead(void *context, size_t size, void *buf)
+{
+	fastimage_fd_context_t *fdc;
+	size_t done = 0;
+
+	fdc = (fastimage_fd_context_t *)context;
+
+	if(size > fdc->size-fdc->pos)
+		size = (size_t)(fdc->size-fdc->pos);
+
+	while(done < size) {
+#if defined(_WIN32)
+		OVERLAPPED overlapped;
+		DWORD part = 0, to_read;
+		uint64_t offset = fdc->base+fdc->pos;
+
+		to_read = (size-done > 0x40000000)?0x40000000:(DWORD)(size-done);
+
+		memset(&overlapped, 0, sizeof(OVERLAPPED));
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset>>32);
+
+		if(!ReadFile((HANDLE)_get_osfhandle(fdc->fd), (char *)buf+done, to_read, &part, &overlapped) || !part) break;
+#else
+		ssize_t part;
+
+		part = pread64(fdc->fd, (char *)buf+done, size-done, (off64_t)(fdc->base+fdc->pos));
+		if(part < 0 && errno == EINTR) continue;
+		if(part <= 0) break;
+#endif
+
+		done += (size_t)part;
+		fdc->pos += (uint64_t)part;
+	}
+
+	return done;
+}
+
+static bool FASTIMAGE_APIENTRY fastimageFdSeek(void *context, int64_t pos, bool seek_cur)
+{
+	fastimage_fd_context_t *fdc;
+
+	fdc = (fastimage_fd_context_t *)context;
+
+	if(seek_cur) pos += fdc->pos;
+
+	if(pos < 0 || (uint64_t)pos > fdc->size) return false;
+
+	fdc->pos = (uint64_t)pos;
+
+	return true;
+}
+
+fastimage_image_t fastimageOpenFd(int fd, uint64_t offset, uint64_t length)
+{
+	return fastimageOpenFdEx(fd, offset, length, 0);
+}
+
+fastimage_image_t fastimageOpenFdEx(int fd, uint64_t offset, uint64_t length, const fastimage_options_t *options)
+{
+	fastimage_fd_context_t context;
+	fastimage_reader_t reader;
+
+	context.fd = fd;
+	context.base = offset;
+	context.size = length?length:(UINT64_MAX-offset);
+	context.pos = 0;
+
+	if(options && options->fingerprint && options->fingerprint->mode == fastimage_fingerprint_prefix) {
+		options->fingerprint->size = length;
+
+		if(!length) {
+#if defined(_WIN32)
+			struct _stati64 st;
+
+			if(!_fstati64(fd, &st) && (uint64_t)st.st_size > offset)
+#else
+			struct stat st;
+
+			if(!fstat(fd, &st) && (uint64_t)st.st_size > offset)
+#endif
+				options->fingerprint->size = (uint64_t)st.st_size-offset;
+		}
+	}
+
+	reader.context = &context;
+	reader.read = fastimageFdRead;
+	reader.seek = fastimageFdSeek;
+
+	return fastimageOpenEx(&reader, options);
+}
+
+typedef struct {
+	const fastimage_reader_t *reader;
+	uint64_t base;
+	uint64_t size;
+	uint64_t pos;
+} fastimage_slice_context_t;
+
+static size_t FASTIMAGE_APIENTRY fastimageSliceRead(void *context, size_t size, void *buf)
+{
+	fastimage_slice_context_t *slice;
+
+	slice = (fastimage_slice_context_t *)context;
+
+	if(size > slice->size-slice->pos)
+		size = (size_t)(slice->size-slice->pos);
+
+	size = slice->reader->read(slice->reader->context, size, buf);
+	slice->pos += size;
+
+	return size;
+}
+
+static bool FASTIMAGE_APIENTRY fastimageSliceSeek(void *context, int64_t pos, bool seek_cur)
+{
+	fastimage_slice_context_t *slice;
+
+	slice = (fastimage_slice_context_t *)context;
+
+	if(seek_cur) pos += slice->pos;
+
+	if(pos < 0 || (uint64_t)pos > slice->size) return false;
+
+	if(!slice->reader->seek(slice->reader->context, (int64_t)(slice->base+pos), false)) return false;
+
+	slice->pos = pos;
+
+	return true;
+}
+
+// Reader for part of another stream, seeks parent to the beginning of part
+static bool fastimageSliceInit(fastimage_slice_context_t *slice, fastimage_reader_t *reader, const fastimage_reader_t *parent, uint64_t base, uint64_t size)
+{
+	slice->reader = parent;
+	slice->base = base;
+	slice->size = size;
+	slice->pos = 0;
+
+	reader->context = slice;
+	reader->read = fastimageSliceRead;
+	reader->seek = fastimageSliceSeek;
+
+	return parent->seek(parent->context, (int64_t)base, false);
+}
+
+#if defined(FASTIMAGE_USE_ZLIB)
+#define FASTIMAGE_INFLATE_CHUNK 4096
+
+typedef struct {
+	const fastimage_reader_t *reader;
+	uint64_t base;
+	uint64_t compressed_size; // UINT64_MAX if unknown
+	uint64_t compressed_pos;
+	uint64_t pos;
+	bool finished;
+	z_stream stream;
+	unsigned char in[FASTIMAGE_INFLATE_CHUNK];
+} fastimage_inflate_context_t;
+
+static size_t FASTIMAGE_APIENTRY fastimageInflateRead(void *context, size_t size, void *buf)
+{
+	fastimage_inflate_context_t *inflatec;
+
+	inflatec = (fastimage_inflate_context_t *)context;
+
+	inflatec->stream.next_out = buf;
+	inflatec->stream.avail_out = (uInt)size;
+
+	// Inflate only as much as requested, parser stops reading after header
+	while(inflatec->stream.avail_out && !inflatec->finished) {
+		int z_result;
+
+		if(!inflatec->stream.avail_in) {
+			size_t in_size = FASTIMAGE_INFLATE_CHUNK;
+
+			if(in_size > inflatec->compressed_size-inflatec->compressed_pos)
+				in_size = (size_t)(inflatec->compressed_size-inflatec->compressed_pos);
+
+			if(in_size)
+				in_size = inflatec->reader->read(inflatec->reader->context, in_size, inflatec->in);
+
+			if(!in_size) break;
+
+			inflatec->compressed_pos += in_size;
+			inflatec->stream.next_in = inflatec->in;
+			inflatec->stream.avail_in = (uInt)in_size;
+		}
+
+		z_result = inflate(&inflatec->stream, Z_NO_FLUSH);
+
+		if(z_result == Z_STREAM_END)
+			inflatec->finished = true;
+		else if(z_result != Z_OK)
+			break;
+	}
+
+	size -= inflatec->stream.avail_out;
+	inflatec->pos += size;
+
+	return size;
+}
+
+static bool FASTIMAGE_APIENTRY fastimageInflateSeek(void *context, int64_t pos, bool seek_cur)
+{
+	fastimage_inflate_context_t *inflatec;
+	unsigned char skip_buf[FASTIMAGE_INFLATE_CHUNK];
+
+	inflatec = (fastimage_inflate_context_t *)context;
+
+	if(seek_cur) pos += inflatec->pos;
+
+	if(pos < 0) return false;
+
+	// Deflate stream can't be seeked back, start it over
+	if((uint64_t)pos < inflatec->pos) {
+		if(!inflatec->reader->seek(inflatec->reader->context, (int64_t)inflatec->base, false)) return false;
+		if(inflateReset(&inflatec->stream) != Z_OK) return false;
+
+		inflatec->compressed_pos = 0;
+		inflatec->pos = 0;
+		inflatec->finished = false;
+		inflatec->stream.avail_in = 0;
+	}
+
+	while(inflatec->pos < (uint64_t)pos) {
+		size_t skip_size = FASTIMAGE_INFLATE_CHUNK;
+
+		if(skip_size > (uint64_t)pos-inflatec->pos)
+			skip_size = (size_t)((uint64_t)pos-inflatec->pos);
+
+		if(fastimageInflateRead(context, skip_size, skip_buf) != skip_size) return false;
+	}
+
+	return true;
+}
+
+// window_bits as in inflateInit2: -15 for raw deflate, 31 for gzip
+static bool fastimageInflateInit(fastimage_inflate_context_t *inflatec, fastimage_reader_t *reader, const fastimage_reader_t *parent, uint64_t base, uint64_t compressed_size, int window_bits)
+{
+	memset(inflatec, 0, sizeof(fastimage_inflate_context_t));
+
+	inflatec->reader = parent;
+	inflatec->base = base;
+	inflatec->compressed_size = compressed_size;
+
+	if(inflateInit2(&inflatec->stream, window_bits) != Z_OK) return false;
+
+	reader->context = inflatec;
+	reader->read = fastimageInflateRead;
+	reader->seek = fastimageInflateSeek;
+
+	if(!parent->seek(parent->context, (int64_t)base, false)) {
+		inflateEnd(&inflatec->stream);
+
+		return false;
+	}
+
+	return true;
+}
+
+// Compressed bytes that caller has already read, right before base, are inflated first without reading them again
+static void fastimageInflatePreload(fastimage_inflate_context_t *inflatec, const unsigned char *data, size_t size)
+{
+	memcpy(inflatec->in, data, size);
+	inflatec->stream.next_in = inflatec->in;
+	inflatec->stream.avail_in = (uInt)size;
+	inflatec->compressed_pos = size;
+	inflatec->base -= size;
+}
+
+static void fastimageInflateFree(fastimage_inflate_context_t *inflatec)
+{
+	inflateEnd(&inflatec->stream);
+}
+#endif
+
+// SVG and SVGZ: only the root element is read, at most FASTIMAGE_SVG_MAX_HEAD bytes of text
+// (FASTIMAGE_SVG_CHUNK at format level)
+
+#define FASTIMAGE_SVG_MAX_HEAD 4096
+#define FASTIMAGE_SVG_CHUNK 512
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+
+enum fastimage_svg_state {
+	fastimage_svg_more, // Root element is not complete yet
+	fastimage_svg_found,
+	fastimage_svg_not_svg
+};
+
+typedef struct {
+	double width; // Negative - not set or relative
+	double height;
+	double viewbox_width; // Zero - no viewBox
+	double viewbox_height;
+} fastimage_svg_t;
+
+static bool fastimageSvgSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Number without locale, end of number in *end. False if there is none
+static bool fastimageSvgNumber(const char *p, const char *limit, const char **end, double *value)
+{
+	double number = 0, scale = 1;
+	int exponent = 0, exponent_sign = 1;
+	bool negative = false, digits = false;
+
+	if(p < limit && (*p == '+' || *p == '-')) negative = (*p++ == '-');
+
+	for(; p < limit && *p >= '0' && *p <= '9'; p++, digits = true)
+		number = number*10+(*p-'0');
+
+	if(p < limit && *p == '.')
+		for(p++; p < limit && *p >= '0' && *p <= '9'; p++, digits = true)
+			number += (*p-'0')*(scale /= 10);
+
+	if(!digits) return false;
+
+	// Exponent, but not "em" or "ex" unit
+	if(p+1 < limit && (*p == 'e' || *p == 'E') && ((p[1] >= '0' && p[1] <= '9') || ((p[1] == '+' || p[1] == '-') && p+2 < limit && p[2] >= '0' && p[2] <= '9'))) {
+		p++;
+		if(*p == '+' || *p == '-') exponent_sign = (*p++ == '-')?-1:1;
+
+		for(; p < limit && *p >= '0' && *p <= '9'; p++)
+			if(exponent < 400) exponent = exponent*10+(*p-'0');
+
+		for(; exponent > 0; exponent--)
+			number = (exponent_sign > 0)?(number*10):(number/10);
+	}
+
+	*value = negative?-number:number;
+	*end = p;
+
+	return true;
+}
+
+// Length in px (96 per inch), negative for percents and errors
+static double fastimageSvgLength(const char *p, const char *limit)
+{
+	static const struct {
+		const char *unit;
+		double px;
+	} units[] = {{"px", 1}, {"pt", 96.0/72}, {"pc", 16}, {"mm", 96/25.4}, {"cm", 96/2.54}, {"in", 96}, {"em", 16}, {"ex", 8}};
+	double value;
+	size_t unit_size, i;
+
+	while(p < limit && fastimageSvgSpace(*p)) p++;
+	while(limit > p && fastimageSvgSpace(limit[-1])) limit--;
+
+	if(!fastimageSvgNumber(p, limit, &p, &value) || value < 0) return -1;
+
+	unit_size = (size_t)(limit-p);
+	if(!unit_size) return value;
+
+	for(i = 0; i < sizeof(units)/sizeof(units[0]); i++)
+		if(unit_size == 2 && !memcmp(p, units[i].unit, 2)) return value*units[i].px;
+
+	return -1;
+}
+
+static void fastimageSvgAttribute(fastimage_svg_t *svg, const char *name, size_t name_size, const char *value, const char *limit)
+{
+	double numbers[4];
+	int i;
+
+	if(name_size == 5 && !memcmp(name, "width", 5))
+		svg->width = fastimageSvgLength(value, limit);
+	else if(name_size == 6 && !memcmp(name, "height", 6))
+		svg->height = fastimageSvgLength(value, limit);
+	else if(name_size == 7 && !memcmp(name, "viewBox", 7)) {
+		// min-x, min-y, width, height separated by spaces and/or comma
+		for(i = 0; i < 4; i++) {
+			while(value < limit && (fastimageSvgSpace(*value) || *value == ',')) value++;
+
+			if(!fastimageSvgNumber(value, limit, &value, &numbers[i])) return;
+		}
+
+		if(numbers[2] > 0 && numbers[3] > 0) {
+			svg->viewbox_width = numbers[2];
+			svg->viewbox_height = numbers[3];
+		}
+	}
+}
+
+static const char *fastimageSvgFind(const char *p, const char *limit, const char *what)
+{
+	size_t size = strlen(what);
+
+	for(; p+size <= limit; p++)
+		if(!memcmp(p, what, size)) return p;
+
+	return 0;
+}
+
+// Prolog (XML declaration, comments, doctype, processing instructions) is skipped up to the first element
+static int fastimageSvgParse(const char *p, const char *limit, fastimage_svg_t *svg)
+{
+	const char *name, *value;
+	size_t name_size;
+	int depth;
+	char quote;
+
+	if(limit-p >= 3 && !memcmp(p, "\xEF\xBB\xBF", 3)) p += 3;
+
+	for(;;) {
+		while(p < limit && fastimageSvgSpace(*p)) p++;
+
+		if(p == limit) return fastimage_svg_more;
+		if(*p != '<') return fastimage_svg_not_svg;
+		if(limit-p < 4) return fastimage_svg_more;
+
+		if(p[1] == '?') {
+			p = fastimageSvgFind(p+2, limit, "?>");
+			if(!p) return fastimage_svg_more;
+			p += 2;
+		} else if(!memcmp(p, "<!--", 4)) {
+			p = fastimageSvgFind(p+4, limit, "-->");
+			if(!p) return fastimage_svg_more;
+			p += 3;
+		} else if(p[1] == '!') {
+			// Doctype may have internal subset in brackets
+			for(p += 2, depth = 0, quote = 0; p < limit; p++) {
+				if(quote) {
+					if(*p == quote) quote = 0;
+				} else if(*p == '"' || *p == '\'') {
+					quote = *p;
+				} else if(*p == '[') {
+					depth++;
+				} else if(*p == ']') {
+					depth--;
+				} else if(*p == '>' && depth <= 0)
+					break;
+			}
+
+			if(p == limit) return fastimage_svg_more;
+			p++;
+		} else
+			break;
+	}
+
+	// Root element, namespace prefix is allowed
+	name = ++p;
+	while(p < limit && !fastimageSvgSpace(*p) && *p != '/' && *p != '>') p++;
+	if(p == limit) return fastimage_svg_more;
+
+	for(value = name; value < p; value++)
+		if(*value == ':') name = value+1;
+
+	if(p-name != 3 || memcmp(name, "svg", 3)) return fastimage_svg_not_svg;
+
+	for(;;) {
+		while(p < limit && fastimageSvgSpace(*p)) p++;
+
+		if(p == limit) return fastimage_svg_more;
+		if(*p == '>' || *p == '/') return fastimage_svg_found;
+
+		name = p;
+		while(p < limit && !fastimageSvgSpace(*p) && *p != '=' && *p != '>' && *p != '/') p++;
+		name_size = (size_t)(p-name);
+		if(!name_size) return fastimage_svg_not_svg;
+
+		while(p < limit && fastimageSvgSpace(*p)) p++;
+		if(p == limit) return fastimage_svg_more;
+		if(*p != '=') return fastimage_svg_not_svg;
+
+		for(p++; p < limit && fastimageSvgSpace(*p); p++);
+		if(p == limit) return fastimage_svg_more;
+		if(*p != '"' && *p != '\'') return fastimage_svg_not_svg;
+
+		quote = *p++;
+		value = p;
+		while(p < limit && *p != quote) p++;
+		if(p == limit) return fastimage_svg_more;
+
+		fastimageSvgAttribute(svg, name, name_size, value, p);
+		p++;
+	}
+}
+
+// Text starts with prefix (bytes already read from reader)
+static void fastimageParseSvg(const fastimage_reader_t *reader, const unsigned char *prefix, size_t prefix_size, size_t max_head, fastimage_image_t *image)
+{
+	char head[FASTIMAGE_SVG_MAX_HEAD];
+	fastimage_svg_t svg;
+	size_t size = prefix_size, got, part;
+	int state = fastimage_svg_more;
+	double width, height;
+
+	svg.width = svg.height = -1;
+	svg.viewbox_width = svg.viewbox_height = 0;
+
+	if(prefix_size) {
+		memcpy(head, prefix, prefix_size);
+		state = fastimageSvgParse(head, head+size, &svg);
+	}
+
+	// Some readers refuse reads past the end, so smaller reads are tried there
+	while(state == fastimage_svg_more && size < max_head) {
+		for(part = (max_head-size < FASTIMAGE_SVG_CHUNK)?(max_head-size):FASTIMAGE_SVG_CHUNK, got = 0; part && !got; part /= 2)
+			got = reader->read(reader->context, part, head+size);
+
+		if(!got) break;
+		size += got;
+
+		state = fastimageSvgParse(head, head+size, &svg);
+	}
+
+	if(state != fastimage_svg_found) return;
+
+	image->format = fastimage_svg;
+	image->channels = 4;
+	image->bitsperpixel = 32;
+
+	// Missing or relative size comes from viewBox, keeping its aspect ratio
+	width = svg.width;
+	height = svg.height;
+
+	if(svg.viewbox_width > 0) {
+		if(width <= 0 && height > 0)
+			width = height*svg.viewbox_width/svg.viewbox_height;
+		else if(width <= 0)
+			width = svg.viewbox_width;
+
+		if(height <= 0)
+			height = width*svg.viewbox_height/svg.viewbox_width;
+	}
+
+	if(width > 0 && height > 0 && width < 1e9 && height < 1e9) {
+		image->width = (size_t)(width+0.5);
+		image->height = (size_t)(height+0.5);
+	}
+}
+
+#if defined(FASTIMAGE_USE_ZLIB)
+// Name in gzip header tells if member is worth inflating: .svg or .svgz. Without name it is inflated
+// only when dimensions are asked, format level doesn't inflate unknown gzip
+static bool fastimageSvgzName(const fastimage_reader_t *reader, const unsigned char *sign, int level, unsigned char *header, size_t *header_size)
+{
+	size_t size = 4, got, part, name, end;
+
+	memcpy(header, sign, 4);
+	*header_size = 4;
+
+	if(!(sign[3]&GZIP_FLAG_NAME)) return level != fastimage_level_format;
+
+	// Name must be in the first block
+	while(size < FASTIMAGE_SVG_CHUNK) {
+		for(part = FASTIMAGE_SVG_CHUNK-size, got = 0; part; part /= 2) {
+			got = reader->read(reader->context, part, header+size);
+			if(got) break;
+		}
+
+		if(!got) break;
+		size += got;
+		if(got < part) break; // Short read is the end
+	}
+
+	*header_size = size;
+
+	// Fixed header is 10 bytes, then extra field with 2 bytes of length
+	name = 10;
+	if(sign[3]&GZIP_FLAG_EXTRA) {
+		if(size < 12) return false;
+
+		name = 12+header[10]+(size_t)header[11]*256;
+	}
+
+	for(end = name; end < size && header[end]; end++);
+	if(end >= size) return false;
+
+	// Letters in any case (|0x20 makes ASCII letter lower)
+	if(end-name >= 5 && (header[end-1]|0x20) == 'z') end--;
+
+	return end-name >= 4 && header[end-4] == '.' && (header[end-3]|0x20) == 's' && (header[end-2]|0x20) == 'v' && (header[end-1]|0x20) == 'g';
+}
+#endif
+
+// Text is parsed on from signature, gzip is inflated from what is read of its header when its name allows
+static void fastimageReadSvg(const fastimage_reader_t *reader, const unsigned char *sign, fastimage_image_t *image, int level)
+{
+	size_t max_head;
+
+	// Format level decides from the first block
+	max_head = (level == fastimage_level_format)?FASTIMAGE_SVG_CHUNK:FASTIMAGE_SVG_MAX_HEAD;
+
+	if(sign[0] == 0x1F && sign[1] == 0x8B) {
+#if defined(FASTIMAGE_USE_ZLIB)
+		fastimage_inflate_context_t *inflatec;
+		fastimage_reader_t svgz;
+		unsigned char header[FASTIMAGE_SVG_CHUNK];
+		size_t header_size;
+
+		if(!fastimageSvgzName(reader, sign, level, header, &header_size)) return;
+
+		// Inflated only as far as text is read
+		inflatec = malloc(sizeof(fastimage_inflate_context_t));
+		if(!inflatec) return;
+
+		if(fastimageInflateInit(inflatec, &svgz, reader, header_size, UINT64_MAX, 31)) {
+			fastimageInflatePreload(inflatec, header, header_size);
+			fastimageParseSvg(&svgz, 0, 0, max_head, image);
+			fastimageInflateFree(inflatec);
+		}
+
+		free(inflatec);
+#endif
+	} else
+		fastimageParseSvg(reader, sign, 4, max_head, image);
+}
+
+#define ZIP_EOCD_SIZE 22
+#define ZIP_EOCD_MAX_COMMENT 65535
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP64_EOCD_SIZE 56
+#define ZIP_CDIR_HEADER_SIZE 46
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define TAR_BLOCK_SIZE 512
+#define TAR_MAX_LONG_NAME 65536
+
+static bool fastimageArchiveSetName(fastimage_archive_t *archive, const char *name, size_t name_len)
+{
+	if(name_len+1 > archive->name_size) {
+		char *_name;
+
+		_name = realloc(archive->name, name_len+1);
+		if(!_name) return false;
+
+		archive->name = _name;
+		archive->name_size = name_len+1;
+	}
+
+	memcpy(archive->name, name, name_len);
+	archive->name[name_len] = 0;
+
+	return true;
+}
+
+static int fastimageArchiveOpenZip(fastimage_archive_t *archive)
+{
+	const fastimage_reader_t *reader = &archive->reader;
+	unsigned char *tail = 0, *eocd = 0;
+	size_t tail_size, i;
+	uint64_t cdir_offset, cdir_size;
+
+	if(archive->size < ZIP_EOCD_SIZE) goto ZIP_ERROR;
+
+	// Usually there is no comment, so try to read only EOCD first
+	tail_size = ZIP_EOCD_SIZE;
+
+	while(1) {
+		tail = malloc(tail_size);
+		if(!tail) goto ZIP_ERROR;
+
+		if(!reader->seek(reader->context, (int64_t)(archive->size-tail_size), false)) goto ZIP_ERROR;
+		if(reader->read(reader->context, tail_size, tail) != tail_size) goto ZIP_ERROR;
+
+		for(i = tail_size-ZIP_EOCD_SIZE+1; i > 0; i--)
+			if(!memcmp(tail+i-1, "PK\x05\x06", 4)) {
+				eocd = tail+i-1;
+				break;
+			}
+
+		if(eocd || tail_size != ZIP_EOCD_SIZE || tail_size == archive->size) break;
+
+		free(tail);
+		tail = 0;
+
+		tail_size = ZIP_EOCD_SIZE+ZIP_EOCD_MAX_COMMENT;
+		if(tail_size > archive->size) tail_size = (size_t)archive->size;
+	}
+
+	if(!eocd) goto ZIP_ERROR;
+
+	archive->entries = fastimageLe16(eocd+10);
+	cdir_size = fastimageLe32(eocd+12);
+	cdir_offset = fastimageLe32(eocd+16);
+
+	if(archive->entries == 0xFFFF || cdir_size == 0xFFFFFFFF || cdir_offset == 0xFFFFFFFF) { // Zip64
+		unsigned char zip64[ZIP64_EOCD_SIZE];
+		uint64_t eocd_offset;
+
+		eocd_offset = archive->size-tail_size+(size_t)(eocd-tail);
+		if(eocd_offset < ZIP64_LOCATOR_SIZE) goto ZIP_ERROR;
+
+		if(!reader->seek(reader->context, (int64_t)(eocd_offset-ZIP64_LOCATOR_SIZE), false)) goto ZIP_ERROR;
+		if(reader->read(reader->context, ZIP64_LOCATOR_SIZE, zip64) != ZIP64_LOCATOR_SIZE) goto ZIP_ERROR;
+		if(memcmp(zip64, "PK\x06\x07", 4)) goto ZIP_ERROR;
+
+		if(!reader->seek(reader->context, (int64_t)fastimageLe64(zip64+8), false)) goto ZIP_ERROR;
+		if(reader->read(reader->context, ZIP64_EOCD_SIZE, zip64) != ZIP64_EOCD_SIZE) goto ZIP_ERROR;
+		if(memcmp(zip64, "PK\x06\x06", 4)) goto ZIP_ERROR;
+
+		archive->entries = fastimageLe64(zip64+32);
+		cdir_size = fastimageLe64(zip64+40);
+		cdir_offset = fastimageLe64(zip64+48);
+	}
+
+	free(tail);
+	tail = 0;
+
+	if(cdir_size > archive->size || cdir_offset > archive->size-cdir_size) goto ZIP_ERROR;
+	if(cdir_size > SIZE_MAX) goto ZIP_ERROR;
+
+	// Read whole central directory at once
+	archive->dir_size = (size_t)cdir_size;
+	archive->dir = malloc(archive->dir_size?archive->dir_size:1);
+	if(!archive->dir) goto ZIP_ERROR;
+
+	if(!reader->seek(reader->context, (int64_t)cdir_offset, false)) goto ZIP_ERROR;
+	if(reader->read(reader->context, archive->dir_size, archive->dir) != archive->dir_size) goto ZIP_ERROR;
+
+	archive->format = fastimage_archive_zip;
+
+	return archive->format;
+
+ZIP_ERROR:
+	if(tail) free(tail);
+
+	return fastimage_archive_error;
+}
+
+static int fastimageArchiveOpenTar(fastimage_archive_t *archive, unsigned char *sign)
+{
+	const fastimage_reader_t *reader = &archive->reader;
+	unsigned char header[TAR_BLOCK_SIZE];
+	unsigned int checksum = 0, header_checksum = 0;
+	size_t i;
+
+	memcpy(header, sign, 4);
+
+	if(reader->read(reader->context, TAR_BLOCK_SIZE-4, header+4) != TAR_BLOCK_SIZE-4) return fastimage_archive_unknown;
+
+	// Old tars have no magic, so check header checksum
+	for(i = 0; i < TAR_BLOCK_SIZE; i++)
+		checksum += (i >= 148 && i < 156)?(' '):(header[i]);
+
+	for(i = 148; i < 156; i++) {
+		if(header[i] < '0' || header[i] > '7') break;
+
+		header_checksum = header_checksum*8+(header[i]-'0');
+	}
+
+	if(checksum != header_checksum && memcmp(header+257, "ustar", 5)) return fastimage_archive_unknown;
+
+	if(!reader->seek(reader->context, 0, false)) return fastimage_archive_error;
+
+	archive->format = fastimage_archive_tar;
+
+	return archive->format;
+}
+
+int fastimageArchiveOpen(const fastimage_reader_t *reader, uint64_t size, fastimage_archive_t *archive)
+{
+	unsigned char sign[4];
+
+	memset(archive, 0, sizeof(fastimage_archive_t));
+	archive->reader = *reader;
+	archive->size = size;
+
+	if(reader->read(reader->context, 4, sign) != 4) {
+		archive->format = fastimage_archive_error;
+
+		return archive->format;
+	}
+
+	if(!memcmp(sign, "PK\x03\x04", 4) || !memcmp(sign, "PK\x05\x06", 4))
+		archive->format = fastimageArchiveOpenZip(archive);
+	else
+		archive->format = fastimageArchiveOpenTar(archive, sign);
+
+	if(archive->format != fastimage_archive_zip && archive->format != fastimage_archive_tar) {
+		int format = archive->format;
+
+		fastimageArchiveClose(archive);
+		archive->format = format;
+	}
+
+	return archive->format;
+}
+
+int fastimageArchiveOpenFile(FILE *f, fastimage_archive_t *archive)
+{
+	fastimage_reader_t reader;
+	int64_t size;
+
+	reader.context = f;
+	reader.read = fastimageFileRead;
+	reader.seek = fastimageFileSeek;
+
+#if defined(_WIN32)
+	if(_fseeki64(f, 0, SEEK_END)) size = -1;
+	else size = _ftelli64(f);
+#else
+	if(fseeko64(f, 0, SEEK_END)) size = -1;
+	else size = ftello64(f);
+#endif
+
+	if(size < 0 || !fastimageFileSeek(f, 0, false)) {
+		memset(archive, 0, sizeof(fastimage_archive_t));
+		archive->format = fastimage_archive_error;
+
+		return archive->format;
+	}
+
+	return fastimageArchiveOpen(&reader, (uint64_t)size, archive);
+}
+
+static void fastimageArchiveProbe(fastimage_archive_t *archive, fastimage_archive_entry_t *entry)
+{
+	fastimage_reader_t entry_reader;
+
+	if(entry->method == 0) { // Stored, just a part of archive
+		fastimage_slice_context_t slice;
+
+		if(fastimageSliceInit(&slice, &entry_reader, &archive->reader, entry->offset, entry->size))
+			entry->image = fastimageOpen(&entry_reader);
+#if defined(FASTIMAGE_USE_ZLIB)
+	} else if(entry->method == 8) { // Deflated, inflate only header
+		fastimage_inflate_context_t inflatec;
+
+		if(fastimageInflateInit(&inflatec, &entry_reader, &archive->reader, entry->offset, entry->compressed_size, -MAX_WBITS)) {
+			entry->image = fastimageOpen(&entry_reader);
+
+			fastimageInflateFree(&inflatec);
+		}
+#endif
+	}
+}
+
+static bool fastimageArchiveNextZip(fastimage_archive_t *archive, fastimage_archive_entry_t *entry)
+{
+	const fastimage_reader_t *reader = &archive->reader;
+
+	while(archive->index < archive->entries) {
+		unsigned char *header, local_header[ZIP_LOCAL_HEADER_SIZE];
+		size_t name_len, extra_len, comment_len, extra_pos;
+		uint64_t local_offset;
+		unsigned int flags;
+
+		if(archive->dir_size-archive->dir_pos < ZIP_CDIR_HEADER_SIZE) return false;
+
+		header = archive->dir+archive->dir_pos;
+		if(memcmp(header, "PK\x01\x02", 4)) return false;
+
+		name_len = fastimageLe16(header+28);
+		extra_len = fastimageLe16(header+30);
+		comment_len = fastimageLe16(header+32);
+
+		if(archive->dir_size-archive->dir_pos-ZIP_CDIR_HEADER_SIZE < name_len+extra_len+comment_len) return false;
+
+		archive->dir_pos += ZIP_CDIR_HEADER_SIZE+name_len+extra_len+comment_len;
+		archive->index++;
+
+		// Skip directories
+		if(!name_len || header[ZIP_CDIR_HEADER_SIZE+name_len-1] == '/') continue;
+
+		memset(entry, 0, sizeof(fastimage_archive_entry_t));
+
+		if(!fastimageArchiveSetName(archive, (char *)header+ZIP_CDIR_HEADER_SIZE, name_len)) return false;
+
+		flags = fastimageLe16(header+8);
+		entry->name = archive->name;
+		entry->method = fastimageLe16(header+10);
+		entry->compressed_size = fastimageLe32(header+20);
+		entry->size = fastimageLe32(header+24);
+		local_offset = fastimageLe32(header+42);
+
+		// Zip64 extended information
+		extra_pos = ZIP_CDIR_HEADER_SIZE+name_len;
+		while(extra_pos+4 <= ZIP_CDIR_HEADER_SIZE+name_len+extra_len) {
+			size_t field_size, field_pos;
+
+			field_size = fastimageLe16(header+extra_pos+2);
+			field_pos = extra_pos+4;
+
+			if(field_pos+field_size > ZIP_CDIR_HEADER_SIZE+name_len+extra_len) break;
+
+			if(fastimageLe16(header+extra_pos) == 1) {
+				if(entry->size == 0xFFFFFFFF && field_pos+8 <= extra_pos+4+field_size) {
+					entry->size = fastimageLe64(header+field_pos);
+					field_pos += 8;
+				}
+				if(entry->compressed_size == 0xFFFFFFFF && field_pos+8 <= extra_pos+4+field_size) {
+					entry->compressed_size = fastimageLe64(header+field_pos);
+					field_pos += 8;
+				}
+				if(local_offset == 0xFFFFFFFF && field_pos+8 <= extra_pos+4+field_size)
+					local_offset = fastimageLe64(header+field_pos);
+			}
+
+			extra_pos += 4+field_size;
+		}
+
+		entry->image.format = fastimage_error;
+
+		// Data starts after local header, its extra field may differ from central one
+		if(!reader->seek(reader->context, (int64_t)local_offset, false)) return true;
+		if(reader->read(reader->context, ZIP_LOCAL_HEADER_SIZE, local_header) != ZIP_LOCAL_HEADER_SIZE) return true;
+		if(memcmp(local_header, "PK\x03\x04", 4)) return true;
+
+		entry->offset = local_offset+ZIP_LOCAL_HEADER_SIZE+fastimageLe16(local_header+26)+fastimageLe16(local_header+28);
+
+		if(entry->offset > archive->size || entry->compressed_size > archive->size-entry->offset) return true;
+
+		if(!(flags & 1)) // Not encrypted
+			fastimageArchiveProbe(archive, entry);
+
+		return true;
+	}
+
+	return false;
+}
+
+static uint64_t fastimageTarNumber(const unsigned char *field, size_t size)
+{
+	uint64_t number = 0;
+	size_t i;
+
+	if(field[0] & 0x80) { // Base-256 for big values
+		for(i = 1; i < size; i++)
+			number = (number<<8)+field[i];
+
+		return number;
+	}
+
+	for(i = 0; i < size && field[i] == ' '; i++);
+
+	for(; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+		number = number*8+(field[i]-'0');
+
+	return number;
+}
+
+// Only path and size records are used
+static void fastimageTarPax(fastimage_archive_t *archive, char *pax, size_t pax_size, uint64_t *size)
+{
+	size_t pos = 0;
+
+	while(pos < pax_size) {
+		size_t record_len = 0, i;
+		char *key, *value, *record_end;
+
+		for(i = pos; i < pax_size && pax[i] >= '0' && pax[i] <= '9'; i++)
+			record_len = record_len*10+(pax[i]-'0');
+
+		if(i >= pax_size || pax[i] != ' ' || record_len <= i-pos || record_len > pax_size-pos) return;
+
+		key = pax+i+1;
+		record_end = pax+pos+record_len-1; // '\n'
+
+		for(value = key; value < record_end && *value != '='; value++);
+
+		if(value < record_end) {
+			if(value-key == 4 && !memcmp(key, "path", 4)) {
+				if(fastimageArchiveSetName(archive, value+1, record_end-value-1))
+					archive->long_name = true;
+			} else if(value-key == 4 && !memcmp(key, "size", 4)) {
+				*size = 0;
+				for(value++; value < record_end && *value >= '0' && *value <= '9'; value++)
+					*size = *size*10+(*value-'0');
+			}
+		}
+
+		pos += record_len;
+	}
+}
+
+static bool fastimageArchiveNextTar(fastimage_archive_t *archive, fastimage_archive_entry_t *entry)
+{
+	const fastimage_reader_t *reader = &archive->reader;
+	uint64_t pax_size = UINT64_MAX;
+
+	while(1) {
+		unsigned char header[TAR_BLOCK_SIZE];
+		uint64_t entry_size, header_offset = archive->offset, next;
+		char type;
+
+		if(!reader->seek(reader->context, (int64_t)archive->offset, false)) return false;
+		if(reader->read(reader->context, TAR_BLOCK_SIZE, header) != TAR_BLOCK_SIZE) return false;
+
+		if(!header[0]) return false; // End of archive
+
+		type = header[156];
+		entry_size = fastimageTarNumber(header+124, 12);
+
+		if(pax_size != UINT64_MAX && type != 'L' && type != 'x' && type != 'g') {
+			entry_size = pax_size;
+			pax_size = UINT64_MAX;
+		}
+
+		archive->offset += TAR_BLOCK_SIZE;
+
+		// Base-256 sizes go up to 2^64, data must fit in what is left of archive
+		if(entry_size > (uint64_t)INT64_MAX) return false;
+		if(archive->size && (archive->offset > archive->size || entry_size > archive->size-archive->offset)) return false;
+
+		// Next header, offset must only grow or walk would never end
+		next = archive->offset+(entry_size+TAR_BLOCK_SIZE-1)/TAR_BLOCK_SIZE*TAR_BLOCK_SIZE;
+		if(next <= header_offset) return false;
+
+		if((type == 'L' || type == 'x') && entry_size <= TAR_MAX_LONG_NAME) { // GNU long name or pax header
+			char *data;
+
+			data = malloc((size_t)entry_size+1);
+			if(!data) return false;
+
+			if(reader->read(reader->context, (size_t)entry_size, data) != entry_size) {
+				free(data);
+
+				return false;
+			}
+
+			if(type == 'L') {
+				data[entry_size] = 0;
+				if(fastimageArchiveSetName(archive, data, strlen(data)))
+					archive->long_name = true;
+			} else
+				fastimageTarPax(archive, data, (size_t)entry_size, &pax_size);
+
+			free(data);
+		} else if(type == '0' || type == 0 || type == '7') { // Regular file
+			memset(entry, 0, sizeof(fastimage_archive_entry_t));
+
+			if(!archive->long_name) {
+				char name[256];
+				size_t prefix_len, name_len;
+
+				prefix_len = strnlen((char *)header+345, 155);
+				name_len = strnlen((char *)header, 100);
+
+				if(prefix_len && !memcmp(header+257, "ustar", 5)) {
+					memcpy(name, header+345, prefix_len);
+					name[prefix_len] = '/';
+					memcpy(name+prefix_len+1, header, name_len);
+					name_len += prefix_len+1;
+				} else
+					memcpy(name, header, name_len);
+
+				if(!fastimageArchiveSetName(archive, name, name_len)) return false;
+			}
+
+			archive->long_name = false;
+			archive->index++;
+
+			entry->name = archive->name;
+			entry->offset = archive->offset;
+			entry->size = entry_size;
+			entry->compressed_size = entry_size;
+
+			entry->image.format = fastimage_error;
+			fastimageArchiveProbe(archive, entry);
+
+			archive->offset = next;
+
+			return true;
+		} else
+			archive->long_name = false;
+
+		archive->offset = next;
+	}
+}
+
+bool fastimageArchiveNext(fastimage_archive_t *archive, fastimage_archive_entry_t *entry)
+{
+	if(archive->format == fastimage_archive_zip)
+		return fastimageArchiveNextZip(archive, entry);
+	else if(archive->format == fastimage_archive_tar)
+		return fastimageArchiveNextTar(archive, entry);
+
+	return false;
+}
+
+void fastimageArchiveClose(fastimage_archive_t *archive)
+{
+	if(archive->dir) free(archive->dir);
+	if(archive->name) free(archive->name);
+
+	memset(archive, 0, sizeof(fastimage_archive_t));
+}
+
+// PDF: cross-reference sections are followed from startxref, then dictionaries of objects are read in order of offsets
+
+#define PDF_TAIL_SIZE 1024
+#define PDF_PEEK_SIZE 1024
+#define PDF_MAX_HEAD 65536 // Object header and dictionary
+#define PDF_MAX_OBJECTS (1<<22)
+#define PDF_MAX_SECTIONS 256
+#define PDF_MAX_DEPTH 32
+#define PDF_XREF_ENTRY_SIZE 20
+#define PDF_RESOLVE_SIZE 512
+#define PDF_STREAM_TAIL 16 // Enough for "stream" keyword with end of line after dictionary
+#define PDF_UNSEEN UINT64_MAX
+
+static bool fastimagePdfSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == 0;
+}
+
+static bool fastimagePdfDelimiter(char c)
+{
+	return c == '(' || c == ')' || c == '<' || c == '>' || c == '[' || c == ']' || c == '{' || c == '}' || c == '/' || c == '%';
+}
+
+static const char *fastimagePdfSkipSpace(const char *p, const char *end)
+{
+	while(p < end) {
+		if(*p == '%') {
+			while(p < end && *p != '\r' && *p != '\n') p++;
+		} else if(fastimagePdfSpace(*p))
+			p++;
+		else
+			break;
+	}
+
+	return p;
+}
+
+// End of regular token (number, keyword or name after slash)
+static const char *fastimagePdfToken(const char *p, const char *end)
+{
+	while(p < end && !fastimagePdfSpace(*p) && !fastimagePdfDelimiter(*p)) p++;
+
+	return p;
+}
+
+static bool fastimagePdfKeyword(const char *p, const char *end, const char *keyword)
+{
+	size_t size = strlen(keyword);
+
+	return (size_t)(fastimagePdfToken(p, end)-p) == size && !memcmp(p, keyword, size);
+}
+
+static const char *fastimagePdfUnsigned(const char *p, const char *end, uint64_t *value)
+{
+	const char *start = p;
+
+	*value = 0;
+
+	while(p < end && *p >= '0' && *p <= '9') {
+		if(*value > (UINT64_MAX-9)/10) return 0;
+
+		*value = *value*10+(uint64_t)(*p-'0');
+		p++;
+	}
+
+	if(p == start || fastimagePdfToken(p, end) != p) return 0;
+
+	return p;
+}
+
+// "number generation R", returns pointer after it
+static const char *fastimagePdfReference(const char *p, const char *end, uint64_t *number)
+{
+	uint64_t generation;
+
+	if(!(p = fastimagePdfUnsigned(p, end, number))) return 0;
+	if(!(p = fastimagePdfUnsigned(fastimagePdfSkipSpace(p, end), end, &generation))) return 0;
+
+	p = fastimagePdfSkipSpace(p, end);
+	if(!fastimagePdfKeyword(p, end, "R")) return 0;
+
+	return p+1;
+}
+
+// Pointer after value at p, 0 if it's not complete before end
+static const char *fastimagePdfSkipValue(const char *p, const char *end, int depth)
+{
+	const char *next;
+	uint64_t number;
+	int level = 0;
+
+	p = fastimagePdfSkipSpace(p, end);
+	if(p >= end || depth > PDF_MAX_DEPTH) return 0;
+
+	if(*p == '<' && p+1 < end && p[1] == '<') { // Dictionary, keys are values too
+		p += 2;
+
+		while(1) {
+			p = fastimagePdfSkipSpace(p, end);
+			if(p+1 >= end) return 0;
+			if(*p == '>' && p[1] == '>') return p+2;
+
+			if(!(p = fastimagePdfSkipValue(p, end, depth+1))) return 0;
+		}
+	}
+
+	if(*p == '[') {
+		p++;
+
+		while(1) {
+			p = fastimagePdfSkipSpace(p, end);
+			if(p >= end) return 0;
+			if(*p == ']') return p+1;
+
+			if(!(p = fastimagePdfSkipValue(p, end, depth+1))) return 0;
+		}
+	}
+
+	if(*p == '(') { // String with balanced parentheses and escapes
+		for(; p < end; p++) {
+			if(*p == '\\')
+				p++;
+			else if(*p == '(')
+				level++;
+			else if(*p == ')' && !--level)
+				return p+1;
+		}
+
+		return 0;
+	}
+
+	if(*p == '<') {
+		next = memchr(p, '>', (size_t)(end-p));
+
+		return next?next+1:0;
+	}
+
+	if(*p == '/') return fastimagePdfToken(p+1, end);
+
+	if((next = fastimagePdfReference(p, end, &number)) != 0) return next;
+
+	next = fastimagePdfToken(p, end);
+
+	return (next != p)?next:0;
+}
+
+// Value of key in dictionary between p (after "<<") and end, 0 if there is no such key
+static const char *fastimagePdfDictGet(const char *p, const char *end, const char *key)
+{
+	size_t key_size = strlen(key);
+	const char *name_end;
+
+	while(1) {
+		p = fastimagePdfSkipSpace(p, end);
+		if(p >= end || *p != '/') return 0;
+
+		name_end = fastimagePdfToken(p+1, end);
+		if((size_t)(name_end-p-1) == key_size && !memcmp(p+1, key, key_size))
+			return fastimagePdfSkipSpace(name_end, end);
+
+		if(!(p = fastimagePdfSkipValue(name_end, end, 0))) return 0;
+	}
+}
+
+static bool fastimagePdfName(const char *p, const char *end, const char *name)
+{
+	return p && p < end && *p == '/' && fastimagePdfKeyword(p+1, end, name);
+}
+
+// Start of value after "number generation obj"
+static const char *fastimagePdfObjectBody(const char *p, const char *end, uint64_t *number)
+{
+	uint64_t generation;
+
+	p = fastimagePdfSkipSpace(p, end);
+	if(!(p = fastimagePdfUnsigned(p, end, number))) return 0;
+	if(!(p = fastimagePdfUnsigned(fastimagePdfSkipSpace(p, end), end, &generation))) return 0;
+
+	p = fastimagePdfSkipSpace(p, end);
+	if(!fastimagePdfKeyword(p, end, "obj")) return 0;
+
+	return p+3;
+}
+
+static size_t fastimagePdfReadTo(fastimage_pdf_t *pdf, uint64_t offset, size_t size, char *buf)
+{
+	if(offset >= pdf->size) return 0;
+	if(size > pdf->size-offset) size = (size_t)(pdf->size-offset); // Some readers return nothing when asked past the end
+
+	if(!pdf->reader.seek(pdf->reader.context, (int64_t)offset, false)) return 0;
+
+	return pdf->reader.read(pdf->reader.context, size, buf);
+}
+
+// Reads to pdf->buf, which is zero terminated
+static size_t fastimagePdfRead(fastimage_pdf_t *pdf, uint64_t offset, size_t size)
+{
+	if(size+1 > pdf->buf_size) {
+		char *_buf;
+
+		_buf = realloc(pdf->buf, size+1);
+		if(!_buf) return 0;
+
+		pdf->buf = _buf;
+		pdf->buf_size = size+1;
+	}
+
+	size = fastimagePdfReadTo(pdf, offset, size, pdf->buf);
+	pdf->buf[size] = 0;
+
+	return size;
+}
+
+// Reads window at offset until the value after first skip bytes is complete and followed by tail bytes (or end of file)
+static bool fastimagePdfLoadValue(fastimage_pdf_t *pdf, uint64_t offset, size_t size, size_t skip, size_t tail, const char **value, const char **value_end)
+{
+	const char *p, *end;
+	size_t n;
+
+	while(1) {
+		n = fastimagePdfRead(pdf, offset, size);
+		if(n < skip) return false;
+
+		end = pdf->buf+n;
+		p = fastimagePdfSkipSpace(pdf->buf+skip, end);
+		*value_end = fastimagePdfSkipValue(p, end, 0);
+
+		if(*value_end && ((size_t)(end-*value_end) >= tail || n < size)) {
+			*value = p;
+
+			return true;
+		}
+
+		if(n < size || size >= PDF_MAX_HEAD) return false;
+
+		size *= 2;
+		if(size > PDF_MAX_HEAD) size = PDF_MAX_HEAD;
+	}
+}
+
+// Value of indirect object in buf, pdf->buf is kept
+static const char *fastimagePdfResolve(fastimage_pdf_t *pdf, uint64_t number, char *buf, size_t size, const char **value_end)
+{
+	const char *p, *end;
+	uint64_t found;
+
+	if(number >= pdf->objects || !pdf->offsets[number]) return 0;
+
+	end = buf+fastimagePdfReadTo(pdf, pdf->offsets[number], size, buf);
+
+	p = fastimagePdfObjectBody(buf, end, &found);
+	if(!p || found != number) return 0;
+
+	p = fastimagePdfSkipSpace(p, end);
+	*value_end = fastimagePdfSkipValue(p, end, 0);
+
+	return *value_end?p:0;
+}
+
+// Direct number or reference to it
+static bool fastimagePdfInteger(fastimage_pdf_t *pdf, const char *p, const char *end, uint64_t *value)
+{
+	char buf[PDF_RESOLVE_SIZE];
+	const char *value_end;
+	uint64_t number;
+
+	if(!p) return false;
+
+	if(fastimagePdfReference(p, end, &number)) {
+		if(!(p = fastimagePdfResolve(pdf, number, buf, sizeof(buf), &value_end))) return false;
+
+		return fastimagePdfUnsigned(p, value_end, value) != 0;
+	}
+
+	return fastimagePdfUnsigned(p, end, value) != 0;
+}
+
+// Channels of color space, palette is set to 1 for Indexed
+static unsigned int fastimagePdfColorSpace(fastimage_pdf_t *pdf, const char *p, const char *end, bool *palette, int depth)
+{
+	char buf[PDF_RESOLVE_SIZE];
+	const char *value_end, *next;
+	uint64_t number, channels;
+
+	if(!p || depth > 2) return 0;
+
+	if(fastimagePdfReference(p, end, &number)) {
+		if(!(p = fastimagePdfResolve(pdf, number, buf, sizeof(buf), &value_end))) return 0;
+
+		return fastimagePdfColorSpace(pdf, p, value_end, palette, depth+1);
+	}
+
+	if(*p == '[') p = fastimagePdfSkipSpace(p+1, end);
+	if(p >= end || *p != '/') return 0;
+
+	if(fastimagePdfName(p, end, "DeviceGray") || fastimagePdfName(p, end, "CalGray") || fastimagePdfName(p, end, "Separation")) return 1;
+	if(fastimagePdfName(p, end, "DeviceRGB") || fastimagePdfName(p, end, "CalRGB") || fastimagePdfName(p, end, "Lab")) return 3;
+	if(fastimagePdfName(p, end, "DeviceCMYK")) return 4;
+
+	next = fastimagePdfSkipSpace(fastimagePdfToken(p+1, end), end);
+
+	// [/Indexed base hival lookup]
+	if(fastimagePdfName(p, end, "Indexed")) {
+		*palette = true;
+
+		return fastimagePdfColorSpace(pdf, next, end, palette, depth+1);
+	}
+
+	// [/ICCBased stream], number of components is /N of stream dictionary
+	if(fastimagePdfName(p, end, "ICCBased") && fastimagePdfReference(next, end, &number)) {
+		if(!(p = fastimagePdfResolve(pdf, number, buf, sizeof(buf), &value_end)) || *p != '<') return 0;
+		if(!fastimagePdfInteger(pdf, fastimagePdfDictGet(p+2, value_end, "N"), value_end, &channels) || channels > 32) return 0;
+
+		return (unsigned int)channels;
+	}
+
+	// [/DeviceN [names] alternate tint]
+	if(fastimagePdfName(p, end, "DeviceN") && next < end && *next == '[') {
+		channels = 0;
+
+		for(p = fastimagePdfSkipSpace(next+1, end); p < end && *p == '/'; p = fastimagePdfSkipSpace(fastimagePdfToken(p+1, end), end))
+			channels++;
+
+		return (unsigned int)channels;
+	}
+
+	return 0;
+}
+
+static bool fastimagePdfReserve(fastimage_pdf_t *pdf, uint64_t objects)
+{
+	uint64_t *_offsets, i;
+
+	if(objects <= pdf->objects) return true;
+	if(objects > PDF_MAX_OBJECTS) return false;
+
+	_offsets = realloc(pdf->offsets, (size_t)objects*sizeof(uint64_t));
+	if(!_offsets) return false;
+
+	for(i = pdf->objects; i < objects; i++)
+		_offsets[i] = PDF_UNSEEN;
+
+	pdf->offsets = _offsets;
+	pdf->objects = objects;
+
+	return true;
+}
+
+// Newer sections are read first, so only the first entry of object counts
+static void fastimagePdfSetOffset(fastimage_pdf_t *pdf, uint64_t number, uint64_t offset)
+{
+	if(pdf->offsets[number] == PDF_UNSEEN) pdf->offsets[number] = offset;
+}
+
+static uint64_t fastimagePdfField(const unsigned char *p, unsigned int size)
+{
+	uint64_t value = 0;
+
+	while(size--)
+		value = (value<<8)|*p++;
+
+	return value;
+}
+
+// PNG predictors (10-15) of one byte per pixel
+static bool fastimagePdfUnpredict(unsigned char *row, const unsigned char *prev, size_t size)
+{
+	size_t i;
+	int a, b, c, p, pa, pb, pc;
+
+	for(i = 0; i < size; i++) {
+		a = i?row[i]:0; // Left, row[0] is filter type
+		b = prev[i+1];
+		c = i?prev[i]:0;
+
+		switch(row[0]) {
+			case 0: p = 0; break;
+			case 1: p = a; break;
+			case 2: p = b; break;
+			case 3: p = (a+b)/2; break;
+			case 4:
+				pa = abs(b-c);
+				pb = abs(a-c);
+				pc = abs(a+b-2*c);
+				p = (pa <= pb && pa <= pc)?a:((pb <= pc)?b:c);
+				break;
+			default: return false;
+		}
+
+		row[i+1] = (unsigned char)(row[i+1]+p);
+	}
+
+	return true;
+}
+
+static bool fastimagePdfXrefStream(fastimage_pdf_t *pdf, uint64_t offset, uint64_t *prev)
+{
+	const char *p, *end, *value, *value_end, *dict, *dict_end, *index;
+	fastimage_reader_t stream_reader;
+	fastimage_slice_context_t slice;
+#if defined(FASTIMAGE_USE_ZLIB)
+	fastimage_inflate_context_t inflatec;
+#endif
+	bool inflated = false, result = false;
+	uint64_t number, size, length, start, count, predictor = 1, columns = 1, data, i;
+	unsigned int widths[3], row_size, k;
+	unsigned char row[2][1+3*8];
+	int current = 0;
+
+	if(!fastimagePdfRead(pdf, offset, PDF_PEEK_SIZE)) return false;
+	if(!(p = fastimagePdfObjectBody(pdf->buf, pdf->buf+strlen(pdf->buf), &number))) return false;
+	if(!fastimagePdfLoadValue(pdf, offset, PDF_PEEK_SIZE, (size_t)(p-pdf->buf), PDF_STREAM_TAIL, &value, &value_end)) return false;
+	if(*value != '<') return false;
+
+	dict = value+2;
+	dict_end = value_end-2;
+	end = pdf->buf+strlen(pdf->buf);
+
+	if(!fastimagePdfName(fastimagePdfDictGet(dict, dict_end, "Type"), dict_end, "XRef")) return false;
+	if(!fastimagePdfInteger(pdf, fastimagePdfDictGet(dict, dict_end, "Size"), dict_end, &size)) return false;
+	if(!fastimagePdfInteger(pdf, fastimagePdfDictGet(dict, dict_end, "Length"), dict_end, &length)) return false;
+	if(!fastimagePdfInteger(pdf, fastimagePdfDictGet(dict, dict_end, "Prev"), dict_end, prev)) *prev = 0;
+	if(fastimagePdfDictGet(dict, dict_end, "Encrypt")) pdf->encrypted = true;
+
+	// Widths of type, offset (or object stream) and generation (or index) fields
+	if(!(p = fastimagePdfDictGet(dict, dict_end, "W")) || *p != '[') return false;
+
+	for(p++, k = 0; k < 3; k++) {
+		if(!(p = fastimagePdfUnsigned(fastimagePdfSkipSpace(p, dict_end), dict_end, &number)) || number > 8) return false;
+
+		widths[k] = (unsigned int)number;
+	}
+
+	row_size = widths[0]+widths[1]+widths[2];
+
+	p = fastimagePdfDictGet(dict, dict_end, "Filter");
+	if(p && *p == '[') p = fastimagePdfSkipSpace(p+1, dict_end);
+	if(p && p < dict_end && *p == '/') {
+		if(!fastimagePdfName(p, dict_end, "FlateDecode")) return false;
+
+		inflated = true;
+
+		if((p = fastimagePdfDictGet(dict, dict_end, "DecodeParms")) != 0 && *p == '[') p = fastimagePdfSkipSpace(p+1, dict_end);
+		if(p && *p == '<' && (value = fastimagePdfSkipValue(p, dict_end, 0)) != 0) {
+			fastimagePdfInteger(pdf, fastimagePdfDictGet(p+2, value-2, "Predictor"), value-2, &predictor);
+			fastimagePdfInteger(pdf, fastimagePdfDictGet(p+2, value-2, "Columns"), value-2, &columns);
+		}
+
+		// TIFF predictor is not used by writers of cross-reference streams
+		if(predictor != 1 && (predictor < 10 || columns != row_size)) return false;
+	}
+
+	// Data follows "stream" and end of line
+	p = fastimagePdfSkipSpace(value_end, end);
+	if(!fastimagePdfKeyword(p, end, "stream")) return false;
+	p += 6;
+	if(p < end && *p == '\r') p++;
+	if(p < end && *p == '\n') p++;
+
+	data = offset+(uint64_t)(p-pdf->buf);
+	if(data > pdf->size || length > pdf->size-data) return false;
+
+	if(!inflated) {
+		if(!fastimageSliceInit(&slice, &stream_reader, &pdf->reader, data, length)) return false;
+	} else {
+#if defined(FASTIMAGE_USE_ZLIB)
+		if(!fastimageInflateInit(&inflatec, &stream_reader, &pdf->reader, data, length, 15)) return false;
+#else
+		return false;
+#endif
+	}
+
+	// Subsections are pairs of first object and count, whole range by default
+	index = fastimagePdfDictGet(dict, dict_end, "Index");
+	if(index && *index == '[')
+		index = fastimagePdfSkipSpace(index+1, dict_end);
+	else
+		index = 0;
+
+	memset(row, 0, sizeof(row));
+
+	while(1) {
+		if(index) {
+			if(*index == ']') break;
+			if(!(index = fastimagePdfUnsigned(index, dict_end, &start))) goto XREF_STREAM_END;
+			if(!(index = fastimagePdfUnsigned(fastimagePdfSkipSpace(index, dict_end), dict_end, &count))) goto XREF_STREAM_END;
+
+			index = fastimagePdfSkipSpace(index, dict_end);
+		} else {
+			start = 0;
+			count = size;
+		}
+
+		// start+count must not wrap
+		if(start > PDF_MAX_OBJECTS || count > PDF_MAX_OBJECTS-start || !fastimagePdfReserve(pdf, start+count)) goto XREF_STREAM_END;
+
+		for(i = 0; i < count; i++) {
+			unsigned char *fields;
+
+			if(predictor >= 10) {
+				if(stream_reader.read(stream_reader.context, row_size+1, row[current]) != row_size+1) goto XREF_STREAM_END;
+				if(!fastimagePdfUnpredict(row[current], row[current^1], row_size)) goto XREF_STREAM_END;
+
+				fields = row[current]+1;
+				current ^= 1;
+			} else {
+				if(stream_reader.read(stream_reader.context, row_size, row[0]) != row_size) goto XREF_STREAM_END;
+
+				fields = row[0];
+			}
+
+			// Type 1 is object at offset, 0 is free, 2 is in object stream
+			if(!widths[0] || fastimagePdfField(fields, widths[0]) == 1)
+				fastimagePdfSetOffset(pdf, start+i, fastimagePdfField(fields+widths[0], widths[1]));
+			else
+				fastimagePdfSetOffset(pdf, start+i, 0);
+		}
+
+		if(!index) break;
+	}
+
+	result = true;
+
+XREF_STREAM_END:
+#if defined(FASTIMAGE_USE_ZLIB)
+	if(inflated) fastimageInflateFree(&inflatec);
+#endif
+
+	return result;
+}
+
+static bool fastimagePdfXrefTable(fastimage_pdf_t *pdf, uint64_t offset, uint64_t *prev)
+{
+	const char *p, *end, *value, *value_end;
+	uint64_t start, count, entries, i, stream;
+	size_t n, chunk, k;
+
+	offset += 4; // "xref"
+
+	while(1) {
+		n = fastimagePdfRead(pdf, offset, PDF_PEEK_SIZE);
+		end = pdf->buf+n;
+		p = fastimagePdfSkipSpace(pdf->buf, end);
+
+		if(fastimagePdfKeyword(p, end, "trailer")) {
+			if(!fastimagePdfLoadValue(pdf, offset, PDF_PEEK_SIZE, (size_t)(p+7-pdf->buf), 0, &value, &value_end) || *value != '<') return false;
+
+			if(!fastimagePdfInteger(pdf, fastimagePdfDictGet(value+2, value_end-2, "Prev"), value_end-2, prev)) *prev = 0;
+			if(fastimagePdfDictGet(value+2, value_end-2, "Encrypt")) pdf->encrypted = true;
+
+			// Hybrid file, objects in object streams are listed by stream of the same update
+			if(fastimagePdfInteger(pdf, fastimagePdfDictGet(value+2, value_end-2, "XRefStm"), value_end-2, &stream)) {
+				uint64_t stream_prev;
+
+				fastimagePdfXrefStream(pdf, stream, &stream_prev);
+			}
+
+			return true;
+		}
+
+		if(!(p = fastimagePdfUnsigned(p, end, &start))) return false;
+		if(!(p = fastimagePdfUnsigned(fastimagePdfSkipSpace(p, end), end, &count))) return false;
+		if(start > PDF_MAX_OBJECTS || count > PDF_MAX_OBJECTS-start || !fastimagePdfReserve(pdf, start+count)) return false;
+
+		// Entries are "oooooooooo ggggg n" with two characters of end of line
+		entries = offset+(uint64_t)(fastimagePdfSkipSpace(p, end)-pdf->buf);
+
+		for(i = 0; i < count; i += chunk) {
+			chunk = PDF_PEEK_SIZE/PDF_XREF_ENTRY_SIZE;
+			if(chunk > count-i) chunk = (size_t)(count-i);
+
+			if(fastimagePdfRead(pdf, entries+i*PDF_XREF_ENTRY_SIZE, chunk*PDF_XREF_ENTRY_SIZE) != chunk*PDF_XREF_ENTRY_SIZE) return false;
+
+			for(k = 0; k < chunk; k++) {
+				const char *entry = pdf->buf+k*PDF_XREF_ENTRY_SIZE;
+				uint64_t entry_offset;
+
+				if(!fastimagePdfUnsigned(entry, entry+10, &entry_offset)) return false;
+
+				fastimagePdfSetOffset(pdf, start+i+k, (entry[17] == 'n')?entry_offset:0);
+			}
+		}
+
+		offset = entries+count*PDF_XREF_ENTRY_SIZE;
+	}
 }
 
-fastimage_image_t fastimageOpen(const fastimage_reader_t *reader)
+static int fastimagePdfCompareObjects(const void *a, const void *b)
 {
-	fastimage_image_t image;
-	unsigned char sign[4];
-	
-	memset(&image, 0, sizeof(fastimage_image_t));
-	
-	if(reader->read(reader->context, 4, sign) != 4) {
-		image.format = fastimage_error;
-		
-		return image;
-	}
-	
-	image.format = fastimage_unknown;
-	
-	if(!memcmp(sign, "BM", 2))
-		image.format = fastimage_bmp;
-	else if(!memcmp(sign, "\x89PNG", 4))
-		image.format = fastimage_png;
-	else if(!memcmp(sign, "GIF8", 4)) // GIF87a or GIF89a
-		image.format = fastimage_gif;
-	else if(!memcmp(sign, "RIFF", 4))
-		image.format = fastimage_webp;
-	else if(!memcmp(sign, "qoif", 4))
-		image.format = fastimage_qoi;
-	else if(!memcmp(sign, "qoyf", 4))
-		image.format = fastimage_qoy;
-	else if(sign[0] == 0xFF && sign[1] == 0xD8)
-		image.format = fastimage_jpg;
-	else if(sign[0] == 10 && sign[1] == 5 && sign[2] == 1 && sign[3] == 8)
-		image.format = fastimage_pcx;
-	else if(sign[0] == 0 && sign[1] == 0 && sign[2] == 1 && sign[3] == 0)
-		image.format = fastimage_ico;
-
-	// Try to detect TGA
-	switch(sign[2]) { // DataType
-		case 1: // Palette, uncompressed
-		case 9: // Palette, RLE
-			if(sign[1] == 1) // Color Map (availability)
-				image.format = fastimage_tga;
-			break;
-		case 2: // True Color, uncompressed
-		case 3: // Grayscale, uncompressed
-		case 10: // True Color, RLE
-		case 11: // Grayscale, RLE
-			if(sign[1] == 0)
-				image.format = fastimage_tga;
-			break;
-	}
+	const fastimage_pdf_object_t *object_a = a, *object_b = b;
 
+	if(object_a->offset != object_b->offset) return (object_a->offset < object_b->offset)?-1:1;
 
-	// Try to detect HEIF or AVIF
-	if(image.format == fastimage_unknown)
-		fastimageDetectISOBMFF(reader, sign, &image); // Should be last, because we read some data here
-	
-	// Read BMP meta
-	if(image.format == fastimage_bmp)
-		fastimageReadBmp(reader, sign, &image);
-	
-	// Read TGA meta
-	if(image.format == fastimage_tga)
-		fastimageReadTga(reader, sign, &image);
-	
-	// Read PCX meta
-	if(image.format == fastimage_pcx)
-		fastimageReadPcx(reader, sign, &image);
-	
-	// Read PNG meta
-	if(image.format == fastimage_png)
-		fastimageReadPng(reader, sign, &image);
-	
-	// Read GIF meta
-	if(image.format == fastimage_gif)
-		fastimageReadGif(reader, sign, &image);
-	
-	// Read WEBP meta
-	if(image.format == fastimage_webp)
-		fastimageReadWebp(reader, sign, &image);
-	
-	// Read HEIC or AVIF meta
-	if(image.format == fastimage_heic || image.format == fastimage_avif || image.format == fastimage_miaf)
-		fastimageReadISOBMFF(reader, sign, &image);
-	
-	// Read JPG meta
-	if(image.format == fastimage_jpg)
-		fastimageReadJpeg(reader, sign, &image);
-	
-	if(image.format == fastimage_qoi || image.format == fastimage_qoy)
-		fastimageReadQoi(reader, sign, &image);
-	
-	if(image.format == fastimage_ico)
-		fastimageReadIco(reader, sign, &image);
-	
-	return image;
+	return 0;
 }
 
-static size_t FASTIMAGE_APIENTRY fastimageFileRead(void *context, size_t size, void *buf)
+bool fastimagePdfOpen(const fastimage_reader_t *reader, uint64_t size, fastimage_pdf_t *pdf)
 {
-	return fread(buf, 1, size, context);
-}
+	uint64_t xref, prev, i;
+	size_t tail_size, n;
+	const char *p;
+	int sections;
 
-static bool FASTIMAGE_APIENTRY fastimageFileSeek(void *context, int64_t pos, bool seek_cur)
-{
-#if defined(_WIN32)
-	return _fseeki64(context, pos, seek_cur?(SEEK_CUR):(SEEK_SET)) == 0;
-#else
-	return fseeko64(context, pos, seek_cur?(SEEK_CUR):(SEEK_SET)) == 0;
-#endif
+	memset(pdf, 0, sizeof(fastimage_pdf_t));
+	pdf->reader = *reader;
+	pdf->size = size;
+
+	// Last startxref points to the newest cross-reference section
+	tail_size = (size > PDF_TAIL_SIZE)?PDF_TAIL_SIZE:(size_t)size;
+
+	n = fastimagePdfRead(pdf, size-tail_size, tail_size);
+	if(n < 9) goto PDF_ERROR;
+
+	for(p = pdf->buf+n-9; p >= pdf->buf; p--)
+		if(!memcmp(p, "startxref", 9)) break;
+
+	if(p < pdf->buf) goto PDF_ERROR;
+	if(!fastimagePdfUnsigned(fastimagePdfSkipSpace(p+9, pdf->buf+n), pdf->buf+n, &xref)) goto PDF_ERROR;
+
+	for(sections = 0; xref && sections < PDF_MAX_SECTIONS; sections++) {
+		bool result;
+
+		n = fastimagePdfRead(pdf, xref, 16);
+		p = fastimagePdfSkipSpace(pdf->buf, pdf->buf+n);
+
+		if(fastimagePdfKeyword(p, pdf->buf+n, "xref"))
+			result = fastimagePdfXrefTable(pdf, xref+(uint64_t)(p-pdf->buf), &prev);
+		else
+			result = fastimagePdfXrefStream(pdf, xref, &prev);
+
+		// Older updates may be broken, newest one must be there
+		if(!result) {
+			if(!sections) goto PDF_ERROR;
+
+			break;
+		}
+
+		if(prev == xref) break;
+		xref = prev;
+	}
+
+	// Objects with offsets in order of file, so their dictionaries are read forward
+	for(i = 0; i < pdf->objects; i++) {
+		if(pdf->offsets[i] == PDF_UNSEEN || pdf->offsets[i] >= size) pdf->offsets[i] = 0;
+		if(pdf->offsets[i]) pdf->count++;
+	}
+
+	if(pdf->count) {
+		pdf->order = malloc((size_t)pdf->count*sizeof(fastimage_pdf_object_t));
+		if(!pdf->order) goto PDF_ERROR;
+
+		for(i = 0, n = 0; i < pdf->objects; i++)
+			if(pdf->offsets[i]) {
+				pdf->order[n].offset = pdf->offsets[i];
+				pdf->order[n].number = i;
+				n++;
+			}
+
+		qsort(pdf->order, (size_t)pdf->count, sizeof(fastimage_pdf_object_t), fastimagePdfCompareObjects);
+	}
+
+	return true;
+
+PDF_ERROR:
+	fastimagePdfClose(pdf);
+
+	return false;
 }
 
-fastimage_image_t fastimageOpenFile(FILE *f)
+bool fastimagePdfOpenFile(FILE *f, fastimage_pdf_t *pdf)
 {
 	fastimage_reader_t reader;
-	
+	int64_t size;
+
 	reader.context = f;
 	reader.read = fastimageFileRead;
 	reader.seek = fastimageFileSeek;
-	
-	return fastimageOpen(&reader);
-}
 
-fastimage_image_t fastimageOpenFileA(const char *filename)
-{
-	FILE *f = 0;
-	
-	f = fopen(filename, "rb");
-	if(!f) {
-		fastimage_image_t image;
-		
-		memset(&image, 0, sizeof(fastimage_image_t));
-		image.format = fastimage_error;
-	
-		return image;
+#if defined(_WIN32)
+	if(_fseeki64(f, 0, SEEK_END)) size = -1;
+	else size = _ftelli64(f);
+#else
+	if(fseeko64(f, 0, SEEK_END)) size = -1;
+	else size = ftello64(f);
+#endif
+
+	if(size < 0) {
+		memset(pdf, 0, sizeof(fastimage_pdf_t));
+
+		return false;
 	}
-	
-	return fastimageOpenFile(f);
+
+	return fastimagePdfOpen(&reader, (uint64_t)size, pdf);
 }
 
-#if !defined(_WIN32)
-FILE *_wfopen(const wchar_t* filename, const wchar_t* mode)
+// Stream dictionary with /Subtype /Image
+static bool fastimagePdfReadImage(fastimage_pdf_t *pdf, const fastimage_pdf_object_t *object, uint64_t next_offset, fastimage_pdf_image_t *image)
 {
-	size_t filename_len, mode_len;
-	char* cfilename = 0, * cmode = 0;
-	FILE *f = 0;
+	const char *p, *end, *value, *value_end, *dict, *dict_end;
+	uint64_t number, width, height, bits = 0;
+	size_t size = PDF_PEEK_SIZE, n;
+	bool palette = false;
 
-	filename_len = wcslen(filename);
-	mode_len = wcslen(mode);
+	// Usually the next object is close, no need to read the whole peek
+	if(next_offset-object->offset < size) size = (size_t)(next_offset-object->offset);
 
-	cfilename = malloc(filename_len * MB_CUR_MAX + 1);
-	cmode = malloc(mode_len * MB_CUR_MAX + 1);
-	if (!cfilename || !cmode) {
-		errno = ENOMEM;
-		goto FINAL;
-	}
+	n = fastimagePdfRead(pdf, object->offset, size);
 
-	if (wcstombs(cfilename, filename, filename_len * MB_CUR_MAX + 1) == (size_t)(-1)) {
-		errno = EINVAL;
-		goto FINAL;
+	p = fastimagePdfObjectBody(pdf->buf, pdf->buf+n, &number);
+	if(!p || number != object->number) return false;
+
+	// Dictionary is checked before the rest of it is read
+	value = fastimagePdfSkipSpace(p, pdf->buf+n);
+	if(value+1 >= pdf->buf+n || value[0] != '<' || value[1] != '<') return false;
+
+	if(!fastimagePdfLoadValue(pdf, object->offset, size, (size_t)(p-pdf->buf), PDF_STREAM_TAIL, &value, &value_end)) return false;
+
+	dict = value+2;
+	dict_end = value_end-2;
+	end = pdf->buf+strlen(pdf->buf);
+
+	if(!fastimagePdfName(fastimagePdfDictGet(dict, dict_end, "Subtype"), dict_end, "Image")) return false;
+
+	p = fastimagePdfSkipSpace(value_end, end);
+	if(!fastimagePdfKeyword(p, end, "stream")) return false;
+	p += 6;
+	if(p < end && *p == '\r') p++;
+	if(p < end && *p == '\n') p++;
+
+	memset(image, 0, sizeof(fastimage_pdf_image_t));
+	image->object = object->number;
+	image->offset = object->offset+(uint64_t)(p-pdf->buf);
+
+	if(!fastimagePdfInteger(pdf, fastimagePdfDictGet(dict, dict_end, "Length"), dict_end, &image->length) || image->length > pdf->size-image->offset)
+		image->length = pdf->size-image->offset;
+
+	if(!fastimagePdfInteger(pdf, fastimagePdfDictGet(dict, dict_end, "Width"), dict_end, &width)) width = 0;
+	if(!fastimagePdfInteger(pdf, fastimagePdfDictGet(dict, dict_end, "Height"), dict_end, &height)) height = 0;
+
+	// Filter is a name or array of names, applied in order
+	if((p = fastimagePdfDictGet(dict, dict_end, "Filter")) != 0) {
+		const char *last = 0;
+
+		if(*p == '[') {
+			for(p = fastimagePdfSkipSpace(p+1, dict_end); p < dict_end && *p == '/'; p = fastimagePdfSkipSpace(fastimagePdfToken(p+1, dict_end), dict_end)) {
+				last = p+1;
+				image->filters++;
+			}
+		} else if(*p == '/') {
+			last = p+1;
+			image->filters = 1;
+		}
+
+		if(last) {
+			n = (size_t)(fastimagePdfToken(last, dict_end)-last);
+			if(n >= sizeof(image->filter)) n = sizeof(image->filter)-1;
+
+			memcpy(image->filter, last, n);
+			image->filter[n] = 0;
+		}
 	}
 
-	if (wcstombs(cmode, mode, mode_len * MB_CUR_MAX + 1) == (size_t)(-1)) {
-		errno = EINVAL;
-		goto FINAL;
+	// Masks have 1 bit and no color space
+	if((p = fastimagePdfDictGet(dict, dict_end, "ImageMask")) != 0 && fastimagePdfKeyword(p, dict_end, "true")) {
+		bits = 1;
+		image->image.channels = 1;
+	} else {
+		fastimagePdfInteger(pdf, fastimagePdfDictGet(dict, dict_end, "BitsPerComponent"), dict_end, &bits);
+		image->image.channels = fastimagePdfColorSpace(pdf, fastimagePdfDictGet(dict, dict_end, "ColorSpace"), dict_end, &palette, 0);
 	}
 
-	f = fopen(cfilename, cmode);
+	if(bits > 32) bits = 0;
+	image->bitspercomponent = (unsigned int)bits;
 
-FINAL:
-	if (cfilename) free(cfilename);
-	if (cmode) free(cmode);
+	image->image.format = fastimage_unknown;
+	image->image.width = (size_t)width;
+	image->image.height = (size_t)height;
 
-	return f;
+	if(palette) {
+		image->image.palette = image->bitspercomponent;
+		image->image.bitsperpixel = image->image.channels*8;
+	} else
+		image->image.bitsperpixel = image->image.channels*image->bitspercomponent;
+
+	// JPEG stream is a whole JPEG file
+	if(image->filters == 1 && !strcmp(image->filter, "DCTDecode") && !pdf->encrypted) {
+		fastimage_reader_t stream_reader;
+		fastimage_slice_context_t slice;
+
+		if(fastimageSliceInit(&slice, &stream_reader, &pdf->reader, image->offset, image->length))
+			image->image = fastimageOpen(&stream_reader);
+	}
+
+	return true;
 }
-#endif
 
-fastimage_image_t fastimageOpenFileW(const wchar_t *filename)
+bool fastimagePdfNext(fastimage_pdf_t *pdf, fastimage_pdf_image_t *image)
 {
-	FILE *f = 0;
-	
-	f = _wfopen(filename, L"rb");
-	if(!f) {
-		fastimage_image_t image;
-		
-		memset(&image, 0, sizeof(fastimage_image_t));
-		image.format = fastimage_error;
-	
-		return image;
+	while(pdf->index < pdf->count) {
+		const fastimage_pdf_object_t *object = &pdf->order[pdf->index++];
+		uint64_t next_offset;
+
+		next_offset = (pdf->index < pdf->count)?pdf->order[pdf->index].offset:pdf->size;
+
+		if(fastimagePdfReadImage(pdf, object, next_offset, image)) return true;
 	}
-	
-	return fastimageOpenFile(f);
+
+	return false;
+}
+
+void fastimagePdfClose(fastimage_pdf_t *pdf)
+{
+	if(pdf->offsets) free(pdf->offsets);
+	if(pdf->order) free(pdf->order);
+	if(pdf->buf) free(pdf->buf);
+
+	memset(pdf, 0, sizeof(fastimage_pdf_t));
 }
 
 #if defined(FASTIMAGE_USE_LIBCURL)
@@ -778,7 +6438,10 @@ typedef struct {
 	CURL *curl;
 	size_t offset;
 	size_t filesize;
+	size_t maxsize;
+	bool truncated;
 	unsigned char *filedata;
+	const fastimage_options_t *options;
 } fastimage_curl_context_t;
 
 static size_t FASTIMAGE_APIENTRY fastimageHttpRead(void *context, size_t size, void* buf)
@@ -819,6 +6482,14 @@ static size_t fastimageCurlWriteData(void *ptr, size_t size, size_t nmemb, fasti
 	if((SIZE_MAX-context->filesize)/nmemb < size) return 0;
 	
 	block_size = size*nmemb;
+
+	// Parser is not allowed to read more, so don't download it
+	if(context->maxsize && block_size >= context->maxsize-context->filesize) {
+		block_size = context->maxsize-context->filesize;
+		context->truncated = true;
+
+		if(!block_size) return 0;
+	}
 	
 	if(context->filedata)
 		_filedata = realloc(context->filedata, context->filesize+block_size);
@@ -831,16 +6502,39 @@ static size_t fastimageCurlWriteData(void *ptr, size_t size, size_t nmemb, fasti
 		memcpy(context->filedata+context->offset, ptr, block_size);
 		context->offset = context->filesize;
 		
-		return nmemb;
+		return context->truncated?0:nmemb;
 	}
 
 	return 0;
 }
 
+static int fastimageCurlProgress(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+	fastimage_curl_context_t *context;
+
+	(void)dltotal;
+	(void)dlnow;
+	(void)ultotal;
+	(void)ulnow;
+
+	context = (fastimage_curl_context_t *)clientp;
+
+	return (context->options->cancel && *context->options->cancel)?1:0;
+}
+
 fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy)
+{
+	return fastimageOpenHttpExA(url, support_proxy, 0);
+}
+
+fastimage_image_t fastimageOpenHttpExA(const char *url, bool support_proxy, const fastimage_options_t *options)
 {
 	fastimage_image_t image;
 	fastimage_curl_context_t context;
+	fastimage_options_t probe_options;
+	uint64_t start_ticks = 0;
+	long http_status = 0;
+	curl_off_t retry_after = 0;
 	bool success = true;
 	
 	memset(&context, 0, sizeof(fastimage_curl_context_t));
@@ -848,13 +6542,59 @@ fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy)
 	if(!context.curl) success = false;
 	
 	if(success) {
+		CURLcode curl_result;
+
 		curl_easy_setopt(context.curl, CURLOPT_URL, url);
 		curl_easy_setopt(context.curl, CURLOPT_WRITEFUNCTION, fastimageCurlWriteData);
 		curl_easy_setopt(context.curl, CURLOPT_WRITEDATA, &context);
 		curl_easy_setopt(context.curl, CURLOPT_USERAGENT, "fastimage_c/1.0");
+		curl_easy_setopt(context.curl, CURLOPT_NOSIGNAL, 1L);
+
+		if(options) {
+			start_ticks = fastimageTicks();
+			context.options = options;
+			context.maxsize = (options->max_bytes > SIZE_MAX)?(SIZE_MAX):((size_t)options->max_bytes);
+
+			if(options->timeout_ms)
+				curl_easy_setopt(context.curl, CURLOPT_TIMEOUT_MS, (long)options->timeout_ms);
+
+			if(options->low_speed_limit && options->low_speed_time) {
+				curl_easy_setopt(context.curl, CURLOPT_LOW_SPEED_LIMIT, (long)options->low_speed_limit);
+				curl_easy_setopt(context.curl, CURLOPT_LOW_SPEED_TIME, (long)options->low_speed_time);
+			}
+
+			if(options->http_share)
+				curl_easy_setopt(context.curl, CURLOPT_SHARE, (CURLSH *)options->http_share);
+
+			if(options->cancel) {
+				curl_easy_setopt(context.curl, CURLOPT_XFERINFOFUNCTION, fastimageCurlProgress);
+				curl_easy_setopt(context.curl, CURLOPT_XFERINFODATA, &context);
+				curl_easy_setopt(context.curl, CURLOPT_NOPROGRESS, 0L);
+			}
+		}
 		
-		if(curl_easy_perform(context.curl) != CURLE_OK)
+		curl_result = curl_easy_perform(context.curl);
+
+		if(curl_result == CURLE_WRITE_ERROR && context.truncated)
+			curl_result = CURLE_OK; // Stopped by us, there is enough data for parser
+
+		curl_easy_getinfo(context.curl, CURLINFO_RESPONSE_CODE, &http_status);
+#if LIBCURL_VERSION_NUM >= 0x074200
+		curl_easy_getinfo(context.curl, CURLINFO_RETRY_AFTER, &retry_after);
+#endif
+
+		if(curl_result != CURLE_OK) {
 			success = false;
+
+			if(options && options->stats) {
+				memset(options->stats, 0, sizeof(fastimage_stats_t));
+
+				if(curl_result == CURLE_OPERATION_TIMEDOUT)
+					options->stats->abort_reason = fastimage_abort_timeout;
+				else if(curl_result == CURLE_ABORTED_BY_CALLBACK)
+					options->stats->abort_reason = fastimage_abort_cancel;
+			}
+		}
 	}
 
 	if(success) {
@@ -865,15 +6605,36 @@ fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy)
 		reader.read = fastimageHttpRead;
 		reader.seek = fastimageHttpSeek;
 
-		image = fastimageOpen(&reader);
+		if(options) {
+			uint64_t elapsed;
+
+			// Download time counts too
+			probe_options = *options;
+
+			if(options->fingerprint && options->fingerprint->mode == fastimage_fingerprint_prefix)
+				options->fingerprint->size = context.truncated?0:context.filesize;
+			elapsed = fastimageTicks()-start_ticks;
+			if(options->timeout_ms)
+				probe_options.timeout_ms = (elapsed < options->timeout_ms)?((uint32_t)(options->timeout_ms-elapsed)):(1);
+
+			image = fastimageOpenEx(&reader, &probe_options);
+		} else
+			image = fastimageOpen(&reader);
 		
 		free(context.filedata);
-	}
+	} else if(context.filedata)
+		free(context.filedata);
 	
 	if(!success) {
 		memset(&image, 0, sizeof(fastimage_image_t));
 		image.format = fastimage_error;
 	}
+
+	// Body of error response is probed too, status tells schedulers about throttling
+	if(options && options->stats) {
+		options->stats->http_status = (int)http_status;
+		options->stats->retry_after = (retry_after > 0 && retry_after < UINT32_MAX)?(uint32_t)retry_after:0;
+	}
 	
 	if(context.curl) curl_easy_cleanup(context.curl);
 	
@@ -881,6 +6642,11 @@ fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy)
 }
 
 fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
+{
+	return fastimageOpenHttpExW(url, support_proxy, 0);
+}
+
+fastimage_image_t fastimageOpenHttpExW(const wchar_t *url, bool support_proxy, const fastimage_options_t *options)
 {
 	fastimage_image_t image;
 	char *urlc = 0;
@@ -896,7 +6662,8 @@ fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
 		wcstombs(urlc, url, url_len*4);
 	}
 	
-	image = fastimageOpenHttpA(urlc, support_proxy);
+	if(success)
+		image = fastimageOpenHttpExA(urlc, support_proxy, options);
 	
 	if(!success) {
 		memset(&image, 0, sizeof(fastimage_image_t));
@@ -992,6 +6759,11 @@ static bool FASTIMAGE_APIENTRY fastimageHttpSeek(void *context, int64_t pos, boo
 }
 
 fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
+{
+	return fastimageOpenHttpExW(url, support_proxy, 0);
+}
+
+fastimage_image_t fastimageOpenHttpExW(const wchar_t *url, bool support_proxy, const fastimage_options_t *options)
 {
 	HINTERNET session = 0, connect = 0, request = 0;
 	bool success = true;
@@ -1042,6 +6814,12 @@ fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
 		if(!session) success = false;
 	}
 
+	if(success && options && options->timeout_ms) {
+		int timeout = (options->timeout_ms > INT_MAX)?(INT_MAX):((int)options->timeout_ms);
+
+		if(!WinHttpSetTimeouts(session, timeout, timeout, timeout, timeout)) success = false;
+	}
+
 	if(success) {
 		connect = WinHttpConnect(
 			session,
@@ -1089,7 +6867,7 @@ fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
 			reader.read = fastimageHttpRead;
 			reader.seek = fastimageHttpSeek;
 
-			image = fastimageOpen(&reader);
+			image = fastimageOpenEx(&reader, options);
 		}
 
 		if(results == FALSE) success = false;
@@ -1098,6 +6876,18 @@ fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
 	if(!success) {
 		memset(&image, 0, sizeof(fastimage_image_t));
 		image.format = fastimage_error;
+
+		if(options && options->stats) memset(options->stats, 0, sizeof(fastimage_stats_t));
+	}
+
+	if(request && options && options->stats) {
+		DWORD status = 0, status_size = sizeof(DWORD), retry_after = 0, retry_after_size = sizeof(DWORD);
+
+		if(WinHttpQueryHeaders(request, WINHTTP_QUERY_STATUS_CODE|WINHTTP_QUERY_FLAG_NUMBER, WINHTTP_HEADER_NAME_BY_INDEX, &status, &status_size, WINHTTP_NO_HEADER_INDEX))
+			options->stats->http_status = (int)status;
+
+		if(WinHttpQueryHeaders(request, WINHTTP_QUERY_RETRY_AFTER|WINHTTP_QUERY_FLAG_NUMBER, WINHTTP_HEADER_NAME_BY_INDEX, &retry_after, &retry_after_size, WINHTTP_NO_HEADER_INDEX))
+			options->stats->retry_after = retry_after;
 	}
 
 	if(url_server_copy) free(url_server_copy);
@@ -1109,6 +6899,11 @@ fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
 }
 
 fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy)
+{
+	return fastimageOpenHttpExA(url, support_proxy, 0);
+}
+
+fastimage_image_t fastimageOpenHttpExA(const char *url, bool support_proxy, const fastimage_options_t *options)
 {
 	fastimage_image_t image;
 	wchar_t *wurl;
@@ -1126,7 +6921,7 @@ fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy)
 	
 	mbstowcs(wurl, url, url_len);
 
-	image = fastimageOpenHttpW(wurl, support_proxy);
+	image = fastimageOpenHttpExW(wurl, support_proxy, options);
 	
 	free(wurl);
 	
@@ -1134,11 +6929,17 @@ fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy)
 }
 #else
 fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
+{
+	return fastimageOpenHttpExW(url, support_proxy, 0);
+}
+
+fastimage_image_t fastimageOpenHttpExW(const wchar_t *url, bool support_proxy, const fastimage_options_t *options)
 {
 	fastimage_image_t image;
 
 	(void)url;
 	(void)support_proxy;
+	(void)options;
 
 	memset(&image, 0, sizeof(fastimage_image_t));
 	image.format = fastimage_error;
@@ -1147,11 +6948,17 @@ fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy)
 }
 
 fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy)
+{
+	return fastimageOpenHttpExA(url, support_proxy, 0);
+}
+
+fastimage_image_t fastimageOpenHttpExA(const char *url, bool support_proxy, const fastimage_options_t *options)
 {
 	fastimage_image_t image;
 
 	(void)url;
 	(void)support_proxy;
+	(void)options;
 
 	memset(&image, 0, sizeof(fastimage_image_t));
 	image.format = fastimage_error;
@@ -60,9 +60,30 @@ enum fastimage_image_format {
 	fastimage_qoi,
 	fastimage_qoy,
 	fastimage_ani,
-	fastimage_ico
+	fastimage_ico,
+	fastimage_cur,
+	fastimage_svg, // Also gzipped SVGZ (with zlib), size is in px from width, height and viewBox of root element
+	fastimage_dds, // GPU textures: size of the top mip level, bitsperpixel is rounded up for block compression
+	fastimage_ktx,
+	fastimage_ktx2,
+	fastimage_pvr, // PVR v3
+	fastimage_astc,
+	fastimage_exr, // OpenEXR, size of data window, first part of multi-part files
+	fastimage_hdr, // Radiance RGBE or XYZE
+	fastimage_psd, // Also PSB
+	fastimage_pnm, // NetPBM P1-P6 and PAM (P7)
+	fastimage_farbfeld,
+	fastimage_mp4, // Video containers: display size of the first video track, see fastimageVideoOpen
+	fastimage_mov,
+	fastimage_mkv,
+	fastimage_webm
 };
 
+#define FASTIMAGE_FORMATS_NUM (fastimage_webm+1)
+
+// Lower case name of fastimage_image_format ("jpg", "ktx2"...), "other" for anything out of enum
+extern const char *fastimageFormatName(int format);
+
 typedef struct {
 	int format;
 	size_t width;
@@ -81,12 +102,310 @@ typedef struct {
 	fastimage_seekfunc_t seek;
 } fastimage_reader_t;
 
+enum fastimage_abort_reason {
+	fastimage_abort_none,
+	fastimage_abort_bytes,
+	fastimage_abort_seeks,
+	fastimage_abort_timeout,
+	fastimage_abort_cancel
+};
+
+typedef struct {
+	uint64_t reads;
+	uint64_t seeks;
+	uint64_t bytes_read;
+	int abort_reason;
+	int http_status; // Response code of http functions, 0 without response
+	uint32_t retry_after; // Seconds from Retry-After of http response, 0 if there is none
+	int verify; // fastimage_verify_result of verify level
+} fastimage_stats_t;
+
+enum fastimage_level {
+	fastimage_level_full, // Everything that is known
+	fastimage_level_dimensions, // Format and size, channels, bitsperpixel and palette may be 0
+	fastimage_level_format, // Only format, no reads after signature (except form type of RIFF and ISOBMFF, DocType of EBML, cur/TGA check, SVG root element in the first 512 bytes)
+	fastimage_level_verify // Full, then PNG, JPEG and GIF are read to the end and checked (format is error if they are broken)
+};
+
+enum fastimage_verify_result {
+	fastimage_verify_none, // Not asked or format can't be verified
+	fastimage_verify_ok,
+	fastimage_verify_truncated,
+	fastimage_verify_corrupt // PNG CRC, JPEG markers or GIF blocks are wrong
+};
+
+enum fastimage_fingerprint_mode {
+	fastimage_fingerprint_none,
+	fastimage_fingerprint_prefix, // First prefix_size bytes and size of stream, only what is missing is read after probe
+	fastimage_fingerprint_full // The whole stream, read to the end after probe
+};
+
+typedef struct {
+	int mode;
+	uint64_t prefix_size; // 0 means 64 KB
+	uint64_t size; // Prefix mode: stream size hashed after prefix, filled by file, fd and memory functions (0 - unknown). Full mode: output
+	uint64_t hash; // Output, XXH64 with seed 0 of hashed bytes (size is appended as 8 bytes little endian)
+} fastimage_fingerprint_t;
+
+enum fastimage_hint {
+	fastimage_hint_progressive = 1, // JPEG SOF2, SOF6, SOF10 or SOF14
+	fastimage_hint_arithmetic = 2, // JPEG SOF9-SOF15
+	fastimage_hint_lossless = 4, // JPEG SOF3, SOF7, SOF11 or SOF15, lossless WebP
+	fastimage_hint_hierarchical = 8, // JPEG SOF5-SOF7 and SOF13-SOF15
+	fastimage_hint_interlaced = 16, // Adam7 PNG, interlaced first frame of GIF
+	fastimage_hint_animated = 32, // APNG, GIF with more than one frame, WebP with animation flag
+	fastimage_hint_alpha = 64, // Alpha channel or transparency (PNG tRNS, GIF transparent index, HEIF alpha item)
+	fastimage_hint_high_depth = 128 // More than 8 bits per sample
+};
+
+// Decoder routing hints, from the same header reads as probe. Only with hints PNG chunks are walked up to IDAT,
+// GIF blocks up to the second frame, WebP VP8X/VP8L headers are read
+typedef struct {
+	unsigned int flags; // fastimage_hint
+	unsigned int jpeg_marker; // SOF marker of JPEG (0xC0-0xCF), 0 for other formats
+	unsigned int bitspersample; // The largest, 0 if unknown
+	uint32_t frames; // Number of frames from APNG acTL, 0 if unknown
+} fastimage_hints_t;
+
+// Zero means no limit
+typedef struct {
+	int level;
+	uint64_t max_bytes;
+	uint64_t max_seeks;
+	uint32_t timeout_ms; // Counted from the start of probe
+	uint32_t low_speed_limit; // http only, bytes per second...
+	uint32_t low_speed_time; // ...during this number of seconds
+	volatile int *cancel; // Probe is aborted when it becomes non-zero
+	fastimage_stats_t *stats; // Optional output
+	void *http_share; // CURLSH * for libcurl, probes reuse its connections, DNS and TLS sessions
+	fastimage_fingerprint_t *fingerprint; // Hash computed from the same reads as probe
+	fastimage_hints_t *hints; // Optional output, filled at full and verify levels
+} fastimage_options_t;
+
 extern fastimage_image_t fastimageOpen(const fastimage_reader_t *reader);
+extern fastimage_image_t fastimageOpenEx(const fastimage_reader_t *reader, const fastimage_options_t *options);
 extern fastimage_image_t fastimageOpenFile(FILE *f);
+extern fastimage_image_t fastimageOpenFileEx(FILE *f, const fastimage_options_t *options);
 extern fastimage_image_t fastimageOpenFileA(const char *filename);
+extern fastimage_image_t fastimageOpenFileExA(const char *filename, const fastimage_options_t *options);
 extern fastimage_image_t fastimageOpenFileW(const wchar_t *filename);
+extern fastimage_image_t fastimageOpenFileExW(const wchar_t *filename, const fastimage_options_t *options);
+extern fastimage_image_t fastimageOpenMemory(const void *data, size_t size);
+extern fastimage_image_t fastimageOpenMemoryEx(const void *data, size_t size, const fastimage_options_t *options);
+// Image at offset of descriptor (length 0 - up to the end of file), safe to call from many threads on the same fd
+extern fastimage_image_t fastimageOpenFd(int fd, uint64_t offset, uint64_t length);
+extern fastimage_image_t fastimageOpenFdEx(int fd, uint64_t offset, uint64_t length, const fastimage_options_t *options);
+// Format of each prefix (first bytes of object), same as fastimageOpenMemoryEx with fastimage_level_format on it
+extern void fastimageClassifyBatch(const unsigned char *const *prefixes, const size_t *sizes, size_t count, int *formats);
+// Prefixes of the same size placed every stride bytes
+extern void fastimageClassifyStrided(const void *prefixes, size_t stride, size_t size, size_t count, int *formats);
 extern fastimage_image_t fastimageOpenHttpA(const char *url, bool support_proxy);
+extern fastimage_image_t fastimageOpenHttpExA(const char *url, bool support_proxy, const fastimage_options_t *options);
 extern fastimage_image_t fastimageOpenHttpW(const wchar_t *url, bool support_proxy);
+extern fastimage_image_t fastimageOpenHttpExW(const wchar_t *url, bool support_proxy, const fastimage_options_t *options);
+
+// Icon containers (ico, cur, ani)
+
+enum fastimage_icon_payload {
+	fastimage_icon_unknown,
+	fastimage_icon_bmp,
+	fastimage_icon_png,
+	fastimage_icon_ico // ani frame, it is an ico or cur file itself
+};
+
+typedef struct {
+	size_t width;
+	size_t height;
+	unsigned int bitsperpixel; // Bit depth of the stored image (1, 4, 8, 24, 32...)
+	unsigned int hotspot_x; // cur only
+	unsigned int hotspot_y; // cur only
+	int payload;
+	uint64_t offset;
+	uint64_t size;
+} fastimage_icon_t;
+
+typedef struct {
+	const fastimage_reader_t *reader;
+	int format;
+	size_t count; // Number of entries in ICONDIR (for ani it's known after anih chunk)
+	size_t index;
+	unsigned char *dir;
+	uint64_t offset; // Current stream position
+	uint64_t list_end; // End of ani LIST/fram chunk
+	size_t ani_width;
+	size_t ani_height;
+	unsigned int ani_bitsperpixel;
+	unsigned int ani_flags;
+} fastimage_icons_t;
+
+extern int fastimageIconsOpen(const fastimage_reader_t *reader, fastimage_icons_t *icons);
+extern bool fastimageIconsNext(fastimage_icons_t *icons, fastimage_icon_t *icon);
+extern void fastimageIconsClose(fastimage_icons_t *icons);
+
+// GPU textures (dds, ktx, ktx2, pvr, astc), the whole header is read at once
+
+enum fastimage_texture_encoding {
+	fastimage_texture_unknown,
+	fastimage_texture_uncompressed,
+	fastimage_texture_bc1, // DXT1
+	fastimage_texture_bc2, // DXT2, DXT3
+	fastimage_texture_bc3, // DXT4, DXT5
+	fastimage_texture_bc4,
+	fastimage_texture_bc5,
+	fastimage_texture_bc6h,
+	fastimage_texture_bc7,
+	fastimage_texture_etc1,
+	fastimage_texture_etc2_rgb,
+	fastimage_texture_etc2_rgba1, // Punchthrough alpha
+	fastimage_texture_etc2_rgba,
+	fastimage_texture_eac_r11,
+	fastimage_texture_eac_rg11,
+	fastimage_texture_astc,
+	fastimage_texture_pvrtc_2bpp,
+	fastimage_texture_pvrtc_4bpp,
+	fastimage_texture_etc1s, // Basis Universal in ktx2
+	fastimage_texture_uastc
+};
+
+typedef struct {
+	size_t width;
+	size_t height; // 1 for 1D textures
+	size_t depth; // 1 unless it's a volume texture
+	size_t layers; // Array elements, 1 if it's not an array
+	unsigned int faces; // 6 for cube maps, 1 otherwise
+	unsigned int levels; // Mip levels stored in file
+	int encoding; // fastimage_texture_encoding
+	unsigned int block_width; // Texels in block, all 1 for uncompressed
+	unsigned int block_height;
+	unsigned int block_depth;
+	unsigned int block_bits; // Bits per block, bits per texel for uncompressed, 0 if unknown
+	unsigned int channels;
+	unsigned int bitsperpixel; // block_bits per texel of block, rounded up
+	uint64_t native_format; // DXGI_FORMAT (dds with DX10 header), FourCC or 0 (other dds), glInternalFormat (ktx), VkFormat (ktx2), pixel format (pvr), 0 (astc)
+	unsigned int supercompression; // ktx2 supercompressionScheme
+} fastimage_texture_t;
+
+// Returns format of texture, fastimage_unknown for other files
+extern int fastimageTextureOpen(const fastimage_reader_t *reader, fastimage_texture_t *texture);
+
+// HEIF (heic, avif) items, resolved from pitm, iinf, iref, iprp and iloc of meta box
+
+typedef struct {
+	uint32_t id; // 0 - no such item
+	char type[5]; // hvc1, av01, grid, jpeg...
+	size_t width; // From ispe
+	size_t height;
+	unsigned int channels; // From pixi, 0 if item has none
+	unsigned int bitsperpixel;
+	uint64_t offset; // Coded data in stream, length is 0 when it's not one contiguous range of this file
+	uint64_t length;
+	uint64_t config_offset; // Body of hvcC or av1C property (parameter sets for decoder), length is 0 if there is none
+	uint64_t config_length;
+} fastimage_heif_item_t;
+
+typedef struct {
+	fastimage_heif_item_t primary;
+	fastimage_heif_item_t thumbnail; // The largest item with thmb reference to primary
+	fastimage_heif_item_t tile; // The first tile of grid, all tiles have its size
+	unsigned int grid_rows; // 0 if primary is not grid
+	unsigned int grid_columns;
+	unsigned int thumbnails;
+	bool alpha; // Primary has alpha auxiliary image
+} fastimage_heif_t;
+
+// Returns format (heic, avif or miaf), fastimage_unknown for other files. primary.id is 0 when meta box has no pitm
+extern int fastimageHeifOpen(const fastimage_reader_t *reader, fastimage_heif_t *heif);
+
+// Video containers (mp4, mov, mkv, webm), the first video track
+
+typedef struct {
+	size_t width; // Display size: tkhd of mp4 and mov (before rotation), DisplayWidth and DisplayHeight or cropped pixel size of mkv
+	size_t height;
+	size_t coded_width; // Sample entry of stsd, PixelWidth and PixelHeight of mkv
+	size_t coded_height;
+	char codec[5]; // FourCC of sample entry (avc1, hvc1, av01, vp09...), mapped from CodecID for mkv, empty if unknown
+	char codec_id[32]; // CodecID of mkv (V_VP9...), empty for mp4 and mov
+	unsigned int rotation; // Clockwise degrees of tkhd matrix for display (90, 180 or 270), 0 for mkv
+	unsigned int tracks; // Number of video tracks, 0 for audio only files
+} fastimage_video_t;
+
+// Returns format (mp4, mov, mkv or webm), fastimage_unknown for other files
+extern int fastimageVideoOpen(const fastimage_reader_t *reader, fastimage_video_t *video);
+
+// Archives (zip and its family like cbz or epub, tar)
+
+enum fastimage_archive_format {
+	fastimage_archive_error,
+	fastimage_archive_unknown,
+	fastimage_archive_zip,
+	fastimage_archive_tar
+};
+
+typedef struct {
+	const char *name; // Valid until next call
+	uint64_t offset; // Offset of entry data in archive
+	uint64_t size;
+	uint64_t compressed_size;
+	unsigned int method; // 0 - stored, 8 - deflated
+	fastimage_image_t image; // fastimage_error if entry can't be probed (encrypted, unsupported method)
+} fastimage_archive_entry_t;
+
+typedef struct {
+	fastimage_reader_t reader;
+	int format;
+	uint64_t size;
+	uint64_t entries; // Number of entries in zip central directory
+	uint64_t index;
+	uint64_t offset; // Position of next tar header
+	unsigned char *dir;
+	size_t dir_size;
+	size_t dir_pos;
+	char *name;
+	size_t name_size;
+	bool long_name; // Name was set by previous tar entry
+} fastimage_archive_t;
+
+// size is needed to find zip central directory, it may be 0 for tar
+extern int fastimageArchiveOpen(const fastimage_reader_t *reader, uint64_t size, fastimage_archive_t *archive);
+extern int fastimageArchiveOpenFile(FILE *f, fastimage_archive_t *archive);
+extern bool fastimageArchiveNext(fastimage_archive_t *archive, fastimage_archive_entry_t *entry);
+extern void fastimageArchiveClose(fastimage_archive_t *archive);
+
+// Images of PDF files (image XObjects), found through cross-reference tables or streams (compressed ones need zlib)
+
+typedef struct {
+	uint64_t object; // Object number
+	uint64_t offset; // Offset of stream data
+	uint64_t length; // Size of stream data
+	char filter[16]; // Last filter without slash (DCTDecode, JPXDecode, FlateDecode...), empty if there is none
+	unsigned int filters; // Number of filters
+	unsigned int bitspercomponent;
+	fastimage_image_t image; // Probed for DCTDecode stream without other filters, else from dictionary with fastimage_unknown format
+} fastimage_pdf_image_t;
+
+typedef struct {
+	uint64_t offset;
+	uint64_t number;
+} fastimage_pdf_object_t;
+
+typedef struct {
+	fastimage_reader_t reader;
+	uint64_t size;
+	uint64_t *offsets; // By object number, 0 for free objects and objects inside object streams
+	uint64_t objects;
+	fastimage_pdf_object_t *order; // Objects with offsets, sorted by offset
+	uint64_t count;
+	uint64_t index;
+	char *buf;
+	size_t buf_size;
+	bool encrypted; // Streams are not probed
+} fastimage_pdf_t;
+
+// size is needed to find startxref at the end of file
+extern bool fastimagePdfOpen(const fastimage_reader_t *reader, uint64_t size, fastimage_pdf_t *pdf);
+extern bool fastimagePdfOpenFile(FILE *f, fastimage_pdf_t *pdf);
+extern bool fastimagePdfNext(fastimage_pdf_t *pdf, fastimage_pdf_image_t *image);
+extern void fastimagePdfClose(fastimage_pdf_t *pdf);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1061 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FASTIMAGE_ASYNC_HPP
+#define FASTIMAGE_ASYNC_HPP
+
+// C++20 coroutines over fastimage. Parsers of fastimage.c still pull bytes through a reader, so
+// probe_async runs them over a cache of fetched ranges: a pass that reads outside of cache stops,
+// the missing range is awaited from source and the pass is run again. Most formats are done in one
+// or two fetches of the first chunk. Passes that stream the whole input (verify level, full
+// fingerprint) miss right at the end of the last fetch again and again, such a fetch is twice the
+// previous one, so passes stay logarithmic in stream size and their total work about twice one pass.
+//
+// Source is anything with read(offset, size, buf) returning an awaitable of int64_t (bytes read,
+// less than size only at the end, negative on error). uring_file and curl_source are such sources,
+// both are driven by executor, which runs every coroutine on the calling thread.
+
+#include <algorithm>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(FASTIMAGE_USE_LIBCURL) && defined(__linux__)
+#include <curl/curl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "fastimage.h"
+
+namespace fastimage {
+
+template<typename T = void> class task;
+
+namespace detail {
+
+struct promise_base {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+
+	struct final_awaiter {
+		bool await_ready() noexcept { return false; }
+
+		template<typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			std::coroutine_handle<> continuation = h.promise().continuation;
+
+			return continuation?continuation:std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	final_awaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept { exception = std::current_exception(); }
+};
+
+template<typename T> struct promise : promise_base {
+	std::optional<T> value;
+
+	task<T> get_return_object() noexcept;
+	void return_value(T v) { value = std::move(v); }
+
+	T result()
+	{
+		if(exception)
+			std::rethrow_exception(exception);
+
+		return std::move(*value);
+	}
+};
+
+template<> struct promise<void> : promise_base {
+	task<void> get_return_object() noexcept;
+	void return_void() noexcept {}
+
+	void result()
+	{
+		if(exception)
+			std::rethrow_exception(exception);
+	}
+};
+
+}
+
+// Lazy: starts when awaited or given to executor, the awaiting coroutine is resumed when it's done
+template<typename T> class task {
+public:
+	using promise_type = detail::promise<T>;
+	using handle_type = std::coroutine_handle<promise_type>;
+
+	task() noexcept = default;
+	explicit task(handle_type h) noexcept : h_(h) {}
+	task(task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+
+	task &operator=(task &&other) noexcept
+	{
+		if(this != &other) {
+			if(h_)
+				h_.destroy();
+			h_ = std::exchange(other.h_, nullptr);
+		}
+
+		return *this;
+	}
+
+	~task()
+	{
+		if(h_)
+			h_.destroy();
+	}
+
+	handle_type handle() const noexcept { return h_; }
+	bool done() const noexcept { return !h_ || h_.done(); }
+
+	bool await_ready() const noexcept { return !h_ || h_.done(); }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+	{
+		h_.promise().continuation = continuation;
+
+		return h_;
+	}
+
+	T await_resume() { return h_.promise().result(); }
+
+private:
+	handle_type h_ = nullptr;
+};
+
+namespace detail {
+
+template<typename T> task<T> promise<T>::get_return_object() noexcept
+{
+	return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept
+{
+	return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+}
+
+// Event source of executor: fd becomes readable when process() has something to do
+class io_source {
+public:
+	virtual ~io_source() = default;
+	virtual int fd() const = 0;
+	virtual bool busy() const = 0; // Some coroutine waits for it
+	virtual void process() = 0; // Schedules coroutines whose I/O is complete
+};
+
+// Single threaded: runs ready coroutines, then sleeps in poll() on sources that are busy
+class executor {
+public:
+	executor() = default;
+	executor(const executor &) = delete;
+	executor &operator=(const executor &) = delete;
+
+	void schedule(std::coroutine_handle<> h) { ready_.push_back(h); }
+
+	void add(io_source *source) { sources_.push_back(source); }
+
+	void remove(io_source *source)
+	{
+		for(size_t i = 0; i < sources_.size(); i++)
+			if(sources_[i] == source) {
+				sources_.erase(sources_.begin()+i);
+				break;
+			}
+	}
+
+	// co_await ex.yield() lets other ready coroutines run first
+	auto yield()
+	{
+		struct awaiter {
+			executor &ex;
+
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> h) { ex.schedule(h); }
+			void await_resume() const noexcept {}
+		};
+
+		return awaiter{*this};
+	}
+
+	// Runs task along with others, its exception is rethrown by run()
+	template<typename T> void spawn(task<T> t);
+
+	// Runs until t is done
+	template<typename T> T run(task<T> t)
+	{
+		std::coroutine_handle<> h = t.handle();
+
+		schedule(h);
+		while(!h.done())
+			if(!step())
+				throw std::logic_error("fastimage::executor: task waits for nothing");
+
+		rethrow();
+
+		return t.await_resume();
+	}
+
+	// Runs until nothing is ready and no source is busy
+	void run()
+	{
+		while(step())
+			;
+
+		rethrow();
+	}
+
+	// One ready coroutine or one wait for sources, false when there is nothing to do
+	bool step()
+	{
+		std::vector<struct pollfd> fds;
+		std::vector<io_source *> owners;
+
+		if(!ready_.empty()) {
+			std::coroutine_handle<> h = ready_.front();
+
+			ready_.pop_front();
+			h.resume();
+
+			return true;
+		}
+
+		for(io_source *source : sources_)
+			if(source->busy()) {
+				fds.push_back({source->fd(), POLLIN, 0});
+				owners.push_back(source);
+			}
+
+		if(fds.empty())
+			return false;
+
+		while(poll(fds.data(), fds.size(), -1) < 0)
+			if(errno != EINTR)
+				throw std::system_error(errno, std::generic_category(), "poll");
+
+		for(size_t i = 0; i < fds.size(); i++)
+			if(fds[i].revents)
+				owners[i]->process();
+
+		return true;
+	}
+
+	void fail(std::exception_ptr e)
+	{
+		if(!failure_)
+			failure_ = e;
+	}
+
+private:
+	std::deque<std::coroutine_handle<>> ready_;
+	std::vector<io_source *> sources_;
+	std::exception_ptr failure_;
+
+	void rethrow()
+	{
+		if(failure_)
+			std::rethrow_exception(std::exchange(failure_, nullptr));
+	}
+};
+
+namespace detail {
+
+// Owns itself, frame is freed at the end
+struct detached {
+	struct promise_type {
+		detached get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+
+template<typename T> detached spawn(executor &ex, task<T> t)
+{
+	co_await ex.yield();
+
+	try {
+		co_await t;
+	} catch(...) {
+		ex.fail(std::current_exception());
+	}
+}
+
+}
+
+template<typename T> void executor::spawn(task<T> t)
+{
+	detail::spawn(*this, std::move(t));
+}
+
+namespace detail {
+
+// Fetched ranges of stream, neighbours are merged. eof is known after a short read
+class range_cache {
+public:
+	uint64_t eof = UINT64_MAX;
+
+	void insert(uint64_t pos, const unsigned char *data, size_t size)
+	{
+		uint64_t start = pos, stop = pos+size;
+		std::map<uint64_t, std::vector<unsigned char>>::iterator first, last;
+		std::vector<unsigned char> merged;
+
+		if(!size)
+			return;
+
+		first = segments_.upper_bound(pos);
+		if(first != segments_.begin() && std::prev(first)->first+std::prev(first)->second.size() >= pos)
+			--first;
+
+		for(last = first; last != segments_.end() && last->first <= stop; ++last) {
+			start = std::min(start, last->first);
+			stop = std::max(stop, last->first+last->second.size());
+		}
+
+		merged.resize(stop-start);
+		for(auto i = first; i != last; ++i)
+			memcpy(merged.data()+(i->first-start), i->second.data(), i->second.size());
+		memcpy(merged.data()+(pos-start), data, size);
+
+		segments_.erase(first, last);
+		segments_.emplace(start, std::move(merged));
+	}
+
+	// Bytes cached from pos on
+	size_t find(uint64_t pos, const unsigned char **data) const
+	{
+		auto i = segments_.upper_bound(pos);
+
+		if(i == segments_.begin())
+			return 0;
+		--i;
+		if(pos >= i->first+i->second.size())
+			return 0;
+
+		*data = i->second.data()+(pos-i->first);
+
+		return (size_t)(i->first+i->second.size()-pos);
+	}
+
+private:
+	std::map<uint64_t, std::vector<unsigned char>> segments_;
+};
+
+// Reader of one pass, the first read outside of cache is remembered and the pass is cancelled
+struct probe_pass {
+	range_cache cache;
+	uint64_t pos = 0;
+	volatile int *user_cancel = nullptr;
+	volatile int cancel = 0;
+	bool missed = false;
+	uint64_t miss_pos = 0;
+	size_t miss_size = 0;
+
+	void reset()
+	{
+		pos = 0;
+		cancel = 0;
+		missed = false;
+	}
+
+	static size_t FASTIMAGE_APIENTRY read(void *context, size_t size, void *buf)
+	{
+		probe_pass *pass = (probe_pass *)context;
+		size_t done = 0;
+
+		if(pass->user_cancel && *pass->user_cancel) {
+			pass->cancel = 1;
+			return 0;
+		}
+
+		while(done < size && pass->pos < pass->cache.eof) {
+			const unsigned char *data;
+			size_t n = pass->cache.find(pass->pos, &data);
+
+			if(!n) {
+				pass->missed = true;
+				pass->miss_pos = pass->pos;
+				pass->miss_size = size-done;
+				pass->cancel = 1;
+				break;
+			}
+
+			n = std::min<uint64_t>(n, std::min<uint64_t>(size-done, pass->cache.eof-pass->pos));
+			memcpy((unsigned char *)buf+done, data, n);
+			done += n;
+			pass->pos += n;
+		}
+
+		return done;
+	}
+
+	static bool FASTIMAGE_APIENTRY seek(void *context, int64_t pos, bool seek_cur)
+	{
+		probe_pass *pass = (probe_pass *)context;
+
+		if(seek_cur)
+			pos += (int64_t)pass->pos;
+		if(pos < 0)
+			return false;
+
+		pass->pos = (uint64_t)pos;
+
+		return true;
+	}
+};
+
+template<typename Source> task<fastimage_image_t> probe(Source &source, fastimage_options_t options, size_t chunk)
+{
+	probe_pass pass;
+	fastimage_reader_t reader;
+	std::vector<unsigned char> buf;
+	size_t fetch = chunk;
+	uint64_t fetch_end = 0;
+
+	reader.context = &pass;
+	reader.read = probe_pass::read;
+	reader.seek = probe_pass::seek;
+
+	pass.user_cancel = options.cancel;
+	options.cancel = &pass.cancel;
+
+	while(1) {
+		fastimage_image_t image;
+		size_t size;
+		int64_t got;
+
+		pass.reset();
+		image = fastimageOpenEx(&reader, &options);
+		if(!pass.missed)
+			co_return image;
+
+		// Missing range, at least a chunk of it. Stream read on from the last fetch doubles it
+		if(fetch_end && pass.miss_pos == fetch_end)
+			fetch = (fetch <= SIZE_MAX/2)?fetch*2:fetch;
+		else
+			fetch = chunk;
+		size = std::max(pass.miss_size, fetch);
+		buf.resize(size);
+		got = co_await source.read(pass.miss_pos, size, buf.data());
+		if(got < 0 || (pass.user_cancel && *pass.user_cancel))
+			break;
+
+		pass.cache.insert(pass.miss_pos, buf.data(), (size_t)got);
+		if((size_t)got < size)
+			pass.cache.eof = std::min<uint64_t>(pass.cache.eof, pass.miss_pos+got);
+		fetch_end = pass.miss_pos+(uint64_t)got;
+	}
+
+	fastimage_image_t image;
+
+	memset(&image, 0, sizeof(fastimage_image_t));
+	image.format = fastimage_error;
+	if(options.stats) {
+		memset(options.stats, 0, sizeof(fastimage_stats_t));
+		options.stats->abort_reason = (pass.user_cancel && *pass.user_cancel)?fastimage_abort_cancel:fastimage_abort_none;
+	}
+
+	co_return image;
+}
+
+}
+
+// Same result as fastimageOpenEx. Options are copied, cancel, stats and fingerprint must outlive the task.
+// Limits apply to each pass, stats are of the last one. The first fetch is chunk bytes from 0, a fetch
+// that goes on from the end of the previous one is twice its size, any other is chunk bytes again
+template<typename Source> task<fastimage_image_t> probe_async(Source &source, const fastimage_options_t *options = nullptr, size_t chunk = 65536)
+{
+	fastimage_options_t copy;
+
+	if(options)
+		copy = *options;
+	else
+		memset(&copy, 0, sizeof(fastimage_options_t));
+
+	return detail::probe(source, copy, chunk ? chunk : 1);
+}
+
+// Memory as source, reads complete at once
+class memory_source {
+public:
+	memory_source(const void *data, size_t size) : data_((const unsigned char *)data), size_(size) {}
+
+	auto read(uint64_t offset, size_t size, void *buf)
+	{
+		struct awaiter {
+			int64_t result;
+
+			bool await_ready() const noexcept { return true; }
+			void await_suspend(std::coroutine_handle<>) const noexcept {}
+			int64_t await_resume() const noexcept { return result; }
+		};
+		size_t n = 0;
+
+		if(offset < size_) {
+			n = std::min<uint64_t>(size, size_-offset);
+			memcpy(buf, data_+offset, n);
+		}
+
+		return awaiter{(int64_t)n};
+	}
+
+private:
+	const unsigned char *data_;
+	size_t size_;
+};
+
+#if defined(__linux__)
+// io_uring through raw system calls (no liburing), completions are signalled by eventfd
+class uring : public io_source {
+public:
+	struct read_op {
+		uring *ring;
+		int fd;
+		uint64_t offset;
+		size_t size;
+		void *buf;
+		int64_t result;
+		std::coroutine_handle<> handle;
+
+		bool await_ready() const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			handle = h;
+			ring->push(this);
+		}
+
+		int64_t await_resume() const noexcept { return result; }
+	};
+
+	explicit uring(executor &ex, unsigned entries = 64) : ex_(ex)
+	{
+		struct io_uring_params params;
+		size_t sq_size, cq_size;
+
+		memset(&params, 0, sizeof(params));
+		ring_fd_ = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if(ring_fd_ < 0)
+			throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+
+		sq_size = params.sq_off.array+params.sq_entries*sizeof(unsigned);
+		cq_size = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+			sq_size = cq_size = std::max(sq_size, cq_size);
+
+		sq_map_ = mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+		if(sq_map_ == MAP_FAILED)
+			goto error;
+		sq_map_size_ = sq_size;
+
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+			cq_map_ = sq_map_;
+		else {
+			cq_map_ = mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+			if(cq_map_ == MAP_FAILED)
+				goto error;
+			cq_map_size_ = cq_size;
+		}
+
+		sqes_size_ = params.sq_entries*sizeof(struct io_uring_sqe);
+		sqes_ = (struct io_uring_sqe *)mmap(0, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+		if(sqes_ == MAP_FAILED)
+			goto error;
+
+		sq_head_ = (unsigned *)((char *)sq_map_+params.sq_off.head);
+		sq_tail_ = (unsigned *)((char *)sq_map_+params.sq_off.tail);
+		sq_mask_ = *(unsigned *)((char *)sq_map_+params.sq_off.ring_mask);
+		sq_array_ = (unsigned *)((char *)sq_map_+params.sq_off.array);
+		sq_entries_ = params.sq_entries;
+		cq_head_ = (unsigned *)((char *)cq_map_+params.cq_off.head);
+		cq_tail_ = (unsigned *)((char *)cq_map_+params.cq_off.tail);
+		cq_mask_ = *(unsigned *)((char *)cq_map_+params.cq_off.ring_mask);
+		cqes_ = (struct io_uring_cqe *)((char *)cq_map_+params.cq_off.cqes);
+		cq_entries_ = params.cq_entries;
+
+		event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(event_fd_ < 0)
+			goto error;
+		if(syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_EVENTFD, &event_fd_, 1) < 0)
+			goto error;
+
+		ex_.add(this);
+
+		return;
+
+error:
+		int e = errno;
+
+		release();
+
+		throw std::system_error(e, std::generic_category(), "io_uring");
+	}
+
+	uring(const uring &) = delete;
+	uring &operator=(const uring &) = delete;
+
+	~uring()
+	{
+		ex_.remove(this);
+		release();
+	}
+
+	// Awaitable of bytes read or -errno
+	read_op read(int fd, uint64_t offset, size_t size, void *buf)
+	{
+		return read_op{this, fd, offset, std::min<size_t>(size, 1u<<30), buf, 0, nullptr};
+	}
+
+	int fd() const override { return event_fd_; }
+	bool busy() const override { return in_flight_ || !backlog_.empty(); }
+
+	void process() override
+	{
+		unsigned head, tail;
+		uint64_t value;
+
+		if(::read(event_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN)
+			throw std::system_error(errno, std::generic_category(), "eventfd");
+
+		head = *cq_head_;
+		tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		for(; head != tail; head++) {
+			struct io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+			read_op *op = (read_op *)(uintptr_t)cqe->user_data;
+
+			op->result = cqe->res;
+			in_flight_--;
+			ex_.schedule(op->handle);
+		}
+		__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+		// Queued while rings were full
+		while(!backlog_.empty() && submit(backlog_.front()))
+			backlog_.pop_front();
+	}
+
+private:
+	executor &ex_;
+	int ring_fd_ = -1;
+	int event_fd_ = -1;
+	void *sq_map_ = MAP_FAILED;
+	void *cq_map_ = MAP_FAILED;
+	size_t sq_map_size_ = 0;
+	size_t cq_map_size_ = 0;
+	struct io_uring_sqe *sqes_ = (struct io_uring_sqe *)MAP_FAILED;
+	size_t sqes_size_ = 0;
+	unsigned *sq_head_, *sq_tail_, *sq_array_, *cq_head_, *cq_tail_;
+	unsigned sq_mask_, cq_mask_, sq_entries_, cq_entries_;
+	struct io_uring_cqe *cqes_;
+	unsigned in_flight_ = 0;
+	std::deque<read_op *> backlog_;
+
+	void push(read_op *op)
+	{
+		if(!backlog_.empty() || !submit(op))
+			backlog_.push_back(op);
+	}
+
+	// One sqe per read, false if there is no room for it or for its completion
+	bool submit(read_op *op)
+	{
+		unsigned tail = *sq_tail_;
+		struct io_uring_sqe *sqe;
+		int ret;
+
+		if(in_flight_ >= cq_entries_ || tail-__atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+			return false;
+
+		sqe = &sqes_[tail & sq_mask_];
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = op->fd;
+		sqe->off = op->offset;
+		sqe->addr = (uint64_t)(uintptr_t)op->buf;
+		sqe->len = (uint32_t)op->size;
+		sqe->user_data = (uint64_t)(uintptr_t)op;
+		sq_array_[tail & sq_mask_] = tail & sq_mask_;
+		__atomic_store_n(sq_tail_, tail+1, __ATOMIC_RELEASE);
+
+		do
+			ret = (int)syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, 0, 0);
+		while(ret < 0 && errno == EINTR);
+
+		if(ret < 0) {
+			// Never seen by kernel, take it back
+			__atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+			op->result = -errno;
+			ex_.schedule(op->handle);
+
+			return true;
+		}
+
+		in_flight_++;
+
+		return true;
+	}
+
+	void release()
+	{
+		if(event_fd_ >= 0)
+			close(event_fd_);
+		if(sqes_ != MAP_FAILED)
+			munmap(sqes_, sqes_size_);
+		if(cq_map_ != MAP_FAILED && cq_map_ != sq_map_)
+			munmap(cq_map_, cq_map_size_);
+		if(sq_map_ != MAP_FAILED)
+			munmap(sq_map_, sq_map_size_);
+		if(ring_fd_ >= 0)
+			close(ring_fd_);
+	}
+};
+
+// File descriptor read through uring, fd is not closed
+class uring_file {
+public:
+	uring_file(uring &ring, int fd) : ring_(ring), fd_(fd) {}
+
+	uring::read_op read(uint64_t offset, size_t size, void *buf) { return ring_.read(fd_, offset, size, buf); }
+
+private:
+	uring &ring_;
+	int fd_;
+};
+#endif
+
+#if defined(FASTIMAGE_USE_LIBCURL) && defined(__linux__)
+// Transfers of curl multi handle driven by socket callbacks, sockets and timer are in one epoll fd
+class curl_multi : public io_source {
+public:
+	struct fetch_op {
+		curl_multi *multi;
+		const std::string *url;
+		uint64_t offset;
+		size_t size;
+		unsigned char *buf;
+		size_t got;
+		uint64_t skip;
+		long status;
+		int64_t result;
+		CURL *curl;
+		std::coroutine_handle<> handle;
+
+		bool await_ready() const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			handle = h;
+			multi->start(this);
+		}
+
+		int64_t await_resume() const noexcept { return result; }
+	};
+
+	explicit curl_multi(executor &ex, CURLSH *share = nullptr) : ex_(ex), share_(share)
+	{
+		struct epoll_event ev;
+
+		multi_ = curl_multi_init();
+		epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+		timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if(!multi_ || epoll_fd_ < 0 || timer_fd_ < 0)
+			goto error;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = timer_fd_;
+		if(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev) < 0)
+			goto error;
+
+		curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, socket_callback);
+		curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+		curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, timer_callback);
+		curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+
+		ex_.add(this);
+
+		return;
+
+error:
+		release();
+
+		throw std::runtime_error("fastimage::curl_multi: can't create multi handle");
+	}
+
+	curl_multi(const curl_multi &) = delete;
+	curl_multi &operator=(const curl_multi &) = delete;
+
+	~curl_multi()
+	{
+		ex_.remove(this);
+		release();
+	}
+
+	// Ranged GET, awaitable of bytes received (short only at the end) or -1
+	fetch_op fetch(const std::string &url, uint64_t offset, size_t size, void *buf)
+	{
+		return fetch_op{this, &url, offset, size, (unsigned char *)buf, 0, 0, 0, 0, 0, nullptr};
+	}
+
+	int fd() const override { return epoll_fd_; }
+	bool busy() const override { return active_ > 0; }
+
+	void process() override
+	{
+		struct epoll_event events[32];
+		int running, n, i;
+		CURLMsg *msg;
+
+		n = epoll_wait(epoll_fd_, events, 32, 0);
+		for(i = 0; i < n; i++) {
+			int flags = 0;
+
+			if(events[i].data.fd == timer_fd_) {
+				uint64_t expirations;
+
+				if(::read(timer_fd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+					throw std::system_error(errno, std::generic_category(), "timerfd");
+				curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+				continue;
+			}
+
+			if(events[i].events & EPOLLIN)
+				flags |= CURL_CSELECT_IN;
+			if(events[i].events & EPOLLOUT)
+				flags |= CURL_CSELECT_OUT;
+			if(events[i].events & (EPOLLERR | EPOLLHUP))
+				flags |= CURL_CSELECT_ERR;
+			curl_multi_socket_action(multi_, events[i].data.fd, flags, &running);
+		}
+
+		while((msg = curl_multi_info_read(multi_, &n)) != 0) {
+			fetch_op *op;
+
+			if(msg->msg != CURLMSG_DONE)
+				continue;
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&op);
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &op->status);
+
+			// Write callback stops transfer when it has enough
+			if(msg->data.result == CURLE_OK || (msg->data.result == CURLE_WRITE_ERROR && op->got == op->size)) {
+				if(op->status == 200 || op->status == 206)
+					op->result = (int64_t)op->got;
+				else if(op->status == 416) // Range starts past the end
+					op->result = 0;
+				else
+					op->result = -1;
+			} else
+				op->result = -1;
+
+			curl_multi_remove_handle(multi_, op->curl);
+			curl_easy_cleanup(op->curl);
+			op->curl = 0;
+			active_--;
+			ex_.schedule(op->handle);
+		}
+	}
+
+private:
+	executor &ex_;
+	CURLSH *share_;
+	CURLM *multi_ = 0;
+	int epoll_fd_ = -1;
+	int timer_fd_ = -1;
+	unsigned active_ = 0;
+
+	void start(fetch_op *op)
+	{
+		char range[64];
+
+		op->curl = curl_easy_init();
+		if(!op->curl) {
+			op->result = -1;
+			ex_.schedule(op->handle);
+			return;
+		}
+
+		snprintf(range, sizeof(range), "%llu-%llu", (unsigned long long)op->offset, (unsigned long long)(op->offset+op->size-1));
+		curl_easy_setopt(op->curl, CURLOPT_URL, op->url->c_str());
+		curl_easy_setopt(op->curl, CURLOPT_RANGE, range);
+		curl_easy_setopt(op->curl, CURLOPT_FOLLOWLOCATION, 1L);
+		curl_easy_setopt(op->curl, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(op->curl, CURLOPT_WRITEFUNCTION, write_callback);
+		curl_easy_setopt(op->curl, CURLOPT_WRITEDATA, op);
+		curl_easy_setopt(op->curl, CURLOPT_PRIVATE, op);
+		if(share_)
+			curl_easy_setopt(op->curl, CURLOPT_SHARE, share_);
+
+		if(curl_multi_add_handle(multi_, op->curl) != CURLM_OK) {
+			curl_easy_cleanup(op->curl);
+			op->curl = 0;
+			op->result = -1;
+			ex_.schedule(op->handle);
+			return;
+		}
+
+		active_++;
+	}
+
+	static size_t write_callback(char *data, size_t size, size_t nmemb, void *userdata)
+	{
+		fetch_op *op = (fetch_op *)userdata;
+		size_t total = size*nmemb, n = total;
+
+		if(!op->status) {
+			curl_easy_getinfo(op->curl, CURLINFO_RESPONSE_CODE, &op->status);
+			// Server ignored range, skip to offset
+			if(op->status == 200)
+				op->skip = op->offset;
+		}
+
+		// Error page
+		if(op->status != 200 && op->status != 206)
+			return total;
+
+		if(op->skip) {
+			size_t k = (size_t)std::min<uint64_t>(op->skip, n);
+
+			op->skip -= k;
+			data += k;
+			n -= k;
+		}
+
+		size_t k = std::min(n, op->size-op->got);
+
+		memcpy(op->buf+op->got, data, k);
+		op->got += k;
+
+		// The rest is not needed
+		if(k < n)
+			return 0;
+
+		return total;
+	}
+
+	static int socket_callback(CURL *, curl_socket_t s, int what, void *userp, void *)
+	{
+		curl_multi *multi = (curl_multi *)userp;
+		struct epoll_event ev;
+
+		if(what == CURL_POLL_REMOVE) {
+			epoll_ctl(multi->epoll_fd_, EPOLL_CTL_DEL, s, 0);
+			return 0;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.data.fd = s;
+		if(what & CURL_POLL_IN)
+			ev.events |= EPOLLIN;
+		if(what & CURL_POLL_OUT)
+			ev.events |= EPOLLOUT;
+
+		if(epoll_ctl(multi->epoll_fd_, EPOLL_CTL_MOD, s, &ev) < 0 && errno == ENOENT)
+			epoll_ctl(multi->epoll_fd_, EPOLL_CTL_ADD, s, &ev);
+
+		return 0;
+	}
+
+	// 0 must fire at once, but zero itimerspec disarms, so it's 1 ns
+	static int timer_callback(CURLM *, long timeout_ms, void *userp)
+	{
+		curl_multi *multi = (curl_multi *)userp;
+		struct itimerspec spec;
+
+		memset(&spec, 0, sizeof(spec));
+		if(timeout_ms >= 0) {
+			spec.it_value.tv_sec = timeout_ms/1000;
+			spec.it_value.tv_nsec = (timeout_ms%1000)*1000000;
+			if(!timeout_ms)
+				spec.it_value.tv_nsec = 1;
+		}
+
+		timerfd_settime(multi->timer_fd_, 0, &spec, 0);
+
+		return 0;
+	}
+
+	void release()
+	{
+		if(multi_)
+			curl_multi_cleanup(multi_);
+		if(timer_fd_ >= 0)
+			close(timer_fd_);
+		if(epoll_fd_ >= 0)
+			close(epoll_fd_);
+	}
+};
+
+// Url read by ranged GETs of curl_multi, servers without ranges work too, but send more
+class curl_source {
+public:
+	curl_source(curl_multi &multi, std::string url) : multi_(multi), url_(std::move(url)) {}
+
+	curl_multi::fetch_op read(uint64_t offset, size_t size, void *buf) { return multi_.fetch(url_, offset, size, buf); }
+
+private:
+	curl_multi &multi_;
+	std::string url_;
+};
+#endif
+
+}
+
+#endif
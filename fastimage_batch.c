@@ -0,0 +1,510 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fastimage_batch.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#if defined(FASTIMAGE_USE_LIBCURL)
+#include <curl/curl.h>
+#endif
+
+#define FASTIMAGE_BATCH_IN_FLIGHT 32
+#define FASTIMAGE_BATCH_PER_HOST 4
+#define FASTIMAGE_BATCH_BACKOFF 1000
+#define FASTIMAGE_BATCH_MAX_BACKOFF 60000
+#define FASTIMAGE_BATCH_NONE SIZE_MAX
+
+typedef struct {
+	const char *name; // Points into url, name_size bytes
+	size_t name_size;
+	size_t head; // Queue of urls
+	size_t tail;
+	unsigned int in_flight;
+	uint32_t backoff;
+	uint64_t paused_until;
+} fastimage_batch_host_t;
+
+typedef struct {
+	const fastimage_http_batch_t *batch;
+	const char *const *urls;
+	fastimage_image_t *images;
+	fastimage_stats_t *stats;
+	fastimage_batch_host_t *hosts;
+	size_t hosts_num;
+	size_t cursor; // Host which is asked first next time
+	size_t *url_host;
+	size_t *next; // Next url in queue of host
+	unsigned int *attempts;
+	size_t remaining; // Urls without result
+	unsigned int max_per_host;
+	uint32_t backoff;
+	uint32_t max_backoff;
+	void *http_share;
+#if defined(_WIN32)
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE changed;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+#if defined(FASTIMAGE_USE_LIBCURL)
+	pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+#endif
+#endif
+} fastimage_batch_state_t;
+
+static uint64_t fastimageBatchTicks(void)
+{
+#if defined(_WIN32) && defined(__WATCOMC__)
+	return GetTickCount();
+#elif defined(_WIN32)
+	return GetTickCount64();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec*1000+(uint64_t)ts.tv_nsec/1000000;
+#endif
+}
+
+// Host and port of url, without user info
+static const char *fastimageBatchHost(const char *url, size_t *size)
+{
+	const char *host, *end, *p;
+
+	host = strstr(url, "://");
+	host = host?(host+3):url;
+	end = host+strcspn(host, "/?#");
+
+	for(p = host; p < end; p++)
+		if(*p == '@') host = p+1;
+
+	*size = (size_t)(end-host);
+
+	return host;
+}
+
+static uint64_t fastimageBatchHash(const char *name, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+
+	for(i = 0; i < size; i++) {
+		hash ^= (unsigned char)tolower((unsigned char)name[i]);
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static bool fastimageBatchSameHost(const char *a, const char *b, size_t size)
+{
+	size_t i;
+
+	for(i = 0; i < size; i++)
+		if(tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+
+	return true;
+}
+
+// Groups urls by host, queues keep order of urls
+static bool fastimageBatchQueue(fastimage_batch_state_t *state, size_t count)
+{
+	size_t *table, table_size = 1, slot, name_size, i;
+	fastimage_batch_host_t *host;
+	const char *name;
+
+	while(table_size < count*2) table_size <<= 1;
+
+	table = malloc(table_size*sizeof(size_t));
+	state->hosts = malloc(count*sizeof(fastimage_batch_host_t));
+	state->url_host = malloc(count*sizeof(size_t));
+	state->next = malloc(count*sizeof(size_t));
+	state->attempts = calloc(count, sizeof(unsigned int));
+
+	if(!table || !state->hosts || !state->url_host || !state->next || !state->attempts) {
+		free(table);
+
+		return false;
+	}
+
+	for(i = 0; i < table_size; i++)
+		table[i] = FASTIMAGE_BATCH_NONE;
+
+	for(i = 0; i < count; i++) {
+		name = fastimageBatchHost(state->urls[i], &name_size);
+		slot = (size_t)fastimageBatchHash(name, name_size)&(table_size-1);
+
+		while(table[slot] != FASTIMAGE_BATCH_NONE) {
+			host = &state->hosts[table[slot]];
+			if(host->name_size == name_size && fastimageBatchSameHost(host->name, name, name_size)) break;
+
+			slot = (slot+1)&(table_size-1);
+		}
+
+		if(table[slot] == FASTIMAGE_BATCH_NONE) {
+			table[slot] = state->hosts_num;
+			host = &state->hosts[state->hosts_num++];
+
+			memset(host, 0, sizeof(fastimage_batch_host_t));
+			host->name = name;
+			host->name_size = name_size;
+			host->head = FASTIMAGE_BATCH_NONE;
+			host->tail = FASTIMAGE_BATCH_NONE;
+		}
+
+		host = &state->hosts[table[slot]];
+		state->url_host[i] = table[slot];
+		state->next[i] = FASTIMAGE_BATCH_NONE;
+
+		if(host->tail == FASTIMAGE_BATCH_NONE)
+			host->head = i;
+		else
+			state->next[host->tail] = i;
+		host->tail = i;
+	}
+
+	free(table);
+
+	return true;
+}
+
+// Url of next host in turn that has one and is neither full nor paused. Otherwise *wait is time until first pause ends
+static size_t fastimageBatchPick(fastimage_batch_state_t *state, uint64_t now, uint64_t *wait)
+{
+	fastimage_batch_host_t *host;
+	size_t i, h, url;
+
+	*wait = UINT64_MAX;
+
+	for(i = 0; i < state->hosts_num; i++) {
+		h = (state->cursor+i)%state->hosts_num;
+		host = &state->hosts[h];
+
+		if(host->head == FASTIMAGE_BATCH_NONE || host->in_flight >= state->max_per_host) continue;
+
+		if(host->paused_until > now) {
+			if(host->paused_until-now < *wait) *wait = host->paused_until-now;
+
+			continue;
+		}
+
+		url = host->head;
+		host->head = state->next[url];
+		if(host->head == FASTIMAGE_BATCH_NONE) host->tail = FASTIMAGE_BATCH_NONE;
+
+		host->in_flight++;
+		state->cursor = (h+1)%state->hosts_num;
+
+		return url;
+	}
+
+	return FASTIMAGE_BATCH_NONE;
+}
+
+static void fastimageBatchDone(fastimage_batch_state_t *state, size_t url, const fastimage_image_t *image, const fastimage_stats_t *stats)
+{
+	fastimage_batch_host_t *host = &state->hosts[state->url_host[url]];
+	uint64_t pause;
+
+	host->in_flight--;
+
+	if(stats->http_status == 429 || stats->http_status == 503) {
+		host->backoff = host->backoff?((host->backoff > state->max_backoff/2)?state->max_backoff:(host->backoff*2)):state->backoff;
+
+		pause = (uint64_t)stats->retry_after*1000;
+		if(pause > state->max_backoff) pause = state->max_backoff;
+		if(pause < host->backoff) pause = host->backoff;
+
+		host->paused_until = fastimageBatchTicks()+pause;
+
+		if(state->attempts[url] < state->batch->max_retries) {
+			// Url is first again when pause ends
+			state->attempts[url]++;
+			state->next[url] = host->head;
+			host->head = url;
+			if(host->tail == FASTIMAGE_BATCH_NONE) host->tail = url;
+
+			return;
+		}
+	} else
+		host->backoff = 0;
+
+	state->images[url] = *image;
+	if(state->stats) state->stats[url] = *stats;
+	state->remaining--;
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI fastimageBatchWorker(void *arg)
+#else
+static void *fastimageBatchWorker(void *arg)
+#endif
+{
+	fastimage_batch_state_t *state = (fastimage_batch_state_t *)arg;
+	fastimage_options_t options;
+	fastimage_image_t image;
+	fastimage_stats_t stats;
+	uint64_t wait;
+	size_t url;
+
+	memset(&options, 0, sizeof(fastimage_options_t));
+	if(state->batch->options) options = *state->batch->options;
+	options.stats = &stats;
+	options.fingerprint = 0;
+	options.http_share = state->http_share;
+
+#if defined(_WIN32)
+	EnterCriticalSection(&state->lock);
+#else
+	pthread_mutex_lock(&state->lock);
+#endif
+
+	while(state->remaining) {
+		url = fastimageBatchPick(state, fastimageBatchTicks(), &wait);
+
+		if(url == FASTIMAGE_BATCH_NONE) {
+			// Until some probe ends or pause of host is over
+#if defined(_WIN32)
+			SleepConditionVariableCS(&state->changed, &state->lock, (wait == UINT64_MAX)?INFINITE:(DWORD)wait);
+#else
+			if(wait == UINT64_MAX) {
+				pthread_cond_wait(&state->changed, &state->lock);
+			} else {
+				struct timespec deadline;
+
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				deadline.tv_sec += (time_t)(wait/1000);
+				deadline.tv_nsec += (long)(wait%1000)*1000000;
+				if(deadline.tv_nsec >= 1000000000) {
+					deadline.tv_sec++;
+					deadline.tv_nsec -= 1000000000;
+				}
+
+				pthread_cond_timedwait(&state->changed, &state->lock, &deadline);
+			}
+#endif
+
+			continue;
+		}
+
+#if defined(_WIN32)
+		LeaveCriticalSection(&state->lock);
+#else
+		pthread_mutex_unlock(&state->lock);
+#endif
+
+		memset(&stats, 0, sizeof(fastimage_stats_t));
+		image = fastimageOpenHttpExA(state->urls[url], state->batch->support_proxy, &options);
+
+#if defined(_WIN32)
+		EnterCriticalSection(&state->lock);
+#else
+		pthread_mutex_lock(&state->lock);
+#endif
+
+		fastimageBatchDone(state, url, &image, &stats);
+
+#if defined(_WIN32)
+		WakeAllConditionVariable(&state->changed);
+#else
+		pthread_cond_broadcast(&state->changed);
+#endif
+	}
+
+#if defined(_WIN32)
+	LeaveCriticalSection(&state->lock);
+#else
+	pthread_mutex_unlock(&state->lock);
+#endif
+
+	return 0;
+}
+
+#if defined(FASTIMAGE_USE_LIBCURL) && !defined(_WIN32)
+static void fastimageBatchShareLock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	(void)handle;
+	(void)access;
+
+	pthread_mutex_lock(((fastimage_batch_state_t *)userptr)->share_locks+data);
+}
+
+static void fastimageBatchShareUnlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+	(void)handle;
+
+	pthread_mutex_unlock(((fastimage_batch_state_t *)userptr)->share_locks+data);
+}
+#endif
+
+void fastimageOpenHttpBatchA(const char *const *urls, size_t count, fastimage_image_t *images, fastimage_stats_t *stats, const fastimage_http_batch_t *batch)
+{
+	fastimage_batch_state_t state;
+	size_t threads_num, started = 0, i;
+#if defined(FASTIMAGE_USE_LIBCURL) && !defined(_WIN32)
+	bool own_share = false;
+#endif
+#if defined(_WIN32)
+	HANDLE *threads;
+#else
+	pthread_t *threads;
+	pthread_condattr_t cond_attr;
+#endif
+
+	for(i = 0; i < count; i++) {
+		memset(&images[i], 0, sizeof(fastimage_image_t));
+		images[i].format = fastimage_error;
+		if(stats) memset(&stats[i], 0, sizeof(fastimage_stats_t));
+	}
+
+	if(!count) return;
+
+	memset(&state, 0, sizeof(fastimage_batch_state_t));
+	state.batch = batch;
+	state.urls = urls;
+	state.images = images;
+	state.stats = stats;
+	state.remaining = count;
+	state.max_per_host = batch->max_per_host?batch->max_per_host:FASTIMAGE_BATCH_PER_HOST;
+	state.backoff = batch->backoff_ms?batch->backoff_ms:FASTIMAGE_BATCH_BACKOFF;
+	state.max_backoff = batch->max_backoff_ms?batch->max_backoff_ms:FASTIMAGE_BATCH_MAX_BACKOFF;
+	if(state.max_backoff < state.backoff) state.max_backoff = state.backoff;
+	state.http_share = batch->options?batch->options->http_share:0;
+
+	if(!fastimageBatchQueue(&state, count)) goto BATCH_END;
+
+#if defined(_WIN32)
+	InitializeCriticalSection(&state.lock);
+	InitializeConditionVariable(&state.changed);
+#else
+	// Timed waits end with pauses, which are measured by monotonic clock
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+	pthread_mutex_init(&state.lock, 0);
+	pthread_cond_init(&state.changed, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+#endif
+
+#if defined(FASTIMAGE_USE_LIBCURL)
+	// Not thread safe, so before threads
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
+#if !defined(_WIN32)
+	// Connections, DNS and TLS sessions are reused by all threads
+	if(!state.http_share) {
+		CURLSH *share;
+
+		for(i = 0; i < CURL_LOCK_DATA_LAST; i++)
+			pthread_mutex_init(state.share_locks+i, 0);
+
+		share = curl_share_init();
+		if(share) {
+			curl_share_setopt(share, CURLSHOPT_LOCKFUNC, fastimageBatchShareLock);
+			curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, fastimageBatchShareUnlock);
+			curl_share_setopt(share, CURLSHOPT_USERDATA, &state);
+			curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+			curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+			curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+			state.http_share = share;
+		}
+
+		own_share = true;
+	}
+#endif
+#endif
+
+	threads_num = batch->max_in_flight?batch->max_in_flight:FASTIMAGE_BATCH_IN_FLIGHT;
+	if(threads_num > count) threads_num = count;
+
+	// Calling thread is one of workers
+#if defined(_WIN32)
+	threads = malloc(threads_num*sizeof(HANDLE));
+
+	for(i = 1; threads && i < threads_num; i++) {
+		threads[started] = CreateThread(0, 0, fastimageBatchWorker, &state, 0, 0);
+		if(threads[started]) started++;
+	}
+#else
+	threads = malloc(threads_num*sizeof(pthread_t));
+
+	for(i = 1; threads && i < threads_num; i++)
+		if(!pthread_create(&threads[started], 0, fastimageBatchWorker, &state)) started++;
+#endif
+
+	fastimageBatchWorker(&state);
+
+	for(i = 0; i < started; i++) {
+#if defined(_WIN32)
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], 0);
+#endif
+	}
+
+	free(threads);
+
+#if defined(FASTIMAGE_USE_LIBCURL)
+#if !defined(_WIN32)
+	if(own_share) {
+		if(state.http_share) curl_share_cleanup((CURLSH *)state.http_share);
+
+		for(i = 0; i < CURL_LOCK_DATA_LAST; i++)
+			pthread_mutex_destroy(state.share_locks+i);
+	}
+#endif
+
+	curl_global_cleanup();
+#endif
+
+#if defined(_WIN32)
+	DeleteCriticalSection(&state.lock);
+#else
+	pthread_cond_destroy(&state.changed);
+	pthread_mutex_destroy(&state.lock);
+#endif
+
+BATCH_END:
+	free(state.hosts);
+	free(state.url_host);
+	free(state.next);
+	free(state.attempts);
+}
@@ -0,0 +1,58 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FASTIMAGE_BATCH_H
+#define FASTIMAGE_BATCH_H
+
+#include "fastimage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bulk http probing. Urls are queued by host and hosts take turns, so one host with most of urls
+// doesn't starve others. Host answering 429 or 503 is paused, pause doubles on every next one.
+
+typedef struct {
+	unsigned int max_in_flight; // Probes at once, 0 means 32
+	unsigned int max_per_host; // Probes of one host at once, 0 means 4
+	uint32_t backoff_ms; // First pause after 429 or 503, 0 means 1000. Longer Retry-After is used instead
+	uint32_t max_backoff_ms; // 0 means 60000
+	unsigned int max_retries; // Attempts after 429 or 503 for each url
+	bool support_proxy;
+	const fastimage_options_t *options; // Optional, stats and fingerprint are not used
+} fastimage_http_batch_t;
+
+// Images (and stats of last attempt, may be null) are in order of urls
+extern void fastimageOpenHttpBatchA(const char *const *urls, size_t count, fastimage_image_t *images, fastimage_stats_t *stats, const fastimage_http_batch_t *batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,244 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fastimage_client.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void fastimageClientPut32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char)value;
+	p[1] = (unsigned char)(value>>8);
+	p[2] = (unsigned char)(value>>16);
+	p[3] = (unsigned char)(value>>24);
+}
+
+static uint32_t fastimageClientGet32(const unsigned char *p)
+{
+	return (uint32_t)p[0]|((uint32_t)p[1]<<8)|((uint32_t)p[2]<<16)|((uint32_t)p[3]<<24);
+}
+
+static uint64_t fastimageClientGet64(const unsigned char *p)
+{
+	return (uint64_t)fastimageClientGet32(p)|((uint64_t)fastimageClientGet32(p+4)<<32);
+}
+
+bool fastimageClientConnect(fastimage_client_t *client, const char *socket_path)
+{
+	struct sockaddr_un addr;
+
+	memset(client, 0, sizeof(fastimage_client_t));
+	client->socket = -1;
+	client->next_id = 1;
+
+	if(!socket_path) socket_path = FASTIMAGE_DAEMON_SOCKET;
+	if(strlen(socket_path) >= sizeof(addr.sun_path)) return false;
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	client->socket = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if(client->socket < 0) return false;
+
+	if(connect(client->socket, (struct sockaddr *)&addr, sizeof(struct sockaddr_un))) {
+		close(client->socket);
+		client->socket = -1;
+
+		return false;
+	}
+
+	return true;
+}
+
+void fastimageClientClose(fastimage_client_t *client)
+{
+	if(client->socket >= 0) close(client->socket);
+
+	client->socket = -1;
+}
+
+// Request bytes, descriptor (if fd >= 0) is attached to them
+static uint32_t fastimageClientSend(fastimage_client_t *client, int type, const char *payload, int fd, int level)
+{
+	unsigned char header[FASTIMAGE_DAEMON_REQUEST_SIZE];
+	struct iovec iov[2];
+	struct msghdr msg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	size_t payload_size = 0, sent = 0, total;
+	uint32_t id;
+
+	if(client->socket < 0) return 0;
+
+	if(payload) payload_size = strlen(payload);
+	if(payload_size > FASTIMAGE_DAEMON_MAX_PAYLOAD) return 0;
+
+	id = client->next_id++;
+	if(!client->next_id) client->next_id = 1;
+
+	fastimageClientPut32(header, id);
+	header[4] = (unsigned char)type;
+	header[5] = (unsigned char)level;
+	header[6] = (unsigned char)payload_size;
+	header[7] = (unsigned char)(payload_size>>8);
+
+	total = sizeof(header)+payload_size;
+
+	while(sent < total) {
+		ssize_t result;
+		int iov_num = 0;
+
+		memset(&msg, 0, sizeof(struct msghdr));
+
+		if(sent < sizeof(header)) {
+			iov[iov_num].iov_base = header+sent;
+			iov[iov_num++].iov_len = sizeof(header)-sent;
+		}
+
+		if(payload_size) {
+			size_t payload_sent = (sent > sizeof(header))?(sent-sizeof(header)):0;
+
+			iov[iov_num].iov_base = (char *)payload+payload_sent;
+			iov[iov_num++].iov_len = payload_size-payload_sent;
+		}
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iov_num;
+
+		// Only with the first byte
+		if(fd >= 0 && !sent) {
+			struct cmsghdr *cmsg;
+
+			memset(&control, 0, sizeof(control));
+			msg.msg_control = control.buf;
+			msg.msg_controllen = sizeof(control.buf);
+
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+		}
+
+		result = sendmsg(client->socket, &msg, MSG_NOSIGNAL);
+		if(result < 0 && errno == EINTR) continue;
+		if(result <= 0) return 0;
+
+		sent += (size_t)result;
+	}
+
+	return id;
+}
+
+uint32_t fastimageClientSendPath(fastimage_client_t *client, const char *path, int level)
+{
+	return fastimageClientSend(client, fastimage_daemon_path, path, -1, level);
+}
+
+uint32_t fastimageClientSendFd(fastimage_client_t *client, int fd, int level)
+{
+	if(fd < 0) return 0;
+
+	return fastimageClientSend(client, fastimage_daemon_fd, 0, fd, level);
+}
+
+uint32_t fastimageClientSendUrl(fastimage_client_t *client, const char *url, int level)
+{
+	return fastimageClientSend(client, fastimage_daemon_url, url, -1, level);
+}
+
+bool fastimageClientReceive(fastimage_client_t *client, uint32_t *id, fastimage_image_t *image)
+{
+	unsigned char response[FASTIMAGE_DAEMON_RESPONSE_SIZE];
+	size_t received = 0;
+
+	memset(image, 0, sizeof(fastimage_image_t));
+	image->format = fastimage_error;
+
+	if(client->socket < 0) return false;
+
+	while(received < sizeof(response)) {
+		ssize_t result;
+
+		result = recv(client->socket, response+received, sizeof(response)-received, 0);
+		if(result < 0 && errno == EINTR) continue;
+		if(result <= 0) return false;
+
+		received += (size_t)result;
+	}
+
+	*id = fastimageClientGet32(response);
+	image->format = (int32_t)fastimageClientGet32(response+4);
+	image->width = (size_t)fastimageClientGet64(response+8);
+	image->height = (size_t)fastimageClientGet64(response+16);
+	image->channels = fastimageClientGet32(response+24);
+	image->bitsperpixel = fastimageClientGet32(response+28);
+	image->palette = fastimageClientGet32(response+32);
+
+	return true;
+}
+
+static fastimage_image_t fastimageClientWait(fastimage_client_t *client, uint32_t id)
+{
+	fastimage_image_t image;
+	uint32_t response_id;
+
+	memset(&image, 0, sizeof(fastimage_image_t));
+	image.format = fastimage_error;
+
+	if(!id) return image;
+
+	while(fastimageClientReceive(client, &response_id, &image))
+		if(response_id == id) return image;
+
+	return image;
+}
+
+fastimage_image_t fastimageClientProbePath(fastimage_client_t *client, const char *path)
+{
+	return fastimageClientWait(client, fastimageClientSendPath(client, path, fastimage_level_full));
+}
+
+fastimage_image_t fastimageClientProbeFd(fastimage_client_t *client, int fd)
+{
+	return fastimageClientWait(client, fastimageClientSendFd(client, fd, fastimage_level_full));
+}
+
+fastimage_image_t fastimageClientProbeUrl(fastimage_client_t *client, const char *url)
+{
+	return fastimageClientWait(client, fastimageClientSendUrl(client, url, fastimage_level_full));
+}
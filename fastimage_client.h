@@ -0,0 +1,80 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FASTIMAGE_CLIENT_H
+#define FASTIMAGE_CLIENT_H
+
+#include "fastimage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Client of fastimaged, POSIX only
+
+#define FASTIMAGE_DAEMON_SOCKET "/tmp/fastimaged.sock"
+
+// Request: id (u32), type (u8), level (u8), payload size (u16), payload (path or url, no terminating zero).
+// Fd requests have no payload, descriptor goes as SCM_RIGHTS with the request bytes.
+// Response: id (u32), format (i32), width (u64), height (u64), channels (u32), bitsperpixel (u32), palette (u32).
+// All numbers are little endian. Responses may come in any order, id tells which request it answers.
+#define FASTIMAGE_DAEMON_REQUEST_SIZE 8
+#define FASTIMAGE_DAEMON_RESPONSE_SIZE 36
+#define FASTIMAGE_DAEMON_MAX_PAYLOAD 8192
+
+enum fastimage_daemon_request {
+	fastimage_daemon_path = 1,
+	fastimage_daemon_fd,
+	fastimage_daemon_url
+};
+
+typedef struct {
+	int socket;
+	uint32_t next_id;
+} fastimage_client_t;
+
+// socket_path 0 means FASTIMAGE_DAEMON_SOCKET
+extern bool fastimageClientConnect(fastimage_client_t *client, const char *socket_path);
+extern void fastimageClientClose(fastimage_client_t *client);
+
+// Pipelined requests, return request id or 0 on error. Descriptor stays open in caller.
+extern uint32_t fastimageClientSendPath(fastimage_client_t *client, const char *path, int level);
+extern uint32_t fastimageClientSendFd(fastimage_client_t *client, int fd, int level);
+extern uint32_t fastimageClientSendUrl(fastimage_client_t *client, const char *url, int level);
+extern bool fastimageClientReceive(fastimage_client_t *client, uint32_t *id, fastimage_image_t *image);
+
+// One request and its answer, only when nothing else is pending on client
+extern fastimage_image_t fastimageClientProbePath(fastimage_client_t *client, const char *path);
+extern fastimage_image_t fastimageClientProbeFd(fastimage_client_t *client, int fd);
+extern fastimage_image_t fastimageClientProbeUrl(fastimage_client_t *client, const char *url);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
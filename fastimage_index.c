@@ -0,0 +1,515 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_WIN32)
+#define _LARGEFILE_SOURCE
+#define _LARGEFILE64_SOURCE
+#endif
+
+#include "fastimage_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define FASTIMAGE_INDEX_COPY_CHUNK 65536
+
+static const size_t fastimage_index_column_size[fastimage_index_columns] = {1, 1, 1, 1, 1, 4, 4, 8, 8, 8, 8, 1};
+
+static void fastimageIndexPut(unsigned char *p, uint64_t value, size_t size)
+{
+	size_t i;
+
+	for(i = 0; i < size; i++)
+		p[i] = (unsigned char)(value>>(i*8));
+}
+
+static uint64_t fastimageIndexGet(const unsigned char *p, size_t size)
+{
+	uint64_t value = 0;
+	size_t i;
+
+	for(i = 0; i < size; i++)
+		value |= (uint64_t)p[i]<<(i*8);
+
+	return value;
+}
+
+static bool fastimageIndexSeek(FILE *f, uint64_t pos)
+{
+#if defined(_WIN32)
+	return _fseeki64(f, (int64_t)pos, SEEK_SET) == 0;
+#else
+	return fseeko64(f, (off64_t)pos, SEEK_SET) == 0;
+#endif
+}
+
+static void fastimageIndexCloseColumns(fastimage_index_writer_t *writer)
+{
+	int i;
+
+	for(i = 0; i < fastimage_index_columns; i++) {
+		if(writer->columns[i]) fclose(writer->columns[i]);
+		writer->columns[i] = 0;
+	}
+}
+
+bool fastimageIndexCreate(fastimage_index_writer_t *writer, const char *filename)
+{
+	int i;
+
+	memset(writer, 0, sizeof(fastimage_index_writer_t));
+
+	writer->f = fopen(filename, "wb");
+	if(!writer->f) return false;
+
+	// Columns are written one after another only at the end, so they grow in temporary files
+	for(i = 0; i < fastimage_index_columns; i++) {
+		writer->columns[i] = tmpfile();
+
+		if(!writer->columns[i]) {
+			fastimageIndexCloseColumns(writer);
+			fclose(writer->f);
+			writer->f = 0;
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Column values of row, image can be null
+static void fastimageIndexValues(unsigned char values[fastimage_index_heap][8], uint64_t path, uint64_t parent, unsigned int flags, uint64_t size, int64_t mtime, const fastimage_image_t *image)
+{
+	fastimage_image_t empty;
+
+	if(!image) {
+		memset(&empty, 0, sizeof(fastimage_image_t));
+		image = &empty;
+	}
+
+	fastimageIndexPut(values[fastimage_index_format], (uint64_t)image->format, 1);
+	fastimageIndexPut(values[fastimage_index_channels], image->channels, 1);
+	fastimageIndexPut(values[fastimage_index_bitsperpixel], image->bitsperpixel, 1);
+	fastimageIndexPut(values[fastimage_index_palette], image->palette, 1);
+	fastimageIndexPut(values[fastimage_index_flags], flags, 1);
+	fastimageIndexPut(values[fastimage_index_width], (image->width > UINT32_MAX)?UINT32_MAX:image->width, 4);
+	fastimageIndexPut(values[fastimage_index_height], (image->height > UINT32_MAX)?UINT32_MAX:image->height, 4);
+	fastimageIndexPut(values[fastimage_index_size], size, 8);
+	fastimageIndexPut(values[fastimage_index_mtime], (uint64_t)mtime, 8);
+	fastimageIndexPut(values[fastimage_index_parent], parent, 8);
+	fastimageIndexPut(values[fastimage_index_path], path, 8);
+}
+
+bool fastimageIndexAdd(fastimage_index_writer_t *writer, const char *path, uint64_t parent, unsigned int flags, uint64_t size, int64_t mtime, const fastimage_image_t *image)
+{
+	unsigned char values[fastimage_index_heap][8];
+	size_t path_size;
+	int i;
+
+	if(writer->failed) return false;
+
+	path_size = strlen(path)+1;
+
+	fastimageIndexValues(values, writer->heap_size, parent, flags, size, mtime, image);
+
+	for(i = 0; i < fastimage_index_heap; i++)
+		if(fwrite(values[i], 1, fastimage_index_column_size[i], writer->columns[i]) != fastimage_index_column_size[i])
+			writer->failed = true;
+
+	if(fwrite(path, 1, path_size, writer->columns[fastimage_index_heap]) != path_size)
+		writer->failed = true;
+
+	writer->count++;
+	writer->heap_size += path_size;
+
+	return !writer->failed;
+}
+
+static uint64_t fastimageIndexAlign(uint64_t value)
+{
+	return (value+7)&~(uint64_t)7;
+}
+
+// Column offsets for given capacity
+static uint64_t fastimageIndexLayout(uint64_t capacity, uint64_t heap_capacity, uint64_t *offsets)
+{
+	uint64_t offset = FASTIMAGE_INDEX_HEADER_SIZE;
+	int i;
+
+	for(i = 0; i < fastimage_index_heap; i++) {
+		offsets[i] = offset;
+		offset = fastimageIndexAlign(offset+capacity*fastimage_index_column_size[i]);
+	}
+
+	offsets[fastimage_index_heap] = offset;
+
+	return offset+heap_capacity;
+}
+
+static bool fastimageIndexCopy(FILE *dst, FILE *src)
+{
+	unsigned char chunk[FASTIMAGE_INDEX_COPY_CHUNK];
+	size_t size;
+
+	rewind(src);
+
+	while((size = fread(chunk, 1, sizeof(chunk), src)) != 0)
+		if(fwrite(chunk, 1, size, dst) != size) return false;
+
+	return !ferror(src);
+}
+
+bool fastimageIndexFinish(fastimage_index_writer_t *writer, uint64_t reserve_rows, uint64_t reserve_heap)
+{
+	unsigned char header[FASTIMAGE_INDEX_HEADER_SIZE];
+	uint64_t offsets[fastimage_index_columns], capacity, heap_capacity, file_size;
+	bool success = !writer->failed;
+	int i;
+
+	if(!writer->f) return false;
+
+	capacity = writer->count+reserve_rows;
+	heap_capacity = writer->heap_size+reserve_heap;
+	file_size = fastimageIndexLayout(capacity, heap_capacity, offsets);
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, FASTIMAGE_INDEX_MAGIC, sizeof(FASTIMAGE_INDEX_MAGIC));
+	fastimageIndexPut(header+8, FASTIMAGE_INDEX_VERSION, 4);
+	fastimageIndexPut(header+12, FASTIMAGE_INDEX_HEADER_SIZE, 4);
+	fastimageIndexPut(header+16, writer->count, 8);
+	fastimageIndexPut(header+24, capacity, 8);
+	fastimageIndexPut(header+32, writer->heap_size, 8);
+	fastimageIndexPut(header+40, heap_capacity, 8);
+
+	for(i = 0; i < fastimage_index_columns; i++)
+		fastimageIndexPut(header+48+i*8, offsets[i], 8);
+
+	if(success && fwrite(header, 1, sizeof(header), writer->f) != sizeof(header)) success = false;
+
+	// Reserved space is left as a hole
+	for(i = 0; i < fastimage_index_columns && success; i++)
+		if(!fastimageIndexSeek(writer->f, offsets[i]) || !fastimageIndexCopy(writer->f, writer->columns[i])) success = false;
+
+	if(success && file_size > 0) {
+		unsigned char zero = 0;
+
+		if(!fastimageIndexSeek(writer->f, file_size-1) || fwrite(&zero, 1, 1, writer->f) != 1) success = false;
+	}
+
+	fastimageIndexCloseColumns(writer);
+
+	if(fclose(writer->f)) success = false;
+	writer->f = 0;
+
+	return success;
+}
+
+bool fastimageIndexOpen(fastimage_index_t *index, const char *filename, bool writable)
+{
+	uint64_t *offsets, expected[fastimage_index_columns], file_size;
+	uint16_t endian_test = 1;
+	int i;
+
+	memset(index, 0, sizeof(fastimage_index_t));
+#if !defined(_WIN32)
+	index->fd = -1;
+#endif
+	index->writable = writable;
+
+	// Columns are used in place
+	if(*(unsigned char *)&endian_test != 1) return false;
+
+#if defined(_WIN32)
+	{
+		LARGE_INTEGER size;
+
+		index->file = CreateFileA(filename, writable?(GENERIC_READ|GENERIC_WRITE):GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if(index->file == INVALID_HANDLE_VALUE) {
+			index->file = 0;
+
+			return false;
+		}
+
+		if(!GetFileSizeEx(index->file, &size) || size.QuadPart < FASTIMAGE_INDEX_HEADER_SIZE) goto INDEX_ERROR;
+		index->map_size = (uint64_t)size.QuadPart;
+
+		index->mapping = CreateFileMappingA(index->file, 0, writable?PAGE_READWRITE:PAGE_READONLY, 0, 0, 0);
+		if(!index->mapping) goto INDEX_ERROR;
+
+		index->map = MapViewOfFile(index->mapping, writable?FILE_MAP_WRITE:FILE_MAP_READ, 0, 0, 0);
+		if(!index->map) goto INDEX_ERROR;
+	}
+#else
+	{
+		struct stat st;
+		void *map;
+
+		index->fd = open(filename, writable?O_RDWR:O_RDONLY);
+		if(index->fd < 0) return false;
+
+		if(fstat(index->fd, &st) || st.st_size < FASTIMAGE_INDEX_HEADER_SIZE) goto INDEX_ERROR;
+		index->map_size = (uint64_t)st.st_size;
+
+		map = mmap(0, (size_t)index->map_size, writable?(PROT_READ|PROT_WRITE):PROT_READ, MAP_SHARED, index->fd, 0);
+		if(map == MAP_FAILED) goto INDEX_ERROR;
+		index->map = map;
+	}
+#endif
+
+	if(memcmp(index->map, FASTIMAGE_INDEX_MAGIC, sizeof(FASTIMAGE_INDEX_MAGIC))) goto INDEX_ERROR;
+	if(fastimageIndexGet(index->map+8, 4) != FASTIMAGE_INDEX_VERSION) goto INDEX_ERROR;
+	if(fastimageIndexGet(index->map+12, 4) != FASTIMAGE_INDEX_HEADER_SIZE) goto INDEX_ERROR;
+
+	index->count = fastimageIndexGet(index->map+16, 8);
+	index->capacity = fastimageIndexGet(index->map+24, 8);
+	index->heap_size = fastimageIndexGet(index->map+32, 8);
+	index->heap_capacity = fastimageIndexGet(index->map+40, 8);
+
+	if(index->count > index->capacity || index->heap_size > index->heap_capacity) goto INDEX_ERROR;
+	if(index->capacity > index->map_size || index->heap_capacity > index->map_size) goto INDEX_ERROR;
+
+	offsets = index->offsets;
+	for(i = 0; i < fastimage_index_columns; i++)
+		offsets[i] = fastimageIndexGet(index->map+48+i*8, 8);
+
+	// Only the layout written by fastimageIndexFinish is accepted, then every column is inside file
+	file_size = fastimageIndexLayout(index->capacity, index->heap_capacity, expected);
+	if(file_size > index->map_size || memcmp(offsets, expected, sizeof(expected))) goto INDEX_ERROR;
+
+	index->format = index->map+offsets[fastimage_index_format];
+	index->channels = index->map+offsets[fastimage_index_channels];
+	index->bitsperpixel = index->map+offsets[fastimage_index_bitsperpixel];
+	index->palette = index->map+offsets[fastimage_index_palette];
+	index->flags = index->map+offsets[fastimage_index_flags];
+	index->width = (uint32_t *)(index->map+offsets[fastimage_index_width]);
+	index->height = (uint32_t *)(index->map+offsets[fastimage_index_height]);
+	index->size = (uint64_t *)(index->map+offsets[fastimage_index_size]);
+	index->mtime = (int64_t *)(index->map+offsets[fastimage_index_mtime]);
+	index->parent = (uint64_t *)(index->map+offsets[fastimage_index_parent]);
+	index->path = (uint64_t *)(index->map+offsets[fastimage_index_path]);
+	index->heap = (char *)(index->map+offsets[fastimage_index_heap]);
+
+	// Last path should be terminated
+	if(index->heap_size && index->heap[index->heap_size-1]) goto INDEX_ERROR;
+
+	return true;
+
+INDEX_ERROR:
+	fastimageIndexClose(index);
+
+	return false;
+}
+
+void fastimageIndexClose(fastimage_index_t *index)
+{
+#if defined(_WIN32)
+	if(index->map) UnmapViewOfFile(index->map);
+	if(index->mapping) CloseHandle(index->mapping);
+	if(index->file) CloseHandle(index->file);
+#else
+	if(index->map) munmap(index->map, (size_t)index->map_size);
+	if(index->fd >= 0) close(index->fd);
+#endif
+
+	memset(index, 0, sizeof(fastimage_index_t));
+#if !defined(_WIN32)
+	index->fd = -1;
+#endif
+}
+
+const char *fastimageIndexGetPath(const fastimage_index_t *index, uint64_t row)
+{
+	if(row >= index->count || index->path[row] >= index->heap_size) return "";
+
+	return index->heap+index->path[row];
+}
+
+fastimage_image_t fastimageIndexGetImage(const fastimage_index_t *index, uint64_t row)
+{
+	fastimage_image_t image;
+
+	memset(&image, 0, sizeof(fastimage_image_t));
+
+	if(row >= index->count) return image;
+
+	image.format = index->format[row];
+	image.width = index->width[row];
+	image.height = index->height[row];
+	image.channels = index->channels[row];
+	image.bitsperpixel = index->bitsperpixel[row];
+	image.palette = index->palette[row];
+
+	return image;
+}
+
+// Row values except path and parent when path is null
+static void fastimageIndexWrite(fastimage_index_t *index, uint64_t row, const unsigned char values[fastimage_index_heap][8], bool path)
+{
+	int i;
+
+	for(i = 0; i < fastimage_index_heap; i++) {
+		if(!path && (i == fastimage_index_parent || i == fastimage_index_path)) continue;
+
+		memcpy(index->map+index->offsets[i]+row*fastimage_index_column_size[i], values[i], fastimage_index_column_size[i]);
+	}
+}
+
+bool fastimageIndexSet(fastimage_index_t *index, uint64_t row, unsigned int flags, uint64_t size, int64_t mtime, const fastimage_image_t *image)
+{
+	unsigned char values[fastimage_index_heap][8];
+
+	if(!index->writable || row >= index->count) return false;
+
+	fastimageIndexValues(values, 0, 0, flags, size, mtime, image);
+	fastimageIndexWrite(index, row, values, false);
+
+	return true;
+}
+
+bool fastimageIndexAppend(fastimage_index_t *index, const char *path, uint64_t parent, unsigned int flags, uint64_t size, int64_t mtime, const fastimage_image_t *image)
+{
+	unsigned char values[fastimage_index_heap][8];
+	size_t path_size;
+
+	path_size = strlen(path)+1;
+
+	if(!index->writable || index->count >= index->capacity || path_size > index->heap_capacity-index->heap_size) return false;
+
+	memcpy(index->heap+index->heap_size, path, path_size);
+
+	fastimageIndexValues(values, index->heap_size, parent, flags, size, mtime, image);
+	fastimageIndexWrite(index, index->count, values, true);
+
+	index->heap_size += path_size;
+	index->count++;
+
+	fastimageIndexPut(index->map+32, index->heap_size, 8);
+	fastimageIndexPut(index->map+16, index->count, 8);
+
+	return true;
+}
+
+bool fastimageIndexGrow(fastimage_index_t *index, const char *filename, uint64_t reserve_rows, uint64_t reserve_heap)
+{
+	fastimage_index_writer_t writer;
+	uint64_t row;
+	char *temp;
+	bool success;
+
+	if(!index->writable) return false;
+
+	temp = malloc(strlen(filename)+5);
+	if(!temp) return false;
+	sprintf(temp, "%s.tmp", filename);
+
+	// New file replaces old one at once, other readers keep their mapping of old file
+	if(!fastimageIndexCreate(&writer, temp)) {
+		free(temp);
+
+		return false;
+	}
+
+	for(row = 0; row < index->count; row++) {
+		fastimage_image_t image = fastimageIndexGetImage(index, row);
+
+		fastimageIndexAdd(&writer, fastimageIndexGetPath(index, row), index->parent[row], index->flags[row], index->size[row], index->mtime[row], &image);
+	}
+
+	success = fastimageIndexFinish(&writer, reserve_rows, reserve_heap);
+
+	fastimageIndexClose(index);
+
+#if defined(_WIN32)
+	if(success && !MoveFileExA(temp, filename, MOVEFILE_REPLACE_EXISTING)) success = false;
+#else
+	if(success && rename(temp, filename)) success = false;
+#endif
+
+	if(!success) remove(temp);
+	free(temp);
+
+	// Old file is opened again on error
+	if(!fastimageIndexOpen(index, filename, true)) return false;
+
+	return success;
+}
+
+bool fastimageIndexSync(fastimage_index_t *index)
+{
+	if(!index->map) return false;
+
+#if defined(_WIN32)
+	return FlushViewOfFile(index->map, 0) != 0;
+#else
+	return msync(index->map, (size_t)index->map_size, MS_SYNC) == 0;
+#endif
+}
+
+void fastimageIndexQueryInit(fastimage_index_query_t *query)
+{
+	memset(query, 0, sizeof(fastimage_index_query_t));
+
+	query->format = -1;
+}
+
+size_t fastimageIndexQuery(const fastimage_index_t *index, const fastimage_index_query_t *query, uint64_t *start, uint64_t *rows, size_t max_rows)
+{
+	uint32_t min_width, max_width, min_height, max_height;
+	uint64_t row;
+	size_t found = 0;
+
+	min_width = query->min_width;
+	max_width = query->max_width?query->max_width:UINT32_MAX;
+	min_height = query->min_height;
+	max_height = query->max_height?query->max_height:UINT32_MAX;
+
+	// Only needed columns are touched, format first as the most selective
+	for(row = *start; row < index->count && found < max_rows; row++) {
+		if(index->flags[row]) continue;
+		if(query->format >= 0 && index->format[row] != query->format) continue;
+		if(index->width[row] < min_width || index->width[row] > max_width) continue;
+		if(index->height[row] < min_height || index->height[row] > max_height) continue;
+		if(query->channels && index->channels[row] != query->channels) continue;
+
+		rows[found++] = row;
+	}
+
+	*start = row;
+
+	return found;
+}
@@ -0,0 +1,147 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FASTIMAGE_INDEX_H
+#define FASTIMAGE_INDEX_H
+
+#include "fastimage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Columnar file of scan results, used through memory mapping.
+// Header (256 bytes): magic "FIMGIDX\0", version (u32), header size (u32), count, capacity, heap size,
+// heap capacity (u64 each) and offsets of columns (u64 each, in order of fastimage_index_column).
+// Every column has capacity elements, heap has zero terminated paths. All numbers are little endian.
+// Rows past count and heap past heap size are reserved for appends in place.
+// Directories have rows too, with their mtime, so updates can skip subtrees. Rows are never removed
+// in place, only flagged as deleted.
+
+#define FASTIMAGE_INDEX_MAGIC "FIMGIDX"
+#define FASTIMAGE_INDEX_VERSION 2
+#define FASTIMAGE_INDEX_HEADER_SIZE 256
+#define FASTIMAGE_INDEX_NO_ROW UINT64_MAX
+
+enum fastimage_index_column {
+	fastimage_index_format, // u8
+	fastimage_index_channels, // u8
+	fastimage_index_bitsperpixel, // u8
+	fastimage_index_palette, // u8
+	fastimage_index_flags, // u8, fastimage_index_flag
+	fastimage_index_width, // u32
+	fastimage_index_height, // u32
+	fastimage_index_size, // u64, file size
+	fastimage_index_mtime, // i64, seconds
+	fastimage_index_parent, // u64, row of directory or FASTIMAGE_INDEX_NO_ROW
+	fastimage_index_path, // u64, offset in heap
+	fastimage_index_heap,
+	fastimage_index_columns
+};
+
+enum fastimage_index_flag {
+	fastimage_index_directory = 1,
+	fastimage_index_deleted = 2
+};
+
+typedef struct {
+	FILE *f;
+	FILE *columns[fastimage_index_columns]; // Temporary, joined by fastimageIndexFinish
+	uint64_t count;
+	uint64_t heap_size;
+	bool failed;
+} fastimage_index_writer_t;
+
+typedef struct {
+	unsigned char *map;
+	uint64_t map_size;
+	uint64_t count;
+	uint64_t capacity;
+	uint64_t heap_size;
+	uint64_t heap_capacity;
+	uint8_t *format;
+	uint8_t *channels;
+	uint8_t *bitsperpixel;
+	uint8_t *palette;
+	uint8_t *flags;
+	uint32_t *width;
+	uint32_t *height;
+	uint64_t *size;
+	int64_t *mtime;
+	uint64_t *parent;
+	uint64_t *path;
+	char *heap;
+	uint64_t offsets[fastimage_index_columns];
+	bool writable;
+#if defined(_WIN32)
+	void *file;
+	void *mapping;
+#else
+	int fd;
+#endif
+} fastimage_index_t;
+
+// Zero means no limit, format -1 means any
+typedef struct {
+	int format;
+	uint32_t min_width;
+	uint32_t max_width;
+	uint32_t min_height;
+	uint32_t max_height;
+	unsigned int channels;
+} fastimage_index_query_t;
+
+extern bool fastimageIndexCreate(fastimage_index_writer_t *writer, const char *filename);
+// Row is writer->count before call, image can be null for directories
+extern bool fastimageIndexAdd(fastimage_index_writer_t *writer, const char *path, uint64_t parent, unsigned int flags, uint64_t size, int64_t mtime, const fastimage_image_t *image);
+// Writes the file, reserve_rows and reserve_heap are left free for appends. Writer is closed even on error
+extern bool fastimageIndexFinish(fastimage_index_writer_t *writer, uint64_t reserve_rows, uint64_t reserve_heap);
+
+// Columns point into mapping, values are little endian (native on supported platforms)
+extern bool fastimageIndexOpen(fastimage_index_t *index, const char *filename, bool writable);
+extern void fastimageIndexClose(fastimage_index_t *index);
+extern const char *fastimageIndexGetPath(const fastimage_index_t *index, uint64_t row);
+extern fastimage_image_t fastimageIndexGetImage(const fastimage_index_t *index, uint64_t row);
+
+// Updates of index opened writable, visible to other mappings right away. Path and parent of row are kept
+extern bool fastimageIndexSet(fastimage_index_t *index, uint64_t row, unsigned int flags, uint64_t size, int64_t mtime, const fastimage_image_t *image);
+// Uses reserved space, false when it's not enough. Count is stored last, so readers never see partial row
+extern bool fastimageIndexAppend(fastimage_index_t *index, const char *path, uint64_t parent, unsigned int flags, uint64_t size, int64_t mtime, const fastimage_image_t *image);
+// Rewrites file with more reserved space and reopens it, rows keep their numbers
+extern bool fastimageIndexGrow(fastimage_index_t *index, const char *filename, uint64_t reserve_rows, uint64_t reserve_heap);
+extern bool fastimageIndexSync(fastimage_index_t *index);
+
+extern void fastimageIndexQueryInit(fastimage_index_query_t *query);
+// Up to max_rows matching rows starting from *start, directories and deleted rows never match, *start is moved past the last checked row
+extern size_t fastimageIndexQuery(const fastimage_index_t *index, const fastimage_index_query_t *query, uint64_t *start, uint64_t *rows, size_t max_rows);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1154 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if defined(_DEBUG) && defined(USE_STB_LEAKCHECK)
+#include "third_party/stb_leakcheck.h"
+#endif
+
+#include "fastimage_preview.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(FASTIMAGE_USE_ZLIB)
+#include <zlib.h>
+#endif
+
+// Fallback decoder for everything else, static so it doesn't clash with stb_image of application
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_STATIC
+#define STBI_NO_STDIO
+#define STBI_NO_LINEAR
+#define STBI_NO_HDR
+#include "third_party/stb_image.h"
+
+#define PREVIEW_BUF_SIZE 4096
+#define PREVIEW_SCALE 8
+#define PREVIEW_MAX_PIXELS (1u<<26) // Full decode by stb_image, 256 MB at 4 channels
+
+typedef struct {
+	const fastimage_reader_t *reader;
+	unsigned char buf[PREVIEW_BUF_SIZE];
+	size_t pos;
+	size_t size;
+} preview_stream_t;
+
+static int previewGetByte(preview_stream_t *stream)
+{
+	if(stream->pos == stream->size) {
+		stream->size = stream->reader->read(stream->reader->context, PREVIEW_BUF_SIZE, stream->buf);
+		stream->pos = 0;
+
+		if(!stream->size) return -1;
+	}
+
+	return stream->buf[stream->pos++];
+}
+
+static bool previewRead(preview_stream_t *stream, size_t size, unsigned char *buf)
+{
+	while(size) {
+		size_t part;
+
+		if(stream->pos == stream->size) {
+			stream->size = stream->reader->read(stream->reader->context, PREVIEW_BUF_SIZE, stream->buf);
+			stream->pos = 0;
+
+			if(!stream->size) return false;
+		}
+
+		part = stream->size-stream->pos;
+		if(part > size) part = size;
+
+		memcpy(buf, stream->buf+stream->pos, part);
+		stream->pos += part;
+		buf += part;
+		size -= part;
+	}
+
+	return true;
+}
+
+static bool previewSkip(preview_stream_t *stream, size_t size)
+{
+	size_t part;
+
+	part = stream->size-stream->pos;
+	if(part > size) part = size;
+
+	stream->pos += part;
+	size -= part;
+
+	if(!size) return true;
+
+	// Rest is not buffered, seek over it
+	stream->pos = stream->size = 0;
+
+	return stream->reader->seek(stream->reader->context, (int64_t)size, true);
+}
+
+static uint32_t previewBe16(const unsigned char *p)
+{
+	return (uint32_t)(p[0])*256+p[1];
+}
+
+static uint32_t previewBe32(const unsigned char *p)
+{
+	return (uint32_t)(p[0])*16777216+(uint32_t)(p[1])*65536+(uint32_t)(p[2])*256+p[3];
+}
+
+static unsigned char previewClamp(int value)
+{
+	if(value < 0) return 0;
+	if(value > 255) return 255;
+
+	return (unsigned char)value;
+}
+
+// Area average to fit max_side, returns src if it already fits
+static unsigned char *previewDownscale(unsigned char *src, size_t width, size_t height, unsigned int channels, size_t max_side, size_t *out_width, size_t *out_height)
+{
+	unsigned char *dst;
+	uint64_t *sums; // Box of a big image with small max_side doesn't fit 32 bits
+	size_t dst_width, dst_height, x, y, sx, sy;
+	unsigned int c;
+
+	if(width <= max_side && height <= max_side) {
+		*out_width = width;
+		*out_height = height;
+
+		return src;
+	}
+
+	if(width >= height) {
+		dst_width = max_side;
+		dst_height = (size_t)((uint64_t)height*max_side/width);
+	} else {
+		dst_height = max_side;
+		dst_width = (size_t)((uint64_t)width*max_side/height);
+	}
+
+	if(!dst_width) dst_width = 1;
+	if(!dst_height) dst_height = 1;
+
+	dst = malloc(dst_width*dst_height*channels);
+	sums = malloc(dst_width*channels*sizeof(uint64_t));
+	if(!dst || !sums) {
+		free(dst);
+		free(sums);
+
+		return 0;
+	}
+
+	for(y = 0; y < dst_height; y++) {
+		size_t y0, y1;
+
+		y0 = (size_t)((uint64_t)y*height/dst_height);
+		y1 = (size_t)((uint64_t)(y+1)*height/dst_height);
+		if(y1 <= y0) y1 = y0+1;
+
+		memset(sums, 0, dst_width*channels*sizeof(uint64_t));
+
+		for(sy = y0; sy < y1; sy++) {
+			const unsigned char *row = src+sy*width*channels;
+
+			for(x = 0; x < dst_width; x++) {
+				size_t x0, x1;
+
+				x0 = (size_t)((uint64_t)x*width/dst_width);
+				x1 = (size_t)((uint64_t)(x+1)*width/dst_width);
+				if(x1 <= x0) x1 = x0+1;
+
+				for(sx = x0; sx < x1; sx++)
+					for(c = 0; c < channels; c++)
+						sums[x*channels+c] += row[sx*channels+c];
+			}
+		}
+
+		for(x = 0; x < dst_width; x++) {
+			size_t x0, x1, area;
+
+			x0 = (size_t)((uint64_t)x*width/dst_width);
+			x1 = (size_t)((uint64_t)(x+1)*width/dst_width);
+			if(x1 <= x0) x1 = x0+1;
+
+			area = (x1-x0)*(y1-y0);
+
+			for(c = 0; c < channels; c++)
+				dst[(y*dst_width+x)*channels+c] = (unsigned char)((sums[x*channels+c]+area/2)/area);
+		}
+	}
+
+	free(sums);
+
+	*out_width = dst_width;
+	*out_height = dst_height;
+
+	return dst;
+}
+
+// JPEG, only DC coefficients: each 8x8 block becomes one pixel
+
+#define JPEG_FAST_BITS 9
+#define JPEG_MAX_COMPONENTS 4
+
+typedef struct {
+	unsigned char vals[256];
+	unsigned char sizes[256];
+	unsigned char fast[1<<JPEG_FAST_BITS]; // Index in vals, 255 if code is longer
+	int32_t maxcode[18];
+	int32_t valptr[17];
+	int32_t mincode[17];
+	bool defined;
+} jpeg_huffman_t;
+
+typedef struct {
+	int id;
+	int h;
+	int v;
+	int tq;
+	int dc_table;
+	int pred;
+	size_t blocks_w; // Allocated block grid (MCU aligned)
+	size_t blocks_h;
+	int *dc;
+	int q0; // DC quantizer
+	bool done;
+} jpeg_component_t;
+
+typedef struct {
+	preview_stream_t stream;
+	uint32_t bits;
+	int count;
+	int marker; // Marker found inside entropy coded data
+	jpeg_huffman_t dc_tables[4];
+	jpeg_huffman_t ac_tables[4];
+	unsigned int qt[4][64];
+	jpeg_component_t comps[JPEG_MAX_COMPONENTS];
+	int comps_num;
+	int hmax;
+	int vmax;
+	size_t width;
+	size_t height;
+	size_t mcux;
+	size_t mcuy;
+	unsigned int restart_interval;
+	bool progressive;
+	bool adobe_rgb;
+} jpeg_decoder_t;
+
+static bool jpegBuildHuffman(jpeg_huffman_t *table, const unsigned char *counts, const unsigned char *vals, size_t vals_num)
+{
+	int32_t code = 0;
+	size_t k = 0, i;
+	int len;
+
+	memset(table, 0, sizeof(jpeg_huffman_t));
+	memset(table->fast, 255, sizeof(table->fast));
+	memcpy(table->vals, vals, vals_num);
+
+	for(len = 1; len <= 16; len++) {
+		table->valptr[len] = (int32_t)k;
+		table->mincode[len] = code;
+
+		for(i = 0; i < counts[len-1]; i++, k++) {
+			if(code >= (1<<len)) return false;
+
+			table->sizes[k] = (unsigned char)len;
+
+			if(len <= JPEG_FAST_BITS) {
+				int32_t first = code<<(JPEG_FAST_BITS-len), j;
+
+				for(j = 0; j < (1<<(JPEG_FAST_BITS-len)); j++)
+					table->fast[first+j] = (unsigned char)k;
+			}
+
+			code++;
+		}
+
+		table->maxcode[len] = counts[len-1]?code:0;
+		code <<= 1;
+	}
+
+	table->maxcode[17] = INT32_MAX;
+	table->defined = true;
+
+	return true;
+}
+
+static void jpegFill(jpeg_decoder_t *jpeg)
+{
+	while(jpeg->count <= 24) {
+		int byte = 0;
+
+		if(!jpeg->marker) {
+			byte = previewGetByte(&jpeg->stream);
+
+			if(byte < 0) {
+				jpeg->marker = 0xD9; // Treat end of stream as EOI
+				byte = 0;
+			} else if(byte == 0xFF) {
+				int next;
+
+				do next = previewGetByte(&jpeg->stream); while(next == 0xFF);
+
+				if(next == 0)
+					byte = 0xFF; // Stuffed byte
+				else {
+					jpeg->marker = (next < 0)?0xD9:next;
+					byte = 0;
+				}
+			}
+		}
+
+		jpeg->bits |= (uint32_t)byte<<(24-jpeg->count);
+		jpeg->count += 8;
+	}
+}
+
+static int jpegGetBits(jpeg_decoder_t *jpeg, int n)
+{
+	int value;
+
+	if(!n) return 0;
+
+	jpegFill(jpeg);
+
+	value = (int)(jpeg->bits>>(32-n));
+	jpeg->bits <<= n;
+	jpeg->count -= n;
+
+	return value;
+}
+
+static int jpegExtend(int value, int n)
+{
+	if(n && value < (1<<(n-1)))
+		value -= (1<<n)-1;
+
+	return value;
+}
+
+static int jpegDecodeHuffman(jpeg_decoder_t *jpeg, jpeg_huffman_t *table)
+{
+	int k, len;
+
+	jpegFill(jpeg);
+
+	k = table->fast[jpeg->bits>>(32-JPEG_FAST_BITS)];
+	if(k != 255) {
+		len = table->sizes[k];
+		jpeg->bits <<= len;
+		jpeg->count -= len;
+
+		return table->vals[k];
+	}
+
+	for(len = JPEG_FAST_BITS+1; len <= 16; len++) {
+		int32_t code = (int32_t)(jpeg->bits>>(32-len));
+
+		if(code < table->maxcode[len]) {
+			k = table->valptr[len]+code-table->mincode[len];
+			if(k < 0 || k > 255) return -1;
+
+			jpeg->bits <<= len;
+			jpeg->count -= len;
+
+			return table->vals[k];
+		}
+	}
+
+	return -1;
+}
+
+// Returns next marker, 0 on error
+static int jpegNextMarker(jpeg_decoder_t *jpeg)
+{
+	int byte;
+
+	if(jpeg->marker) {
+		byte = jpeg->marker;
+		jpeg->marker = 0;
+		jpeg->bits = 0;
+		jpeg->count = 0;
+
+		return byte;
+	}
+
+	jpeg->bits = 0;
+	jpeg->count = 0;
+
+	// Skip garbage or entropy coded data of skipped scan until marker, FF 00 is stuffed byte of data
+	do {
+		do {
+			byte = previewGetByte(&jpeg->stream);
+			if(byte < 0) return 0;
+		} while(byte != 0xFF);
+
+		do byte = previewGetByte(&jpeg->stream); while(byte == 0xFF);
+
+		if(byte < 0) return 0;
+	} while(!byte);
+
+	return byte;
+}
+
+static bool jpegReadSegment(jpeg_decoder_t *jpeg, unsigned char **data, size_t *size)
+{
+	unsigned char len_bytes[2];
+	size_t len;
+
+	if(!previewRead(&jpeg->stream, 2, len_bytes)) return false;
+
+	len = previewBe16(len_bytes);
+	if(len < 2) return false;
+
+	*size = len-2;
+	*data = malloc(*size?*size:1);
+	if(!*data) return false;
+
+	if(!previewRead(&jpeg->stream, *size, *data)) {
+		free(*data);
+
+		return false;
+	}
+
+	return true;
+}
+
+static bool jpegReadFrame(jpeg_decoder_t *jpeg, const unsigned char *data, size_t size)
+{
+	int i;
+
+	if(size < 6 || data[0] != 8) return false; // 12 bit is left to fallback
+
+	jpeg->height = previewBe16(data+1);
+	jpeg->width = previewBe16(data+3);
+	jpeg->comps_num = data[5];
+
+	if(!jpeg->width || !jpeg->height) return false;
+	if(jpeg->comps_num != 1 && jpeg->comps_num != 3) return false;
+	if(size < 6+(size_t)jpeg->comps_num*3) return false;
+
+	jpeg->hmax = jpeg->vmax = 1;
+
+	for(i = 0; i < jpeg->comps_num; i++) {
+		jpeg_component_t *comp = jpeg->comps+i;
+
+		comp->id = data[6+i*3];
+		comp->h = data[7+i*3]>>4;
+		comp->v = data[7+i*3]&15;
+		comp->tq = data[8+i*3]&3;
+
+		if(comp->h < 1 || comp->h > 4 || comp->v < 1 || comp->v > 4) return false;
+
+		if(comp->h > jpeg->hmax) jpeg->hmax = comp->h;
+		if(comp->v > jpeg->vmax) jpeg->vmax = comp->v;
+	}
+
+	jpeg->mcux = (jpeg->width+8*jpeg->hmax-1)/(8*jpeg->hmax);
+	jpeg->mcuy = (jpeg->height+8*jpeg->vmax-1)/(8*jpeg->vmax);
+
+	for(i = 0; i < jpeg->comps_num; i++) {
+		jpeg_component_t *comp = jpeg->comps+i;
+
+		comp->blocks_w = jpeg->mcux*comp->h;
+		comp->blocks_h = jpeg->mcuy*comp->v;
+		comp->dc = calloc(comp->blocks_w*comp->blocks_h, sizeof(int));
+		if(!comp->dc) return false;
+	}
+
+	return true;
+}
+
+static bool jpegReadHuffmanTables(jpeg_decoder_t *jpeg, const unsigned char *data, size_t size)
+{
+	size_t pos = 0;
+
+	while(pos+17 <= size) {
+		int table_class = data[pos]>>4, table_id = data[pos]&3;
+		size_t vals_num = 0, i;
+
+		for(i = 0; i < 16; i++)
+			vals_num += data[pos+1+i];
+
+		if(vals_num > 256 || pos+17+vals_num > size) return false;
+
+		if(!jpegBuildHuffman(table_class?(jpeg->ac_tables+table_id):(jpeg->dc_tables+table_id), data+pos+1, data+pos+17, vals_num)) return false;
+
+		pos += 17+vals_num;
+	}
+
+	return true;
+}
+
+static bool jpegReadQuantTables(jpeg_decoder_t *jpeg, const unsigned char *data, size_t size)
+{
+	size_t pos = 0;
+
+	while(pos < size) {
+		int precision = data[pos]>>4, table_id = data[pos]&3, i;
+
+		if(pos+1+64*(precision?2:1) > size) return false;
+
+		for(i = 0; i < 64; i++)
+			jpeg->qt[table_id][i] = precision?previewBe16(data+pos+1+i*2):data[pos+1+i];
+
+		pos += 1+64*(precision?2:1);
+	}
+
+	return true;
+}
+
+static bool jpegRestart(jpeg_decoder_t *jpeg, jpeg_component_t **scan_comps, int scan_comps_num)
+{
+	int marker, i;
+
+	marker = jpegNextMarker(jpeg);
+	if(marker < 0xD0 || marker > 0xD7) return false;
+
+	for(i = 0; i < scan_comps_num; i++)
+		scan_comps[i]->pred = 0;
+
+	return true;
+}
+
+static bool jpegDecodeBlock(jpeg_decoder_t *jpeg, jpeg_component_t *comp, int ac_table, int al, size_t bx, size_t by)
+{
+	int t, diff;
+
+	t = jpegDecodeHuffman(jpeg, jpeg->dc_tables+comp->dc_table);
+	if(t < 0 || t > 16) return false;
+
+	diff = jpegExtend(jpegGetBits(jpeg, t), t);
+	comp->pred += diff;
+
+	if(bx < comp->blocks_w && by < comp->blocks_h)
+		comp->dc[by*comp->blocks_w+bx] = comp->pred*(1<<al);
+
+	// Baseline block has AC coefficients too, they should be decoded to be skipped
+	if(ac_table >= 0) {
+		int k;
+
+		for(k = 1; k < 64; ) {
+			int rs, r, s;
+
+			rs = jpegDecodeHuffman(jpeg, jpeg->ac_tables+ac_table);
+			if(rs < 0) return false;
+
+			r = rs>>4;
+			s = rs&15;
+
+			if(s) {
+				k += r+1;
+				jpegGetBits(jpeg, s);
+			} else if(r == 15)
+				k += 16;
+			else
+				break;
+		}
+	}
+
+	return true;
+}
+
+static bool jpegReadScan(jpeg_decoder_t *jpeg, const unsigned char *data, size_t size)
+{
+	jpeg_component_t *scan_comps[JPEG_MAX_COMPONENTS];
+	int scan_comps_num, ac_tables[JPEG_MAX_COMPONENTS], ss, se, ah, al, i, j;
+	unsigned int mcus_to_restart;
+
+	if(size < 1) return false;
+
+	scan_comps_num = data[0];
+	if(scan_comps_num < 1 || scan_comps_num > jpeg->comps_num || size < 4+(size_t)scan_comps_num*2) return false;
+
+	for(i = 0; i < scan_comps_num; i++) {
+		int id = data[1+i*2];
+
+		scan_comps[i] = 0;
+		for(j = 0; j < jpeg->comps_num; j++)
+			if(jpeg->comps[j].id == id) scan_comps[i] = jpeg->comps+j;
+
+		if(!scan_comps[i]) return false;
+
+		scan_comps[i]->dc_table = data[2+i*2]>>4&3;
+		ac_tables[i] = data[2+i*2]&3;
+		scan_comps[i]->pred = 0;
+	}
+
+	ss = data[1+scan_comps_num*2];
+	se = data[2+scan_comps_num*2];
+	ah = data[3+scan_comps_num*2]>>4;
+	al = data[3+scan_comps_num*2]&15;
+
+	// Progressive AC and refinement scans don't touch DC, their data is skipped by jpegNextMarker
+	if(jpeg->progressive && (ss != 0 || ah != 0)) return true;
+	if(!jpeg->progressive && (ss != 0 || se != 63)) return false;
+
+	for(i = 0; i < scan_comps_num; i++) {
+		if(!jpeg->dc_tables[scan_comps[i]->dc_table].defined) return false;
+		if(!jpeg->progressive && !jpeg->ac_tables[ac_tables[i]].defined) return false;
+		if(jpeg->progressive) ac_tables[i] = -1;
+	}
+
+	jpeg->bits = 0;
+	jpeg->count = 0;
+	jpeg->marker = 0;
+	mcus_to_restart = jpeg->restart_interval;
+
+	if(scan_comps_num == 1) { // Not interleaved, blocks of component without MCU padding
+		jpeg_component_t *comp = scan_comps[0];
+		size_t comp_w, comp_h, bx, by;
+
+		comp_w = ((jpeg->width*comp->h+jpeg->hmax-1)/jpeg->hmax+7)/8;
+		comp_h = ((jpeg->height*comp->v+jpeg->vmax-1)/jpeg->vmax+7)/8;
+
+		for(by = 0; by < comp_h; by++)
+			for(bx = 0; bx < comp_w; bx++) {
+				if(jpeg->restart_interval && !mcus_to_restart) {
+					if(!jpegRestart(jpeg, scan_comps, 1)) return false;
+					mcus_to_restart = jpeg->restart_interval;
+				}
+
+				if(!jpegDecodeBlock(jpeg, comp, ac_tables[0], al, bx, by)) return false;
+
+				mcus_to_restart--;
+			}
+	} else {
+		size_t mx, my;
+
+		for(my = 0; my < jpeg->mcuy; my++)
+			for(mx = 0; mx < jpeg->mcux; mx++) {
+				if(jpeg->restart_interval && !mcus_to_restart) {
+					if(!jpegRestart(jpeg, scan_comps, scan_comps_num)) return false;
+					mcus_to_restart = jpeg->restart_interval;
+				}
+
+				for(i = 0; i < scan_comps_num; i++) {
+					jpeg_component_t *comp = scan_comps[i];
+					int x, y;
+
+					for(y = 0; y < comp->v; y++)
+						for(x = 0; x < comp->h; x++)
+							if(!jpegDecodeBlock(jpeg, comp, ac_tables[i], al, mx*comp->h+x, my*comp->v+y)) return false;
+				}
+
+				mcus_to_restart--;
+			}
+	}
+
+	for(i = 0; i < scan_comps_num; i++) {
+		scan_comps[i]->done = true;
+		scan_comps[i]->q0 = (int)jpeg->qt[scan_comps[i]->tq][0];
+	}
+
+	return true;
+}
+
+static bool jpegDecodeDC(const fastimage_reader_t *reader, fastimage_preview_t *preview)
+{
+	jpeg_decoder_t *jpeg;
+	bool success = false, frame = false;
+	size_t x, y;
+	int i;
+
+	jpeg = calloc(1, sizeof(jpeg_decoder_t));
+	if(!jpeg) return false;
+
+	jpeg->stream.reader = reader;
+
+	if(previewGetByte(&jpeg->stream) != 0xFF || previewGetByte(&jpeg->stream) != 0xD8) goto JPEG_FINAL;
+
+	while(1) {
+		unsigned char *data;
+		size_t size;
+		int marker;
+		bool all_done = true;
+
+		if(frame) {
+			for(i = 0; i < jpeg->comps_num; i++)
+				if(!jpeg->comps[i].done) all_done = false;
+
+			// Everything else in file is not needed
+			if(all_done) break;
+		}
+
+		marker = jpegNextMarker(jpeg);
+		if(!marker || marker == 0xD9) goto JPEG_FINAL;
+
+		if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue; // No length, RSTn of skipped scan
+
+		if(!jpegReadSegment(jpeg, &data, &size)) goto JPEG_FINAL;
+
+		switch(marker) {
+			case 0xC0: // Baseline
+			case 0xC1: // Extended
+			case 0xC2: // Progressive
+				jpeg->progressive = marker == 0xC2;
+				frame = !frame && jpegReadFrame(jpeg, data, size);
+				if(!frame) goto JPEG_SEGMENT_ERROR;
+				break;
+			case 0xC4:
+				if(!jpegReadHuffmanTables(jpeg, data, size)) goto JPEG_SEGMENT_ERROR;
+				break;
+			case 0xDB:
+				if(!jpegReadQuantTables(jpeg, data, size)) goto JPEG_SEGMENT_ERROR;
+				break;
+			case 0xDD:
+				if(size < 2) goto JPEG_SEGMENT_ERROR;
+				jpeg->restart_interval = previewBe16(data);
+				break;
+			case 0xDA:
+				if(!frame || !jpegReadScan(jpeg, data, size)) goto JPEG_SEGMENT_ERROR;
+				break;
+			case 0xEE: // Adobe, transform 0 means RGB
+				if(size >= 12 && !memcmp(data, "Adobe", 5) && data[11] == 0) jpeg->adobe_rgb = true;
+				break;
+			default:
+				if(marker >= 0xC3 && marker <= 0xCF && marker != 0xC8 && marker != 0xCC) goto JPEG_SEGMENT_ERROR; // Lossless, arithmetic...
+		}
+
+		free(data);
+		continue;
+
+JPEG_SEGMENT_ERROR:
+		free(data);
+		goto JPEG_FINAL;
+	}
+
+	// No Adobe marker, but components named R, G, B
+	if(jpeg->comps_num == 3 && jpeg->comps[0].id == 'R' && jpeg->comps[1].id == 'G' && jpeg->comps[2].id == 'B') jpeg->adobe_rgb = true;
+
+	// Each luma block is one pixel
+	preview->width = (jpeg->width+PREVIEW_SCALE-1)/PREVIEW_SCALE;
+	preview->height = (jpeg->height+PREVIEW_SCALE-1)/PREVIEW_SCALE;
+	preview->channels = (unsigned int)jpeg->comps_num;
+	preview->scale = PREVIEW_SCALE;
+	preview->pixels = malloc(preview->width*preview->height*preview->channels);
+	if(!preview->pixels) goto JPEG_FINAL;
+
+	for(y = 0; y < preview->height; y++)
+		for(x = 0; x < preview->width; x++) {
+			int values[3];
+			unsigned char *pixel = preview->pixels+(y*preview->width+x)*preview->channels;
+
+			for(i = 0; i < jpeg->comps_num; i++) {
+				jpeg_component_t *comp = jpeg->comps+i;
+				size_t bx, by;
+
+				bx = x*comp->h/jpeg->hmax;
+				by = y*comp->v/jpeg->vmax;
+
+				// DC/8 is the mean of block
+				values[i] = comp->dc[by*comp->blocks_w+bx]*comp->q0/8+128;
+			}
+
+			if(jpeg->comps_num == 1)
+				pixel[0] = previewClamp(values[0]);
+			else if(jpeg->adobe_rgb) {
+				pixel[0] = previewClamp(values[0]);
+				pixel[1] = previewClamp(values[1]);
+				pixel[2] = previewClamp(values[2]);
+			} else { // YCbCr
+				int cb = values[1]-128, cr = values[2]-128;
+
+				pixel[0] = previewClamp(values[0]+((91881*cr+32768)>>16));
+				pixel[1] = previewClamp(values[0]-((22554*cb+46802*cr+32768)>>16));
+				pixel[2] = previewClamp(values[0]+((116130*cb+32768)>>16));
+			}
+		}
+
+	success = true;
+
+JPEG_FINAL:
+	for(i = 0; i < JPEG_MAX_COMPONENTS; i++)
+		free(jpeg->comps[i].dc);
+	free(jpeg);
+
+	return success;
+}
+
+// PNG, first pass of Adam7 is every 8th pixel of every 8th row
+
+#if defined(FASTIMAGE_USE_ZLIB)
+static unsigned char previewPaeth(int a, int b, int c)
+{
+	int p = a+b-c, pa = abs(p-a), pb = abs(p-b), pc = abs(p-c);
+
+	if(pa <= pb && pa <= pc) return (unsigned char)a;
+	if(pb <= pc) return (unsigned char)b;
+
+	return (unsigned char)c;
+}
+
+// With image the header is taken from probe and reader is right after IHDR, else reader is at the signature
+static bool pngDecodePass1(const fastimage_reader_t *reader, const fastimage_image_t *image, fastimage_preview_t *preview)
+{
+	preview_stream_t *stream;
+	z_stream zs;
+	unsigned char header[33], palette[256*4], *raw = 0, *prev_row, *row;
+	size_t width, height, pass_width, pass_height, row_size, raw_size, x, y;
+	unsigned int bit_depth, color_type, samples, pixel_bytes, c;
+	uint32_t chunk_left = 0;
+	bool success = false, zs_init = false, has_trns = false;
+
+	stream = malloc(sizeof(preview_stream_t));
+	if(!stream) return false;
+
+	stream->reader = reader;
+	stream->pos = stream->size = 0;
+
+	if(image) {
+		width = image->width;
+		height = image->height;
+
+		if(image->palette) {
+			bit_depth = image->palette;
+			color_type = 3;
+		} else {
+			static const unsigned int types[5] = {0, 0, 4, 2, 6};
+
+			if(image->channels < 1 || image->channels > 4) goto PNG_FINAL;
+
+			bit_depth = image->bitsperpixel/image->channels;
+			color_type = types[image->channels];
+		}
+	} else {
+		// Signature and whole IHDR with CRC
+		if(!previewRead(stream, sizeof(header), header)) goto PNG_FINAL;
+		if(memcmp(header+12, "IHDR", 4)) goto PNG_FINAL;
+
+		width = previewBe32(header+16);
+		height = previewBe32(header+20);
+		bit_depth = header[24];
+		color_type = header[25];
+
+		if(header[28] != 1) goto PNG_FINAL; // Not interlaced
+	}
+
+	switch(color_type) {
+		case 0: samples = 1; break;
+		case 2: samples = 3; break;
+		case 3: samples = 1; break;
+		case 4: samples = 2; break;
+		case 6: samples = 4; break;
+		default: goto PNG_FINAL;
+	}
+
+	if(bit_depth != 1 && bit_depth != 2 && bit_depth != 4 && bit_depth != 8 && bit_depth != 16) goto PNG_FINAL;
+
+	memset(palette, 255, sizeof(palette));
+
+	// Chunks before image data
+	while(1) {
+		unsigned char chunk_head[8];
+		uint32_t chunk_size;
+
+		if(!previewRead(stream, 8, chunk_head)) goto PNG_FINAL;
+
+		chunk_size = previewBe32(chunk_head);
+
+		if(!memcmp(chunk_head+4, "IDAT", 4)) {
+			chunk_left = chunk_size;
+			break;
+		} else if(!memcmp(chunk_head+4, "PLTE", 4) && chunk_size <= 768 && chunk_size%3 == 0) {
+			unsigned char rgb[768];
+			size_t i;
+
+			if(!previewRead(stream, chunk_size, rgb)) goto PNG_FINAL;
+
+			for(i = 0; i < chunk_size/3; i++)
+				memcpy(palette+i*4, rgb+i*3, 3);
+
+			chunk_size = 0;
+		} else if(!memcmp(chunk_head+4, "tRNS", 4) && color_type == 3 && chunk_size <= 256) {
+			unsigned char alpha[256];
+			size_t i;
+
+			if(!previewRead(stream, chunk_size, alpha)) goto PNG_FINAL;
+
+			for(i = 0; i < chunk_size; i++)
+				palette[i*4+3] = alpha[i];
+
+			has_trns = true;
+			chunk_size = 0;
+		} else if(!memcmp(chunk_head+4, "IEND", 4))
+			goto PNG_FINAL;
+
+		if(!previewSkip(stream, (size_t)chunk_size+4)) goto PNG_FINAL;
+	}
+
+	pass_width = (width+7)/8;
+	pass_height = (height+7)/8;
+	if(!pass_width || !pass_height) goto PNG_FINAL;
+
+	pixel_bytes = (bit_depth*samples+7)/8;
+	row_size = (pass_width*bit_depth*samples+7)/8;
+	raw_size = (row_size+1)*pass_height;
+
+	raw = malloc(raw_size+row_size);
+	if(!raw) goto PNG_FINAL;
+
+	memset(&zs, 0, sizeof(z_stream));
+	if(inflateInit(&zs) != Z_OK) goto PNG_FINAL;
+	zs_init = true;
+
+	// Inflate only first pass, the rest of IDAT is never read
+	zs.next_out = raw;
+	zs.avail_out = (uInt)raw_size;
+
+	while(zs.avail_out) {
+		unsigned char in[PREVIEW_BUF_SIZE];
+		size_t in_size;
+		int z_result;
+
+		while(!chunk_left) { // Next IDAT
+			unsigned char chunk_head[8];
+
+			if(!previewSkip(stream, 4)) goto PNG_FINAL;
+			if(!previewRead(stream, 8, chunk_head)) goto PNG_FINAL;
+			if(memcmp(chunk_head+4, "IDAT", 4)) goto PNG_FINAL;
+
+			chunk_left = previewBe32(chunk_head);
+		}
+
+		in_size = (chunk_left < 256)?chunk_left:256; // Small steps, to stop right after pass
+		if(!previewRead(stream, in_size, in)) goto PNG_FINAL;
+		chunk_left -= (uint32_t)in_size;
+
+		zs.next_in = in;
+		zs.avail_in = (uInt)in_size;
+
+		while(zs.avail_in && zs.avail_out) {
+			z_result = inflate(&zs, Z_NO_FLUSH);
+
+			if(z_result == Z_STREAM_END && zs.avail_out) goto PNG_FINAL;
+			if(z_result != Z_OK && z_result != Z_STREAM_END) goto PNG_FINAL;
+		}
+	}
+
+	preview->width = pass_width;
+	preview->height = pass_height;
+	preview->channels = (color_type == 3)?(has_trns?4:3):samples;
+	preview->scale = PREVIEW_SCALE;
+	preview->pixels = malloc(pass_width*pass_height*preview->channels);
+	if(!preview->pixels) goto PNG_FINAL;
+
+	// Zero row before the first one
+	prev_row = raw+raw_size;
+	memset(prev_row, 0, row_size);
+
+	for(y = 0; y < pass_height; y++) {
+		unsigned char filter = raw[y*(row_size+1)];
+
+		row = raw+y*(row_size+1)+1;
+
+		for(x = 0; x < row_size; x++) {
+			int a = (x >= pixel_bytes)?row[x-pixel_bytes]:0, b = prev_row[x], cc = (x >= pixel_bytes)?prev_row[x-pixel_bytes]:0;
+
+			switch(filter) {
+				case 0: break;
+				case 1: row[x] = (unsigned char)(row[x]+a); break;
+				case 2: row[x] = (unsigned char)(row[x]+b); break;
+				case 3: row[x] = (unsigned char)(row[x]+((a+b)>>1)); break;
+				case 4: row[x] = (unsigned char)(row[x]+previewPaeth(a, b, cc)); break;
+				default:
+					free(preview->pixels);
+					preview->pixels = 0;
+					goto PNG_FINAL;
+			}
+		}
+
+		for(x = 0; x < pass_width; x++) {
+			unsigned char *pixel = preview->pixels+(y*pass_width+x)*preview->channels;
+
+			for(c = 0; c < samples; c++) {
+				unsigned int value;
+				size_t sample = x*samples+c;
+
+				if(bit_depth == 16)
+					value = row[sample*2];
+				else if(bit_depth == 8)
+					value = row[sample];
+				else {
+					size_t bit = sample*bit_depth;
+
+					value = (row[bit/8]>>(8-bit_depth-bit%8))&((1u<<bit_depth)-1);
+					if(color_type != 3)
+						value = value*255/((1u<<bit_depth)-1);
+				}
+
+				if(color_type == 3)
+					memcpy(pixel, palette+value*4, preview->channels);
+				else
+					pixel[c] = (unsigned char)value;
+			}
+		}
+
+		prev_row = row;
+	}
+
+	success = true;
+
+PNG_FINAL:
+	if(zs_init) inflateEnd(&zs);
+	free(raw);
+	free(stream);
+
+	return success;
+}
+#endif
+
+// Everything else is decoded fully by stb_image, then scaled down
+
+typedef struct {
+	const fastimage_reader_t *reader;
+	bool eof;
+} preview_stb_context_t;
+
+static int previewStbRead(void *user, char *data, int size)
+{
+	preview_stb_context_t *context = (preview_stb_context_t *)user;
+	size_t read_size;
+
+	read_size = context->reader->read(context->reader->context, (size_t)size, data);
+	if(read_size < (size_t)size) context->eof = true;
+
+	return (int)read_size;
+}
+
+static void previewStbSkip(void *user, int n)
+{
+	preview_stb_context_t *context = (preview_stb_context_t *)user;
+
+	if(!context->reader->seek(context->reader->context, n, true))
+		context->eof = true;
+}
+
+static int previewStbEof(void *user)
+{
+	preview_stb_context_t *context = (preview_stb_context_t *)user;
+
+	return context->eof;
+}
+
+static bool previewDecodeStb(const fastimage_reader_t *reader, fastimage_preview_t *preview)
+{
+	preview_stb_context_t context;
+	stbi_io_callbacks callbacks;
+	int width, height, channels;
+
+	context.reader = reader;
+	context.eof = false;
+
+	callbacks.read = previewStbRead;
+	callbacks.skip = previewStbSkip;
+	callbacks.eof = previewStbEof;
+
+	// Size from header of stb_image itself, then reader is rewound for decode
+	if(!stbi_info_from_callbacks(&callbacks, &context, &width, &height, &channels)) return false;
+	if((uint64_t)width*(uint64_t)height > PREVIEW_MAX_PIXELS) return false;
+	if(!reader->seek(reader->context, 0, false)) return false;
+	context.eof = false;
+
+	preview->pixels = stbi_load_from_callbacks(&callbacks, &context, &width, &height, &channels, 0);
+	if(!preview->pixels) return false;
+
+	preview->width = (size_t)width;
+	preview->height = (size_t)height;
+	preview->channels = (unsigned int)channels;
+	preview->scale = 1;
+
+	return true;
+}
+
+fastimage_preview_t fastimageDecodePreview(const fastimage_reader_t *reader, const fastimage_image_t *image, const fastimage_hints_t *hints, size_t max_side)
+{
+	fastimage_preview_t preview;
+	size_t image_side, width, height;
+	unsigned char *pixels;
+	bool decoded = false;
+
+	memset(&preview, 0, sizeof(fastimage_preview_t));
+
+	if(!max_side || image->format == fastimage_error || image->format == fastimage_unknown) return preview;
+
+	image_side = (image->width > image->height)?image->width:image->height;
+
+	// 1/8 decoders are used only if their result is not smaller than needed
+	if((image_side+PREVIEW_SCALE-1)/PREVIEW_SCALE >= max_side) {
+		if(image->format == fastimage_jpg) {
+			// Tables before SOF are needed, so file is parsed again, unless hints say decoder doesn't support this SOF
+			bool supported = !hints || (hints->jpeg_marker >= 0xC0 && hints->jpeg_marker <= 0xC2 && hints->bitspersample <= 8);
+
+			if(supported && reader->seek(reader->context, 0, false))
+				decoded = jpegDecodeDC(reader, &preview);
+#if defined(FASTIMAGE_USE_ZLIB)
+		} else if(image->format == fastimage_png) {
+			// Signature and IHDR are 33 bytes, probe has already parsed them
+			if(hints) {
+				if((hints->flags&fastimage_hint_interlaced) && reader->seek(reader->context, 33, false))
+					decoded = pngDecodePass1(reader, image, &preview);
+			} else if(reader->seek(reader->context, 0, false))
+				decoded = pngDecodePass1(reader, 0, &preview);
+#endif
+		}
+	}
+
+	if(!decoded) {
+		if(!reader->seek(reader->context, 0, false) || !previewDecodeStb(reader, &preview)) {
+			memset(&preview, 0, sizeof(fastimage_preview_t));
+
+			return preview;
+		}
+	}
+
+	pixels = previewDownscale(preview.pixels, preview.width, preview.height, preview.channels, max_side, &width, &height);
+	if(pixels != preview.pixels) {
+		free(preview.pixels);
+		preview.pixels = pixels;
+		preview.width = width;
+		preview.height = height;
+
+		if(!pixels)
+			memset(&preview, 0, sizeof(fastimage_preview_t));
+	}
+
+	return preview;
+}
+
+void fastimageFreePreview(fastimage_preview_t *preview)
+{
+	if(preview->pixels) free(preview->pixels);
+
+	memset(preview, 0, sizeof(fastimage_preview_t));
+}
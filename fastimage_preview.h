@@ -0,0 +1,55 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FASTIMAGE_PREVIEW_H
+#define FASTIMAGE_PREVIEW_H
+
+#include "fastimage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	unsigned char *pixels; // 8 bits per channel, 0 on error
+	size_t width;
+	size_t height;
+	unsigned int channels;
+	unsigned int scale; // Decoder scale denominator before box downscale (8 for jpeg DC and png pass 1)
+} fastimage_preview_t;
+
+// image is the result of fastimageOpen for the same reader, reader is rewound before decoding.
+// hints (optional) are from the same probe, then its header is not parsed again
+extern fastimage_preview_t fastimageDecodePreview(const fastimage_reader_t *reader, const fastimage_image_t *image, const fastimage_hints_t *hints, size_t max_side);
+extern void fastimageFreePreview(fastimage_preview_t *preview);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,449 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CPython module: fastimage.probe(buffer) over any object with buffer protocol, without copy, and
+// fastimage.probe_many(items, threads=0) over paths and buffers by a pool of threads without GIL
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "fastimage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Record of probe_many, little endian: format, channels, bitsperpixel, palette (u8 each), width, height (u32 each)
+#define PYFASTIMAGE_RECORD_FORMAT "<BBBBII"
+#define PYFASTIMAGE_RECORD_SIZE 12
+
+static PyStructSequence_Field pyfastimage_image_fields[] = {
+	{"format", "Name of format, 'error' or 'unknown' when there is no image"},
+	{"width", 0},
+	{"height", 0},
+	{"channels", 0},
+	{"bitsperpixel", 0},
+	{"palette", "Bits of palette index, 0 without palette"},
+	{0, 0}
+};
+
+static PyStructSequence_Desc pyfastimage_image_desc = {
+	"fastimage.Image",
+	"Result of probe",
+	pyfastimage_image_fields,
+	6
+};
+
+static PyTypeObject *pyfastimage_image_type;
+
+// Path (the whole stream is probed from file) or buffer
+typedef struct {
+	PyObject *path; // bytes of file system encoding, str on Windows
+#if defined(_WIN32)
+	wchar_t *wpath;
+#endif
+	Py_buffer view;
+	bool has_view;
+	fastimage_image_t image;
+} pyfastimage_item_t;
+
+typedef struct {
+	pyfastimage_item_t *items;
+	size_t count;
+	fastimage_options_t options;
+	size_t next;
+#if defined(_WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+} pyfastimage_batch_t;
+
+static bool pyfastimageLevel(int level)
+{
+	if(level == fastimage_level_full || level == fastimage_level_dimensions || level == fastimage_level_format || level == fastimage_level_verify)
+		return true;
+
+	PyErr_SetString(PyExc_ValueError, "unknown level");
+
+	return false;
+}
+
+static PyObject *pyfastimageImage(const fastimage_image_t *image)
+{
+	PyObject *result;
+
+	result = PyStructSequence_New(pyfastimage_image_type);
+	if(!result) return 0;
+
+	PyStructSequence_SET_ITEM(result, 0, PyUnicode_FromString(fastimageFormatName(image->format)));
+	PyStructSequence_SET_ITEM(result, 1, PyLong_FromSize_t(image->width));
+	PyStructSequence_SET_ITEM(result, 2, PyLong_FromSize_t(image->height));
+	PyStructSequence_SET_ITEM(result, 3, PyLong_FromUnsignedLong(image->channels));
+	PyStructSequence_SET_ITEM(result, 4, PyLong_FromUnsignedLong(image->bitsperpixel));
+	PyStructSequence_SET_ITEM(result, 5, PyLong_FromUnsignedLong(image->palette));
+
+	if(PyErr_Occurred()) {
+		Py_DECREF(result);
+
+		return 0;
+	}
+
+	return result;
+}
+
+static PyObject *pyfastimageProbe(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = {"buffer", "level", 0};
+	fastimage_options_t options;
+	fastimage_image_t image;
+	Py_buffer view;
+	int level = fastimage_level_full;
+
+	(void)self; // Unused
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|i:probe", keywords, &view, &level)) return 0;
+
+	if(!pyfastimageLevel(level)) {
+		PyBuffer_Release(&view);
+
+		return 0;
+	}
+
+	memset(&options, 0, sizeof(fastimage_options_t));
+	options.level = level;
+
+	// Exporter can't resize or free memory while view is held
+	Py_BEGIN_ALLOW_THREADS
+	image = fastimageOpenMemoryEx(view.buf, (size_t)view.len, &options);
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&view);
+
+	return pyfastimageImage(&image);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI pyfastimageWorker(void *arg)
+#else
+static void *pyfastimageWorker(void *arg)
+#endif
+{
+	pyfastimage_batch_t *batch = (pyfastimage_batch_t *)arg;
+	pyfastimage_item_t *item;
+	size_t i;
+
+	for(;;) {
+#if defined(_WIN32)
+		EnterCriticalSection(&batch->lock);
+		i = batch->next++;
+		LeaveCriticalSection(&batch->lock);
+#else
+		pthread_mutex_lock(&batch->lock);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+#endif
+
+		if(i >= batch->count) break;
+
+		item = batch->items+i;
+
+		if(item->has_view)
+			item->image = fastimageOpenMemoryEx(item->view.buf, (size_t)item->view.len, &batch->options);
+		else
+#if defined(_WIN32)
+			item->image = fastimageOpenFileExW(item->wpath, &batch->options);
+#else
+			item->image = fastimageOpenFileExA(PyBytes_AS_STRING(item->path), &batch->options);
+#endif
+	}
+
+	return 0;
+}
+
+// Runs without GIL, calling thread is a worker too
+static void pyfastimageRun(pyfastimage_batch_t *batch, size_t threads_num)
+{
+	size_t started = 0, i;
+#if defined(_WIN32)
+	HANDLE *threads;
+#else
+	pthread_t *threads;
+#endif
+
+	if(threads_num > batch->count) threads_num = batch->count;
+
+#if defined(_WIN32)
+	InitializeCriticalSection(&batch->lock);
+	threads = malloc(threads_num*sizeof(HANDLE));
+
+	for(i = 1; threads && i < threads_num; i++) {
+		threads[started] = CreateThread(0, 0, pyfastimageWorker, batch, 0, 0);
+		if(threads[started]) started++;
+	}
+#else
+	pthread_mutex_init(&batch->lock, 0);
+	threads = malloc(threads_num*sizeof(pthread_t));
+
+	for(i = 1; threads && i < threads_num; i++)
+		if(!pthread_create(&threads[started], 0, pyfastimageWorker, batch)) started++;
+#endif
+
+	pyfastimageWorker(batch);
+
+	for(i = 0; i < started; i++) {
+#if defined(_WIN32)
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], 0);
+#endif
+	}
+
+#if defined(_WIN32)
+	DeleteCriticalSection(&batch->lock);
+#else
+	pthread_mutex_destroy(&batch->lock);
+#endif
+
+	free(threads);
+}
+
+static size_t pyfastimageCpus(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+
+	return info.dwNumberOfProcessors?info.dwNumberOfProcessors:1;
+#else
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (cpus > 0)?(size_t)cpus:1;
+#endif
+}
+
+// str and os.PathLike are paths, everything else must have buffer protocol (bytes too)
+static bool pyfastimageItem(PyObject *object, pyfastimage_item_t *item)
+{
+	if(PyUnicode_Check(object) || PyObject_HasAttrString(object, "__fspath__")) {
+#if defined(_WIN32)
+		if(!PyUnicode_FSDecoder(object, &item->path)) return false;
+
+		item->wpath = PyUnicode_AsWideCharString(item->path, 0);
+
+		return item->wpath != 0;
+#else
+		return PyUnicode_FSConverter(object, &item->path) != 0;
+#endif
+	}
+
+	if(PyObject_GetBuffer(object, &item->view, PyBUF_SIMPLE)) return false;
+
+	item->has_view = true;
+
+	return true;
+}
+
+static void pyfastimageItemRelease(pyfastimage_item_t *item)
+{
+	if(item->has_view) PyBuffer_Release(&item->view);
+#if defined(_WIN32)
+	if(item->wpath) PyMem_Free(item->wpath);
+#endif
+	Py_XDECREF(item->path);
+}
+
+static PyObject *pyfastimageProbeMany(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = {"items", "threads", "level", 0};
+	pyfastimage_batch_t batch;
+	PyObject *items, *sequence, *result = 0;
+	unsigned char *record;
+	Py_ssize_t threads = 0, count, i;
+	int level = fastimage_level_full;
+
+	(void)self; // Unused
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ni:probe_many", keywords, &items, &threads, &level)) return 0;
+	if(!pyfastimageLevel(level)) return 0;
+
+	if(threads < 0) {
+		PyErr_SetString(PyExc_ValueError, "threads must be 0 (all processors) or more");
+
+		return 0;
+	}
+
+	sequence = PySequence_Fast(items, "items must be iterable");
+	if(!sequence) return 0;
+
+	count = PySequence_Fast_GET_SIZE(sequence);
+
+	memset(&batch, 0, sizeof(pyfastimage_batch_t));
+	batch.options.level = level;
+
+	batch.items = PyMem_Calloc(count?(size_t)count:1, sizeof(pyfastimage_item_t));
+	if(!batch.items) {
+		PyErr_NoMemory();
+		goto PROBE_MANY_END;
+	}
+
+	// Items are zeroed, so the one that failed is released too
+	for(i = 0; i < count; i++) {
+		batch.count++;
+
+		if(!pyfastimageItem(PySequence_Fast_GET_ITEM(sequence, i), batch.items+i)) goto PROBE_MANY_END;
+	}
+
+	if(!threads) threads = (Py_ssize_t)pyfastimageCpus();
+
+	if(batch.count) {
+		Py_BEGIN_ALLOW_THREADS
+		pyfastimageRun(&batch, (size_t)threads);
+		Py_END_ALLOW_THREADS
+	}
+
+	result = PyBytes_FromStringAndSize(0, count*PYFASTIMAGE_RECORD_SIZE);
+	if(!result) goto PROBE_MANY_END;
+
+	record = (unsigned char *)PyBytes_AS_STRING(result);
+
+	for(i = 0; i < count; i++, record += PYFASTIMAGE_RECORD_SIZE) {
+		const fastimage_image_t *image = &batch.items[i].image;
+		uint32_t width, height;
+
+		// Sizes past 32 bits are only in broken headers
+		width = (image->width > UINT32_MAX)?UINT32_MAX:(uint32_t)image->width;
+		height = (image->height > UINT32_MAX)?UINT32_MAX:(uint32_t)image->height;
+
+		record[0] = (unsigned char)image->format;
+		record[1] = (unsigned char)image->channels;
+		record[2] = (unsigned char)image->bitsperpixel;
+		record[3] = (unsigned char)image->palette;
+		record[4] = (unsigned char)width;
+		record[5] = (unsigned char)(width>>8);
+		record[6] = (unsigned char)(width>>16);
+		record[7] = (unsigned char)(width>>24);
+		record[8] = (unsigned char)height;
+		record[9] = (unsigned char)(height>>8);
+		record[10] = (unsigned char)(height>>16);
+		record[11] = (unsigned char)(height>>24);
+	}
+
+PROBE_MANY_END:
+	if(batch.items) {
+		for(i = 0; i < (Py_ssize_t)batch.count; i++)
+			pyfastimageItemRelease(batch.items+i);
+
+		PyMem_Free(batch.items);
+	}
+
+	Py_DECREF(sequence);
+
+	return result;
+}
+
+static PyMethodDef pyfastimage_methods[] = {
+	{"probe", (PyCFunction)(void (*)(void))pyfastimageProbe, METH_VARARGS|METH_KEYWORDS,
+		"probe(buffer, level=LEVEL_FULL) -> Image\n\nProbes bytes of any object with buffer protocol, without copy and without GIL."},
+	{"probe_many", (PyCFunction)(void (*)(void))pyfastimageProbeMany, METH_VARARGS|METH_KEYWORDS,
+		"probe_many(items, threads=0, level=LEVEL_FULL) -> bytes\n\n"
+		"Probes paths (str or os.PathLike) and buffers by threads (0 means all processors) without GIL.\n"
+		"Returns a record of RECORD_FORMAT for each item in order, format is index in FORMATS.\n"
+		"numpy.frombuffer(result, dtype=RECORD_DTYPE) gives a structured array without copy."},
+	{0, 0, 0, 0}
+};
+
+static struct PyModuleDef pyfastimage_module = {
+	PyModuleDef_HEAD_INIT,
+	"fastimage",
+	"Image size and type from headers",
+	-1,
+	pyfastimage_methods,
+	0, 0, 0, 0
+};
+
+PyMODINIT_FUNC PyInit_fastimage(void);
+
+PyMODINIT_FUNC PyInit_fastimage(void)
+{
+	PyObject *module, *formats, *dtype;
+	size_t i;
+
+	module = PyModule_Create(&pyfastimage_module);
+	if(!module) return 0;
+
+	pyfastimage_image_type = PyStructSequence_NewType(&pyfastimage_image_desc);
+	if(!pyfastimage_image_type) goto INIT_ERROR;
+
+	Py_INCREF(pyfastimage_image_type);
+	if(PyModule_AddObject(module, "Image", (PyObject *)pyfastimage_image_type)) {
+		Py_DECREF(pyfastimage_image_type);
+		goto INIT_ERROR;
+	}
+
+	formats = PyTuple_New(FASTIMAGE_FORMATS_NUM);
+	if(!formats) goto INIT_ERROR;
+
+	for(i = 0; i < FASTIMAGE_FORMATS_NUM; i++)
+		PyTuple_SET_ITEM(formats, i, PyUnicode_FromString(fastimageFormatName((int)i)));
+
+	if(PyErr_Occurred() || PyModule_AddObject(module, "FORMATS", formats)) {
+		Py_DECREF(formats);
+		goto INIT_ERROR;
+	}
+
+	// Fields of record in numpy notation
+	dtype = Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)(ss)]", "format", "u1", "channels", "u1", "bitsperpixel", "u1", "palette", "u1", "width", "<u4", "height", "<u4");
+	if(!dtype || PyModule_AddObject(module, "RECORD_DTYPE", dtype)) {
+		Py_XDECREF(dtype);
+		goto INIT_ERROR;
+	}
+
+	if(PyModule_AddStringConstant(module, "RECORD_FORMAT", PYFASTIMAGE_RECORD_FORMAT)
+		|| PyModule_AddIntConstant(module, "RECORD_SIZE", PYFASTIMAGE_RECORD_SIZE)
+		|| PyModule_AddIntConstant(module, "LEVEL_FULL", fastimage_level_full)
+		|| PyModule_AddIntConstant(module, "LEVEL_DIMENSIONS", fastimage_level_dimensions)
+		|| PyModule_AddIntConstant(module, "LEVEL_FORMAT", fastimage_level_format)
+		|| PyModule_AddIntConstant(module, "LEVEL_VERIFY", fastimage_level_verify))
+		goto INIT_ERROR;
+
+	return module;
+
+INIT_ERROR:
+	Py_DECREF(module);
+
+	return 0;
+}
@@ -0,0 +1,713 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fastimage_s3.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define FASTIMAGE_S3_RANGE_SIZE 16384
+#define FASTIMAGE_S3_CONCURRENCY 16
+// SHA-256 of empty payload
+#define FASTIMAGE_S3_EMPTY_HASH "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t size;
+	unsigned char block[64];
+} fastimage_sha256_t;
+
+static const uint32_t fastimage_sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define FASTIMAGE_ROTR32(x, n) (((x)>>(n))|((x)<<(32-(n))))
+
+static void fastimageSha256Block(fastimage_sha256_t *sha, const unsigned char *p)
+{
+	uint32_t w[64], s[8], t1, t2;
+	int i;
+
+	for(i = 0; i < 16; i++)
+		w[i] = ((uint32_t)p[i*4]<<24)|((uint32_t)p[i*4+1]<<16)|((uint32_t)p[i*4+2]<<8)|p[i*4+3];
+
+	for(i = 16; i < 64; i++)
+		w[i] = w[i-16]+(FASTIMAGE_ROTR32(w[i-15], 7)^FASTIMAGE_ROTR32(w[i-15], 18)^(w[i-15]>>3))+
+			w[i-7]+(FASTIMAGE_ROTR32(w[i-2], 17)^FASTIMAGE_ROTR32(w[i-2], 19)^(w[i-2]>>10));
+
+	memcpy(s, sha->state, sizeof(s));
+
+	for(i = 0; i < 64; i++) {
+		t1 = s[7]+(FASTIMAGE_ROTR32(s[4], 6)^FASTIMAGE_ROTR32(s[4], 11)^FASTIMAGE_ROTR32(s[4], 25))+((s[4]&s[5])^(~s[4]&s[6]))+fastimage_sha256_k[i]+w[i];
+		t2 = (FASTIMAGE_ROTR32(s[0], 2)^FASTIMAGE_ROTR32(s[0], 13)^FASTIMAGE_ROTR32(s[0], 22))+((s[0]&s[1])^(s[0]&s[2])^(s[1]&s[2]));
+
+		memmove(s+1, s, 7*sizeof(uint32_t));
+		s[4] += t1;
+		s[0] = t1+t2;
+	}
+
+	for(i = 0; i < 8; i++)
+		sha->state[i] += s[i];
+}
+
+static void fastimageSha256Init(fastimage_sha256_t *sha)
+{
+	static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+	memcpy(sha->state, init, sizeof(init));
+	sha->size = 0;
+}
+
+static void fastimageSha256Update(fastimage_sha256_t *sha, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	size_t used, part;
+
+	while(size) {
+		used = (size_t)(sha->size&63);
+		part = (size < 64-used)?size:(64-used);
+
+		memcpy(sha->block+used, p, part);
+		sha->size += part;
+		p += part;
+		size -= part;
+
+		if(used+part == 64) fastimageSha256Block(sha, sha->block);
+	}
+}
+
+static void fastimageSha256Final(fastimage_sha256_t *sha, unsigned char *digest)
+{
+	unsigned char tail[8];
+	uint64_t bits = sha->size*8;
+	int i;
+
+	fastimageSha256Update(sha, "\x80", 1);
+	while((sha->size&63) != 56) fastimageSha256Update(sha, "", 1);
+
+	for(i = 0; i < 8; i++)
+		tail[i] = (unsigned char)(bits>>(56-i*8));
+	fastimageSha256Update(sha, tail, 8);
+
+	for(i = 0; i < 32; i++)
+		digest[i] = (unsigned char)(sha->state[i/4]>>(24-(i%4)*8));
+}
+
+static void fastimageHmacSha256(const void *key, size_t key_size, const char *data, unsigned char *mac)
+{
+	fastimage_sha256_t sha;
+	unsigned char pad[64], inner[32];
+	int i;
+
+	// Keys here are never longer than block
+	memset(pad, 0, sizeof(pad));
+	memcpy(pad, key, (key_size > 64)?64:key_size);
+
+	for(i = 0; i < 64; i++) pad[i] ^= 0x36;
+	fastimageSha256Init(&sha);
+	fastimageSha256Update(&sha, pad, 64);
+	fastimageSha256Update(&sha, data, strlen(data));
+	fastimageSha256Final(&sha, inner);
+
+	for(i = 0; i < 64; i++) pad[i] ^= 0x36^0x5c;
+	fastimageSha256Init(&sha);
+	fastimageSha256Update(&sha, pad, 64);
+	fastimageSha256Update(&sha, inner, 32);
+	fastimageSha256Final(&sha, mac);
+}
+
+static void fastimageHex(const unsigned char *data, size_t size, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	size_t i;
+
+	for(i = 0; i < size; i++) {
+		hex[i*2] = digits[data[i]>>4];
+		hex[i*2+1] = digits[data[i]&15];
+	}
+
+	hex[size*2] = 0;
+}
+
+// URI encoding of SigV4, slashes of key are kept
+static size_t fastimageS3Encode(const char *s, char *out)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	size_t size = 0;
+	unsigned char c;
+
+	for(; *s; s++) {
+		c = (unsigned char)*s;
+
+		if((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' || c == '~' || c == '/') {
+			if(out) out[size] = (char)c;
+			size++;
+		} else {
+			if(out) {
+				out[size] = '%';
+				out[size+1] = digits[c>>4];
+				out[size+2] = digits[c&15];
+			}
+			size += 3;
+		}
+	}
+
+	if(out) out[size] = 0;
+
+	return size;
+}
+
+typedef struct {
+	fastimage_s3_t *s3;
+	const fastimage_options_t *options;
+	char *url;
+	char *host;
+	char *path; // Canonical URI
+	unsigned char *window; // Last fetched range
+	size_t window_capacity;
+	size_t window_size;
+	uint64_t window_start;
+	uint64_t object_size;
+	bool size_known;
+	uint64_t pos;
+	uint64_t get_start; // Range of GET in progress
+	size_t get_size;
+	uint64_t received;
+	long status;
+} fastimage_s3_context_t;
+
+static size_t fastimageS3Header(char *buffer, size_t size, size_t nmemb, void *userdata)
+{
+	fastimage_s3_context_t *s3c = (fastimage_s3_context_t *)userdata;
+	size_t length = size*nmemb;
+	unsigned long long total;
+	char line[256], *slash;
+
+	if(length >= sizeof(line)) return length;
+	memcpy(line, buffer, length);
+	line[length] = 0;
+
+	if(!strncmp(line, "HTTP/", 5)) {
+		// New response (after redirect or 100 Continue)
+		s3c->status = 0;
+		s3c->received = 0;
+		sscanf(line, "%*s %ld", &s3c->status);
+	} else if(!strncmp(line, "Content-Range:", 14) || !strncmp(line, "content-range:", 14)) {
+		// "bytes first-last/total" or "bytes */total"
+		slash = strchr(line, '/');
+		if(slash && sscanf(slash+1, "%llu", &total) == 1) {
+			s3c->object_size = total;
+			s3c->size_known = true;
+		}
+	} else if(s3c->status == 200 && (!strncmp(line, "Content-Length:", 15) || !strncmp(line, "content-length:", 15))) {
+		if(sscanf(line+15, "%llu", &total) == 1) {
+			s3c->object_size = total;
+			s3c->size_known = true;
+		}
+	}
+
+	return length;
+}
+
+static size_t fastimageS3Write(void *data, size_t size, size_t nmemb, void *userdata)
+{
+	fastimage_s3_context_t *s3c = (fastimage_s3_context_t *)userdata;
+	size_t length = size*nmemb, skip = 0, part;
+	uint64_t body_start;
+
+	if(s3c->status != 200 && s3c->status != 206) return length;
+
+	// Server without range support sends the whole object
+	body_start = (s3c->status == 206)?s3c->get_start:0;
+
+	if(body_start+s3c->received < s3c->get_start) {
+		skip = (size_t)(s3c->get_start-body_start-s3c->received);
+		if(skip > length) skip = length;
+	}
+
+	s3c->received += length;
+
+	part = length-skip;
+	if(part > s3c->get_size-s3c->window_size) part = s3c->get_size-s3c->window_size;
+
+	memcpy(s3c->window+s3c->window_size, (unsigned char *)data+skip, part);
+	s3c->window_size += part;
+
+	// Rest is not needed, transfer stops
+	return (s3c->window_size == s3c->get_size)?((s3c->status == 206)?length:0):length;
+}
+
+static int fastimageS3Progress(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+	fastimage_s3_context_t *s3c = (fastimage_s3_context_t *)clientp;
+
+	(void)dltotal;
+	(void)dlnow;
+	(void)ultotal;
+	(void)ulnow;
+
+	return (s3c->options && s3c->options->cancel && *s3c->options->cancel)?1:0;
+}
+
+// Fetches size bytes at start into window, fewer at the end of object
+static bool fastimageS3Get(fastimage_s3_context_t *s3c, uint64_t start, size_t size)
+{
+	const fastimage_s3_config_t *config = s3c->s3->config;
+	CURL *curl = (CURL *)s3c->s3->curl;
+	struct curl_slist *headers = 0, *list;
+	fastimage_sha256_t sha;
+	unsigned char hash[32], key[32];
+	char date[9], amz_date[17], range[64], hex[65], secret[256], *canonical, *string_to_sign, *header;
+	const char *region, *signed_headers;
+	size_t header_size;
+	struct tm tm;
+	time_t now;
+	CURLcode result;
+	bool success = false;
+
+	if(size > s3c->window_capacity) {
+		unsigned char *window = realloc(s3c->window, size);
+
+		if(!window) return false;
+
+		s3c->window = window;
+		s3c->window_capacity = size;
+	}
+
+	s3c->window_start = start;
+	s3c->window_size = 0;
+	s3c->get_start = start;
+	s3c->get_size = size;
+	s3c->received = 0;
+	s3c->status = 0;
+
+	now = time(0);
+#if defined(_WIN32)
+	gmtime_s(&tm, &now);
+#else
+	gmtime_r(&now, &tm);
+#endif
+	strftime(date, sizeof(date), "%Y%m%d", &tm);
+	strftime(amz_date, sizeof(amz_date), "%Y%m%dT%H%M%SZ", &tm);
+
+	region = config->region?config->region:"us-east-1";
+	signed_headers = config->session_token?"host;range;x-amz-content-sha256;x-amz-date;x-amz-security-token":"host;range;x-amz-content-sha256;x-amz-date";
+	sprintf(range, "bytes=%llu-%llu", (unsigned long long)start, (unsigned long long)(start+size-1));
+
+	header_size = strlen(s3c->path)+strlen(s3c->host)+(config->session_token?strlen(config->session_token):0)+512;
+	canonical = malloc(header_size);
+	string_to_sign = malloc(header_size);
+	header = malloc(header_size+strlen(config->access_key)+strlen(region));
+	if(!canonical || !string_to_sign || !header || strlen(config->secret_key) > sizeof(secret)-5) goto S3_GET_END;
+
+	// Method, URI, query, headers, signed headers, payload hash
+	sprintf(canonical, "GET\n%s\n\nhost:%s\nrange:%s\nx-amz-content-sha256:%s\nx-amz-date:%s\n%s%s%s\n%s\n%s", s3c->path, s3c->host, range, FASTIMAGE_S3_EMPTY_HASH, amz_date,
+		config->session_token?"x-amz-security-token:":"", config->session_token?config->session_token:"", config->session_token?"\n":"", signed_headers, FASTIMAGE_S3_EMPTY_HASH);
+
+	fastimageSha256Init(&sha);
+	fastimageSha256Update(&sha, canonical, strlen(canonical));
+	fastimageSha256Final(&sha, hash);
+	fastimageHex(hash, 32, hex);
+
+	sprintf(string_to_sign, "AWS4-HMAC-SHA256\n%s\n%s/%s/s3/aws4_request\n%s", amz_date, date, region, hex);
+
+	sprintf(secret, "AWS4%s", config->secret_key);
+	fastimageHmacSha256(secret, strlen(secret), date, key);
+	fastimageHmacSha256(key, 32, region, key);
+	fastimageHmacSha256(key, 32, "s3", key);
+	fastimageHmacSha256(key, 32, "aws4_request", key);
+	fastimageHmacSha256(key, 32, string_to_sign, hash);
+	fastimageHex(hash, 32, hex);
+
+	sprintf(header, "Host: %s", s3c->host);
+	headers = curl_slist_append(headers, header);
+	sprintf(header, "Range: %s", range);
+	headers = curl_slist_append(headers, header);
+	headers = curl_slist_append(headers, "x-amz-content-sha256: " FASTIMAGE_S3_EMPTY_HASH);
+	sprintf(header, "x-amz-date: %s", amz_date);
+	headers = curl_slist_append(headers, header);
+	if(config->session_token) {
+		sprintf(header, "x-amz-security-token: %s", config->session_token);
+		headers = curl_slist_append(headers, header);
+	}
+	sprintf(header, "Authorization: AWS4-HMAC-SHA256 Credential=%s/%s/%s/s3/aws4_request, SignedHeaders=%s, Signature=%s", config->access_key, date, region, signed_headers, hex);
+	list = curl_slist_append(headers, header);
+	if(!list) goto S3_GET_END;
+	headers = list;
+
+	curl_easy_setopt(curl, CURLOPT_URL, s3c->url);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+	result = curl_easy_perform(curl);
+	s3c->s3->requests++;
+	s3c->s3->status = s3c->status;
+
+	// Stopped by us when server ignored range
+	if(result == CURLE_WRITE_ERROR && s3c->window_size == s3c->get_size) result = CURLE_OK;
+
+	if(result == CURLE_OK) {
+		if(s3c->status == 206 || s3c->status == 200) {
+			success = true;
+		} else if(s3c->status == 416) {
+			// Range starts at the end of object
+			success = true;
+			s3c->window_size = 0;
+		}
+	}
+
+S3_GET_END:
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, (struct curl_slist *)0);
+	curl_slist_free_all(headers);
+	free(canonical);
+	free(string_to_sign);
+	free(header);
+
+	return success;
+}
+
+static size_t FASTIMAGE_APIENTRY fastimageS3Read(void *context, size_t size, void *buf)
+{
+	fastimage_s3_context_t *s3c = (fastimage_s3_context_t *)context;
+	uint64_t window_end;
+	size_t want, available;
+
+	if(s3c->size_known && s3c->pos >= s3c->object_size) return 0;
+
+	// Window that reaches the end of object has all there is
+	window_end = s3c->window_start+s3c->window_size;
+	if(s3c->pos < s3c->window_start || s3c->pos >= window_end || (s3c->pos+size > window_end && !(s3c->size_known && window_end >= s3c->object_size))) {
+		want = s3c->s3->config->range_size?s3c->s3->config->range_size:FASTIMAGE_S3_RANGE_SIZE;
+		if(want < size) want = size;
+		if(s3c->size_known && want > s3c->object_size-s3c->pos) want = (size_t)(s3c->object_size-s3c->pos);
+
+		if(!fastimageS3Get(s3c, s3c->pos, want)) return 0;
+	}
+
+	if(s3c->pos < s3c->window_start || s3c->pos >= s3c->window_start+s3c->window_size) return 0;
+
+	available = (size_t)(s3c->window_start+s3c->window_size-s3c->pos);
+	if(size > available) size = available;
+
+	memcpy(buf, s3c->window+(s3c->pos-s3c->window_start), size);
+	s3c->pos += size;
+
+	return size;
+}
+
+static bool FASTIMAGE_APIENTRY fastimageS3Seek(void *context, int64_t pos, bool seek_cur)
+{
+	fastimage_s3_context_t *s3c = (fastimage_s3_context_t *)context;
+
+	if(seek_cur) pos += (int64_t)s3c->pos;
+
+	if(pos < 0 || (s3c->size_known && (uint64_t)pos > s3c->object_size)) return false;
+
+	// Nothing is fetched until next read
+	s3c->pos = (uint64_t)pos;
+
+	return true;
+}
+
+bool fastimageS3Init(fastimage_s3_t *s3, const fastimage_s3_config_t *config)
+{
+	memset(s3, 0, sizeof(fastimage_s3_t));
+
+	if(!config->endpoint || !config->access_key || !config->secret_key) return false;
+
+	s3->config = config;
+	s3->curl = curl_easy_init();
+
+	return s3->curl != 0;
+}
+
+void fastimageS3Close(fastimage_s3_t *s3)
+{
+	if(s3->curl) curl_easy_cleanup((CURL *)s3->curl);
+
+	memset(s3, 0, sizeof(fastimage_s3_t));
+}
+
+// URL and Host header of object, endpoint is "scheme://host[:port][/path]"
+static bool fastimageS3Locate(fastimage_s3_context_t *s3c, const char *bucket, const char *key)
+{
+	const char *endpoint = s3c->s3->config->endpoint, *authority, *base;
+	size_t scheme_size, authority_size, base_size, key_size;
+
+	authority = strstr(endpoint, "://");
+	if(!authority) return false;
+	authority += 3;
+	scheme_size = (size_t)(authority-endpoint);
+
+	base = strchr(authority, '/');
+	if(!base) base = authority+strlen(authority);
+	authority_size = (size_t)(base-authority);
+	base_size = strlen(base);
+	while(base_size && base[base_size-1] == '/') base_size--;
+
+	while(*key == '/') key++;
+	key_size = fastimageS3Encode(key, 0);
+
+	s3c->host = malloc(strlen(bucket)+authority_size+2);
+	s3c->path = malloc(base_size+strlen(bucket)+key_size+3);
+	if(!s3c->host || !s3c->path) return false;
+
+	if(s3c->s3->config->virtual_host) {
+		sprintf(s3c->host, "%s.%.*s", bucket, (int)authority_size, authority);
+		sprintf(s3c->path, "%.*s/", (int)base_size, base);
+	} else {
+		sprintf(s3c->host, "%.*s", (int)authority_size, authority);
+		sprintf(s3c->path, "%.*s/%s/", (int)base_size, base, bucket);
+	}
+
+	fastimageS3Encode(key, s3c->path+strlen(s3c->path));
+
+	s3c->url = malloc(scheme_size+strlen(s3c->host)+strlen(s3c->path)+1);
+	if(!s3c->url) return false;
+
+	sprintf(s3c->url, "%.*s%s%s", (int)scheme_size, endpoint, s3c->host, s3c->path);
+
+	return true;
+}
+
+fastimage_image_t fastimageOpenS3(fastimage_s3_t *s3, const char *bucket, const char *key)
+{
+	return fastimageOpenS3Ex(s3, bucket, key, 0);
+}
+
+fastimage_image_t fastimageOpenS3Ex(fastimage_s3_t *s3, const char *bucket, const char *key, const fastimage_options_t *options)
+{
+	fastimage_s3_context_t context;
+	fastimage_reader_t reader;
+	fastimage_image_t image;
+	CURL *curl = (CURL *)s3->curl;
+	size_t range_size;
+
+	memset(&image, 0, sizeof(fastimage_image_t));
+	image.format = fastimage_error;
+
+	memset(&context, 0, sizeof(fastimage_s3_context_t));
+	context.s3 = s3;
+	context.options = options;
+
+	if(!curl || !fastimageS3Locate(&context, bucket, key)) goto S3_END;
+
+	// Connections are kept by reset
+	curl_easy_reset(curl);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fastimageS3Write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &context);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, fastimageS3Header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &context);
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, "fastimage_c/1.0");
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+	if(options) {
+		if(options->timeout_ms)
+			curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)options->timeout_ms);
+
+		if(options->low_speed_limit && options->low_speed_time) {
+			curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long)options->low_speed_limit);
+			curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)options->low_speed_time);
+		}
+
+		if(options->http_share)
+			curl_easy_setopt(curl, CURLOPT_SHARE, (CURLSH *)options->http_share);
+
+		if(options->cancel) {
+			curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, fastimageS3Progress);
+			curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &context);
+			curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+		}
+	}
+
+	// Prefix is fetched first, it tells size of object too
+	range_size = s3->config->range_size?s3->config->range_size:FASTIMAGE_S3_RANGE_SIZE;
+	if(!fastimageS3Get(&context, 0, range_size)) goto S3_END;
+
+	reader.context = &context;
+	reader.read = fastimageS3Read;
+	reader.seek = fastimageS3Seek;
+
+	if(options) {
+		if(options->fingerprint && options->fingerprint->mode == fastimage_fingerprint_prefix)
+			options->fingerprint->size = context.size_known?context.object_size:0;
+
+		image = fastimageOpenEx(&reader, options);
+	} else
+		image = fastimageOpen(&reader);
+
+S3_END:
+	curl_easy_setopt(curl, CURLOPT_SHARE, (CURLSH *)0);
+	free(context.window);
+	free(context.url);
+	free(context.host);
+	free(context.path);
+
+	return image;
+}
+
+typedef struct {
+	const fastimage_s3_config_t *config;
+	const char *bucket;
+	const char *const *keys;
+	size_t count;
+	fastimage_image_t *images;
+	const fastimage_options_t *options;
+	size_t next;
+#if defined(_WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+} fastimage_s3_batch_t;
+
+#if defined(_WIN32)
+static DWORD WINAPI fastimageS3Worker(void *arg)
+#else
+static void *fastimageS3Worker(void *arg)
+#endif
+{
+	fastimage_s3_batch_t *batch = (fastimage_s3_batch_t *)arg;
+	fastimage_options_t options;
+	fastimage_s3_t s3;
+	size_t i;
+
+	if(batch->options) {
+		// Outputs would be shared by threads
+		options = *batch->options;
+		options.stats = 0;
+		options.fingerprint = 0;
+	}
+
+	if(fastimageS3Init(&s3, batch->config)) {
+		for(;;) {
+#if defined(_WIN32)
+			EnterCriticalSection(&batch->lock);
+			i = batch->next++;
+			LeaveCriticalSection(&batch->lock);
+#else
+			pthread_mutex_lock(&batch->lock);
+			i = batch->next++;
+			pthread_mutex_unlock(&batch->lock);
+#endif
+
+			if(i >= batch->count) break;
+
+			batch->images[i] = fastimageOpenS3Ex(&s3, batch->bucket, batch->keys[i], batch->options?&options:0);
+		}
+
+		fastimageS3Close(&s3);
+	}
+
+	return 0;
+}
+
+void fastimageOpenS3Batch(const fastimage_s3_config_t *config, const char *bucket, const char *const *keys, size_t count, fastimage_image_t *images, const fastimage_options_t *options)
+{
+	fastimage_s3_batch_t batch;
+	size_t threads_num, started = 0, i;
+#if defined(_WIN32)
+	HANDLE *threads;
+#else
+	pthread_t *threads;
+#endif
+
+	for(i = 0; i < count; i++) {
+		memset(&images[i], 0, sizeof(fastimage_image_t));
+		images[i].format = fastimage_error;
+	}
+
+	if(!count) return;
+
+	memset(&batch, 0, sizeof(fastimage_s3_batch_t));
+	batch.config = config;
+	batch.bucket = bucket;
+	batch.keys = keys;
+	batch.count = count;
+	batch.images = images;
+	batch.options = options;
+
+	threads_num = config->concurrency?config->concurrency:FASTIMAGE_S3_CONCURRENCY;
+	if(threads_num > count) threads_num = count;
+
+	// Not thread safe, so before threads
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
+#if defined(_WIN32)
+	InitializeCriticalSection(&batch.lock);
+	threads = malloc(threads_num*sizeof(HANDLE));
+
+	for(i = 1; threads && i < threads_num; i++) {
+		threads[started] = CreateThread(0, 0, fastimageS3Worker, &batch, 0, 0);
+		if(threads[started]) started++;
+	}
+#else
+	pthread_mutex_init(&batch.lock, 0);
+	threads = malloc(threads_num*sizeof(pthread_t));
+
+	for(i = 1; threads && i < threads_num; i++)
+		if(!pthread_create(&threads[started], 0, fastimageS3Worker, &batch)) started++;
+#endif
+
+	// Calling thread is a worker too, it does keys left by threads that failed to start
+	fastimageS3Worker(&batch);
+
+	for(i = 0; i < started; i++) {
+#if defined(_WIN32)
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], 0);
+#endif
+	}
+
+#if defined(_WIN32)
+	DeleteCriticalSection(&batch.lock);
+#else
+	pthread_mutex_destroy(&batch.lock);
+#endif
+
+	free(threads);
+	curl_global_cleanup();
+}
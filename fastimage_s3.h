@@ -0,0 +1,72 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FASTIMAGE_S3_H
+#define FASTIMAGE_S3_H
+
+#include "fastimage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Objects of S3 compatible stores (AWS, MinIO, Ceph...), needs libcurl.
+// Every read outside of last fetched range is a GET with Range header signed by AWS Signature Version 4,
+// seeks cost nothing, so boxes like ISOBMFF mdat are skipped without downloading them.
+
+typedef struct {
+	const char *endpoint; // "https://s3.eu-west-1.amazonaws.com", "http://127.0.0.1:9000"...
+	const char *region; // "us-east-1" when null
+	const char *access_key;
+	const char *secret_key;
+	const char *session_token; // Optional, for temporary credentials
+	bool virtual_host; // bucket.host/key instead of host/bucket/key
+	uint32_t range_size; // Bytes fetched at least by every GET, 0 means 16 KB
+	unsigned int concurrency; // Batch threads, 0 means 16
+} fastimage_s3_config_t;
+
+typedef struct {
+	const fastimage_s3_config_t *config;
+	void *curl; // Kept between objects, so connection stays alive
+	uint64_t requests; // GETs done
+	long status; // HTTP status of last GET
+} fastimage_s3_t;
+
+extern bool fastimageS3Init(fastimage_s3_t *s3, const fastimage_s3_config_t *config);
+extern void fastimageS3Close(fastimage_s3_t *s3);
+extern fastimage_image_t fastimageOpenS3(fastimage_s3_t *s3, const char *bucket, const char *key);
+extern fastimage_image_t fastimageOpenS3Ex(fastimage_s3_t *s3, const char *bucket, const char *key, const fastimage_options_t *options);
+// Keys are probed by config->concurrency threads, each with its own connection.
+// options may be null, their stats and fingerprint are not used
+extern void fastimageOpenS3Batch(const fastimage_s3_config_t *config, const char *bucket, const char *const *keys, size_t count, fastimage_image_t *images, const fastimage_options_t *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
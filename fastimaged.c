@@ -0,0 +1,818 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Probe daemon: many processes share its workers, result cache and http connections. POSIX only
+
+#define _GNU_SOURCE
+
+#include "fastimage.h"
+#include "fastimage_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(FASTIMAGE_USE_LIBCURL)
+#include <curl/curl.h>
+#endif
+
+#define FASTIMAGED_MAX_FDS 16 // Per recvmsg
+#define FASTIMAGED_READ_SIZE 65536
+
+typedef struct fastimaged_conn_s {
+	int socket;
+	bool closed; // Socket is closed, waits for jobs in progress
+	int jobs; // Jobs in queue or in progress
+	unsigned char *in;
+	size_t in_size;
+	unsigned char *out;
+	size_t out_size;
+	int *fds; // Received with SCM_RIGHTS, in order of requests
+	size_t fds_num;
+	struct fastimaged_conn_s *next;
+} fastimaged_conn_t;
+
+typedef struct fastimaged_job_s {
+	fastimaged_conn_t *conn;
+	uint32_t id;
+	int type;
+	int level;
+	int fd;
+	char *payload;
+	struct fastimaged_job_s *next;
+} fastimaged_job_t;
+
+enum fastimaged_cache_kind {
+	fastimaged_cache_free,
+	fastimaged_cache_file,
+	fastimaged_cache_url
+};
+
+typedef struct {
+	int kind;
+	int level;
+	uint64_t hash;
+	// File is the same if all of these match
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	// Url
+	char *url;
+	time_t expires;
+	fastimage_image_t image;
+} fastimaged_cache_entry_t;
+
+static struct {
+	fastimaged_conn_t *conns;
+	fastimaged_job_t *jobs_head;
+	fastimaged_job_t *jobs_tail;
+	pthread_mutex_t lock; // Jobs, conn->jobs, conn->out and conn->closed
+	pthread_cond_t jobs_cond;
+	int wake[2]; // Workers write here when there is output
+	fastimaged_cache_entry_t *cache;
+	size_t cache_size;
+	pthread_mutex_t cache_lock;
+	unsigned int url_ttl;
+	uint32_t timeout_ms;
+	uint64_t max_bytes;
+	void *http_share;
+	volatile sig_atomic_t stop;
+} fastimaged;
+
+#if defined(FASTIMAGE_USE_LIBCURL)
+static pthread_mutex_t fastimaged_share_locks[CURL_LOCK_DATA_LAST];
+
+static void fastimagedShareLock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	(void)handle;
+	(void)access;
+	(void)userptr;
+
+	pthread_mutex_lock(fastimaged_share_locks+data);
+}
+
+static void fastimagedShareUnlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+	(void)handle;
+	(void)userptr;
+
+	pthread_mutex_unlock(fastimaged_share_locks+data);
+}
+
+static void *fastimagedShareInit(void)
+{
+	CURLSH *share;
+	int i;
+
+	for(i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(fastimaged_share_locks+i, 0);
+
+	share = curl_share_init();
+	if(!share) return 0;
+
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, fastimagedShareLock);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, fastimagedShareUnlock);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+	return share;
+}
+#endif
+
+static uint64_t fastimagedHash(const void *data, size_t size, uint64_t hash)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	// FNV-1a
+	for(i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+// Direct mapped, a new entry replaces the old one in the same slot
+static fastimaged_cache_entry_t *fastimagedCacheSlot(uint64_t hash)
+{
+	return fastimaged.cache+hash%fastimaged.cache_size;
+}
+
+static bool fastimagedCacheFindFile(const struct stat *st, int level, uint64_t hash, fastimage_image_t *image)
+{
+	fastimaged_cache_entry_t *entry;
+	bool found = false;
+
+	if(!fastimaged.cache_size) return false;
+
+	pthread_mutex_lock(&fastimaged.cache_lock);
+
+	entry = fastimagedCacheSlot(hash);
+	if(entry->kind == fastimaged_cache_file && entry->hash == hash && entry->level == level && entry->dev == st->st_dev && entry->ino == st->st_ino
+		&& entry->size == st->st_size && entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec) {
+		*image = entry->image;
+		found = true;
+	}
+
+	pthread_mutex_unlock(&fastimaged.cache_lock);
+
+	return found;
+}
+
+static void fastimagedCacheClear(fastimaged_cache_entry_t *entry)
+{
+	if(entry->url) free(entry->url);
+
+	memset(entry, 0, sizeof(fastimaged_cache_entry_t));
+}
+
+static void fastimagedCacheStoreFile(const struct stat *st, int level, uint64_t hash, const fastimage_image_t *image)
+{
+	fastimaged_cache_entry_t *entry;
+
+	if(!fastimaged.cache_size) return;
+
+	pthread_mutex_lock(&fastimaged.cache_lock);
+
+	entry = fastimagedCacheSlot(hash);
+	fastimagedCacheClear(entry);
+
+	entry->kind = fastimaged_cache_file;
+	entry->level = level;
+	entry->hash = hash;
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtim;
+	entry->image = *image;
+
+	pthread_mutex_unlock(&fastimaged.cache_lock);
+}
+
+static bool fastimagedCacheFindUrl(const char *url, int level, uint64_t hash, fastimage_image_t *image)
+{
+	fastimaged_cache_entry_t *entry;
+	bool found = false;
+
+	if(!fastimaged.cache_size) return false;
+
+	pthread_mutex_lock(&fastimaged.cache_lock);
+
+	entry = fastimagedCacheSlot(hash);
+	if(entry->kind == fastimaged_cache_url && entry->hash == hash && entry->level == level && !strcmp(entry->url, url)) {
+		if(entry->expires > time(0)) {
+			*image = entry->image;
+			found = true;
+		} else
+			fastimagedCacheClear(entry);
+	}
+
+	pthread_mutex_unlock(&fastimaged.cache_lock);
+
+	return found;
+}
+
+static void fastimagedCacheStoreUrl(const char *url, int level, uint64_t hash, const fastimage_image_t *image)
+{
+	fastimaged_cache_entry_t *entry;
+	char *url_copy;
+
+	if(!fastimaged.cache_size || !fastimaged.url_ttl) return;
+
+	url_copy = strdup(url);
+	if(!url_copy) return;
+
+	pthread_mutex_lock(&fastimaged.cache_lock);
+
+	entry = fastimagedCacheSlot(hash);
+	fastimagedCacheClear(entry);
+
+	entry->kind = fastimaged_cache_url;
+	entry->level = level;
+	entry->hash = hash;
+	entry->url = url_copy;
+	entry->expires = time(0)+fastimaged.url_ttl;
+	entry->image = *image;
+
+	pthread_mutex_unlock(&fastimaged.cache_lock);
+}
+
+static void fastimagedOptions(fastimage_options_t *options, int level)
+{
+	memset(options, 0, sizeof(fastimage_options_t));
+
+	options->level = level;
+	options->timeout_ms = fastimaged.timeout_ms;
+	options->max_bytes = fastimaged.max_bytes;
+	options->http_share = fastimaged.http_share;
+}
+
+static fastimage_image_t fastimagedProbeFd(int fd, int level)
+{
+	fastimage_image_t image;
+	fastimage_options_t options;
+	struct stat st;
+	uint64_t hash;
+
+	fastimagedOptions(&options, level);
+
+	// Not a regular file can't be cached
+	if(fstat(fd, &st) || !S_ISREG(st.st_mode))
+		return fastimageOpenFdEx(fd, 0, 0, &options);
+
+	hash = fastimagedHash(&st.st_dev, sizeof(st.st_dev), 0xcbf29ce484222325ULL);
+	hash = fastimagedHash(&st.st_ino, sizeof(st.st_ino), hash);
+
+	if(fastimagedCacheFindFile(&st, level, hash, &image)) return image;
+
+	image = fastimageOpenFdEx(fd, 0, 0, &options);
+
+	if(image.format != fastimage_error)
+		fastimagedCacheStoreFile(&st, level, hash, &image);
+
+	return image;
+}
+
+static fastimage_image_t fastimagedProbeUrl(const char *url, int level)
+{
+	fastimage_image_t image;
+	fastimage_options_t options;
+	uint64_t hash;
+
+	hash = fastimagedHash(url, strlen(url), 0xcbf29ce484222325ULL);
+
+	if(fastimagedCacheFindUrl(url, level, hash, &image)) return image;
+
+	fastimagedOptions(&options, level);
+
+	image = fastimageOpenHttpExA(url, false, &options);
+
+	// Network errors are not remembered
+	if(image.format != fastimage_error)
+		fastimagedCacheStoreUrl(url, level, hash, &image);
+
+	return image;
+}
+
+static void fastimagedPut32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char)value;
+	p[1] = (unsigned char)(value>>8);
+	p[2] = (unsigned char)(value>>16);
+	p[3] = (unsigned char)(value>>24);
+}
+
+static void fastimagedPut64(unsigned char *p, uint64_t value)
+{
+	fastimagedPut32(p, (uint32_t)value);
+	fastimagedPut32(p+4, (uint32_t)(value>>32));
+}
+
+// Called with fastimaged.lock held
+static void fastimagedRespond(fastimaged_conn_t *conn, uint32_t id, const fastimage_image_t *image)
+{
+	unsigned char *out;
+
+	if(conn->closed) return;
+
+	out = realloc(conn->out, conn->out_size+FASTIMAGE_DAEMON_RESPONSE_SIZE);
+	if(!out) return;
+
+	conn->out = out;
+	out += conn->out_size;
+	conn->out_size += FASTIMAGE_DAEMON_RESPONSE_SIZE;
+
+	fastimagedPut32(out, id);
+	fastimagedPut32(out+4, (uint32_t)image->format);
+	fastimagedPut64(out+8, image->width);
+	fastimagedPut64(out+16, image->height);
+	fastimagedPut32(out+24, image->channels);
+	fastimagedPut32(out+28, image->bitsperpixel);
+	fastimagedPut32(out+32, image->palette);
+}
+
+static void *fastimagedWorker(void *arg)
+{
+	(void)arg;
+
+	while(1) {
+		fastimaged_job_t *job;
+		fastimage_image_t image;
+		struct stat st;
+		char wake = 0;
+
+		pthread_mutex_lock(&fastimaged.lock);
+
+		while(!fastimaged.jobs_head && !fastimaged.stop)
+			pthread_cond_wait(&fastimaged.jobs_cond, &fastimaged.lock);
+
+		if(fastimaged.stop) {
+			pthread_mutex_unlock(&fastimaged.lock);
+
+			break;
+		}
+
+		job = fastimaged.jobs_head;
+		fastimaged.jobs_head = job->next;
+		if(!fastimaged.jobs_head) fastimaged.jobs_tail = 0;
+
+		pthread_mutex_unlock(&fastimaged.lock);
+
+		memset(&image, 0, sizeof(fastimage_image_t));
+		image.format = fastimage_error;
+
+		switch(job->type) {
+			case fastimage_daemon_path:
+				// Open of FIFO without writer and reads of devices would block worker, only regular files are probed
+				job->fd = open(job->payload, O_RDONLY|O_CLOEXEC|O_NONBLOCK);
+				if(job->fd >= 0 && !fstat(job->fd, &st) && S_ISREG(st.st_mode)) image = fastimagedProbeFd(job->fd, job->level);
+				break;
+			case fastimage_daemon_fd:
+				if(job->fd >= 0) image = fastimagedProbeFd(job->fd, job->level);
+				break;
+			case fastimage_daemon_url:
+				image = fastimagedProbeUrl(job->payload, job->level);
+				break;
+		}
+
+		if(job->fd >= 0) close(job->fd);
+		free(job->payload);
+
+		pthread_mutex_lock(&fastimaged.lock);
+		fastimagedRespond(job->conn, job->id, &image);
+		job->conn->jobs--;
+		pthread_mutex_unlock(&fastimaged.lock);
+
+		free(job);
+
+		while(write(fastimaged.wake[1], &wake, 1) < 0 && errno == EINTR);
+	}
+
+	return 0;
+}
+
+// Parses complete requests from conn->in, returns false on protocol error
+static bool fastimagedParse(fastimaged_conn_t *conn)
+{
+	size_t pos = 0;
+	bool success = true;
+
+	while(conn->in_size-pos >= FASTIMAGE_DAEMON_REQUEST_SIZE) {
+		const unsigned char *header = conn->in+pos;
+		fastimaged_job_t *job;
+		size_t payload_size;
+
+		payload_size = (size_t)header[6]|((size_t)header[7]<<8);
+		if(payload_size > FASTIMAGE_DAEMON_MAX_PAYLOAD) {
+			success = false;
+			break;
+		}
+
+		if(conn->in_size-pos < FASTIMAGE_DAEMON_REQUEST_SIZE+payload_size) break;
+
+		job = calloc(1, sizeof(fastimaged_job_t));
+		if(!job) {
+			success = false;
+			break;
+		}
+
+		job->conn = conn;
+		job->id = (uint32_t)header[0]|((uint32_t)header[1]<<8)|((uint32_t)header[2]<<16)|((uint32_t)header[3]<<24);
+		job->type = header[4];
+		job->level = header[5];
+		job->fd = -1;
+
+		if(job->type == fastimage_daemon_path || job->type == fastimage_daemon_url) {
+			job->payload = malloc(payload_size+1);
+			if(!job->payload) {
+				free(job);
+				success = false;
+				break;
+			}
+
+			memcpy(job->payload, header+FASTIMAGE_DAEMON_REQUEST_SIZE, payload_size);
+			job->payload[payload_size] = 0;
+		} else if(job->type == fastimage_daemon_fd && conn->fds_num) {
+			job->fd = conn->fds[0];
+			memmove(conn->fds, conn->fds+1, (conn->fds_num-1)*sizeof(int));
+			conn->fds_num--;
+		}
+
+		if(job->level > fastimage_level_verify) job->level = fastimage_level_full;
+
+		pos += FASTIMAGE_DAEMON_REQUEST_SIZE+payload_size;
+
+		pthread_mutex_lock(&fastimaged.lock);
+
+		conn->jobs++;
+		if(fastimaged.jobs_tail)
+			fastimaged.jobs_tail->next = job;
+		else
+			fastimaged.jobs_head = job;
+		fastimaged.jobs_tail = job;
+
+		pthread_cond_signal(&fastimaged.jobs_cond);
+		pthread_mutex_unlock(&fastimaged.lock);
+	}
+
+	memmove(conn->in, conn->in+pos, conn->in_size-pos);
+	conn->in_size -= pos;
+
+	return success;
+}
+
+static bool fastimagedReceive(fastimaged_conn_t *conn)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(FASTIMAGED_MAX_FDS*sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	unsigned char *in;
+	ssize_t result;
+
+	in = realloc(conn->in, conn->in_size+FASTIMAGED_READ_SIZE);
+	if(!in) return false;
+	conn->in = in;
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	iov.iov_base = conn->in+conn->in_size;
+	iov.iov_len = FASTIMAGED_READ_SIZE;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	result = recvmsg(conn->socket, &msg, MSG_CMSG_CLOEXEC);
+	if(result < 0) return errno == EINTR || errno == EAGAIN;
+	if(!result) return false;
+
+	for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		size_t fds_num, i;
+		int *fds;
+
+		if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+		fds_num = (cmsg->cmsg_len-CMSG_LEN(0))/sizeof(int);
+
+		fds = realloc(conn->fds, (conn->fds_num+fds_num)*sizeof(int));
+		if(!fds) return false;
+		conn->fds = fds;
+
+		for(i = 0; i < fds_num; i++)
+			memcpy(conn->fds+conn->fds_num++, CMSG_DATA(cmsg)+i*sizeof(int), sizeof(int));
+	}
+
+	conn->in_size += (size_t)result;
+
+	return fastimagedParse(conn);
+}
+
+// Called with fastimaged.lock held
+static bool fastimagedSend(fastimaged_conn_t *conn)
+{
+	while(conn->out_size) {
+		ssize_t result;
+
+		result = send(conn->socket, conn->out, conn->out_size, MSG_NOSIGNAL);
+		if(result < 0) return errno == EINTR || errno == EAGAIN;
+
+		memmove(conn->out, conn->out+result, conn->out_size-(size_t)result);
+		conn->out_size -= (size_t)result;
+	}
+
+	return true;
+}
+
+// Called with fastimaged.lock held, conn is freed later if jobs still use it
+static void fastimagedCloseConn(fastimaged_conn_t *conn)
+{
+	size_t i;
+
+	if(conn->closed) return;
+
+	conn->closed = true;
+	close(conn->socket);
+
+	for(i = 0; i < conn->fds_num; i++)
+		close(conn->fds[i]);
+
+	conn->fds_num = 0;
+	conn->out_size = 0;
+}
+
+static void fastimagedStop(int sig)
+{
+	(void)sig;
+
+	fastimaged.stop = 1;
+}
+
+static int fastimagedListen(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	int listener;
+
+	if(strlen(socket_path) >= sizeof(addr.sun_path)) return -1;
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	listener = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+	if(listener < 0) return -1;
+
+	unlink(socket_path);
+
+	if(bind(listener, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) || listen(listener, SOMAXCONN)) {
+		close(listener);
+
+		return -1;
+	}
+
+	return listener;
+}
+
+static void fastimagedUsage(void)
+{
+	printf("fastimaged [-s socket] [-j workers] [-c cache_entries] [-u url_ttl_seconds] [-t timeout_ms] [-b max_bytes]\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *socket_path = FASTIMAGE_DAEMON_SOCKET;
+	struct pollfd *polls = 0;
+	pthread_t *workers;
+	size_t polls_size = 0;
+	int listener, workers_num = 8, i;
+	struct sigaction sa;
+
+	memset(&fastimaged, 0, sizeof(fastimaged));
+	fastimaged.cache_size = 65536;
+	fastimaged.url_ttl = 300;
+	fastimaged.timeout_ms = 10000;
+	fastimaged.max_bytes = 64*1024*1024;
+
+	for(i = 1; i < argc; i++) {
+		if(i+1 < argc && !strcmp(argv[i], "-s"))
+			socket_path = argv[++i];
+		else if(i+1 < argc && !strcmp(argv[i], "-j"))
+			workers_num = atoi(argv[++i]);
+		else if(i+1 < argc && !strcmp(argv[i], "-c"))
+			fastimaged.cache_size = (size_t)strtoull(argv[++i], 0, 10);
+		else if(i+1 < argc && !strcmp(argv[i], "-u"))
+			fastimaged.url_ttl = (unsigned int)strtoul(argv[++i], 0, 10);
+		else if(i+1 < argc && !strcmp(argv[i], "-t"))
+			fastimaged.timeout_ms = (uint32_t)strtoul(argv[++i], 0, 10);
+		else if(i+1 < argc && !strcmp(argv[i], "-b"))
+			fastimaged.max_bytes = strtoull(argv[++i], 0, 10);
+		else {
+			fastimagedUsage();
+
+			return 1;
+		}
+	}
+
+	if(workers_num < 1) workers_num = 1;
+
+	if(fastimaged.cache_size) {
+		fastimaged.cache = calloc(fastimaged.cache_size, sizeof(fastimaged_cache_entry_t));
+		if(!fastimaged.cache) {
+			fprintf(stderr, "Not enough memory for cache\n");
+
+			return 1;
+		}
+	}
+
+#if defined(FASTIMAGE_USE_LIBCURL)
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	fastimaged.http_share = fastimagedShareInit();
+#endif
+
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, 0);
+	sa.sa_handler = fastimagedStop;
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+
+	pthread_mutex_init(&fastimaged.lock, 0);
+	pthread_mutex_init(&fastimaged.cache_lock, 0);
+	pthread_cond_init(&fastimaged.jobs_cond, 0);
+
+	if(pipe2(fastimaged.wake, O_CLOEXEC|O_NONBLOCK)) {
+		perror("pipe");
+
+		return 1;
+	}
+
+	listener = fastimagedListen(socket_path);
+	if(listener < 0) {
+		perror(socket_path);
+
+		return 1;
+	}
+
+	workers = malloc(workers_num*sizeof(pthread_t));
+	if(!workers) return 1;
+
+	for(i = 0; i < workers_num; i++)
+		pthread_create(workers+i, 0, fastimagedWorker, 0);
+
+	while(!fastimaged.stop) {
+		fastimaged_conn_t *conn, **link;
+		size_t polls_num = 2, j;
+		char drain[256];
+
+		pthread_mutex_lock(&fastimaged.lock);
+
+		// Free connections, which are closed and not used by jobs
+		for(link = &fastimaged.conns; *link; ) {
+			conn = *link;
+
+			if(conn->closed && !conn->jobs) {
+				*link = conn->next;
+				free(conn->in);
+				free(conn->out);
+				free(conn->fds);
+				free(conn);
+			} else {
+				if(!conn->closed) polls_num++;
+				link = &conn->next;
+			}
+		}
+
+		if(polls_num > polls_size) {
+			struct pollfd *new_polls;
+
+			new_polls = realloc(polls, polls_num*sizeof(struct pollfd));
+			if(!new_polls) {
+				pthread_mutex_unlock(&fastimaged.lock);
+
+				break;
+			}
+
+			polls = new_polls;
+			polls_size = polls_num;
+		}
+
+		polls[0].fd = listener;
+		polls[0].events = POLLIN;
+		polls[1].fd = fastimaged.wake[0];
+		polls[1].events = POLLIN;
+
+		for(conn = fastimaged.conns, j = 2; conn; conn = conn->next) {
+			if(conn->closed) continue;
+
+			polls[j].fd = conn->socket;
+			polls[j++].events = POLLIN|(conn->out_size?POLLOUT:0);
+		}
+
+		pthread_mutex_unlock(&fastimaged.lock);
+
+		if(poll(polls, polls_num, -1) < 0) {
+			if(errno == EINTR) continue;
+
+			break;
+		}
+
+		if(polls[1].revents)
+			while(read(fastimaged.wake[0], drain, sizeof(drain)) > 0);
+
+		if(polls[0].revents & POLLIN) {
+			int client;
+
+			while((client = accept4(listener, 0, 0, SOCK_CLOEXEC|SOCK_NONBLOCK)) >= 0) {
+				conn = calloc(1, sizeof(fastimaged_conn_t));
+				if(!conn) {
+					close(client);
+					continue;
+				}
+
+				conn->socket = client;
+
+				pthread_mutex_lock(&fastimaged.lock);
+				conn->next = fastimaged.conns;
+				fastimaged.conns = conn;
+				pthread_mutex_unlock(&fastimaged.lock);
+			}
+		}
+
+		// New connections are not in polls yet, sockets are matched by value
+		for(j = 2; j < polls_num; j++) {
+			for(conn = fastimaged.conns; conn; conn = conn->next)
+				if(!conn->closed && conn->socket == polls[j].fd) break;
+
+			if(!conn) continue;
+
+			if((polls[j].revents & (POLLIN|POLLHUP|POLLERR)) && !fastimagedReceive(conn)) {
+				pthread_mutex_lock(&fastimaged.lock);
+				fastimagedCloseConn(conn);
+				pthread_mutex_unlock(&fastimaged.lock);
+			}
+		}
+
+		// Output from workers
+		pthread_mutex_lock(&fastimaged.lock);
+
+		for(conn = fastimaged.conns; conn; conn = conn->next)
+			if(!conn->closed && conn->out_size && !fastimagedSend(conn))
+				fastimagedCloseConn(conn);
+
+		pthread_mutex_unlock(&fastimaged.lock);
+	}
+
+	pthread_mutex_lock(&fastimaged.lock);
+	fastimaged.stop = 1;
+	pthread_cond_broadcast(&fastimaged.jobs_cond);
+	pthread_mutex_unlock(&fastimaged.lock);
+
+	for(i = 0; i < workers_num; i++)
+		pthread_join(workers[i], 0);
+
+	close(listener);
+	unlink(socket_path);
+
+	return 0;
+}
@@ -0,0 +1,431 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Fuzz target of fastimageOpen over memory, with cost bounds. Besides crashes, every probe is checked against
+// bounds of its format: reader calls, bytes read, heap allocations and bytes allocated. Input over a bound is
+// saved to FASTIMAGE_FUZZ_COST_DIR (fuzz-cost by default) as regression corpus, then the target aborts.
+//
+// fastimage.c is included here, so its allocations are counted through macros (like stb_leakcheck does).
+//
+// libFuzzer: clang -g -O1 -fsanitize=fuzzer,address -DFASTIMAGE_USE_ZLIB fuzz.c -lz -o fuzz
+// AFL: afl-clang-fast -O1 -DFASTIMAGE_FUZZ_MAIN -DFASTIMAGE_USE_ZLIB fuzz.c -lz -o fuzz, then afl-fuzz ... -- ./fuzz @@
+// Regression: make fuzz, then ./fuzz [-v] [-k] file_or_dir... (fuzz-cost and other corpora, stdin without arguments)
+
+// Same as fastimage.c, system headers are included here first
+#if !defined(_WIN32)
+#define _LARGEFILE_SOURCE
+#define _LARGEFILE64_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+static uint64_t fuzz_allocs;
+static uint64_t fuzz_heap;
+
+static void *fuzzMalloc(size_t size)
+{
+	fuzz_allocs++;
+	fuzz_heap += size;
+
+	return malloc(size);
+}
+
+static void *fuzzRealloc(void *p, size_t size)
+{
+	fuzz_allocs++;
+	fuzz_heap += size;
+
+	return realloc(p, size);
+}
+
+#define malloc(size) fuzzMalloc(size)
+#define realloc(p, size) fuzzRealloc(p, size)
+
+#include "fastimage.c"
+
+#undef malloc
+#undef realloc
+
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+	size_t offset;
+	uint64_t calls;
+	uint64_t bytes;
+} fuzz_stream_t;
+
+typedef struct {
+	uint64_t calls; // Reads and seeks
+	uint64_t bytes;
+	uint64_t allocs;
+	uint64_t heap;
+} fuzz_cost_t;
+
+// Bound is base plus per KB of input for formats that walk their structure.
+// Structure is walked through header cursor on the stack, which reads ahead after FASTIMAGE_CURSOR_CALLS calls,
+// so a long walk costs a read and a seek per block, not per segment or box
+typedef struct {
+	int format;
+	uint32_t calls;
+	uint32_t calls_per_kb;
+	uint32_t bytes; // Besides the input itself when bytes_input is set
+	bool bytes_input;
+	uint32_t allocs;
+	uint32_t heap; // Besides twice the input when heap_input is set
+	bool heap_input;
+} fuzz_bound_t;
+
+#define FUZZ_VERIFY_HEAP ((uint32_t)sizeof(fastimage_verify_t))
+#define FUZZ_EOF_CALLS 17 // Reads of verify level are halved down to a byte at the end of stream
+#define FUZZ_CURSOR_CALLS (FASTIMAGE_CURSOR_CALLS+2) // Read ahead is tried once more without it at the end of stream
+#define FUZZ_INFLATE_HEAP 65536 // Inflate context, zlib state and window
+
+// Headers of fixed size
+static const fuzz_bound_t fuzz_default_bound = {fastimage_unknown, 8, 0, 4096, false, 0, 0, false};
+
+static const fuzz_bound_t fuzz_bounds[] = {
+	{fastimage_unknown, 96+FUZZ_EOF_CALLS+FUZZ_CURSOR_CALLS, 4, 4096, true, 48, FUZZ_INFLATE_HEAP, true}, // Text or gzip sniffed for SVG, then ISOBMFF detection and boxes of video
+	{fastimage_png, 8+FUZZ_CURSOR_CALLS, 4, 0, true, 0, 0, false}, // Chunk headers up to IDAT with hints
+	{fastimage_gif, 8+FUZZ_CURSOR_CALLS, 4, 0, true, 0, 0, false},
+	{fastimage_webp, 8, 0, 4096, false, 0, 0, false},
+	{fastimage_heic, 80, 0, 0, true, 40, 0, true}, // Top level boxes up to meta, meta grows by chunks
+	{fastimage_avif, 80, 0, 0, true, 40, 0, true},
+	{fastimage_miaf, 80, 0, 0, true, 40, 0, true},
+	{fastimage_jpg, 8+FUZZ_CURSOR_CALLS, 4, 0, true, 0, 0, false},
+	{fastimage_svg, 16+FUZZ_EOF_CALLS, 1, 4096, true, 8, FUZZ_INFLATE_HEAP, true}, // Root element, inflated for svgz
+	{fastimage_exr, 8, 4, 0, true, 1, EXR_CHLIST_MAX, false}, // Text and attribute headers are read ahead from the start
+	{fastimage_hdr, 8, 3, 0, true, 0, 0, false},
+	{fastimage_pnm, 8, 3, 16, true, 0, 0, false}, // Signature is read again by header
+	{fastimage_mp4, 8+FUZZ_CURSOR_CALLS, 4, 8, true, 0, 0, false}, // moov may be after mdat, QuickTime atom is read again after detection
+	{fastimage_mov, 8+FUZZ_CURSOR_CALLS, 4, 8, true, 0, 0, false},
+	{fastimage_mkv, 8+FUZZ_CURSOR_CALLS, 4, 0, true, 0, 0, false},
+	{fastimage_webm, 8+FUZZ_CURSOR_CALLS, 4, 0, true, 0, 0, false}
+};
+
+static bool fuzz_verbose;
+static bool fuzz_abort = true;
+static int fuzz_failures;
+
+static size_t FASTIMAGE_APIENTRY fuzzRead(void *context, size_t size, void *buf)
+{
+	fuzz_stream_t *stream = context;
+
+	stream->calls++;
+
+	if(size > stream->size-stream->offset) size = stream->size-stream->offset;
+
+	memcpy(buf, stream->data+stream->offset, size);
+	stream->offset += size;
+	stream->bytes += size;
+
+	return size;
+}
+
+static bool FASTIMAGE_APIENTRY fuzzSeek(void *context, int64_t pos, bool seek_cur)
+{
+	fuzz_stream_t *stream = context;
+
+	stream->calls++;
+
+	if(seek_cur) pos += (int64_t)stream->offset;
+
+	if(pos < 0 || (uint64_t)pos > stream->size) return false;
+
+	stream->offset = (size_t)pos;
+
+	return true;
+}
+
+static const fuzz_bound_t *fuzzBound(int format)
+{
+	size_t i;
+
+	for(i = 0; i < sizeof(fuzz_bounds)/sizeof(fuzz_bounds[0]); i++)
+		if(fuzz_bounds[i].format == format) return fuzz_bounds+i;
+
+	return &fuzz_default_bound;
+}
+
+// Input is saved under name of its format and hash, so the same input is saved once
+static void fuzzSave(const unsigned char *data, size_t size, int format)
+{
+	fastimage_xxh64_t state;
+	const char *dir;
+	char path[4096];
+	FILE *f;
+
+	dir = getenv("FASTIMAGE_FUZZ_COST_DIR");
+	if(!dir) dir = "fuzz-cost";
+
+#if defined(_WIN32)
+	_mkdir(dir);
+#else
+	mkdir(dir, 0755);
+#endif
+
+	fastimageXxh64Init(&state);
+	fastimageXxh64Update(&state, data, size);
+
+	snprintf(path, sizeof(path), "%s/%s-%016llx", dir, fastimageFormatName(format), (unsigned long long)fastimageXxh64Digest(&state));
+
+	f = fopen(path, "wb");
+	if(!f) return;
+
+	fwrite(data, 1, size, f);
+	fclose(f);
+
+	fprintf(stderr, "saved %s\n", path);
+}
+
+static void fuzzProbe(const unsigned char *data, size_t size, int level, const char *name)
+{
+	fuzz_stream_t stream;
+	fastimage_reader_t reader;
+	fastimage_options_t options;
+	fastimage_hints_t hints;
+	fastimage_image_t image;
+	const fuzz_bound_t *bound;
+	fuzz_cost_t cost, limit;
+	unsigned char sign[4];
+	int format;
+
+	memset(&stream, 0, sizeof(fuzz_stream_t));
+	stream.data = data;
+	stream.size = size;
+
+	reader.context = &stream;
+	reader.read = fuzzRead;
+	reader.seek = fuzzSeek;
+
+	memset(&options, 0, sizeof(fastimage_options_t));
+	options.level = level;
+	options.hints = &hints;
+
+	fuzz_allocs = 0;
+	fuzz_heap = 0;
+
+	image = fastimageOpenEx(&reader, &options);
+
+	cost.calls = stream.calls;
+	cost.bytes = stream.bytes;
+	cost.allocs = fuzz_allocs;
+	cost.heap = fuzz_heap;
+
+	// Broken files are charged to format of signature
+	format = image.format;
+	if(format == fastimage_error || format == fastimage_unknown) {
+		memset(sign, 0, 4);
+		memcpy(sign, data, (size < 4)?size:4);
+
+		format = fastimageMatchSign(sign);
+		if(format == fastimage_pnm && !fastimagePnmSign(sign))
+			format = fastimage_unknown;
+	}
+
+	bound = fuzzBound(format);
+
+	limit.calls = bound->calls+bound->calls_per_kb*(uint64_t)(size/1024+1);
+	limit.bytes = bound->bytes+(bound->bytes_input?size:0);
+	limit.allocs = bound->allocs;
+	limit.heap = bound->heap+(bound->heap_input?2*(uint64_t)size+ISOBMFF_META_CHUNK:0);
+
+	// Verify level reads the whole stream once more and checks it
+	if(level == fastimage_level_verify) {
+		limit.calls += size/FASTIMAGE_VERIFY_BLOCK+FUZZ_EOF_CALLS+8;
+		limit.bytes += size;
+		limit.allocs += 1;
+		limit.heap += FUZZ_VERIFY_HEAP;
+	}
+
+	if(fuzz_verbose)
+		printf("%s level %d %s: calls %llu/%llu, bytes %llu/%llu, allocs %llu/%llu, heap %llu/%llu\n", name, level,
+			fastimageFormatName(format),
+			(unsigned long long)cost.calls, (unsigned long long)limit.calls, (unsigned long long)cost.bytes, (unsigned long long)limit.bytes,
+			(unsigned long long)cost.allocs, (unsigned long long)limit.allocs, (unsigned long long)cost.heap, (unsigned long long)limit.heap);
+
+	if(cost.calls <= limit.calls && cost.bytes <= limit.bytes && cost.allocs <= limit.allocs && cost.heap <= limit.heap) return;
+
+	fprintf(stderr, "%s: cost bound of %s is broken at level %d: calls %llu/%llu, bytes %llu/%llu, allocs %llu/%llu, heap %llu/%llu\n", name,
+		fastimageFormatName(format), level,
+		(unsigned long long)cost.calls, (unsigned long long)limit.calls, (unsigned long long)cost.bytes, (unsigned long long)limit.bytes,
+		(unsigned long long)cost.allocs, (unsigned long long)limit.allocs, (unsigned long long)cost.heap, (unsigned long long)limit.heap);
+
+	fuzzSave(data, size, format);
+	fuzz_failures++;
+
+	if(fuzz_abort) abort();
+}
+
+static void fuzzRun(const unsigned char *data, size_t size, const char *name)
+{
+	fuzzProbe(data, size, fastimage_level_format, name);
+	fuzzProbe(data, size, fastimage_level_full, name);
+	fuzzProbe(data, size, fastimage_level_verify, name);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	fuzzRun(data, size, "input");
+
+	return 0;
+}
+
+#if defined(FASTIMAGE_FUZZ_MAIN)
+static unsigned char *fuzzReadAll(FILE *f, size_t *size)
+{
+	unsigned char *data = 0, *grown;
+	size_t capacity = 0, got;
+
+	*size = 0;
+
+	while(1) {
+		if(*size == capacity) {
+			capacity = capacity?capacity*2:65536;
+
+			grown = realloc(data, capacity);
+			if(!grown) {
+				free(data);
+
+				return 0;
+			}
+
+			data = grown;
+		}
+
+		got = fread(data+*size, 1, capacity-*size, f);
+		if(!got) break;
+
+		*size += got;
+	}
+
+	return data;
+}
+
+static void fuzzFile(const char *path)
+{
+	unsigned char *data;
+	size_t size;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if(!f) {
+		fprintf(stderr, "can't read %s\n", path);
+
+		return;
+	}
+
+	data = fuzzReadAll(f, &size);
+	fclose(f);
+
+	if(data) fuzzRun(data, size, path);
+
+	free(data);
+}
+
+static void fuzzPath(const char *path)
+{
+#if defined(_WIN32)
+	fuzzFile(path);
+#else
+	struct stat st;
+	struct dirent *entry;
+	DIR *dir;
+
+	if(stat(path, &st) || !S_ISDIR(st.st_mode)) {
+		fuzzFile(path);
+
+		return;
+	}
+
+	dir = opendir(path);
+	if(!dir) return;
+
+	while((entry = readdir(dir)) != 0) {
+		char *child;
+
+		if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+
+		child = malloc(strlen(path)+strlen(entry->d_name)+2);
+		if(!child) break;
+		sprintf(child, "%s/%s", path, entry->d_name);
+		fuzzPath(child);
+		free(child);
+	}
+
+	closedir(dir);
+#endif
+}
+
+// Files and directories, or stdin. -k keeps going after a broken bound, -v prints every cost
+int main(int argc, char **argv)
+{
+	unsigned char *data;
+	size_t size;
+	int arg, paths = 0;
+
+	for(arg = 1; arg < argc; arg++) {
+		if(!strcmp(argv[arg], "-v"))
+			fuzz_verbose = true;
+		else if(!strcmp(argv[arg], "-k"))
+			fuzz_abort = false;
+		else {
+			fuzzPath(argv[arg]);
+			paths++;
+		}
+	}
+
+	if(!paths) {
+		data = fuzzReadAll(stdin, &size);
+		if(data) fuzzRun(data, size, "stdin");
+
+		free(data);
+	}
+
+	if(fuzz_failures) {
+		printf("%d probes over bounds\n", fuzz_failures);
+
+		return 1;
+	}
+
+	return 0;
+}
+#endif
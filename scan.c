@@ -0,0 +1,747 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Scans directories into columnar index and queries it
+
+#if !defined(_WIN32)
+#define _LARGEFILE_SOURCE
+#define _LARGEFILE64_SOURCE
+#endif
+
+#include "fastimage.h"
+#include "fastimage_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#if defined(__linux__)
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#define SCAN_QUERY_ROWS 4096
+#define SCAN_WATCH_EVENTS (IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR|IN_DONT_FOLLOW)
+
+typedef struct {
+	fastimage_index_writer_t writer;
+	uint64_t files;
+	uint64_t images;
+} scan_state_t;
+
+static int scanFormatByName(const char *name)
+{
+	int i;
+
+	for(i = 0; i < FASTIMAGE_FORMATS_NUM; i++)
+		if(!strcmp(fastimageFormatName(i), name)) return i;
+
+	return -2;
+}
+
+static void scanFile(scan_state_t *state, const char *path, uint64_t parent, uint64_t size, int64_t mtime)
+{
+	fastimage_image_t image;
+
+	image = fastimageOpenFileA(path);
+
+	state->files++;
+	if(image.format != fastimage_error && image.format != fastimage_unknown) state->images++;
+
+	if(!fastimageIndexAdd(&state->writer, path, parent, 0, size, mtime, &image))
+		fprintf(stderr, "can't write %s to index\n", path);
+}
+
+#if !defined(_WIN32)
+// Child path, separators at end of path are not repeated
+static char *scanJoin(const char *path, const char *name)
+{
+	size_t path_len;
+	char *child;
+
+	path_len = strlen(path);
+	while(path_len > 1 && path[path_len-1] == '/') path_len--;
+
+	child = malloc(path_len+strlen(name)+2);
+	if(child) sprintf(child, "%.*s/%s", (int)path_len, path, name);
+
+	return child;
+}
+#endif
+
+static void scanPath(scan_state_t *state, const char *path, uint64_t parent)
+{
+	uint64_t row;
+
+#if defined(_WIN32)
+	WIN32_FIND_DATAA find_data;
+	HANDLE find;
+	struct _stati64 st;
+	char *pattern;
+
+	if(_stati64(path, &st)) {
+		fprintf(stderr, "can't stat %s\n", path);
+
+		return;
+	}
+
+	if(!(st.st_mode & _S_IFDIR)) {
+		scanFile(state, path, parent, (uint64_t)st.st_size, (int64_t)st.st_mtime);
+
+		return;
+	}
+
+	row = state->writer.count;
+	if(!fastimageIndexAdd(&state->writer, path, parent, fastimage_index_directory, 0, (int64_t)st.st_mtime, 0)) return;
+
+	pattern = malloc(strlen(path)+3);
+	if(!pattern) return;
+	sprintf(pattern, "%s\\*", path);
+
+	find = FindFirstFileA(pattern, &find_data);
+	free(pattern);
+	if(find == INVALID_HANDLE_VALUE) return;
+
+	do {
+		char *child;
+
+		if(!strcmp(find_data.cFileName, ".") || !strcmp(find_data.cFileName, "..")) continue;
+
+		child = malloc(strlen(path)+strlen(find_data.cFileName)+2);
+		if(!child) break;
+		sprintf(child, "%s\\%s", path, find_data.cFileName);
+		scanPath(state, child, row);
+		free(child);
+	} while(FindNextFileA(find, &find_data));
+
+	FindClose(find);
+#else
+	struct stat st;
+	struct dirent *entry;
+	DIR *dir;
+
+	// Symbolic links are not followed, so loops are not possible
+	if(lstat(path, &st)) {
+		fprintf(stderr, "can't stat %s\n", path);
+
+		return;
+	}
+
+	if(S_ISREG(st.st_mode)) {
+		scanFile(state, path, parent, (uint64_t)st.st_size, (int64_t)st.st_mtime);
+
+		return;
+	}
+
+	if(!S_ISDIR(st.st_mode)) return;
+
+	row = state->writer.count;
+	if(!fastimageIndexAdd(&state->writer, path, parent, fastimage_index_directory, 0, (int64_t)st.st_mtime, 0)) return;
+
+	dir = opendir(path);
+	if(!dir) return;
+
+	while((entry = readdir(dir)) != 0) {
+		char *child;
+
+		if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+
+		child = scanJoin(path, entry->d_name);
+		if(!child) break;
+		scanPath(state, child, row);
+		free(child);
+	}
+
+	closedir(dir);
+#endif
+}
+
+#if !defined(_WIN32)
+typedef struct {
+	fastimage_index_t index;
+	const char *filename;
+	uint64_t *table; // Row+1 by hash of path, zero is free
+	uint64_t table_size;
+	uint64_t *first_child;
+	uint64_t *next_sibling;
+	uint64_t files;
+	uint64_t removed;
+	bool failed;
+#if defined(__linux__)
+	int inotify;
+	uint64_t *watches; // Directory row by watch descriptor
+	size_t watches_size;
+#endif
+} scan_update_t;
+
+static uint64_t scanHash(const char *path)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	while(*path) {
+		hash ^= (unsigned char)*path++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t scanUpdateFind(const scan_update_t *update, const char *path)
+{
+	uint64_t slot, row;
+
+	slot = scanHash(path)&(update->table_size-1);
+
+	while((row = update->table[slot]) != 0) {
+		if(!strcmp(fastimageIndexGetPath(&update->index, row-1), path)) return row-1;
+
+		slot = (slot+1)&(update->table_size-1);
+	}
+
+	return FASTIMAGE_INDEX_NO_ROW;
+}
+
+static void scanUpdateLinkRow(scan_update_t *update, uint64_t row)
+{
+	uint64_t slot, parent;
+
+	slot = scanHash(fastimageIndexGetPath(&update->index, row))&(update->table_size-1);
+	while(update->table[slot]) slot = (slot+1)&(update->table_size-1);
+	update->table[slot] = row+1;
+
+	update->first_child[row] = FASTIMAGE_INDEX_NO_ROW;
+	update->next_sibling[row] = FASTIMAGE_INDEX_NO_ROW;
+
+	parent = update->index.parent[row];
+	if(parent < row) {
+		update->next_sibling[row] = update->first_child[parent];
+		update->first_child[parent] = row;
+	}
+}
+
+// Path lookup and children of every row, sized for capacity of index
+static bool scanUpdateLink(scan_update_t *update)
+{
+	uint64_t capacity, row, *first_child, *next_sibling;
+
+	capacity = update->index.capacity?update->index.capacity:1;
+
+	update->table_size = 1;
+	while(update->table_size < capacity*2) update->table_size <<= 1;
+
+	free(update->table);
+	update->table = calloc((size_t)update->table_size, sizeof(uint64_t));
+
+	first_child = realloc(update->first_child, (size_t)capacity*sizeof(uint64_t));
+	if(first_child) update->first_child = first_child;
+	next_sibling = realloc(update->next_sibling, (size_t)capacity*sizeof(uint64_t));
+	if(next_sibling) update->next_sibling = next_sibling;
+
+	if(!update->table || !first_child || !next_sibling) return false;
+
+	for(row = 0; row < update->index.count; row++)
+		scanUpdateLinkRow(update, row);
+
+	return true;
+}
+
+// Row of path is reused when it exists, even deleted, so rows of paths never change
+static uint64_t scanUpdatePut(scan_update_t *update, const char *path, uint64_t parent, unsigned int flags, uint64_t size, int64_t mtime, const fastimage_image_t *image)
+{
+	uint64_t row;
+
+	row = scanUpdateFind(update, path);
+	if(row != FASTIMAGE_INDEX_NO_ROW) {
+		fastimageIndexSet(&update->index, row, flags, size, mtime, image);
+
+		return row;
+	}
+
+	if(!fastimageIndexAppend(&update->index, path, parent, flags, size, mtime, image)) {
+		// Reserved space is doubled
+		if(!fastimageIndexGrow(&update->index, update->filename, update->index.count+1024, update->index.heap_size+strlen(path)+65536) || !scanUpdateLink(update) ||
+		   !fastimageIndexAppend(&update->index, path, parent, flags, size, mtime, image)) {
+			fprintf(stderr, "can't grow %s\n", update->filename);
+			update->failed = true;
+
+			return FASTIMAGE_INDEX_NO_ROW;
+		}
+	}
+
+	row = update->index.count-1;
+	scanUpdateLinkRow(update, row);
+
+	return row;
+}
+
+static void scanUpdateRemove(scan_update_t *update, uint64_t row)
+{
+	uint64_t child;
+
+	if(update->index.flags[row] & fastimage_index_deleted) return;
+
+	update->index.flags[row] |= fastimage_index_deleted;
+	update->removed++;
+
+	for(child = update->first_child[row]; child != FASTIMAGE_INDEX_NO_ROW; child = update->next_sibling[child])
+		scanUpdateRemove(update, child);
+}
+
+static void scanUpdateWatch(scan_update_t *update, const char *path, uint64_t row)
+{
+#if defined(__linux__)
+	int wd;
+
+	if(update->inotify < 0) return;
+
+	// Limited by fs.inotify.max_user_watches
+	wd = inotify_add_watch(update->inotify, path, SCAN_WATCH_EVENTS);
+	if(wd < 0) {
+		fprintf(stderr, "can't watch %s\n", path);
+
+		return;
+	}
+
+	if((size_t)wd >= update->watches_size) {
+		size_t size = update->watches_size?update->watches_size*2:1024, i;
+		uint64_t *watches;
+
+		while(size <= (size_t)wd) size *= 2;
+
+		watches = realloc(update->watches, size*sizeof(uint64_t));
+		if(!watches) return;
+
+		for(i = update->watches_size; i < size; i++)
+			watches[i] = FASTIMAGE_INDEX_NO_ROW;
+
+		update->watches = watches;
+		update->watches_size = size;
+	}
+
+	update->watches[wd] = row;
+#else
+	(void)update;
+	(void)path;
+	(void)row;
+#endif
+}
+
+static void scanUpdatePath(scan_update_t *update, const char *path, uint64_t parent);
+
+// New and changed entries of directory, known subdirectories are checked through their own rows
+static void scanUpdateDirectory(scan_update_t *update, const char *path, uint64_t row)
+{
+	struct dirent *entry;
+	struct stat st;
+	uint64_t child;
+	DIR *dir;
+
+	dir = opendir(path);
+	if(!dir) return;
+
+	while((entry = readdir(dir)) != 0 && !update->failed) {
+		char *child_path;
+
+		if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+
+		child_path = scanJoin(path, entry->d_name);
+		if(!child_path) break;
+		scanUpdatePath(update, child_path, row);
+		free(child_path);
+	}
+
+	closedir(dir);
+
+	// Entries which are gone
+	for(child = update->first_child[row]; child != FASTIMAGE_INDEX_NO_ROW && !update->failed; child = update->next_sibling[child]) {
+		if(update->index.flags[child] & fastimage_index_deleted) continue;
+
+		if(lstat(fastimageIndexGetPath(&update->index, child), &st)) scanUpdateRemove(update, child);
+	}
+}
+
+static void scanUpdatePath(scan_update_t *update, const char *path, uint64_t parent)
+{
+	fastimage_image_t image;
+	struct stat st;
+	uint64_t row;
+
+	row = scanUpdateFind(update, path);
+
+	if(lstat(path, &st) || (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))) {
+		if(row != FASTIMAGE_INDEX_NO_ROW) scanUpdateRemove(update, row);
+
+		return;
+	}
+
+	if(row != FASTIMAGE_INDEX_NO_ROW && (update->index.flags[row]&(fastimage_index_directory|fastimage_index_deleted)) == fastimage_index_directory) {
+		if(S_ISDIR(st.st_mode)) return;
+
+		// Directory replaced by file
+		scanUpdateRemove(update, row);
+	}
+
+	if(S_ISREG(st.st_mode)) {
+		// Unchanged files are not probed again
+		if(row != FASTIMAGE_INDEX_NO_ROW && !update->index.flags[row] && update->index.size[row] == (uint64_t)st.st_size && update->index.mtime[row] == (int64_t)st.st_mtime)
+			return;
+
+		image = fastimageOpenFileA(path);
+		update->files++;
+
+		scanUpdatePut(update, path, parent, 0, (uint64_t)st.st_size, (int64_t)st.st_mtime, &image);
+
+		return;
+	}
+
+	// Watch is set before reading, so no entry is missed
+	row = scanUpdatePut(update, path, parent, fastimage_index_directory, 0, (int64_t)st.st_mtime, 0);
+	if(row == FASTIMAGE_INDEX_NO_ROW) return;
+
+	scanUpdateWatch(update, path, row);
+	scanUpdateDirectory(update, path, row);
+}
+
+// Only directories with changed mtime are read, new subtrees are scanned completely
+static void scanUpdateReconcile(scan_update_t *update)
+{
+	uint64_t row, count;
+	struct stat st;
+	char *path;
+
+	count = update->index.count;
+
+	for(row = 0; row < count && !update->failed; row++) {
+		if((update->index.flags[row]&(fastimage_index_directory|fastimage_index_deleted)) != fastimage_index_directory) continue;
+
+		path = strdup(fastimageIndexGetPath(&update->index, row));
+		if(!path) break;
+
+		// Directory replaced by file is found by its parent
+		if(lstat(path, &st) || !S_ISDIR(st.st_mode)) {
+			scanUpdateRemove(update, row);
+		} else {
+			scanUpdateWatch(update, path, row);
+
+			if(update->index.mtime[row] != (int64_t)st.st_mtime) {
+				scanUpdateDirectory(update, path, row);
+				fastimageIndexSet(&update->index, row, fastimage_index_directory, 0, (int64_t)st.st_mtime, 0);
+			}
+		}
+
+		free(path);
+	}
+}
+
+#if defined(__linux__)
+static volatile sig_atomic_t scan_stop = 0;
+
+static void scanStop(int sig)
+{
+	(void)sig;
+
+	scan_stop = 1;
+}
+
+static void scanUpdateEvents(scan_update_t *update)
+{
+	char buffer[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	struct sigaction action;
+	struct stat st;
+	ssize_t size;
+	uint64_t dir, row;
+	char *path, *p;
+
+	// Without SA_RESTART, so read is interrupted
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = scanStop;
+	sigaction(SIGINT, &action, 0);
+	sigaction(SIGTERM, &action, 0);
+
+	while(!scan_stop && !update->failed) {
+		size = read(update->inotify, buffer, sizeof(buffer));
+		if(size <= 0) {
+			if(size < 0 && errno == EINTR) continue;
+
+			break;
+		}
+
+		for(p = buffer; p < buffer+size && !update->failed; p += sizeof(struct inotify_event)+event->len) {
+			event = (const struct inotify_event *)p;
+
+			// Events were lost, directory mtimes tell where
+			if(event->mask & IN_Q_OVERFLOW) {
+				scanUpdateReconcile(update);
+
+				continue;
+			}
+
+			if(event->wd < 0 || (size_t)event->wd >= update->watches_size) continue;
+
+			dir = update->watches[event->wd];
+			if(dir == FASTIMAGE_INDEX_NO_ROW) continue;
+
+			if(event->mask & IN_IGNORED) {
+				update->watches[event->wd] = FASTIMAGE_INDEX_NO_ROW;
+
+				continue;
+			}
+
+			if(!event->len) continue;
+
+			path = scanJoin(fastimageIndexGetPath(&update->index, dir), event->name);
+			if(!path) continue;
+
+			// New files are probed once they are closed
+			if(event->mask & (IN_DELETE|IN_MOVED_FROM)) {
+				row = scanUpdateFind(update, path);
+				if(row != FASTIMAGE_INDEX_NO_ROW) scanUpdateRemove(update, row);
+			} else if(!(event->mask & IN_CREATE) || (event->mask & IN_ISDIR)) {
+				scanUpdatePath(update, path, dir);
+			}
+
+			free(path);
+
+			// Directory row follows its entries, so restart skips it
+			if(!(event->mask & IN_CLOSE_WRITE) && !update->failed && !lstat(fastimageIndexGetPath(&update->index, dir), &st))
+				fastimageIndexSet(&update->index, dir, fastimage_index_directory, 0, (int64_t)st.st_mtime, 0);
+		}
+	}
+}
+#endif
+
+static int scanUpdate(const char *filename, char **paths, int paths_num, bool watch)
+{
+	scan_update_t update;
+	int i;
+
+	memset(&update, 0, sizeof(scan_update_t));
+	update.filename = filename;
+#if defined(__linux__)
+	update.inotify = watch?inotify_init1(IN_CLOEXEC):-1;
+	if(watch && update.inotify < 0) {
+		fprintf(stderr, "can't watch without inotify\n");
+
+		return 1;
+	}
+#else
+	if(watch) {
+		fprintf(stderr, "watching is not supported\n");
+
+		return 1;
+	}
+#endif
+
+	if(!fastimageIndexOpen(&update.index, filename, true)) {
+		fprintf(stderr, "can't open index %s\n", filename);
+
+		return 1;
+	}
+
+	if(!scanUpdateLink(&update)) {
+		fprintf(stderr, "not enough memory\n");
+		update.failed = true;
+	}
+
+	// Known roots are checked by reconcile, new ones are scanned
+	if(!update.failed) scanUpdateReconcile(&update);
+
+	for(i = 0; i < paths_num && !update.failed; i++)
+		scanUpdatePath(&update, paths[i], FASTIMAGE_INDEX_NO_ROW);
+
+	fprintf(stderr, "%llu files probed, %llu rows deleted\n", (unsigned long long)update.files, (unsigned long long)update.removed);
+
+#if defined(__linux__)
+	if(watch && !update.failed) scanUpdateEvents(&update);
+
+	if(update.inotify >= 0) close(update.inotify);
+	free(update.watches);
+#endif
+
+	if(update.index.map) fastimageIndexSync(&update.index);
+	fastimageIndexClose(&update.index);
+
+	free(update.table);
+	free(update.first_child);
+	free(update.next_sibling);
+
+	return update.failed?1:0;
+}
+#endif
+
+static int scanQuery(const char *filename, const fastimage_index_query_t *query)
+{
+	fastimage_index_t index;
+	uint64_t *rows, start = 0, matches = 0;
+	size_t found, i;
+
+	if(!fastimageIndexOpen(&index, filename, false)) {
+		fprintf(stderr, "can't open index %s\n", filename);
+
+		return 1;
+	}
+
+	rows = malloc(SCAN_QUERY_ROWS*sizeof(uint64_t));
+	if(!rows) {
+		fastimageIndexClose(&index);
+
+		return 1;
+	}
+
+	while((found = fastimageIndexQuery(&index, query, &start, rows, SCAN_QUERY_ROWS)) != 0) {
+		for(i = 0; i < found; i++) {
+			fastimage_image_t image = fastimageIndexGetImage(&index, rows[i]);
+
+			printf("%s\t%s\t%u\t%u\t%u\t%u\t%u\n", fastimageIndexGetPath(&index, rows[i]), fastimageFormatName(image.format), (unsigned int)image.width, (unsigned int)image.height,
+				image.channels, image.bitsperpixel, image.palette);
+		}
+
+		matches += found;
+	}
+
+	fprintf(stderr, "%llu of %llu rows\n", (unsigned long long)matches, (unsigned long long)index.count);
+
+	free(rows);
+	fastimageIndexClose(&index);
+
+	return 0;
+}
+
+static void scanUsage(void)
+{
+	printf("scan -o index [-r reserve_rows] path...\n"
+	       "\tprobes every file of paths (recursively) into index\n"
+	       "scan -u index [path...]\n"
+	       "\tupdates index in place, reading only directories with changed mtime, paths are added as new roots\n"
+	       "scan -m index [path...]\n"
+	       "\tupdates index like -u, then keeps it updated by watching directories (Linux)\n"
+	       "scan -q index [-f format] [-w min_width] [-W max_width] [-h min_height] [-H max_height] [-c channels]\n"
+	       "\tprints path, format, width, height, channels, bitsperpixel and palette of matching rows\n");
+}
+
+int main(int argc, char **argv)
+{
+	scan_state_t state;
+	fastimage_index_query_t query;
+	const char *output = 0, *query_index = 0, *update_index = 0;
+	bool watch = false;
+	uint64_t reserve_rows = 0;
+	int i;
+
+	fastimageIndexQueryInit(&query);
+
+	for(i = 1; i < argc && argv[i][0] == '-'; i++) {
+		const char *value = (i+1 < argc)?argv[i+1]:0;
+
+		if(!value || strlen(argv[i]) != 2) {
+			scanUsage();
+
+			return 1;
+		}
+
+		switch(argv[i][1]) {
+			case 'o': output = value; break;
+			case 'q': query_index = value; break;
+			case 'u': update_index = value; break;
+			case 'm': update_index = value; watch = true; break;
+			case 'r': reserve_rows = strtoull(value, 0, 10); break;
+			case 'f':
+				query.format = scanFormatByName(value);
+				if(query.format < -1) {
+					fprintf(stderr, "unknown format %s\n", value);
+
+					return 1;
+				}
+				break;
+			case 'w': query.min_width = (uint32_t)strtoul(value, 0, 10); break;
+			case 'W': query.max_width = (uint32_t)strtoul(value, 0, 10); break;
+			case 'h': query.min_height = (uint32_t)strtoul(value, 0, 10); break;
+			case 'H': query.max_height = (uint32_t)strtoul(value, 0, 10); break;
+			case 'c': query.channels = (unsigned int)strtoul(value, 0, 10); break;
+			default:
+				scanUsage();
+
+				return 1;
+		}
+
+		i++;
+	}
+
+	if(query_index) return scanQuery(query_index, &query);
+
+	if(update_index) {
+#if defined(_WIN32)
+		fprintf(stderr, "updates are not supported\n");
+
+		return 1;
+#else
+		return scanUpdate(update_index, argv+i, argc-i, watch);
+#endif
+	}
+
+	if(!output || i == argc) {
+		scanUsage();
+
+		return 1;
+	}
+
+	memset(&state, 0, sizeof(scan_state_t));
+
+	if(!fastimageIndexCreate(&state.writer, output)) {
+		fprintf(stderr, "can't create %s\n", output);
+
+		return 1;
+	}
+
+	for(; i < argc; i++)
+		scanPath(&state, argv[i], FASTIMAGE_INDEX_NO_ROW);
+
+	// Room for appends in place, at least 1/8 of scanned rows
+	if(!reserve_rows) reserve_rows = state.writer.count/8+1024;
+
+	if(!fastimageIndexFinish(&state.writer, reserve_rows, reserve_rows*64)) {
+		fprintf(stderr, "can't write %s\n", output);
+
+		return 1;
+	}
+
+	fprintf(stderr, "%llu files, %llu images\n", (unsigned long long)state.files, (unsigned long long)state.images);
+
+	return 0;
+}
@@ -0,0 +1,28 @@
+# Python module, see "Python" in README.md: pip install .
+# Set FASTIMAGE_USE_ZLIB=1 in environment to probe svgz (needs zlib headers and library)
+
+import os
+
+from setuptools import Extension, setup
+
+define_macros = []
+libraries = []
+
+if os.environ.get("FASTIMAGE_USE_ZLIB"):
+    define_macros.append(("FASTIMAGE_USE_ZLIB", None))
+    libraries.append("zlib" if os.name == "nt" else "z")
+
+setup(
+    name="fastimage",
+    version="1.0",
+    description="Image size and type from headers",
+    license="BSD-2-Clause",
+    ext_modules=[
+        Extension(
+            "fastimage",
+            sources=["fastimage_python.c", "fastimage.c"],
+            define_macros=define_macros,
+            libraries=libraries,
+        )
+    ],
+)
@@ -31,10 +31,302 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "third_party/stb_leakcheck.h"
 #endif
 
+#if !defined(_WIN32)
+#define _LARGEFILE_SOURCE
+#define _LARGEFILE64_SOURCE
+#endif
+
 #include "fastimage.h"
+#include "fastimage_preview.h"
+#include "fastimage_batch.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static size_t FASTIMAGE_APIENTRY testFileRead(void *context, size_t size, void *buf)
+{
+	return fread(buf, 1, size, context);
+}
+
+static bool FASTIMAGE_APIENTRY testFileSeek(void *context, int64_t pos, bool seek_cur)
+{
+#if defined(_WIN32)
+	return _fseeki64(context, pos, seek_cur?(SEEK_CUR):(SEEK_SET)) == 0;
+#else
+	return fseeko64(context, pos, seek_cur?(SEEK_CUR):(SEEK_SET)) == 0;
+#endif
+}
+
+static void testIcons(FILE *f)
+{
+	fastimage_reader_t reader;
+	fastimage_icons_t icons;
+	fastimage_icon_t icon;
+	int format;
+	size_t n = 0;
+
+	reader.context = f;
+	reader.read = testFileRead;
+	reader.seek = testFileSeek;
+
+	format = fastimageIconsOpen(&reader, &icons);
+	printf("format: %s\n", fastimageFormatName(format));
+	if(format != fastimage_ico && format != fastimage_cur && format != fastimage_ani) return;
+
+	while(fastimageIconsNext(&icons, &icon)) {
+		printf("icon %u: %ux%u, %u bits, %s at %llu size %llu", (unsigned int)n++, (unsigned int)icon.width, (unsigned int)icon.height, icon.bitsperpixel,
+			(icon.payload == fastimage_icon_bmp)?"bmp":(icon.payload == fastimage_icon_png)?"png":(icon.payload == fastimage_icon_ico)?"ico":"unknown",
+			(unsigned long long)icon.offset, (unsigned long long)icon.size);
+		if(format == fastimage_cur) printf(", hotspot %u,%u", icon.hotspot_x, icon.hotspot_y);
+		printf("\n");
+	}
+
+	fastimageIconsClose(&icons);
+}
+
+#if defined(_WIN32)
+static bool testIsType(const wchar_t *type, const char *name)
+{
+	while(*name && *type == (wchar_t)*name) {
+		type++;
+		name++;
+	}
+
+	return !*type && !*name;
+}
+#else
+static bool testIsType(const char *type, const char *name)
+{
+	return !strcmp(type, name);
+}
+#endif
+
+static void testArchive(FILE *f)
+{
+	fastimage_archive_t archive;
+	fastimage_archive_entry_t entry;
+	int format;
+
+	format = fastimageArchiveOpenFile(f, &archive);
+	printf("format: %s\n", (format == fastimage_archive_zip)?"zip":(format == fastimage_archive_tar)?"tar":(format == fastimage_archive_unknown)?"unknown":"error");
+	if(format != fastimage_archive_zip && format != fastimage_archive_tar) return;
+
+	while(fastimageArchiveNext(&archive, &entry)) {
+		printf("%s: %s %ux%u, method %u at %llu size %llu (%llu compressed)\n", entry.name, fastimageFormatName(entry.image.format),
+			(unsigned int)entry.image.width, (unsigned int)entry.image.height, entry.method,
+			(unsigned long long)entry.offset, (unsigned long long)entry.size, (unsigned long long)entry.compressed_size);
+	}
+
+	fastimageArchiveClose(&archive);
+}
+
+static void testTexture(FILE *f)
+{
+	static const char *encodings[] = {"unknown", "uncompressed", "bc1", "bc2", "bc3", "bc4", "bc5", "bc6h", "bc7", "etc1", "etc2_rgb", "etc2_rgba1",
+		"etc2_rgba", "eac_r11", "eac_rg11", "astc", "pvrtc_2bpp", "pvrtc_4bpp", "etc1s", "uastc"};
+	fastimage_reader_t reader;
+	fastimage_texture_t texture;
+	int format;
+
+	reader.context = f;
+	reader.read = testFileRead;
+	reader.seek = testFileSeek;
+
+	format = fastimageTextureOpen(&reader, &texture);
+	printf("format: %s\n", fastimageFormatName(format));
+	if(format == fastimage_error || format == fastimage_unknown) return;
+
+	printf("size: %ux%ux%u, %u layers, %u faces, %u levels\n", (unsigned int)texture.width, (unsigned int)texture.height, (unsigned int)texture.depth,
+		(unsigned int)texture.layers, texture.faces, texture.levels);
+	printf("encoding: %s, block %ux%ux%u of %u bits, %u channels, %u bits per pixel\n",
+		(texture.encoding >= 0 && texture.encoding < (int)(sizeof(encodings)/sizeof(encodings[0])))?encodings[texture.encoding]:"other",
+		texture.block_width, texture.block_height, texture.block_depth, texture.block_bits, texture.channels, texture.bitsperpixel);
+	printf("native format: %llu, supercompression %u\n", (unsigned long long)texture.native_format, texture.supercompression);
+}
+
+static void testPdf(FILE *f)
+{
+	fastimage_pdf_t pdf;
+	fastimage_pdf_image_t image;
+
+	if(!fastimagePdfOpenFile(f, &pdf)) {
+		printf("format: error\n");
+
+		return;
+	}
+
+	printf("format: pdf%s\n", pdf.encrypted?", encrypted":"");
+
+	while(fastimagePdfNext(&pdf, &image)) {
+		printf("object %llu: %s %ux%u, %u bits per component, filter %s (%u) at %llu size %llu\n", (unsigned long long)image.object,
+			fastimageFormatName(image.image.format), (unsigned int)image.image.width, (unsigned int)image.image.height, image.bitspercomponent,
+			image.filter[0]?image.filter:"none", image.filters, (unsigned long long)image.offset, (unsigned long long)image.length);
+	}
+
+	fastimagePdfClose(&pdf);
+}
+
+static void testHeifItem(const char *name, const fastimage_heif_item_t *item)
+{
+	if(!item->id) {
+		printf("%s: none\n", name);
+
+		return;
+	}
+
+	printf("%s: item %u %s %ux%u, %u channels, %u bits per pixel, data at %llu size %llu, config at %llu size %llu\n", name, (unsigned int)item->id, item->type,
+		(unsigned int)item->width, (unsigned int)item->height, item->channels, item->bitsperpixel,
+		(unsigned long long)item->offset, (unsigned long long)item->length, (unsigned long long)item->config_offset, (unsigned long long)item->config_length);
+}
+
+static void testHeif(FILE *f)
+{
+	fastimage_reader_t reader;
+	fastimage_heif_t heif;
+	int format;
+
+	reader.context = f;
+	reader.read = testFileRead;
+	reader.seek = testFileSeek;
+
+	format = fastimageHeifOpen(&reader, &heif);
+	printf("format: %s\n", fastimageFormatName(format));
+	if(format == fastimage_error || format == fastimage_unknown) return;
+
+	testHeifItem("primary", &heif.primary);
+	if(heif.grid_rows) {
+		printf("grid: %ux%u\n", heif.grid_columns, heif.grid_rows);
+		testHeifItem("tile", &heif.tile);
+	}
+	printf("thumbnails: %u\n", heif.thumbnails);
+	if(heif.thumbnails) testHeifItem("thumbnail", &heif.thumbnail);
+	printf("alpha: %s\n", heif.alpha?"yes":"no");
+}
+
+static void testVideo(FILE *f)
+{
+	fastimage_reader_t reader;
+	fastimage_video_t video;
+	int format;
+
+	reader.context = f;
+	reader.read = testFileRead;
+	reader.seek = testFileSeek;
+
+	format = fastimageVideoOpen(&reader, &video);
+	printf("format: %s\n", fastimageFormatName(format));
+	if(format == fastimage_error || format == fastimage_unknown) return;
+
+	printf("tracks: %u\n", video.tracks);
+	if(!video.tracks) return;
+
+	printf("size: %ux%u, coded %ux%u, rotation %u\n", (unsigned int)video.width, (unsigned int)video.height,
+		(unsigned int)video.coded_width, (unsigned int)video.coded_height, video.rotation);
+	printf("codec: %s%s%s\n", video.codec[0]?video.codec:"unknown", video.codec_id[0]?", ":"", video.codec_id);
+}
+
+static void testPreview(FILE *f)
+{
+	fastimage_reader_t reader;
+	fastimage_options_t options;
+	fastimage_hints_t hints;
+	fastimage_image_t image;
+	fastimage_preview_t preview;
+
+	reader.context = f;
+	reader.read = testFileRead;
+	reader.seek = testFileSeek;
+
+	memset(&options, 0, sizeof(fastimage_options_t));
+	memset(&hints, 0, sizeof(fastimage_hints_t));
+	options.hints = &hints;
+
+	image = fastimageOpenEx(&reader, &options);
+	printf("format: %s\n", fastimageFormatName(image.format));
+	if(image.format == fastimage_error || image.format == fastimage_unknown) return;
+
+	preview = fastimageDecodePreview(&reader, &image, &hints, 256);
+	if(!preview.pixels) {
+		printf("preview: error\n");
+
+		return;
+	}
+
+	printf("preview: %ux%u of %ux%u, %u channels, scale 1/%u\n", (unsigned int)preview.width, (unsigned int)preview.height,
+		(unsigned int)image.width, (unsigned int)image.height, preview.channels, preview.scale);
+
+	fastimageFreePreview(&preview);
+}
+
+// One url per line
+static void testBatch(FILE *f)
+{
+	fastimage_http_batch_t batch;
+	fastimage_image_t *images = 0;
+	fastimage_stats_t *stats = 0;
+	char **urls = 0, line[4096];
+	size_t count = 0, i;
+
+	while(fgets(line, sizeof(line), f)) {
+		size_t len = strcspn(line, "\r\n");
+		char **new_urls;
+
+		if(!len) continue;
+		line[len] = 0;
+
+		new_urls = realloc(urls, (count+1)*sizeof(char *));
+		if(!new_urls) goto BATCH_END;
+		urls = new_urls;
+
+		urls[count] = malloc(len+1);
+		if(!urls[count]) goto BATCH_END;
+		memcpy(urls[count++], line, len+1);
+	}
+
+	if(!count) goto BATCH_END;
+
+	images = malloc(count*sizeof(fastimage_image_t));
+	stats = malloc(count*sizeof(fastimage_stats_t));
+	if(!images || !stats) goto BATCH_END;
+
+	memset(&batch, 0, sizeof(fastimage_http_batch_t));
+	batch.support_proxy = true;
+
+	fastimageOpenHttpBatchA((const char *const *)urls, count, images, stats, &batch);
+
+	for(i = 0; i < count; i++)
+		printf("%s: %s %ux%u, status %d\n", urls[i], fastimageFormatName(images[i].format), (unsigned int)images[i].width, (unsigned int)images[i].height, stats[i].http_status);
+
+BATCH_END:
+	for(i = 0; i < count; i++)
+		free(urls[i]);
+	if(urls) free(urls);
+	if(images) free(images);
+	if(stats) free(stats);
+}
+
+// Modes walking the iterators over a file
+static const struct {
+	const char *type;
+	void (*walk)(FILE *f);
+} test_walks[] = {
+	{"icons", testIcons},
+	{"archive", testArchive},
+	{"texture", testTexture},
+	{"pdf", testPdf},
+	{"heif", testHeif},
+	{"video", testVideo},
+	{"preview", testPreview},
+	{"batch", testBatch}
+};
 
 #if defined(_WIN32)
 int wmain(int argc, wchar_t **argv)
@@ -43,6 +335,7 @@ int main(int argc, char **argv)
 #endif
 {
 	fastimage_image_t image;
+	size_t i;
 #if defined(_WIN32)
 	wchar_t *link_type, *link_path;
 #else
@@ -52,7 +345,16 @@ int main(int argc, char **argv)
 	if(argc < 2 || argc > 3) {
 		printf("test.exe [type] input\n"
 		       "\ttype = file - file input\n"
-			   "\ttype = http - http url\n");
+			   "\ttype = http - http url\n"
+			   "\ttype = fd - file input through descriptor\n"
+			   "\ttype = icons - entries of ico, cur or ani file\n"
+			   "\ttype = archive - images in zip or tar file\n"
+			   "\ttype = texture - header of dds, ktx, ktx2, pvr or astc file\n"
+			   "\ttype = pdf - images of pdf file\n"
+			   "\ttype = heif - items of heic or avif file\n"
+			   "\ttype = video - first video track of mp4, mov, mkv or webm file\n"
+			   "\ttype = preview - decode preview of file that fits 256x256\n"
+			   "\ttype = batch - http urls listed in file, one per line\n");
 		
 		return 0;
 	}
@@ -74,17 +376,65 @@ int main(int argc, char **argv)
 			link_type = "file";
 #endif
 	}
+
+	for(i = 0; i < sizeof(test_walks)/sizeof(test_walks[0]); i++) {
+		FILE *f;
+
+		if(!testIsType(link_type, test_walks[i].type)) continue;
+
+#if defined(_WIN32)
+		f = _wfopen(link_path, L"rb");
+#else
+		f = fopen(link_path, "rb");
+#endif
+		if(!f) {
+			printf("Can't open input\n");
+
+			return 0;
+		}
+
+		test_walks[i].walk(f);
+		fclose(f);
+
+#if defined(_DEBUG) && defined(USE_STB_LEAKCHECK)
+		stb_leakcheck_dumpmem();
+#endif
+
+		return 0;
+	}
 	
 #if defined(_WIN32)
 	if(!wcscmp(link_type, L"file")) {
 		image = fastimageOpenFileW(link_path);
 	} else if(!wcscmp(link_type, L"http")) {
 		image = fastimageOpenHttpW(link_path, true);
+	} else if(!wcscmp(link_type, L"fd")) {
+		int fd = _wopen(link_path, _O_RDONLY | _O_BINARY);
+
+		if(fd < 0) {
+			printf("Can't open input\n");
+
+			return 0;
+		}
+
+		image = fastimageOpenFd(fd, 0, 0);
+		_close(fd);
 #else
 	if(!strcmp(link_type, "file")) {
 		image = fastimageOpenFileA(link_path);
 	} else if(!strcmp(link_type, "http")) {
 		image = fastimageOpenHttpA(link_path, true);
+	} else if(!strcmp(link_type, "fd")) {
+		int fd = open(link_path, O_RDONLY);
+
+		if(fd < 0) {
+			printf("Can't open input\n");
+
+			return 0;
+		}
+
+		image = fastimageOpenFd(fd, 0, 0);
+		close(fd);
 #endif
 	} else {
 		printf("Unknown input type\n");
@@ -92,59 +442,7 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
-	printf("format: ");
-	switch(image.format) {
-		case fastimage_error:
-			printf("error\n");
-			break;
-		case fastimage_unknown:
-			printf("unknown\n");
-			break;
-		case fastimage_bmp:
-			printf("bmp\n");
-			break;
-		case fastimage_tga:
-			printf("tga\n");
-			break;
-		case fastimage_pcx:
-			printf("pcx\n");
-			break;
-		case fastimage_png:
-			printf("png\n");
-			break;
-		case fastimage_gif:
-			printf("gif\n");
-			break;
-		case fastimage_webp:
-			printf("webp\n");
-			break;
-		case fastimage_heic:
-			printf("heic\n");
-			break;
-		case fastimage_jpg:
-			printf("jpg\n");
-			break;
-		case fastimage_avif:
-			printf("avif\n");
-			break;
-		case fastimage_miaf:
-			printf("miaf\n");
-			break;
-		case fastimage_qoi:
-			printf("qoi\n");
-			break;
-		case fastimage_qoy:
-			printf("qoy\n");
-			break;
-		case fastimage_ani:
-			printf("ani\n");
-			break;
-		case fastimage_ico:
-			printf("ico\n");
-			break;
-		default:
-			printf("other\n");		
-	}
+	printf("format: %s\n", fastimageFormatName(image.format));
 		
 	printf("width: %u\n", (unsigned int)image.width);
 	printf("height: %u\n", (unsigned int)image.height);
@@ -0,0 +1,376 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Checks probe_async of fastimage_async.hpp over memory_source, uring_file and curl_source (local stand-in
+// http server with ranges) against fastimageOpenMemoryEx, and that probes reading the whole stream take
+// a logarithmic number of fetches. Linux only
+
+#include "fastimage_async.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#define TEST_ASYNC_CHUNK 65536
+#define TEST_ASYNC_BIG_SIZE (4u<<20) // 64 chunks, one pass per chunk would be 64 fetches
+
+struct test_async_file {
+	const char *name;
+	std::vector<unsigned char> data;
+};
+
+struct test_async_mode {
+	const char *name;
+	int level;
+	int fingerprint;
+};
+
+static const test_async_mode modes[] = {
+	{"full", fastimage_level_full, fastimage_fingerprint_none},
+	{"format", fastimage_level_format, fastimage_fingerprint_none},
+	{"verify", fastimage_level_verify, fastimage_fingerprint_none},
+	{"fingerprint", fastimage_level_full, fastimage_fingerprint_full}
+};
+
+static std::vector<test_async_file> files;
+static const std::vector<unsigned char> *served; // Body of http server
+static int server_socket;
+static unsigned short server_port;
+static unsigned int failures;
+
+static void testAsyncCheck(bool condition, const char *what, const char *file, const char *mode)
+{
+	printf("%s: %s, %s %s\n", condition?"ok":"FAILED", what, file, mode);
+	if(!condition) failures++;
+}
+
+static void testAsyncPut32(std::vector<unsigned char> &v, uint32_t x)
+{
+	v.push_back((unsigned char)(x >> 24));
+	v.push_back((unsigned char)(x >> 16));
+	v.push_back((unsigned char)(x >> 8));
+	v.push_back((unsigned char)x);
+}
+
+static void testAsyncPngChunk(std::vector<unsigned char> &v, const char *type, const unsigned char *data, uint32_t size)
+{
+	size_t start;
+
+	testAsyncPut32(v, size);
+	start = v.size();
+	v.insert(v.end(), type, type+4);
+	v.insert(v.end(), data, data+size);
+	testAsyncPut32(v, (uint32_t)crc32(0, v.data()+start, (uInt)(size+4)));
+}
+
+// Png of width x 1 rgb, IDAT is split in 8 KB chunks of filler, verify level checks CRCs only
+static std::vector<unsigned char> testAsyncPng(uint32_t width, size_t idat_size)
+{
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+	std::vector<unsigned char> v(signature, signature+8), ihdr, part(8192);
+	size_t i;
+
+	testAsyncPut32(ihdr, width);
+	testAsyncPut32(ihdr, 1);
+	ihdr.push_back(8);
+	ihdr.push_back(2);
+	ihdr.push_back(0);
+	ihdr.push_back(0);
+	ihdr.push_back(0);
+	testAsyncPngChunk(v, "IHDR", ihdr.data(), 13);
+
+	for(i = 0; i < part.size(); i++)
+		part[i] = (unsigned char)(i*31);
+	for(i = 0; i < idat_size; i += part.size())
+		testAsyncPngChunk(v, "IDAT", part.data(), (uint32_t)std::min(part.size(), idat_size-i));
+
+	testAsyncPngChunk(v, "IEND", 0, 0);
+
+	return v;
+}
+
+static void testAsyncFiles(void)
+{
+	std::vector<unsigned char> broken;
+
+	files.push_back({"small png", testAsyncPng(16, 100)});
+	files.push_back({"big png", testAsyncPng(4096, TEST_ASYNC_BIG_SIZE)});
+
+	// Bad CRC in the middle, verify level must fail the same way
+	broken = testAsyncPng(4096, TEST_ASYNC_BIG_SIZE);
+	broken[broken.size()/2] ^= 0x55;
+	files.push_back({"broken png", broken});
+
+	// Gif header with logical screen size and trailer
+	static const unsigned char gif[14] = {'G', 'I', 'F', '8', '9', 'a', 10, 0, 20, 0, 0, 0, 0, 0x3B};
+	files.push_back({"gif", std::vector<unsigned char>(gif, gif+sizeof(gif))});
+}
+
+// Counts fetches of source
+template<typename Source> class test_async_counted {
+public:
+	unsigned reads = 0;
+
+	explicit test_async_counted(Source &source) : source_(source) {}
+
+	auto read(uint64_t offset, size_t size, void *buf)
+	{
+		reads++;
+
+		return source_.read(offset, size, buf);
+	}
+
+private:
+	Source &source_;
+};
+
+// Ranges of served, 206 with Content-Range or 416 past the end
+static void *testAsyncConnection(void *arg)
+{
+	int socket = (int)(intptr_t)arg;
+	char request[2048], header[256];
+	const char *range;
+	size_t request_size = 0, size = served->size();
+	unsigned long long first = 0, last = size-1;
+	ssize_t result;
+	int header_size;
+
+	request[0] = 0;
+
+	while(request_size < sizeof(request)-1 && !strstr(request, "\r\n\r\n")) {
+		result = recv(socket, request+request_size, sizeof(request)-1-request_size, 0);
+		if(result <= 0) break;
+
+		request_size += (size_t)result;
+		request[request_size] = 0;
+	}
+
+	range = strstr(request, "Range: bytes=");
+	if(range) sscanf(range, "Range: bytes=%llu-%llu", &first, &last);
+	if(last >= size) last = size-1;
+
+	if(first >= size) {
+		header_size = snprintf(header, sizeof(header), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%u\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", (unsigned int)size);
+		send(socket, header, (size_t)header_size, MSG_NOSIGNAL);
+	} else {
+		header_size = snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %llu-%llu/%u\r\nContent-Length: %llu\r\nConnection: close\r\n\r\n",
+			first, last, (unsigned int)size, last-first+1);
+		send(socket, header, (size_t)header_size, MSG_NOSIGNAL);
+		send(socket, served->data()+first, (size_t)(last-first+1), MSG_NOSIGNAL);
+	}
+
+	close(socket);
+
+	return 0;
+}
+
+static void *testAsyncServer(void *)
+{
+	while(1) {
+		pthread_t thread;
+		int socket;
+
+		socket = accept(server_socket, 0, 0);
+		if(socket < 0) continue;
+
+		if(pthread_create(&thread, 0, testAsyncConnection, (void *)(intptr_t)socket))
+			close(socket);
+		else
+			pthread_detach(thread);
+	}
+
+	return 0;
+}
+
+static bool testAsyncStart(void)
+{
+	struct sockaddr_in address;
+	socklen_t address_size = sizeof(address);
+	pthread_t thread;
+
+	server_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if(server_socket < 0) return false;
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if(bind(server_socket, (struct sockaddr *)&address, sizeof(address))) return false;
+	if(listen(server_socket, 64)) return false;
+	if(getsockname(server_socket, (struct sockaddr *)&address, &address_size)) return false;
+
+	server_port = ntohs(address.sin_port);
+
+	if(pthread_create(&thread, 0, testAsyncServer, 0)) return false;
+	pthread_detach(thread);
+
+	return true;
+}
+
+static void testAsyncOptions(const test_async_mode &mode, fastimage_options_t *options, fastimage_fingerprint_t *fingerprint)
+{
+	memset(options, 0, sizeof(fastimage_options_t));
+	memset(fingerprint, 0, sizeof(fastimage_fingerprint_t));
+	options->level = mode.level;
+	fingerprint->mode = mode.fingerprint;
+	if(mode.fingerprint != fastimage_fingerprint_none)
+		options->fingerprint = fingerprint;
+}
+
+static bool testAsyncSame(const fastimage_image_t &a, const fastimage_image_t &b)
+{
+	return a.format == b.format && a.width == b.width && a.height == b.height && a.channels == b.channels &&
+		a.bitsperpixel == b.bitsperpixel && a.palette == b.palette;
+}
+
+// Result of probe_async over source must be the one of fastimageOpenMemoryEx
+template<typename Source> static void testAsyncCompare(fastimage::executor &ex, Source &source, const test_async_file &file, const test_async_mode &mode, const char *what)
+{
+	fastimage_options_t options;
+	fastimage_fingerprint_t fingerprint, expected_fingerprint;
+	fastimage_image_t image, expected;
+	test_async_counted<Source> counted(source);
+	unsigned max_reads;
+	char check[128];
+
+	testAsyncOptions(mode, &options, &expected_fingerprint);
+	expected = fastimageOpenMemoryEx(file.data.data(), file.data.size(), &options);
+
+	testAsyncOptions(mode, &options, &fingerprint);
+	image = ex.run(fastimage::probe_async(counted, &options, TEST_ASYNC_CHUNK));
+
+	snprintf(check, sizeof(check), "%s: same image", what);
+	testAsyncCheck(testAsyncSame(image, expected), check, file.name, mode.name);
+
+	if(mode.fingerprint != fastimage_fingerprint_none) {
+		snprintf(check, sizeof(check), "%s: same fingerprint", what);
+		testAsyncCheck(fingerprint.hash == expected_fingerprint.hash && fingerprint.size == expected_fingerprint.size, check, file.name, mode.name);
+	}
+
+	// Doubling fetches: 64 KB, 128 KB... cover the stream in log2(size/chunk)+1, one more finds the end
+	max_reads = 2;
+	for(size_t covered = TEST_ASYNC_CHUNK; covered < file.data.size(); covered *= 2)
+		max_reads++;
+	snprintf(check, sizeof(check), "%s: %u fetches, at most %u", what, counted.reads, max_reads);
+	testAsyncCheck(counted.reads <= max_reads, check, file.name, mode.name);
+}
+
+static void testAsyncMemory(void)
+{
+	fastimage::executor ex;
+
+	for(const test_async_file &file : files) {
+		fastimage::memory_source source(file.data.data(), file.data.size());
+
+		for(const test_async_mode &mode : modes)
+			testAsyncCompare(ex, source, file, mode, "memory_source");
+	}
+}
+
+// Kernels without io_uring (or with it blocked) skip these checks
+static void testAsyncUring(void)
+{
+	fastimage::executor ex;
+	char name[] = "/tmp/fastimage_test_async_XXXXXX";
+	int fd;
+
+	try {
+		fastimage::uring ring(ex);
+
+		for(const test_async_file &file : files) {
+			fd = mkstemp(name);
+			if(fd < 0 || write(fd, file.data.data(), file.data.size()) != (ssize_t)file.data.size()) {
+				testAsyncCheck(false, "uring_file: temporary file", file.name, "");
+				if(fd >= 0) {
+					close(fd);
+					unlink(name);
+				}
+				return;
+			}
+			unlink(name);
+			strcpy(name+strlen(name)-6, "XXXXXX");
+
+			fastimage::uring_file source(ring, fd);
+
+			for(const test_async_mode &mode : modes)
+				testAsyncCompare(ex, source, file, mode, "uring_file");
+
+			close(fd);
+		}
+	} catch(const std::system_error &e) {
+		printf("skipped: uring_file, %s\n", e.what());
+	}
+}
+
+static void testAsyncCurl(void)
+{
+	fastimage::executor ex;
+	fastimage::curl_multi multi(ex);
+	char url[64];
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/image", (unsigned int)server_port);
+
+	for(const test_async_file &file : files) {
+		fastimage::curl_source source(multi, url);
+
+		// Probes run one at a time, server is not asked while body changes
+		served = &file.data;
+		for(const test_async_mode &mode : modes)
+			testAsyncCompare(ex, source, file, mode, "curl_source");
+	}
+}
+
+int main(void)
+{
+	testAsyncFiles();
+
+	if(!testAsyncStart()) {
+		printf("can't start server\n");
+
+		return 1;
+	}
+
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
+	testAsyncMemory();
+	testAsyncUring();
+	testAsyncCurl();
+
+	curl_global_cleanup();
+
+	printf("%u failed\n", failures);
+
+	return failures?1:0;
+}
@@ -0,0 +1,388 @@
+/*
+BSD 2-Clause License
+
+Copyright (c) 2022, Mikhail Morozov
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Checks scheduler of fastimageOpenHttpBatchA against local stand-in http servers: limit of probes per host,
+// turns of hosts, pauses after 429 and 503 and number of retries. POSIX only
+
+#include "fastimage.h"
+#include "fastimage_batch.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_BATCH_SERVERS 3
+#define TEST_BATCH_REQUESTS 256
+#define TEST_BATCH_RETRY_AFTER 30 // Seconds, longer than max_backoff_ms of tests
+
+typedef struct {
+	int socket;
+	unsigned short port;
+	unsigned int delay_ms; // Before each answer
+	unsigned int in_flight;
+	unsigned int max_in_flight;
+} test_batch_server_t;
+
+typedef struct {
+	int server;
+	char path[64];
+	uint64_t ticks;
+} test_batch_request_t;
+
+typedef struct {
+	int server;
+	int socket;
+} test_batch_connection_t;
+
+static test_batch_server_t servers[TEST_BATCH_SERVERS];
+static test_batch_request_t requests[TEST_BATCH_REQUESTS];
+static size_t requests_num;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int failures;
+
+// Signature and IHDR of 1x1 gray png, enough for probe
+static const unsigned char png[33] = {
+	0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A, 0, 0, 0, 13, 'I', 'H', 'D', 'R',
+	0, 0, 0, 1, 0, 0, 0, 1, 8, 0, 0, 0, 0, 0x3A, 0x7E, 0x9B, 0x55
+};
+
+static uint64_t testBatchTicks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec*1000+(uint64_t)ts.tv_nsec/1000000;
+}
+
+static void testBatchCheck(bool condition, const char *what)
+{
+	printf("%s: %s\n", condition?"ok":"FAILED", what);
+	if(!condition) failures++;
+}
+
+// /ok/... is a png, /busy/... is 429 with Retry-After for the first time and png then, /down/... is always 503
+static void *testBatchConnection(void *arg)
+{
+	test_batch_connection_t *connection = (test_batch_connection_t *)arg;
+	test_batch_server_t *server = &servers[connection->server];
+	char request[2048], path[64], header[256];
+	size_t request_size = 0, i;
+	unsigned int seen = 0;
+	ssize_t result;
+	int header_size;
+
+	request[0] = 0;
+
+	while(request_size < sizeof(request)-1 && !strstr(request, "\r\n\r\n")) {
+		result = recv(connection->socket, request+request_size, sizeof(request)-1-request_size, 0);
+		if(result <= 0) break;
+
+		request_size += (size_t)result;
+		request[request_size] = 0;
+	}
+
+	if(sscanf(request, "GET %63s", path) != 1) path[0] = 0;
+
+	pthread_mutex_lock(&lock);
+
+	for(i = 0; i < requests_num; i++)
+		if(requests[i].server == connection->server && !strcmp(requests[i].path, path)) seen++;
+
+	if(requests_num < TEST_BATCH_REQUESTS) {
+		requests[requests_num].server = connection->server;
+		strcpy(requests[requests_num].path, path);
+		requests[requests_num].ticks = testBatchTicks();
+		requests_num++;
+	}
+
+	server->in_flight++;
+	if(server->in_flight > server->max_in_flight) server->max_in_flight = server->in_flight;
+
+	pthread_mutex_unlock(&lock);
+
+	if(server->delay_ms) usleep(server->delay_ms*1000);
+
+	// Before the answer, so next probe of client is never counted together with this one
+	pthread_mutex_lock(&lock);
+	server->in_flight--;
+	pthread_mutex_unlock(&lock);
+
+	if(!strncmp(path, "/down/", 6))
+		header_size = snprintf(header, sizeof(header), "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+	else if(!strncmp(path, "/busy/", 6) && !seen)
+		header_size = snprintf(header, sizeof(header), "HTTP/1.1 429 Too Many Requests\r\nRetry-After: %d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", TEST_BATCH_RETRY_AFTER);
+	else
+		header_size = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", (unsigned int)sizeof(png));
+
+	send(connection->socket, header, (size_t)header_size, MSG_NOSIGNAL);
+	if(strstr(header, " 200 ")) send(connection->socket, png, sizeof(png), MSG_NOSIGNAL);
+
+	close(connection->socket);
+	free(connection);
+
+	return 0;
+}
+
+static void *testBatchServer(void *arg)
+{
+	int index = (int)(intptr_t)arg;
+
+	while(1) {
+		test_batch_connection_t *connection;
+		pthread_t thread;
+		int socket;
+
+		socket = accept(servers[index].socket, 0, 0);
+		if(socket < 0) continue;
+
+		connection = malloc(sizeof(test_batch_connection_t));
+		if(!connection) {
+			close(socket);
+			continue;
+		}
+
+		connection->server = index;
+		connection->socket = socket;
+
+		if(pthread_create(&thread, 0, testBatchConnection, connection)) {
+			close(socket);
+			free(connection);
+		} else
+			pthread_detach(thread);
+	}
+
+	return 0;
+}
+
+static bool testBatchStart(int index)
+{
+	struct sockaddr_in address;
+	socklen_t address_size = sizeof(address);
+	pthread_t thread;
+
+	servers[index].socket = socket(AF_INET, SOCK_STREAM, 0);
+	if(servers[index].socket < 0) return false;
+
+	// Port is chosen by system, every server is a separate host for scheduler
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if(bind(servers[index].socket, (struct sockaddr *)&address, sizeof(address))) return false;
+	if(listen(servers[index].socket, 64)) return false;
+	if(getsockname(servers[index].socket, (struct sockaddr *)&address, &address_size)) return false;
+
+	servers[index].port = ntohs(address.sin_port);
+
+	if(pthread_create(&thread, 0, testBatchServer, (void *)(intptr_t)index)) return false;
+	pthread_detach(thread);
+
+	return true;
+}
+
+static void testBatchReset(unsigned int delay_ms)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+
+	requests_num = 0;
+	for(i = 0; i < TEST_BATCH_SERVERS; i++) {
+		servers[i].delay_ms = delay_ms;
+		servers[i].in_flight = 0;
+		servers[i].max_in_flight = 0;
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+static char *testBatchUrl(int server, const char *path)
+{
+	char *url = malloc(128);
+
+	if(url) snprintf(url, 128, "http://127.0.0.1:%u%s", (unsigned int)servers[server].port, path);
+
+	return url;
+}
+
+static void testBatchRun(char **urls, size_t count, fastimage_image_t *images, fastimage_stats_t *stats, const fastimage_http_batch_t *batch)
+{
+	size_t i;
+
+	fastimageOpenHttpBatchA((const char *const *)urls, count, images, stats, batch);
+
+	for(i = 0; i < count; i++)
+		free(urls[i]);
+}
+
+// Probes of one host never go above max_per_host, while other hosts go on
+static void testBatchPerHost(void)
+{
+	fastimage_http_batch_t batch;
+	fastimage_image_t images[16];
+	char *urls[16], path[32];
+	size_t i;
+	bool all_png = true;
+
+	testBatchReset(100);
+
+	for(i = 0; i < 16; i++) {
+		snprintf(path, sizeof(path), "/ok/%u", (unsigned int)i);
+		urls[i] = testBatchUrl((i < 12)?0:1, path);
+	}
+
+	memset(&batch, 0, sizeof(fastimage_http_batch_t));
+	batch.max_in_flight = 8;
+	batch.max_per_host = 2;
+
+	testBatchRun(urls, 16, images, 0, &batch);
+
+	for(i = 0; i < 16; i++)
+		if(images[i].format != fastimage_png || images[i].width != 1) all_png = false;
+
+	testBatchCheck(all_png, "per host: every url is probed");
+	testBatchCheck(servers[0].max_in_flight == 2, "per host: 12 urls of host by 8 threads, at most 2 at once");
+	testBatchCheck(servers[1].max_in_flight == 2, "per host: second host runs at the same time, at most 2 at once");
+}
+
+// One thread takes urls of hosts in turn, each host in order of its urls
+static void testBatchRoundRobin(void)
+{
+	static const int order[9] = {0, 1, 2, 0, 1, 2, 0, 1, 2};
+	fastimage_http_batch_t batch;
+	fastimage_image_t images[9];
+	char *urls[9], path[32], expected[32];
+	size_t i;
+	bool in_turn = true;
+
+	testBatchReset(0);
+
+	// Urls are grouped by host
+	for(i = 0; i < 9; i++) {
+		snprintf(path, sizeof(path), "/ok/%u", (unsigned int)i);
+		urls[i] = testBatchUrl((int)(i/3), path);
+	}
+
+	memset(&batch, 0, sizeof(fastimage_http_batch_t));
+	batch.max_in_flight = 1;
+
+	testBatchRun(urls, 9, images, 0, &batch);
+
+	if(requests_num != 9) in_turn = false;
+
+	for(i = 0; in_turn && i < 9; i++) {
+		snprintf(expected, sizeof(expected), "/ok/%u", (unsigned int)(order[i]*3+i/3));
+		if(requests[i].server != order[i] || strcmp(requests[i].path, expected)) in_turn = false;
+	}
+
+	testBatchCheck(in_turn, "round robin: hosts take turns, urls of host keep their order");
+}
+
+// 429 pauses host for Retry-After capped by max_backoff_ms, other hosts are not paused
+static void testBatchBackoff(void)
+{
+	fastimage_http_batch_t batch;
+	fastimage_image_t images[3];
+	fastimage_stats_t stats[3];
+	char *urls[3];
+	uint64_t pause = 0;
+
+	testBatchReset(0);
+
+	urls[0] = testBatchUrl(0, "/busy/a");
+	urls[1] = testBatchUrl(0, "/ok/b");
+	urls[2] = testBatchUrl(1, "/ok/c");
+
+	memset(&batch, 0, sizeof(fastimage_http_batch_t));
+	batch.max_in_flight = 1;
+	batch.backoff_ms = 50;
+	batch.max_backoff_ms = 300;
+	batch.max_retries = 1;
+
+	testBatchRun(urls, 3, images, stats, &batch);
+
+	if(requests_num == 4) pause = requests[2].ticks-requests[0].ticks;
+
+	testBatchCheck(requests_num == 4 && requests[0].server == 0 && requests[1].server == 1 &&
+		!strcmp(requests[2].path, "/busy/a") && !strcmp(requests[3].path, "/ok/b"), "backoff: paused host waits, the other one goes on");
+	testBatchCheck(pause >= 300 && pause < TEST_BATCH_RETRY_AFTER*1000, "backoff: Retry-After is capped by max_backoff_ms");
+	testBatchCheck(images[0].format == fastimage_png && stats[0].http_status == 200, "backoff: retry gets the image");
+}
+
+// 503 without Retry-After: max_retries more attempts, pauses start at backoff_ms and double
+static void testBatchRetries(void)
+{
+	fastimage_http_batch_t batch;
+	fastimage_image_t images[1];
+	fastimage_stats_t stats[1];
+	char *urls[1];
+
+	testBatchReset(0);
+
+	urls[0] = testBatchUrl(2, "/down/a");
+
+	memset(&batch, 0, sizeof(fastimage_http_batch_t));
+	batch.max_in_flight = 1;
+	batch.backoff_ms = 50;
+	batch.max_backoff_ms = 1000;
+	batch.max_retries = 2;
+
+	testBatchRun(urls, 1, images, stats, &batch);
+
+	testBatchCheck(requests_num == 3, "retries: 1+max_retries attempts");
+	testBatchCheck(requests_num == 3 && requests[1].ticks-requests[0].ticks >= 50 && requests[2].ticks-requests[1].ticks >= 100, "retries: pause doubles");
+	testBatchCheck(images[0].format != fastimage_png && stats[0].http_status == 503, "retries: status of the last attempt is kept");
+}
+
+int main(void)
+{
+	int i;
+
+	for(i = 0; i < TEST_BATCH_SERVERS; i++)
+		if(!testBatchStart(i)) {
+			printf("can't start server\n");
+
+			return 1;
+		}
+
+	testBatchPerHost();
+	testBatchRoundRobin();
+	testBatchBackoff();
+	testBatchRetries();
+
+	printf("%u failed\n", failures);
+
+	return failures?1:0;
+}